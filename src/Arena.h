@@ -0,0 +1,56 @@
+#pragma once
+#include <algorithm>
+#include <cstddef>
+#include <memory>
+#include <vector>
+
+// Chunked bump allocator. Pointers handed out stay valid until the arena is
+// destroyed, so string views into it can be stored freely.
+template <typename T>
+class CArena {
+   public:
+    explicit CArena(size_t chunkSize = 64 * 1024) : _chunkSize(chunkSize) {}
+
+    CArena(CArena&&) = default;
+    CArena& operator=(CArena&&) = default;
+
+    T* Allocate(size_t count) {
+        if (_chunks.empty() || _used + count > _chunkCapacity) {
+            _chunkCapacity = (std::max)(_chunkSize, count);
+            _chunks.emplace_back(new T[_chunkCapacity]);
+            _capacity += _chunkCapacity;
+            _used = 0;
+        }
+        T* ptr = _chunks.back().get() + _used;
+        _used += count;
+        return ptr;
+    }
+
+    // Give back the unused tail of the most recent allocation
+    void Shrink(T* ptr, size_t allocated, size_t used) {
+        if (!_chunks.empty() && ptr + allocated == _chunks.back().get() + _used) {
+            _used -= allocated - used;
+        }
+    }
+
+    // Take ownership of another arena's chunks (used when merging parallel parses).
+    // The adopted chunks are kept ahead of our current chunk so bump allocation continues there.
+    void Adopt(CArena&& other) {
+        auto insertAt = _chunks.empty() ? _chunks.end() : _chunks.end() - 1;
+        _chunks.insert(insertAt, std::make_move_iterator(other._chunks.begin()),
+                       std::make_move_iterator(other._chunks.end()));
+        _capacity += other._capacity;
+        other._chunks.clear();
+        other._capacity = 0;
+        other._used = 0;
+    }
+
+    size_t GetMemoryUsage() const { return _capacity * sizeof(T); }
+
+   private:
+    size_t _chunkSize;
+    size_t _chunkCapacity = 0;
+    size_t _used = 0;
+    size_t _capacity = 0;
+    std::vector<std::unique_ptr<T[]>> _chunks;
+};
@@ -0,0 +1,99 @@
+#include "BitVector.h"
+
+#include "Bits.h"
+
+static constexpr size_t WORDS_PER_BLOCK = 512 / 64;
+
+CBitVector::CBitVector() {
+}
+
+CBitVector::~CBitVector() {
+}
+
+void CBitVector::PushBack(bool bit) {
+    if ((_size & 63) == 0) _owned.push_back(0);
+    if (bit) _owned.back() |= 1ull << (_size & 63);
+    _size++;
+}
+
+void CBitVector::Finish() {
+    _owned.shrink_to_fit();
+    _words = _owned.data();
+    BuildDirectories();
+}
+
+void CBitVector::BuildDirectories() {
+    size_t wordCount = (_size + 63) / 64;
+    size_t blockCount = (wordCount + WORDS_PER_BLOCK - 1) / WORDS_PER_BLOCK;
+
+    _blockRanks.assign(blockCount + 1, 0);
+    _select1Samples.clear();
+
+    size_t ones = 0;
+    for (size_t w = 0; w < wordCount; ++w) {
+        if (w % WORDS_PER_BLOCK == 0) _blockRanks[w / WORDS_PER_BLOCK] = static_cast<uint32_t>(ones);
+
+        uint64_t word = _words[w];
+        uint32_t wordOnes = Bits::PopCount(word);
+
+        // Record the exact position of every sampled one that falls in this word
+        while (_select1Samples.size() * SELECT_SAMPLE < ones + wordOnes) {
+            uint32_t k = static_cast<uint32_t>(_select1Samples.size() * SELECT_SAMPLE - ones);
+            _select1Samples.push_back(static_cast<uint32_t>(w * 64 + Bits::SelectInWord(word, k)));
+        }
+        ones += wordOnes;
+    }
+    _blockRanks[blockCount] = static_cast<uint32_t>(ones);
+    _ones = ones;
+
+    _blockRanks.shrink_to_fit();
+    _select1Samples.shrink_to_fit();
+}
+
+size_t CBitVector::Rank1(size_t i) const {
+    size_t block = i / BLOCK_BITS;
+    size_t rank = _blockRanks[block];
+    size_t word = block * WORDS_PER_BLOCK;
+    for (; word < i / 64; ++word) rank += Bits::PopCount(_words[word]);
+    if (i & 63) rank += Bits::PopCount(_words[word] & ((1ull << (i & 63)) - 1));
+    return rank;
+}
+
+size_t CBitVector::Select1(size_t k) const {
+    // Start at the sampled position and count forward; at most SELECT_SAMPLE - 1 more to skip
+    size_t position = _select1Samples[k / SELECT_SAMPLE];
+    size_t remaining = k % SELECT_SAMPLE;
+    size_t w = position >> 6;
+    uint64_t word = _words[w] & (~0ull << (position & 63));
+    for (;;) {
+        uint32_t count = Bits::PopCount(word);
+        if (remaining < count) return w * 64 + Bits::SelectInWord(word, static_cast<uint32_t>(remaining));
+        remaining -= count;
+        word = _words[++w];
+    }
+}
+
+size_t CBitVector::GetMemoryUsage() const {
+    return _owned.capacity() * sizeof(uint64_t) +
+           (_blockRanks.capacity() + _select1Samples.capacity()) * sizeof(uint32_t);
+}
+
+void CBitVector::Write(std::vector<uint64_t>& out) const {
+    out.push_back(_size);
+    out.insert(out.end(), _words, _words + (_size + 63) / 64);
+}
+
+bool CBitVector::Read(const uint64_t*& data, const uint64_t* end) {
+    if (data >= end) return false;
+    size_t size = static_cast<size_t>(*data++);
+    size_t wordCount = (size + 63) / 64;
+    if (static_cast<size_t>(end - data) < wordCount) return false;
+
+    _owned.clear();
+    _owned.shrink_to_fit();
+    _words = data;
+    _size = size;
+    data += wordCount;
+    BuildDirectories();
+    return true;
+}
@@ -0,0 +1,50 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+// Static bit vector with constant-time rank and near-constant-time select. Bits are
+// appended with PushBack, then Finish() builds the directories. The bits can also be
+// a view into a compiled file (see Read); only the small directories live on the heap.
+class CBitVector {
+   public:
+    CBitVector();
+    ~CBitVector();
+
+    CBitVector(CBitVector&&) = default;
+    CBitVector& operator=(CBitVector&&) = default;
+
+    void PushBack(bool bit);
+    void Finish();
+
+    bool Get(size_t i) const { return (_words[i >> 6] >> (i & 63)) & 1; }
+    size_t GetSize() const { return _size; }
+    size_t GetOneCount() const { return _ones; }
+
+    // Number of ones in [0, i)
+    size_t Rank1(size_t i) const;
+    size_t Rank0(size_t i) const { return i - Rank1(i); }
+
+    // Position of the k-th (0-based) one
+    size_t Select1(size_t k) const;
+
+    size_t GetMemoryUsage() const;
+
+    // Serialized as {size, words...}; Read leaves data just past the vector and keeps
+    // pointing at it, so the buffer must outlive this object
+    void Write(std::vector<uint64_t>& out) const;
+    bool Read(const uint64_t*& data, const uint64_t* end);
+
+   private:
+    static constexpr size_t BLOCK_BITS = 512;     // rank directory granularity
+    static constexpr size_t SELECT_SAMPLE = 64;   // every n-th one is sampled
+
+    void BuildDirectories();
+
+    const uint64_t* _words = nullptr;
+    std::vector<uint64_t> _owned;
+    size_t _size = 0;
+    size_t _ones = 0;
+    std::vector<uint32_t> _blockRanks;      // ones before each block
+    std::vector<uint32_t> _select1Samples;  // position of every SELECT_SAMPLE-th one
+};
@@ -0,0 +1,44 @@
+#pragma once
+#include <cstdint>
+
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+
+// Word-level bit tricks shared by the succinct structures
+namespace Bits {
+inline uint32_t PopCount(uint64_t word) {
+#ifdef _MSC_VER
+    return static_cast<uint32_t>(__popcnt64(word));
+#else
+    return static_cast<uint32_t>(__builtin_popcountll(word));
+#endif
+}
+
+// word must not be zero
+inline uint32_t CountTrailingZeros(uint64_t word) {
+#ifdef _MSC_VER
+    unsigned long index;
+    _BitScanForward64(&index, word);
+    return static_cast<uint32_t>(index);
+#else
+    return static_cast<uint32_t>(__builtin_ctzll(word));
+#endif
+}
+
+// Position of the k-th (0-based) set bit; the word must have more than k set bits
+inline uint32_t SelectInWord(uint64_t word, uint32_t k) {
+    // Narrow down by halves, then finish within a byte
+    uint32_t base = 0;
+    for (uint32_t width = 32; width >= 8; width /= 2) {
+        uint32_t low = PopCount(word & ((1ull << width) - 1));
+        if (k >= low) {
+            k -= low;
+            word >>= width;
+            base += width;
+        }
+    }
+    for (uint32_t i = 0; i < k; ++i) word &= word - 1;
+    return base + CountTrailingZeros(word);
+}
+}  // namespace Bits
@@ -0,0 +1,54 @@
+#include "CharacterTable.h"
+
+#include <algorithm>
+
+CCharacterTable::CCharacterTable() : _arena(16 * 1024) {
+}
+
+CCharacterTable::~CCharacterTable() {
+}
+
+CharId CCharacterTable::Intern(std::wstring_view text) {
+    if (!_sorted.empty()) {
+        for (CharId id = 0; id < _strings.size(); ++id) _ids.emplace(_strings[id], id);
+        _sorted = std::vector<CharId>();
+    }
+    auto it = _ids.find(text);
+    if (it != _ids.end()) return it->second;
+
+    wchar_t* stored = _arena.Allocate(text.size());
+    std::copy(text.begin(), text.end(), stored);
+    std::wstring_view view(stored, text.size());
+
+    CharId id = static_cast<CharId>(_strings.size());
+    _strings.push_back(view);
+    _ids.emplace(view, id);
+    return id;
+}
+
+CharId CCharacterTable::Find(std::wstring_view text) const {
+    if (!_sorted.empty()) {
+        auto it = std::lower_bound(_sorted.begin(), _sorted.end(), text,
+                                   [this](CharId id, std::wstring_view t) { return _strings[id] < t; });
+        return it != _sorted.end() && _strings[*it] == text ? *it : INVALID_CHAR_ID;
+    }
+    auto it = _ids.find(text);
+    return it != _ids.end() ? it->second : INVALID_CHAR_ID;
+}
+
+void CCharacterTable::Compact() {
+    if (_strings.empty()) return;
+    _sorted.resize(_strings.size());
+    for (CharId id = 0; id < _sorted.size(); ++id) _sorted[id] = id;
+    std::sort(_sorted.begin(), _sorted.end(), [this](CharId a, CharId b) { return _strings[a] < _strings[b]; });
+    std::unordered_map<std::wstring_view, CharId>().swap(_ids);
+    _strings.shrink_to_fit();
+}
+
+size_t CCharacterTable::GetMemoryUsage() const {
+    // Rough unordered_map cost: one node (key, value, next, hash) per entry plus the bucket array
+    size_t mapBytes = _ids.size() * (sizeof(std::wstring_view) + sizeof(CharId) + 2 * sizeof(void*)) +
+                      _ids.bucket_count() * sizeof(void*);
+    return _arena.GetMemoryUsage() + _strings.capacity() * sizeof(std::wstring_view) + mapBytes +
+           _sorted.capacity() * sizeof(CharId);
+}
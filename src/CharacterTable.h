@@ -0,0 +1,59 @@
+#pragma once
+#include <cstdint>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+#include "Arena.h"
+
+// Dense 32-bit handle for an interned character (or short string)
+typedef uint32_t CharId;
+static constexpr CharId INVALID_CHAR_ID = 0xFFFFFFFFu;
+
+// Interns each distinct character once in an arena. IDs are handed out in order of
+// first appearance, so the same data file always produces the same IDs.
+class CCharacterTable {
+   public:
+    CCharacterTable();
+    ~CCharacterTable();
+
+    CCharacterTable(CCharacterTable&&) = default;
+    CCharacterTable& operator=(CCharacterTable&&) = default;
+
+    CharId Intern(std::wstring_view text);
+    CharId Find(std::wstring_view text) const;
+    std::wstring_view Get(CharId id) const { return _strings[id]; }
+
+    size_t GetCount() const { return _strings.size(); }
+    size_t GetMemoryUsage() const;
+
+    // Trade the hash map behind Find for the ids sorted by text, a quarter of the size
+    // or less, searched in O(log n). A later Intern brings the map back.
+    void Compact();
+
+   private:
+    CArena<wchar_t> _arena;
+    std::vector<std::wstring_view> _strings;
+    std::unordered_map<std::wstring_view, CharId> _ids;
+    std::vector<CharId> _sorted;  // after Compact, in place of _ids
+};
+
+// Fixed-size bitmap over CharIds, used to dedupe result sets
+class CCharIdSet {
+   public:
+    explicit CCharIdSet(size_t count) : _bits((count + 63) / 64, 0) {}
+
+    // Returns true if the id was not in the set yet
+    bool Insert(CharId id) {
+        uint64_t mask = 1ull << (id & 63);
+        uint64_t& word = _bits[id >> 6];
+        if (word & mask) return false;
+        word |= mask;
+        return true;
+    }
+
+    bool Contains(CharId id) const { return (_bits[id >> 6] >> (id & 63)) & 1; }
+
+   private:
+    std::vector<uint64_t> _bits;
+};
@@ -0,0 +1,134 @@
+#include "CompressedBitmap.h"
+
+#include <algorithm>
+
+#include "Bits.h"
+
+CCompressedBitmap::CCompressedBitmap() {
+}
+
+CCompressedBitmap::~CCompressedBitmap() {
+}
+
+bool CCompressedBitmap::Container::Contains(uint16_t low) const {
+    if (!bits.empty()) return (bits[low >> 6] >> (low & 63)) & 1;
+    return std::binary_search(array.begin(), array.end(), low);
+}
+
+void CCompressedBitmap::Append(uint32_t value) {
+    uint16_t key = static_cast<uint16_t>(value >> 16);
+    uint16_t low = static_cast<uint16_t>(value & 0xFFFF);
+    if (_containers.empty() || _containers.back().key != key) {
+        _containers.emplace_back();
+        _containers.back().key = key;
+    }
+
+    Container& container = _containers.back();
+    if (container.bits.empty() && container.array.size() >= ARRAY_LIMIT) {
+        // Switch to a bitset as soon as the array would outgrow it
+        container.bits.assign(BITSET_WORDS, 0);
+        for (uint16_t v : container.array) container.bits[v >> 6] |= 1ull << (v & 63);
+        std::vector<uint16_t>().swap(container.array);
+    }
+    if (!container.bits.empty()) {
+        container.bits[low >> 6] |= 1ull << (low & 63);
+    } else {
+        container.array.push_back(low);
+    }
+    container.cardinality++;
+    _cardinality++;
+}
+
+void CCompressedBitmap::Optimize() {
+    for (auto& container : _containers) {
+        container.array.shrink_to_fit();
+    }
+    _containers.shrink_to_fit();
+}
+
+const CCompressedBitmap::Container* CCompressedBitmap::FindContainer(uint16_t key) const {
+    auto it = std::lower_bound(_containers.begin(), _containers.end(), key,
+                               [](const Container& c, uint16_t k) { return c.key < k; });
+    return (it != _containers.end() && it->key == key) ? &*it : nullptr;
+}
+
+bool CCompressedBitmap::Contains(uint32_t value) const {
+    const Container* container = FindContainer(static_cast<uint16_t>(value >> 16));
+    return container && container->Contains(static_cast<uint16_t>(value & 0xFFFF));
+}
+
+void CCompressedBitmap::AppendBits(const uint64_t* bits, uint32_t high, std::vector<uint32_t>& values) {
+    for (uint32_t w = 0; w < BITSET_WORDS; ++w) {
+        uint64_t word = bits[w];
+        while (word) {
+            values.push_back(high | (w * 64 + Bits::CountTrailingZeros(word)));
+            word &= word - 1;
+        }
+    }
+}
+
+void CCompressedBitmap::ToVector(std::vector<uint32_t>& values) const {
+    values.reserve(values.size() + _cardinality);
+    for (const auto& container : _containers) {
+        uint32_t high = static_cast<uint32_t>(container.key) << 16;
+        if (container.bits.empty()) {
+            for (uint16_t low : container.array) values.push_back(high | low);
+        } else {
+            AppendBits(container.bits.data(), high, values);
+        }
+    }
+}
+
+void CCompressedBitmap::Intersect(std::vector<const CCompressedBitmap*> bitmaps, std::vector<uint32_t>& values) {
+    if (bitmaps.empty()) return;
+    if (bitmaps.size() == 1) {
+        bitmaps[0]->ToVector(values);
+        return;
+    }
+    std::sort(bitmaps.begin(), bitmaps.end(), [](const CCompressedBitmap* a, const CCompressedBitmap* b) {
+        return a->GetCardinality() < b->GetCardinality();
+    });
+
+    std::vector<const Container*> group(bitmaps.size());
+    std::vector<uint64_t> words;
+    for (const auto& first : bitmaps[0]->_containers) {
+        // The containers for this key, smallest first; a missing one empties the key
+        bool present = true;
+        group[0] = &first;
+        for (size_t i = 1; i < bitmaps.size() && present; ++i) {
+            group[i] = bitmaps[i]->FindContainer(first.key);
+            present = group[i] != nullptr;
+        }
+        if (!present) continue;
+        std::sort(group.begin(), group.end(), [](const Container* a, const Container* b) {
+            return a->cardinality < b->cardinality;
+        });
+
+        uint32_t high = static_cast<uint32_t>(first.key) << 16;
+        if (group[0]->bits.empty()) {
+            // Sparse: probe each value of the smallest container against the others
+            for (uint16_t low : group[0]->array) {
+                bool inAll = true;
+                for (size_t i = 1; i < group.size() && inAll; ++i) inAll = group[i]->Contains(low);
+                if (inAll) values.push_back(high | low);
+            }
+            continue;
+        }
+
+        // All dense: AND whole words, then pick out the survivors
+        words.assign(group[0]->bits.begin(), group[0]->bits.end());
+        for (size_t i = 1; i < group.size(); ++i) {
+            const uint64_t* bits = group[i]->bits.data();
+            for (uint32_t w = 0; w < BITSET_WORDS; ++w) words[w] &= bits[w];
+        }
+        AppendBits(words.data(), high, values);
+    }
+}
+
+size_t CCompressedBitmap::GetMemoryUsage() const {
+    size_t bytes = _containers.capacity() * sizeof(Container);
+    for (const auto& container : _containers) {
+        bytes += container.array.capacity() * sizeof(uint16_t) + container.bits.capacity() * sizeof(uint64_t);
+    }
+    return bytes;
+}
@@ -0,0 +1,51 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+// Roaring-style set of 32-bit values: values are grouped by their high 16 bits, and
+// each group is a sorted uint16 array while sparse or a 65536-bit bitset once dense.
+// Built append-only in ascending order, then frozen with Optimize().
+class CCompressedBitmap {
+   public:
+    CCompressedBitmap();
+    ~CCompressedBitmap();
+
+    CCompressedBitmap(CCompressedBitmap&&) = default;
+    CCompressedBitmap& operator=(CCompressedBitmap&&) = default;
+
+    // Values must arrive in strictly ascending order
+    void Append(uint32_t value);
+    // Pick the smaller representation for every container and release spare capacity
+    void Optimize();
+
+    bool Contains(uint32_t value) const;
+    size_t GetCardinality() const { return _cardinality; }
+
+    // Appends every value, ascending
+    void ToVector(std::vector<uint32_t>& values) const;
+
+    // Appends the values present in every bitmap, ascending. Dense containers are
+    // ANDed a word at a time; sparse ones are probed against the others.
+    static void Intersect(std::vector<const CCompressedBitmap*> bitmaps, std::vector<uint32_t>& values);
+
+    size_t GetMemoryUsage() const;
+
+   private:
+    static constexpr uint32_t ARRAY_LIMIT = 4096;  // above this a bitset is smaller
+    static constexpr uint32_t BITSET_WORDS = 65536 / 64;
+
+    struct Container {
+        uint16_t key = 0;
+        uint32_t cardinality = 0;
+        std::vector<uint16_t> array;  // sorted, used while sparse
+        std::vector<uint64_t> bits;   // BITSET_WORDS words, used once dense
+        bool Contains(uint16_t low) const;
+    };
+
+    const Container* FindContainer(uint16_t key) const;
+    static void AppendBits(const uint64_t* bits, uint32_t high, std::vector<uint32_t>& values);
+
+    std::vector<Container> _containers;  // sorted by key
+    size_t _cardinality = 0;
+};
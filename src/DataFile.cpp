@@ -0,0 +1,207 @@
+#include "DataFile.h"
+
+#ifdef _WIN32
+#include <windows.h>
+#endif
+
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <filesystem>
+#include <thread>
+
+#include "Debug.h"
+#include "MappedFile.h"
+#include "Unicode.h"
+
+// Below this many bytes per chunk, thread start-up costs more than it saves
+static constexpr size_t PARALLEL_CHUNK_BYTES = 512 * 1024;
+
+static void ParseChunk(const char* begin, const char* end, const char* commentPrefixes,
+                       CArena<wchar_t>& arena, std::vector<DataFileRecord>& records) {
+    const char* p = begin;
+    while (p < end) {
+        const char* newline = static_cast<const char*>(std::memchr(p, '\n', end - p));
+        const char* lineEnd = newline ? newline : end;
+        const char* next = newline ? newline + 1 : end;
+
+        // Remove carriage return if present (Windows line endings)
+        if (lineEnd > p && lineEnd[-1] == '\r') lineEnd--;
+
+        // Skip empty lines and comments
+        if (lineEnd == p || std::strchr(commentPrefixes, *p)) {
+            p = next;
+            continue;
+        }
+
+        const char* tab = static_cast<const char*>(std::memchr(p, '\t', lineEnd - p));
+        if (!tab || tab == p || tab + 1 == lineEnd) {
+            p = next;  // Invalid line, skip
+            continue;
+        }
+
+        // A UTF-8 line never decodes to more wchar_t than it has bytes
+        size_t capacity = static_cast<size_t>(lineEnd - p);
+        wchar_t* out = arena.Allocate(capacity);
+        size_t keyLength = Unicode::Utf8ToWide(p, tab - p, out);
+        size_t valueLength = Unicode::Utf8ToWide(tab + 1, lineEnd - tab - 1, out + keyLength);
+        arena.Shrink(out, capacity, keyLength + valueLength);
+
+        records.push_back({std::wstring_view(out, keyLength), std::wstring_view(out + keyLength, valueLength)});
+        p = next;
+    }
+}
+
+CDataFile::CDataFile() : _arena(256 * 1024) {
+}
+
+CDataFile::~CDataFile() {
+}
+
+bool CDataFile::Load(const std::wstring& path, const char* commentPrefixes) {
+    auto start = std::chrono::high_resolution_clock::now();
+
+    _records.clear();
+    _arena = CArena<wchar_t>(256 * 1024);
+    _contentHash = 0;
+
+    CMappedFile file;
+    if (!file.Open(path)) {
+        return false;
+    }
+
+    const char* begin = file.GetData();
+    const char* end = begin + file.GetSize();
+    _contentHash = HashBytes(begin, file.GetSize());
+
+    // Skip BOM if present
+    if (end - begin >= 3 && begin[0] == '\xEF' && begin[1] == '\xBB' && begin[2] == '\xBF') {
+        begin += 3;
+    }
+
+    size_t size = static_cast<size_t>(end - begin);
+    size_t threads = (std::min)(static_cast<size_t>((std::max)(1u, std::thread::hardware_concurrency())),
+                                size / PARALLEL_CHUNK_BYTES);
+
+    if (threads <= 1) {
+        _records.reserve(size / 32);
+        ParseChunk(begin, end, commentPrefixes, _arena, _records);
+    } else {
+        // Split on line boundaries so every chunk holds whole lines
+        std::vector<const char*> bounds{begin};
+        for (size_t i = 1; i < threads; ++i) {
+            const char* guess = (std::max)(bounds.back(), begin + size * i / threads);
+            const char* newline = static_cast<const char*>(std::memchr(guess, '\n', end - guess));
+            bounds.push_back(newline ? newline + 1 : end);
+        }
+        bounds.push_back(end);
+
+        std::vector<CArena<wchar_t>> arenas;
+        std::vector<std::vector<DataFileRecord>> chunkRecords(threads);
+        for (size_t i = 0; i < threads; ++i) arenas.emplace_back(256 * 1024);
+
+        std::vector<std::thread> workers;
+        for (size_t i = 0; i < threads; ++i) {
+            workers.emplace_back([&, i]() {
+                chunkRecords[i].reserve((bounds[i + 1] - bounds[i]) / 32);
+                ParseChunk(bounds[i], bounds[i + 1], commentPrefixes, arenas[i], chunkRecords[i]);
+            });
+        }
+        for (auto& worker : workers) worker.join();
+
+        // Stitch chunks back together in file order
+        size_t total = 0;
+        for (const auto& records : chunkRecords) total += records.size();
+        _records.reserve(total);
+        for (size_t i = 0; i < threads; ++i) {
+            _records.insert(_records.end(), chunkRecords[i].begin(), chunkRecords[i].end());
+            _arena.Adopt(std::move(arenas[i]));
+        }
+    }
+
+    auto finish = std::chrono::high_resolution_clock::now();
+    auto duration = std::chrono::duration_cast<std::chrono::microseconds>(finish - start).count();
+    Debug::Log(L"DataFile", (L"Loaded: " + path +
+                             L" | Records: " + std::to_wstring(_records.size()) +
+                             L" | Threads: " + std::to_wstring((std::max)(threads, size_t(1))) +
+                             L" | Time: " + std::to_wstring(duration / 1000) + L"." + std::to_wstring(duration % 1000) + L"ms")
+                                .c_str());
+
+    return true;
+}
+
+bool CDataFile::HashFile(const std::wstring& path, uint64_t& hash) {
+    CMappedFile file;
+    if (!file.Open(path)) return false;
+    hash = HashBytes(file.GetData(), file.GetSize());
+    return true;
+}
+
+uint64_t CDataFile::HashBytes(const char* data, size_t size) {
+    // FNV-1a style mixing, a 64-bit word at a time
+    const uint64_t PRIME = 0x100000001b3ull;
+    uint64_t hash = 0xcbf29ce484222325ull ^ size;
+    size_t i = 0;
+    for (; i + 8 <= size; i += 8) {
+        uint64_t word;
+        std::memcpy(&word, data + i, 8);
+        hash = (hash ^ word) * PRIME;
+        hash ^= hash >> 32;
+    }
+    for (; i < size; ++i) {
+        hash = (hash ^ static_cast<uint8_t>(data[i])) * PRIME;
+    }
+    return hash ^ (hash >> 29);
+}
+
+size_t CDataFile::GetMemoryUsage() const {
+    return _arena.GetMemoryUsage() + _records.capacity() * sizeof(DataFileRecord);
+}
+
+std::wstring CDataFile::GetModuleRelativePath(const wchar_t* fileName) {
+#ifdef _WIN32
+    wchar_t dllPath[MAX_PATH];
+    HMODULE hModule = nullptr;
+
+    // Get handle to our DLL
+    GetModuleHandleEx(GET_MODULE_HANDLE_EX_FLAG_FROM_ADDRESS | GET_MODULE_HANDLE_EX_FLAG_UNCHANGED_REFCOUNT,
+                      (LPCWSTR)&CDataFile::GetModuleRelativePath, &hModule);
+
+    if (hModule && GetModuleFileName(hModule, dllPath, MAX_PATH)) {
+        std::wstring path(dllPath);
+        size_t lastSlash = path.find_last_of(L"\\/");
+        if (lastSlash != std::wstring::npos) {
+            return path.substr(0, lastSlash + 1) + fileName;
+        }
+    }
+#endif
+    return fileName;
+}
+
+std::wstring CDataFile::GetSidePath(const std::wstring& dataPath, const wchar_t* extension) {
+    size_t dot = dataPath.find_last_of(L'.');
+    size_t slash = dataPath.find_last_of(L"\\/");
+    if (dot != std::wstring::npos && (slash == std::wstring::npos || dot > slash)) {
+        return dataPath.substr(0, dot) + extension;
+    }
+    return dataPath + extension;
+}
+
+std::wstring CDataFile::GetUserDataPath(const wchar_t* fileName) {
+    std::filesystem::path dir;
+#ifdef _WIN32
+    if (const wchar_t* appData = _wgetenv(L"APPDATA")) dir = std::filesystem::path(appData) / L"K6IME";
+#else
+    if (const char* dataHome = std::getenv("XDG_DATA_HOME")) {
+        dir = std::filesystem::path(dataHome) / "k6";
+    } else if (const char* home = std::getenv("HOME")) {
+        dir = std::filesystem::path(home) / ".local" / "share" / "k6";
+    }
+#endif
+    std::error_code error;
+    if (dir.empty() || (!std::filesystem::create_directories(dir, error) && error)) {
+        return GetModuleRelativePath(fileName);
+    }
+    return (dir / fileName).wstring();
+}
@@ -0,0 +1,50 @@
+#pragma once
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "Arena.h"
+
+// One parsed line of a tab-separated data file. Views point into the file's arena.
+struct DataFileRecord {
+    std::wstring_view key;    // text before the first tab
+    std::wstring_view value;  // everything after the first tab
+};
+
+// Shared loader for the UTF-8 data files (strokeData.txt, suggestionsData.txt, ...).
+// Maps the whole file once, splits lines/tabs with memchr and decodes straight into
+// arena storage. Large files are parsed in parallel chunks.
+class CDataFile {
+   public:
+    CDataFile();
+    ~CDataFile();
+
+    // Lines that are empty, start with one of commentPrefixes, or have no key/value are skipped
+    bool Load(const std::wstring& path, const char* commentPrefixes = "#;");
+
+    const std::vector<DataFileRecord>& GetRecords() const { return _records; }
+
+    // Hash of the raw file bytes; compiled side files store it to detect a stale source
+    uint64_t GetContentHash() const { return _contentHash; }
+    static uint64_t HashBytes(const char* data, size_t size);
+    // GetContentHash of the file at path without parsing it; false if it cannot be read
+    static bool HashFile(const std::wstring& path, uint64_t& hash);
+
+    size_t GetMemoryUsage() const;
+
+    // Path of a file that sits next to the K6 module (the DLL on Windows)
+    static std::wstring GetModuleRelativePath(const wchar_t* fileName);
+
+    // dataPath with its extension replaced, for compiled side files (e.g. strokeData.prefix)
+    static std::wstring GetSidePath(const std::wstring& dataPath, const wchar_t* extension);
+
+    // Path of a per-user, writable file (%APPDATA%\K6IME on Windows, $XDG_DATA_HOME/k6
+    // elsewhere). Creates the directory; falls back to the module directory.
+    static std::wstring GetUserDataPath(const wchar_t* fileName);
+
+   private:
+    CArena<wchar_t> _arena;
+    std::vector<DataFileRecord> _records;
+    uint64_t _contentHash = 0;
+};
@@ -1,6 +1,10 @@
 #include "Debug.h"
 
-#include "InputStateMachine.h"
+#include "InputAction.h"
+
+#ifndef _WIN32
+#include <cstdio>
+#endif
 
 bool Debug::_enabled = false;
 
@@ -14,7 +18,11 @@ bool Debug::IsEnabled() {
 
 void Debug::OutputDebug(const std::wstring& message) {
     if (!_enabled) return;
+#ifdef _WIN32
     OutputDebugStringW(message.c_str());
+#else
+    fputws(message.c_str(), stderr);
+#endif
 }
 
 void Debug::Log(const wchar_t* component, const wchar_t* message) {
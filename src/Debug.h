@@ -1,6 +1,11 @@
 #pragma once
 
+#ifdef _WIN32
 #include <windows.h>
+#else
+#include <cstdint>
+typedef uintptr_t WPARAM;
+#endif
 
 #include <sstream>
 #include <string>
@@ -1,289 +1,456 @@
 #include "Dictionary.h"
 
-#include <windows.h>
-
+#include <algorithm>
 #include <chrono>
-#include <fstream>
-#include <set>
-#include <sstream>
+#include <cstdlib>
+#include <memory>
+#include <tuple>
+#include <unordered_map>
+#include <unordered_set>
 
+#include "DataFile.h"
 #include "Debug.h"
 #include "Stroke.h"
+#include "StrokePattern.h"
 
-CDictionary::CDictionary() {
+CDictionary::CDictionary() : _data(std::make_unique<CDictionaryData>()) {
 }
 
 CDictionary::~CDictionary() {
+    {
+        std::lock_guard<std::mutex> lock(_foldMutex);
+        _stopping = true;
+    }
+    _foldWake.notify_all();
+    if (_folder.joinable()) _folder.join();
 }
 
-std::vector<std::wstring> CDictionary::Lookup(const std::wstring& code) const {
-    auto start = std::chrono::high_resolution_clock::now();
-
-    auto it = _dictionary.find(code);
-    std::vector<std::wstring> result;
-    if (it != _dictionary.end()) {
-        result = it->second;
+// Whole codes against a LookupRegex pattern
+static std::function<bool(std::wstring_view)> MatcherFor(const std::wstring& pattern) {
+    if (Stroke::HasAnyStrokes(pattern)) {
+        auto automaton = std::make_shared<CStrokePattern>(pattern);
+        return [automaton](std::wstring_view code) { return automaton->Matches(code); };
     }
-
-    auto end = std::chrono::high_resolution_clock::now();
-    auto duration = std::chrono::duration_cast<std::chrono::microseconds>(end - start).count();
-
-    Debug::Log(L"Dictionary", (L"Lookup code: " + code +
-                               L" | Results: " + std::to_wstring(result.size()) +
-                               L" | Time: " + std::to_wstring(duration / 1000) + L"." + std::to_wstring(duration % 1000) + L"ms")
-                                  .c_str());
-
-    return result;
+    return [pattern](std::wstring_view code) {
+        if (code.size() < pattern.size()) return false;
+        for (size_t i = 0; i < pattern.size(); ++i) {
+            if (pattern[i] != Stroke::WILDCARD[0] && pattern[i] != code[i]) return false;
+        }
+        return true;
+    };
 }
 
-std::vector<std::wstring> CDictionary::LookupRegex(const std::wstring& pattern) const {
-    auto start = std::chrono::high_resolution_clock::now();
-
-    if (pattern.empty()) return {};
-
-    auto cacheIt = _regexCache.find(pattern);
-    if (cacheIt != _regexCache.end()) {
-        auto end = std::chrono::high_resolution_clock::now();
-        auto duration = std::chrono::duration_cast<std::chrono::microseconds>(end - start).count();
-        Debug::Log(L"Dictionary", (L"LookupRegex (cached) pattern: " + pattern +
-                                   L" | Results: " + std::to_wstring(cacheIt->second.size()) +
-                                   L" | Time: " + std::to_wstring(duration / 1000) + L"." + std::to_wstring(duration % 1000) + L"ms")
-                                      .c_str());
-        return cacheIt->second;
+CDictionary::Pinned CDictionary::Pin(size_t shard) const {
+    if (_sharded) {
+        auto shards = _shards.Read();
+        // User entries are merged and folded over the whole dictionary
+        if (shards && shard != CDictionaryShards::ALL && (!_user || _user->GetVersion() == 0)) {
+            Snapshot data = shards->Get(shard);
+            return Pinned{std::move(shards), std::move(data), std::nullopt, std::nullopt};
+        }
     }
 
-    std::vector<std::wstring> out;
-    std::set<std::wstring> seen;
-
-    // Pre-reserve capacity to reduce allocations (typical result size)
-    out.reserve(50);
+    Pinned pinned{std::nullopt, ReadAll(), std::nullopt, std::nullopt};
+    if (!_user) return pinned;
+    auto user = _user->Acquire();
+    if (user->GetVersion() == pinned.data->GetUserVersion()) return pinned;
 
-    // Fast wildcard matching without regex - much more efficient
-    // Split pattern into segments (non-wildcard parts)
-    std::vector<std::wstring> segments;
-    std::wstring currentSegment;
+    // Entries folded into data would be counted twice, so merge over the unfolded copy
+    if (pinned.data->GetUserVersion() != 0) pinned.base.emplace(_base.Read());
+    pinned.user.emplace(std::move(user));
+    ScheduleFold();
+    return pinned;
+}
 
-    for (wchar_t ch : pattern) {
-        if (ch == Stroke::WILDCARD[0]) {
-            if (!currentSegment.empty()) {
-                segments.push_back(currentSegment);
-                currentSegment.clear();
-            }
-            segments.push_back(std::wstring(1, Stroke::WILDCARD[0]));
-        } else {
-            currentSegment.push_back(ch);
+std::vector<std::wstring> CDictionary::Merge(const Pinned& pinned, const std::vector<std::wstring>& results,
+                                             const CodeMatcher& matches, size_t exactLength, size_t k) const {
+    const CDictionaryData& source = pinned.GetSource();
+    const CUserDictionary::CEntries& user = **pinned.user;
+
+    // Sort key of a matching entry: longer codes last under exactLength, then rank, and
+    // the user's entry ahead of the shipped one it was placed before
+    typedef std::tuple<bool, uint32_t, bool> Key;
+    auto keyOf = [exactLength](std::wstring_view code, uint32_t rank, bool shipped) {
+        return Key(exactLength != SIZE_MAX && code.size() != exactLength, rank, shipped);
+    };
+    std::vector<std::pair<uint32_t, std::wstring>> entries;
+    auto bestShipped = [&](const std::wstring& character, Key& best) {
+        bool found = false;
+        source.GetEntries(source.FindCharacter(character), entries);
+        for (const auto& [rank, code] : entries) {
+            if (!matches(code) || user.Hides(code, character)) continue;
+            Key key = keyOf(code, rank, true);
+            if (!found || key < best) best = key;
+            found = true;
+        }
+        return found;
+    };
+
+    // Every character the user has entries for is ranked here from scratch: by its
+    // placed entries and the shipped ones left alone. A character that matches neither
+    // way drops out.
+    std::unordered_map<std::wstring, Key> touched;
+    std::unordered_set<std::wstring> seen;
+    for (const auto& entry : user.GetEntries()) {
+        if (!seen.insert(entry.character).second) continue;
+        Key best;
+        bool found = bestShipped(entry.character, best);
+        for (uint32_t i : *user.Find(entry.character)) {
+            const auto& placed = user.GetEntries()[i];
+            if (placed.rank == CUserDictionary::REMOVED || !matches(placed.code)) continue;
+            Key key = keyOf(placed.code, placed.rank, false);
+            if (!found || key < best) best = key;
+            found = true;
         }
+        if (found) touched.emplace(entry.character, best);
     }
-    if (!currentSegment.empty()) {
-        segments.push_back(currentSegment);
+    std::vector<std::pair<Key, std::wstring>> placed;
+    for (auto& [character, key] : touched) placed.emplace_back(key, character);
+    std::sort(placed.begin(), placed.end());
+
+    // The other results keep their order, which is the order of their keys, so each
+    // placed character is binary searched into them
+    std::vector<const std::wstring*> rest;
+    for (const auto& result : results) {
+        if (!user.Find(result)) rest.push_back(&result);
     }
-
-    // Check if pattern starts with wildcard
-    bool startsWithWildcard = !segments.empty() && segments[0] == std::wstring(1, Stroke::WILDCARD[0]);
-
-    // Iterate in insertion order instead of map order
-    for (const auto& entry : _insertionOrder) {
-        const std::wstring& code = entry.first;
-        const std::wstring& character = entry.second;
-
-        // Fast wildcard matching with start-aligned partial match
-        // Pattern matches if all segments match sequentially from the start
-        // but the code can have additional characters after the pattern
-        bool matches = true;
-        size_t codePos = 0;
-
-        for (size_t i = 0; i < segments.size(); ++i) {
-            const auto& segment = segments[i];
-
-            if (segment == std::wstring(1, Stroke::WILDCARD[0])) {
-                // Wildcard matches any single character
-                if (codePos < code.length()) {
-                    codePos++;
-                } else {
-                    // Wildcard but no character left in code
-                    matches = false;
-                    break;
-                }
+    std::vector<std::wstring> merged;
+    size_t from = 0;
+    for (const auto& [key, character] : placed) {
+        size_t lo = from, hi = rest.size();
+        while (lo < hi) {
+            size_t mid = lo + (hi - lo) / 2;
+            Key restKey;
+            if (bestShipped(*rest[mid], restKey) && restKey < key) {
+                lo = mid + 1;
             } else {
-                // Literal segment must match exactly at current position
-                if (codePos + segment.length() > code.length() ||
-                    code.substr(codePos, segment.length()) != segment) {
-                    matches = false;
-                    break;
-                }
-                codePos += segment.length();
+                hi = mid;
             }
         }
+        for (; from < lo && merged.size() < k; ++from) merged.push_back(*rest[from]);
+        if (merged.size() >= k) return merged;
+        merged.push_back(character);
+    }
+    for (; from < rest.size() && merged.size() < k; ++from) merged.push_back(*rest[from]);
+    return merged;
+}
 
-        // Match if pattern matched from start (code can have additional characters after pattern)
-        if (matches) {
-            if (seen.insert(character).second) {
-                out.push_back(character);
-            }
-        }
+CDictionary::Snapshot CDictionary::ReadAll() const {
+    for (;;) {
+        if (_sharded && _shards.Read()) LoadAllShards();
+        Snapshot data = _data.Read();
+        // A reload to shards between the two reads leaves its empty placeholder in _data
+        if (!_sharded || data->GetEntryCount() != 0 || !_shards.Read()) return data;
     }
+}
 
-    // Shrink to actual size to save memory in cache
-    out.shrink_to_fit();
+void CDictionary::LoadAllShards() const {
+    std::lock_guard<std::mutex> lock(_loadMutex);
+    auto start = std::chrono::high_resolution_clock::now();
 
-    _regexCache.emplace(pattern, out);
+    auto all = std::make_unique<CDictionaryData>();
+    {
+        auto shards = _shards.Read();
+        if (!shards) return;  // another thread got here first
+        all->SetScanPool(_scanPool);
+        all->SetMemoryBudget(_memoryBudget);
+        all->LoadFromShards(*shards, CDictionaryShards::ALL);
+        if (!_queryCachePath.empty()) all->LoadQueryCache(_queryCachePath);
+    }
+    _data.Publish(std::move(all));
+    _shards.Publish(nullptr);
+    if (_user && _user->GetVersion() != 0) ScheduleFold();
 
     auto end = std::chrono::high_resolution_clock::now();
     auto duration = std::chrono::duration_cast<std::chrono::microseconds>(end - start).count();
-
-    Debug::Log(L"Dictionary", (L"LookupRegex pattern: " + pattern +
-                               L" | Results: " + std::to_wstring(out.size()) +
-                               L" | Entries scanned: " + std::to_wstring(_insertionOrder.size()) +
-                               L" | Time: " + std::to_wstring(duration / 1000) + L"." + std::to_wstring(duration % 1000) + L"ms")
+    Debug::Log(L"Dictionary", (L"Replaced shards with the whole dictionary | Time: " + std::to_wstring(duration / 1000) +
+                               L"." + std::to_wstring(duration % 1000) + L"ms")
                                   .c_str());
-
-    return out;
 }
 
-std::vector<std::wstring> CDictionary::GetCodesForCharacter(const std::wstring& character) const {
-    auto start = std::chrono::high_resolution_clock::now();
+void CDictionary::ScheduleFold() const {
+    if (_folding.load()) return;
+    std::lock_guard<std::mutex> lock(_foldMutex);
+    if (_folding.load() || _stopping) return;
+    if (_folder.joinable()) _folder.join();
+    _folding = true;
+    _folder = std::thread(&CDictionary::RunFold, this);
+}
 
-    // Check reverse lookup cache first
-    auto cacheIt = _reverseCache.find(character);
-    if (cacheIt != _reverseCache.end()) {
-        auto end = std::chrono::high_resolution_clock::now();
-        auto duration = std::chrono::duration_cast<std::chrono::microseconds>(end - start).count();
-        Debug::Log(L"Dictionary", (L"GetCodesForCharacter (cached): " + character +
-                                   L" | Results: " + std::to_wstring(cacheIt->second.size()) +
-                                   L" | Time: " + std::to_wstring(duration / 1000) + L"." + std::to_wstring(duration % 1000) + L"ms")
-                                      .c_str());
-        return cacheIt->second;
+// Waits out FOLD_DELAY first, so a burst of edits is folded once
+void CDictionary::RunFold() const {
+    {
+        std::unique_lock<std::mutex> lock(_foldMutex);
+        _foldWake.wait_for(lock, FOLD_DELAY, [this]() { return _stopping; });
+        if (_stopping) {
+            _folding = false;
+            return;
+        }
     }
+    Fold();
+    _folding = false;
+}
 
-    std::vector<std::wstring> codes;
-    codes.reserve(10);  // Pre-allocate space for typical number of codes per character
+void CDictionary::Fold() const {
+    std::lock_guard<std::mutex> lock(_loadMutex);
+    auto start = std::chrono::high_resolution_clock::now();
 
-    for (const auto& kv : _dictionary) {
-        for (const auto& ch : kv.second) {
-            if (ch == character) {
-                codes.push_back(kv.first);
-                break;  // Found match in this code's list, move to next code
-            }
+    // The whole dictionary replaces the shards first (see Pin), and schedules a fold again
+    if (_shards.Read()) return;
+
+    auto user = _user->Acquire();
+    std::unique_ptr<CDictionaryData> folded;
+    {
+        auto data = _data.Read();
+        if (data->GetUserVersion() == user->GetVersion()) return;
+        if (data->GetUserVersion() == 0) {
+            // data is unfolded: keep a copy to merge later edits over
+            auto copy = std::make_unique<CDictionaryData>();
+            copy->SetScanPool(_scanPool);
+            copy->SetMemoryBudget(_memoryBudget);
+            if (!copy->LoadMerged(*data, nullptr)) return;
+            _base.Publish(std::move(copy));
         }
+        auto base = _base.Read();
+        folded = std::make_unique<CDictionaryData>();
+        folded->SetScanPool(_scanPool);
+        folded->SetMemoryBudget(_memoryBudget);
+        if (!folded->LoadMerged(*base, user.get())) return;
+        if (!_queryCachePath.empty()) folded->LoadQueryCache(_queryCachePath);
     }
-
-    // Shrink to actual size before caching
-    codes.shrink_to_fit();
-
-    // Cache the result for future lookups
-    _reverseCache.emplace(character, codes);
+    _data.Publish(std::move(folded));
 
     auto end = std::chrono::high_resolution_clock::now();
     auto duration = std::chrono::duration_cast<std::chrono::microseconds>(end - start).count();
-
-    Debug::Log(L"Dictionary", (L"GetCodesForCharacter: " + character +
-                               L" | Results: " + std::to_wstring(codes.size()) +
+    Debug::Log(L"Dictionary", (L"Folded user entries: " + std::to_wstring(user->GetEntries().size()) +
                                L" | Time: " + std::to_wstring(duration / 1000) + L"." + std::to_wstring(duration % 1000) + L"ms")
                                   .c_str());
+}
 
-    return codes;
+std::vector<std::wstring> CDictionary::Lookup(const std::wstring& code) const {
+    Pinned pinned = Pin(CDictionaryShards::GetShard(code));
+    if (!pinned.user) return pinned.data->Lookup(code);
+    return Merge(pinned, pinned.GetSource().Lookup(code), [&code](std::wstring_view c) { return c == code; }, SIZE_MAX,
+                 SIZE_MAX);
 }
 
-// TODO: add a canonical way to select a stroke sequence
-std::wstring CDictionary::GetRandomStrokeForCharacter(const std::wstring& character) const {
-    auto codes = GetCodesForCharacter(character);
-    if (codes.empty()) return L"";
-    size_t idx = static_cast<size_t>(rand()) % codes.size();
-    return codes[idx];
+std::vector<std::wstring> CDictionary::LookupRegex(const std::wstring& pattern, bool* fromPrefetch) const {
+    Pinned pinned = Pin(CDictionaryShards::GetShard(pattern));
+    if (!pinned.user) return pinned.data->LookupRegex(pattern, fromPrefetch);
+    return Merge(pinned, pinned.GetSource().LookupRegex(pattern, fromPrefetch), MatcherFor(pattern), SIZE_MAX, SIZE_MAX);
 }
 
-std::wstring CDictionary::GetDefaultDictionaryPath() {
-    wchar_t dllPath[MAX_PATH];
-    HMODULE hModule = nullptr;
-
-    // Get handle to our DLL
-    GetModuleHandleEx(GET_MODULE_HANDLE_EX_FLAG_FROM_ADDRESS | GET_MODULE_HANDLE_EX_FLAG_UNCHANGED_REFCOUNT,
-                      (LPCWSTR)&CDictionary::GetDefaultDictionaryPath, &hModule);
-
-    if (hModule && GetModuleFileName(hModule, dllPath, MAX_PATH)) {
-        std::wstring path(dllPath);
-        size_t lastSlash = path.find_last_of(L"\\/");
-        if (lastSlash != std::wstring::npos) {
-            return path.substr(0, lastSlash + 1) + L"strokeData.txt";
-        }
-    }
-    return L"strokeData.txt";
+bool CDictionary::PrefetchRegex(const std::wstring& pattern, const std::atomic<uint64_t>& generation,
+                                uint64_t expected) const {
+    // Not worth it for a snapshot about to be replaced by a fold, nor worth decoding
+    // every shard for
+    size_t shard = CDictionaryShards::GetShard(pattern);
+    if (shard == CDictionaryShards::ALL && _sharded && _shards.Read()) return false;
+    Pinned pinned = Pin(shard);
+    if (pinned.user) return false;
+    return pinned.data->PrefetchRegex(pattern, generation, expected);
 }
 
-// Convert UTF-8 string to wide string
-static std::wstring Utf8ToWide(const std::string& utf8) {
-    if (utf8.empty()) return std::wstring();
+bool CDictionary::LookupFirstPage(const std::wstring& pattern, std::vector<std::wstring>& page, size_t& total) const {
+    // The table knows nothing of user entries not folded in yet
+    Pinned pinned = Pin(CDictionaryShards::GetShard(pattern));
+    if (pinned.user) return false;
+    std::vector<CharId> ids;
+    if (!pinned.data->LookupFirstPage(pattern, ids, total)) return false;
 
-    int size = MultiByteToWideChar(CP_UTF8, 0, utf8.c_str(), (int)utf8.size(), nullptr, 0);
-    if (size <= 0) return std::wstring();
+    page.clear();
+    for (CharId id : ids) page.emplace_back(pinned.data->GetCharacter(id));
+    return true;
+}
 
-    std::wstring wide(size, 0);
-    MultiByteToWideChar(CP_UTF8, 0, utf8.c_str(), (int)utf8.size(), &wide[0], size);
-    return wide;
+std::vector<std::wstring> CDictionary::LookupTopK(const std::wstring& pattern, size_t k, bool exactLengthFirst,
+                                                  bool* fromPrefetch, const std::atomic<uint64_t>* generation,
+                                                  uint64_t expected) const {
+    Pinned pinned = Pin(CDictionaryShards::GetShard(pattern));
+    if (!pinned.user) {
+        return pinned.data->ToStrings(
+            pinned.data->LookupTopKIds(pattern, k, exactLengthFirst, fromPrefetch, generation, expected));
+    }
+    // Enough shipped results that k remain after taking out the user's characters
+    const CDictionaryData& source = pinned.GetSource();
+    size_t more = (*pinned.user)->GetCharacterCount();
+    size_t baseK = k > SIZE_MAX - more ? SIZE_MAX : k + more;
+    return Merge(pinned,
+                 source.ToStrings(source.LookupTopKIds(pattern, baseK, exactLengthFirst, fromPrefetch, generation, expected)),
+                 MatcherFor(pattern), exactLengthFirst && !Stroke::HasAnyStrokes(pattern) ? pattern.size() : SIZE_MAX, k);
 }
 
-bool CDictionary::LoadFromFile(const std::wstring& path) {
-    _dictionary.clear();
-    _insertionOrder.clear();
-    _regexCache.clear();
-    _reverseCache.clear();  // Clear reverse cache on reload
-
-    // Open file as UTF-8
-    std::ifstream file(path, std::ios::binary);
-    if (!file.is_open()) {
-        return false;
+std::vector<std::wstring> CDictionary::LookupFuzzy(const std::wstring& pattern, uint32_t maxEdits, size_t k) const {
+    // Near misses may start with any stroke; the compiled trie finds them without
+    // decoding a shard
+    if (_sharded && (!_user || _user->GetVersion() == 0)) {
+        auto shards = _shards.Read();
+        std::vector<std::wstring> matches;
+        if (shards && shards->LookupFuzzy(pattern, maxEdits, k, matches)) return matches;
     }
+    Pinned pinned = Pin();
+    const CDictionaryData& source = pinned.GetSource();
+    std::vector<std::wstring> matches = source.ToStrings(source.LookupFuzzyIds(pattern, maxEdits, k));
+    if (pinned.user) {
+        // Near misses only come from shipped codes; drop characters whose codes all went
+        matches.erase(std::remove_if(matches.begin(), matches.end(),
+                                     [&](const std::wstring& character) {
+                                         return (*pinned.user)->Find(character) && GetCodesForCharacter(character).empty();
+                                     }),
+                      matches.end());
+    }
+    return matches;
+}
 
-    std::string line;
-    line.reserve(256);  // Pre-allocate typical line size
-    int lineNum = 0;
+std::vector<std::wstring> CDictionary::GetCodesForCharacter(const std::wstring& character) const {
+    // A character's codes may start with any stroke; the shard file lists them all
+    if (_sharded && (!_user || _user->GetVersion() == 0)) {
+        auto shards = _shards.Read();
+        if (shards) return shards->GetCodesForCharacter(character);
+    }
+    Pinned pinned = Pin();
+    if (!pinned.user) return pinned.data->GetCodesForCharacter(character);
+    const CUserDictionary::CEntries& user = **pinned.user;
+    const CDictionaryData& source = pinned.GetSource();
+    const std::vector<uint32_t>* indexes = user.Find(character);
+    if (!indexes) return source.GetCodesForCharacter(character);
+
+    // Best rank first, as the fold will list them: the user's entries just ahead of the
+    // shipped entry of the same rank
+    std::vector<std::pair<uint32_t, std::wstring>> entries;
+    std::vector<std::pair<uint32_t, std::wstring>> placed;
+    source.GetEntries(source.FindCharacter(character), entries);
+    for (uint32_t i : *indexes) {
+        const auto& entry = user.GetEntries()[i];
+        if (entry.rank != CUserDictionary::REMOVED) placed.emplace_back(entry.rank, entry.code);
+    }
+    std::stable_sort(placed.begin(), placed.end(), [](const auto& a, const auto& b) { return a.first < b.first; });
 
-    // Skip BOM if present
-    char bom[3];
-    file.read(bom, 3);
-    if (!(bom[0] == '\xEF' && bom[1] == '\xBB' && bom[2] == '\xBF')) {
-        file.seekg(0);  // No BOM, go back to start
+    std::vector<std::wstring> codes;
+    auto add = [&codes](std::wstring& code) {
+        if (std::find(codes.begin(), codes.end(), code) == codes.end()) codes.push_back(std::move(code));
+    };
+    size_t next = 0;
+    for (auto& [rank, code] : entries) {
+        if (user.Hides(code, character)) continue;
+        while (next < placed.size() && placed[next].first <= rank) add(placed[next++].second);
+        add(code);
     }
+    while (next < placed.size()) add(placed[next++].second);
+    return codes;
+}
 
-    while (std::getline(file, line)) {
-        lineNum++;
+size_t CDictionary::GetBestRank(const std::wstring& character) const {
+    if (_sharded && (!_user || _user->GetVersion() == 0)) {
+        auto shards = _shards.Read();
+        if (shards) return shards->GetBestRank(character);
+    }
+    Pinned pinned = Pin();
+    if (!pinned.user) return pinned.data->GetBestRank(character);
+    const CUserDictionary::CEntries& user = **pinned.user;
+    const CDictionaryData& source = pinned.GetSource();
+    const std::vector<uint32_t>* indexes = user.Find(character);
+    if (!indexes) return source.GetBestRank(character);
+
+    size_t best = SIZE_MAX;
+    std::vector<std::pair<uint32_t, std::wstring>> entries;
+    source.GetEntries(source.FindCharacter(character), entries);
+    for (const auto& [rank, code] : entries) {
+        if (!user.Hides(code, character)) best = (std::min)(best, static_cast<size_t>(rank));
+    }
+    for (uint32_t i : *indexes) {
+        const auto& entry = user.GetEntries()[i];
+        if (entry.rank != CUserDictionary::REMOVED) best = (std::min)(best, static_cast<size_t>(entry.rank));
+    }
+    return best;
+}
 
-        // Skip empty lines and comments
-        if (line.empty() || line[0] == '#' || line[0] == ';') {
-            continue;
-        }
+bool CDictionary::MatchesPattern(const std::wstring& pattern, const std::wstring& character) const {
+    CodeMatcher matches = MatcherFor(pattern);
+    for (const auto& code : GetCodesForCharacter(character)) {
+        if (matches(code)) return true;
+    }
+    return false;
+}
 
-        // Remove carriage return if present (Windows line endings)
-        if (!line.empty() && line.back() == '\r') {
-            line.pop_back();
-        }
+size_t CDictionary::GetEntryCount() const {
+    {
+        auto shards = _shards.Read();
+        if (shards) return shards->GetEntryCount();
+    }
+    auto snapshot = _data.Read();
+    return snapshot->GetEntryCount();
+}
 
-        // Find tab separator
-        size_t tabPos = line.find('\t');
-        if (tabPos == std::string::npos || tabPos == 0) {
-            continue;  // Invalid line, skip
-        }
+// TODO: add a canonical way to select a stroke sequence
+std::wstring CDictionary::GetRandomStrokeForCharacter(const std::wstring& character) const {
+    auto codes = GetCodesForCharacter(character);
+    if (codes.empty()) return L"";
+    size_t idx = static_cast<size_t>(rand()) % codes.size();
+    return codes[idx];
+}
 
-        std::string code = line.substr(0, tabPos);
-        std::string character = line.substr(tabPos + 1);
+CDictionary::Snapshot CDictionary::Acquire() const {
+    return ReadAll();
+}
 
-        if (code.empty() || character.empty()) {
-            continue;
-        }
+void CDictionary::GetMemoryReport(CMemoryReport& report) const {
+    auto shards = _shards.Read();
+    if (shards) shards->GetMemoryReport(report, L"dictionary");
+    _data.Read()->GetMemoryReport(report, L"dictionary");
+    auto base = _base.Read();
+    if (base) base->GetMemoryReport(report, L"dictionary.base");
+}
 
-        // Convert to wide strings and add
-        std::wstring wcode = Utf8ToWide(code);
-        std::wstring wchar = Utf8ToWide(character);
+bool CDictionary::SaveQueryCache() const {
+    if (_queryCachePath.empty()) return false;
+    return _data.Read()->SaveQueryCache(_queryCachePath);
+}
 
-        if (!wcode.empty() && !wchar.empty()) {
-            AddEntry(wcode, wchar);
+std::wstring CDictionary::GetDefaultDictionaryPath() {
+    return CDataFile::GetModuleRelativePath(L"strokeData.txt");
+}
+
+bool CDictionary::LoadFromFile(const std::wstring& path) {
+    std::lock_guard<std::mutex> lock(_loadMutex);
+    auto start = std::chrono::high_resolution_clock::now();
+
+    if (_sharded) {
+        auto shards = std::make_unique<CDictionaryShards>();
+        shards->SetScanPool(_scanPool);
+        shards->SetMemoryBudget(_memoryBudget);
+        if (shards->Load(path)) {
+            // Nothing is decoded until the first lookup; the old data goes now
+            _shards.Publish(std::move(shards));
+            _data.Publish(std::make_unique<CDictionaryData>());
+
+            auto end = std::chrono::high_resolution_clock::now();
+            auto duration = std::chrono::duration_cast<std::chrono::microseconds>(end - start).count();
+            Debug::Log(L"Dictionary", (L"Published shards: " + path +
+                                       L" | Time: " + std::to_wstring(duration / 1000) + L"." + std::to_wstring(duration % 1000) + L"ms")
+                                          .c_str());
+            return true;
         }
     }
 
-    return !_dictionary.empty();
-}
+    // Build the replacement completely before anyone can see it
+    auto next = std::make_unique<CDictionaryData>();
+    next->SetScanPool(_scanPool);
+    next->SetMemoryBudget(_memoryBudget);
+    if (!next->LoadFromFile(path)) {
+        // Keep serving the previous snapshot if the new file is missing or empty
+        return false;
+    }
+    if (!_queryCachePath.empty()) next->LoadQueryCache(_queryCachePath);
+    _data.Publish(std::move(next));
+    if (_sharded) _shards.Publish(nullptr);
+    // The new data is unfolded; lookups merge the user entries until they are folded again
+    if (_user && _user->GetVersion() != 0) ScheduleFold();
 
-void CDictionary::AddEntry(const std::wstring& code, const std::wstring& character) {
-    _dictionary[code].push_back(character);
-    _insertionOrder.push_back({code, character});
+    auto end = std::chrono::high_resolution_clock::now();
+    auto duration = std::chrono::duration_cast<std::chrono::microseconds>(end - start).count();
+    Debug::Log(L"Dictionary", (L"Published snapshot: " + path +
+                               L" | Time: " + std::to_wstring(duration / 1000) + L"." + std::to_wstring(duration % 1000) + L"ms")
+                                  .c_str());
+    return true;
 }
@@ -1,38 +1,159 @@
 #pragma once
-#include <map>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <optional>
 #include <string>
+#include <thread>
 #include <vector>
 
+#include "DictionaryData.h"
+#include "DictionaryShards.h"
+#include "Snapshot.h"
+#include "UserDictionary.h"
+
+// Reloadable front end over CDictionaryData. A reload builds a new snapshot off to the
+// side and swaps it in, so lookups on other threads never wait for it.
 class CDictionary {
    public:
+    typedef CSnapshotPtr<CDictionaryData>::ReadGuard Snapshot;
+
     CDictionary();
     ~CDictionary();
 
     // Exact lookup for a full code
     std::vector<std::wstring> Lookup(const std::wstring& code) const;
 
-    // Regex lookup with wildcard '＊' interpreted as '.' (anchored at start)
-    std::vector<std::wstring> LookupRegex(const std::wstring& pattern) const;
+    // Regex lookup with wildcard '＊' interpreted as '.' (anchored at start; a pattern
+    // holding '～' must match the whole code, see Stroke::ANY_STROKES).
+    // fromPrefetch, if given, is set when a background prefetch already had the answer.
+    std::vector<std::wstring> LookupRegex(const std::wstring& pattern, bool* fromPrefetch = nullptr) const;
+
+    // Fill the current snapshot's query cache ahead of time (see CDictionaryData::PrefetchRegex)
+    bool PrefetchRegex(const std::wstring& pattern, const std::atomic<uint64_t>& generation, uint64_t expected) const;
+
+    // First page of LookupRegex and the total count, for short patterns covered by the
+    // precomputed prefix table. Returns false if the caller needs a full LookupRegex.
+    bool LookupFirstPage(const std::wstring& pattern, std::vector<std::wstring>& page, size_t& total) const;
+
+    // The k best-ranked matches of LookupRegex, found without enumerating the rest.
+    // exactLengthFirst puts codes exactly as long as the pattern ahead of longer ones.
+    // A scan gives up (returning a partial list) once generation no longer equals expected.
+    std::vector<std::wstring> LookupTopK(const std::wstring& pattern, size_t k, bool exactLengthFirst,
+                                         bool* fromPrefetch = nullptr,
+                                         const std::atomic<uint64_t>* generation = nullptr,
+                                         uint64_t expected = 0) const;
 
-    // Load dictionary from file (UTF-8 format: code<tab>character per line)
+    // Characters within maxEdits stroke mistakes of pattern, ranked after (and never
+    // repeating) the LookupRegex results; see CDictionaryData::LookupFuzzyIds
+    std::vector<std::wstring> LookupFuzzy(const std::wstring& pattern, uint32_t maxEdits, size_t k) const;
+
+    // Pin the current snapshot, e.g. to use CharIds across several calls (in sharded
+    // mode this decodes the whole dictionary first)
+    Snapshot Acquire() const;
+
+    // Load dictionary from file (UTF-8 format: code<tab>character per line).
+    // Safe to call while other threads are looking up.
     bool LoadFromFile(const std::wstring& path);
 
+    // Pool for large ～ scans, handed to every snapshot loaded from now on (see
+    // CDictionaryData::SetScanPool); call before LoadFromFile
+    void SetScanPool(CScanPool* pool) { _scanPool = pool; }
+
+    // Layer the user's entries over every lookup. An edit shows up in the next lookup,
+    // merged into its results, and FOLD_DELAY later a background thread folds the
+    // entries into a rebuilt snapshot (see CDictionaryData::LoadMerged) so lookups take
+    // the plain path again. Call before LoadFromFile; user must outlive this object.
+    void SetUserDictionary(const CUserDictionary* user) { _user = user; }
+    static constexpr std::chrono::milliseconds FOLD_DELAY{2000};
+
+    // Start every snapshot loaded from now on with the query results saved at path for
+    // its data (see CDictionaryData::LoadQueryCache); call before LoadFromFile
+    void SetQueryCachePath(const std::wstring& path) { _queryCachePath = path; }
+    // Save the current snapshot's most used query results there for the next process
+    bool SaveQueryCache() const;
+
+    // Hold every snapshot loaded from now on to this many bytes, 0 for no limit (see
+    // CDictionaryData::SetMemoryBudget); call before LoadFromFile
+    void SetMemoryBudget(size_t bytes) { _memoryBudget = bytes; }
+    // The current snapshot under dictionary/, and the unfolded copy kept for merging
+    // user entries under dictionary.base/
+    void GetMemoryReport(CMemoryReport& report) const;
+
+    // Load the compiled shard file next to the data (see CDictionaryShards) instead of the
+    // data itself, and each first stroke's entries on the first lookup that needs them.
+    // Near-miss lookups read the compiled trie. Patterns that start with ＊ or ～,
+    // Acquire and user entries need the whole dictionary, which is then decoded from the
+    // shards and replaces them. Falls back to a full load if the shard file is missing or stale. Call
+    // before LoadFromFile.
+    void SetSharded(bool sharded) { _sharded = sharded; }
+
     // Get the dictionary file path next to the DLL
     static std::wstring GetDefaultDictionaryPath();
 
-    // Reverse lookup: collect all stroke codes for a character
+    // Reverse lookup: all stroke codes for a character, best rank first with the user's
+    // entries merged in, in the same order before and after they are folded
     std::vector<std::wstring> GetCodesForCharacter(const std::wstring& character) const;
 
+    // See CDictionaryData::GetBestRank
+    size_t GetBestRank(const std::wstring& character) const;
+
+    // Whether any code of the character matches the LookupRegex pattern
+    bool MatchesPattern(const std::wstring& pattern, const std::wstring& character) const;
+
     // Convenience: pick any stroke sequence for the character (may be empty)
     std::wstring GetRandomStrokeForCharacter(const std::wstring& character) const;
 
-    size_t GetEntryCount() const { return _dictionary.size(); }
+    size_t GetEntryCount() const;
 
    private:
-    std::map<std::wstring, std::vector<std::wstring>> _dictionary;
-    std::vector<std::pair<std::wstring, std::wstring>> _insertionOrder;
-    mutable std::map<std::wstring, std::vector<std::wstring>> _regexCache;
-    mutable std::map<std::wstring, std::vector<std::wstring>> _reverseCache;
+    // The snapshots one lookup reads. user is set when the user entries are newer than
+    // what data has folded in; results then come from GetSource() and are merged.
+    typedef CSnapshotPtr<CDictionaryShards>::ReadGuard ShardsSnapshot;
+    struct Pinned {
+        std::optional<ShardsSnapshot> shards;  // holds data when data is one of its shards
+        Snapshot data;
+        std::optional<Snapshot> base;  // the unfolded data, when data holds an older fold
+        std::optional<CUserDictionary::Snapshot> user;
+        const CDictionaryData& GetSource() const { return base ? **base : *data; }
+    };
+    typedef std::function<bool(std::wstring_view code)> CodeMatcher;
+
+    // The data for lookups in the given shard (see CDictionaryShards::GetShard); ALL
+    // replaces the shards with the whole dictionary if they are still in use
+    Pinned Pin(size_t shard = CDictionaryShards::ALL) const;
+    // The whole dictionary, decoding the shards first if they are still in use
+    Snapshot ReadAll() const;
+    void LoadAllShards() const;
+    // Merges the user's entries into results, the characters of the source whose codes
+    // match in order of their best match, and keeps the k best. exactLength (SIZE_MAX for
+    // none) ranks codes of that length first, as exactLengthFirst does outside ～ patterns.
+    std::vector<std::wstring> Merge(const Pinned& pinned, const std::vector<std::wstring>& results,
+                                    const CodeMatcher& matches, size_t exactLength, size_t k) const;
+
+    void ScheduleFold() const;
+    void RunFold() const;
+    void Fold() const;
+
+    mutable CSnapshotPtr<CDictionaryData> _data;
+    // A copy of the unfolded data, kept once a fold has been published, to merge newer
+    // user entries over until the next fold
+    mutable CSnapshotPtr<CDictionaryData> _base;
+    // The shards while in sharded mode, until something needs the whole dictionary;
+    // _data holds an empty placeholder meanwhile
+    mutable CSnapshotPtr<CDictionaryShards> _shards;
+    mutable std::mutex _loadMutex;  // serialises writers; readers never take it
+    CScanPool* _scanPool = nullptr;
+    const CUserDictionary* _user = nullptr;
+    std::wstring _queryCachePath;
+    size_t _memoryBudget = 0;
+    bool _sharded = false;
 
-    void AddEntry(const std::wstring& code, const std::wstring& character);
+    mutable std::mutex _foldMutex;
+    mutable std::condition_variable _foldWake;
+    mutable std::thread _folder;
+    mutable std::atomic<bool> _folding{false};
+    bool _stopping = false;  // guarded by _foldMutex
 };
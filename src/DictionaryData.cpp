@@ -0,0 +1,1092 @@
+#include "DictionaryData.h"
+
+#include <algorithm>
+#include <chrono>
+
+#include "Bits.h"
+#include "DataFile.h"
+#include "Debug.h"
+#include "DictionaryShards.h"
+#include "PatternBatch.h"
+#include "ScanPool.h"
+#include "Stroke.h"
+#include "StrokePattern.h"
+
+CDictionaryData::CDictionaryData() : _codeArena(64 * 1024) {
+}
+
+CDictionaryData::~CDictionaryData() {
+}
+
+std::vector<std::wstring> CDictionaryData::Lookup(const std::wstring& code) const {
+    auto start = std::chrono::high_resolution_clock::now();
+
+    std::vector<CharId> ids;
+    _trie.Lookup(code, ids);
+    std::vector<std::wstring> result = ToStrings(ids);
+
+    auto end = std::chrono::high_resolution_clock::now();
+    auto duration = std::chrono::duration_cast<std::chrono::microseconds>(end - start).count();
+
+    Debug::Log(L"Dictionary", (L"Lookup code: " + code +
+                               L" | Results: " + std::to_wstring(result.size()) +
+                               L" | Time: " + std::to_wstring(duration / 1000) + L"." + std::to_wstring(duration % 1000) + L"ms")
+                                  .c_str());
+
+    return result;
+}
+
+std::vector<std::wstring> CDictionaryData::LookupRegex(const std::wstring& pattern, bool* fromPrefetch) const {
+    return ToStrings(LookupRegexIds(pattern, fromPrefetch));
+}
+
+std::vector<CharId> CDictionaryData::LookupRegexIds(const std::wstring& pattern, bool* fromPrefetch) const {
+    auto start = std::chrono::high_resolution_clock::now();
+
+    if (fromPrefetch) *fromPrefetch = false;
+    if (pattern.empty()) return {};
+
+    {
+        std::lock_guard<std::mutex> lock(_cacheMutex);
+        if (CachedQuery* cached = FindCached(pattern)) {
+            cached->hits++;
+            if (fromPrefetch) *fromPrefetch = cached->prefetched;
+            auto end = std::chrono::high_resolution_clock::now();
+            auto duration = std::chrono::duration_cast<std::chrono::microseconds>(end - start).count();
+            const wchar_t* source = cached->prefetched ? L"prefetched" : L"cached";
+            Debug::Log(L"Dictionary", (L"LookupRegex (" + std::wstring(source) + L") pattern: " + pattern +
+                                       L" | Results: " + std::to_wstring(cached->ids.size()) +
+                                       L" | Time: " + std::to_wstring(duration / 1000) + L"." + std::to_wstring(duration % 1000) + L"ms")
+                                          .c_str());
+            return cached->ids;
+        }
+    }
+
+    std::vector<CharId> out;
+    size_t scanned = 0;
+    MatchRegex(pattern, out, scanned, nullptr, 0);
+
+    {
+        std::lock_guard<std::mutex> lock(_cacheMutex);
+        AddCached(pattern, CachedQuery{out, false, 1});
+    }
+
+    auto end = std::chrono::high_resolution_clock::now();
+    auto duration = std::chrono::duration_cast<std::chrono::microseconds>(end - start).count();
+
+    Debug::Log(L"Dictionary", (L"LookupRegex pattern: " + pattern +
+                               L" | Results: " + std::to_wstring(out.size()) +
+                               L" | Entries scanned: " + std::to_wstring(scanned) +
+                               L" | Time: " + std::to_wstring(duration / 1000) + L"." + std::to_wstring(duration % 1000) + L"ms")
+                                  .c_str());
+
+    return out;
+}
+
+std::vector<std::vector<CharId>> CDictionaryData::LookupRegexBatchIds(const std::vector<std::wstring>& patterns) const {
+    auto start = std::chrono::high_resolution_clock::now();
+
+    std::vector<std::vector<CharId>> results(patterns.size());
+    std::vector<bool> found(patterns.size(), false);
+    {
+        std::lock_guard<std::mutex> lock(_cacheMutex);
+        for (size_t i = 0; i < patterns.size(); ++i) {
+            if (patterns[i].empty()) continue;
+            if (CachedQuery* cached = FindCached(patterns[i])) {
+                cached->hits++;
+                results[i] = cached->ids;
+                found[i] = true;
+            }
+        }
+    }
+
+    // Only ～ patterns that MatchSuffix cannot answer need a scan; each pattern is
+    // looked up once however often it repeats
+    CPatternBatch batch;
+    std::vector<size_t> scanned;  // pattern index per batch entry
+    std::map<std::wstring_view, size_t> first;
+    for (size_t i = 0; i < patterns.size(); ++i) {
+        if (found[i] || patterns[i].empty()) continue;
+        auto [it, added] = first.emplace(patterns[i], i);
+        if (!added) continue;
+        if (Stroke::HasAnyStrokes(patterns[i])) {
+            if (MatchSuffix(patterns[i], SIZE_MAX, results[i])) continue;
+            if (batch.Add(patterns[i])) {
+                scanned.push_back(i);
+                continue;
+            }
+        }
+        size_t ignored;
+        MatchRegex(patterns[i], results[i], ignored, nullptr, 0);
+    }
+    if (batch.GetCount() > 0) {
+        std::vector<std::vector<CharId>> outs(batch.GetCount());
+        MatchBatch(batch, outs);
+        for (size_t b = 0; b < scanned.size(); ++b) results[scanned[b]] = std::move(outs[b]);
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(_cacheMutex);
+        for (const auto& [pattern, i] : first) AddCached(patterns[i], CachedQuery{results[i], false, 1});
+    }
+    for (size_t i = 0; i < patterns.size(); ++i) {
+        if (!found[i] && !patterns[i].empty() && first[patterns[i]] != i) results[i] = results[first[patterns[i]]];
+    }
+
+    auto end = std::chrono::high_resolution_clock::now();
+    auto duration = std::chrono::duration_cast<std::chrono::microseconds>(end - start).count();
+    Debug::Log(L"Dictionary", (L"LookupRegexBatch patterns: " + std::to_wstring(patterns.size()) +
+                               L" | Looked up: " + std::to_wstring(first.size()) +
+                               L" | Scanned together: " + std::to_wstring(batch.GetCount()) +
+                               L" | Time: " + std::to_wstring(duration / 1000) + L"." + std::to_wstring(duration % 1000) + L"ms")
+                                  .c_str());
+    return results;
+}
+
+void CDictionaryData::MatchBatch(const CPatternBatch& batch, std::vector<std::vector<CharId>>& outs) const {
+    // Matches per chunk as (entry, pattern), so joining the chunks in order keeps every
+    // pattern's list in rank order; duplicates are dropped while joining
+    size_t count = CountEntries();
+    size_t chunkCount = (count + CScanPool::CHUNK_SIZE - 1) / CScanPool::CHUNK_SIZE;
+    std::vector<std::vector<std::pair<uint32_t, uint32_t>>> chunks(chunkCount);
+    auto scan = [&](unsigned, size_t chunk, size_t begin, size_t end) {
+        std::wstring buffer;
+        for (size_t e = begin; e < end; ++e) {
+            batch.Match(GetCode(e, buffer), [&](size_t pattern) {
+                chunks[chunk].emplace_back(static_cast<uint32_t>(e), static_cast<uint32_t>(pattern));
+            });
+        }
+    };
+    if (_scanPool) {
+        _scanPool->Run(count, scan);
+    } else {
+        for (size_t chunk = 0; chunk < chunkCount; ++chunk) {
+            scan(0, chunk, chunk * CScanPool::CHUNK_SIZE, (std::min)(count, (chunk + 1) * CScanPool::CHUNK_SIZE));
+        }
+    }
+
+    std::vector<CCharIdSet> seen(batch.GetCount(), CCharIdSet(_characters.GetCount()));
+    for (const auto& chunk : chunks) {
+        for (auto [e, pattern] : chunk) {
+            CharId character = GetEntryCharacter(e);
+            if (seen[pattern].Insert(character)) outs[pattern].push_back(character);
+        }
+    }
+}
+
+std::vector<CharId> CDictionaryData::LookupTopKIds(const std::wstring& pattern, size_t k, bool exactLengthFirst,
+                                                   bool* fromPrefetch, const std::atomic<uint64_t>* generation,
+                                                   uint64_t expected) const {
+    auto start = std::chrono::high_resolution_clock::now();
+
+    if (fromPrefetch) *fromPrefetch = false;
+    if (pattern.empty()) return {};
+
+    // A cached full result is already in rank order (exactLengthFirst does not apply to ～)
+    if (!exactLengthFirst || Stroke::HasAnyStrokes(pattern)) {
+        std::lock_guard<std::mutex> lock(_cacheMutex);
+        if (CachedQuery* cached = FindCached(pattern)) {
+            cached->hits++;
+            if (fromPrefetch) *fromPrefetch = cached->prefetched;
+            const auto& ids = cached->ids;
+            return std::vector<CharId>(ids.begin(), ids.begin() + (std::min)(k, ids.size()));
+        }
+    }
+
+    // Best-first trie search stops early on literal prefixes, but cannot bound subtrees
+    // by strokes further down, so wildcard patterns go through the position index.
+    // Patterns with ～ run over the entries in rank order until k characters match.
+    std::vector<CharId> out;
+    std::vector<uint32_t> matches;
+    if (Stroke::HasAnyStrokes(pattern)) {
+        if (!MatchSuffix(pattern, k, out)) MatchAnyStrokes(pattern, k, out, generation, expected);
+    } else if (pattern.find(Stroke::WILDCARD[0]) == std::wstring::npos) {
+        _trie.TopK(pattern, k, exactLengthFirst, out);
+    } else {
+        if (!_positionIndex.Match(pattern, matches)) ScanPrefix(pattern, matches);
+        CCharIdSet seen(_characters.GetCount());
+        auto take = [&](bool exactOnly) {
+            for (uint32_t e : matches) {
+                if (out.size() >= k) break;
+                if (exactOnly && GetCodeLength(e) != pattern.size()) continue;
+                CharId character = GetEntryCharacter(e);
+                if (seen.Insert(character)) out.push_back(character);
+            }
+        };
+        if (exactLengthFirst) take(true);
+        take(false);
+    }
+
+    auto end = std::chrono::high_resolution_clock::now();
+    auto duration = std::chrono::duration_cast<std::chrono::microseconds>(end - start).count();
+    Debug::Log(L"Dictionary", (L"LookupTopK pattern: " + pattern +
+                               L" | K: " + std::to_wstring(k) + (exactLengthFirst ? L" (exact length first)" : L"") +
+                               L" | Results: " + std::to_wstring(out.size()) +
+                               L" | Time: " + std::to_wstring(duration / 1000) + L"." + std::to_wstring(duration % 1000) + L"ms")
+                                  .c_str());
+    return out;
+}
+
+std::vector<CharId> CDictionaryData::LookupFuzzyIds(const std::wstring& pattern, uint32_t maxEdits,
+                                                    size_t k) const {
+    auto start = std::chrono::high_resolution_clock::now();
+    if (pattern.empty()) return {};
+
+    maxEdits = CLoudsTrie::GetMaxEdits(pattern.size(), maxEdits);
+    std::vector<CharId> out;
+    _trie.FuzzyTopK(pattern, maxEdits, k, out);
+
+    auto end = std::chrono::high_resolution_clock::now();
+    auto duration = std::chrono::duration_cast<std::chrono::microseconds>(end - start).count();
+    Debug::Log(L"Dictionary", (L"LookupFuzzy pattern: " + pattern +
+                               L" | Edits: " + std::to_wstring(maxEdits) +
+                               L" | Results: " + std::to_wstring(out.size()) +
+                               L" | Time: " + std::to_wstring(duration / 1000) + L"." + std::to_wstring(duration % 1000) + L"ms")
+                                  .c_str());
+    return out;
+}
+
+bool CDictionaryData::PrefetchRegex(const std::wstring& pattern, const std::atomic<uint64_t>& generation,
+                                    uint64_t expected) const {
+    if (pattern.empty()) return false;
+    // The prefix table already answers these without a scan
+    if (_prefixTable.IsLoaded() && pattern.size() <= _prefixTable.GetMaxLength()) return false;
+
+    {
+        std::lock_guard<std::mutex> lock(_cacheMutex);
+        if (FindCached(pattern)) return false;
+    }
+
+    std::vector<CharId> out;
+    size_t scanned = 0;
+    if (!MatchRegex(pattern, out, scanned, &generation, expected)) return false;
+
+    std::lock_guard<std::mutex> lock(_cacheMutex);
+    if (_regexCache.count(pattern)) return false;
+    AddCached(pattern, CachedQuery{std::move(out), true});
+    return true;
+}
+
+bool CDictionaryData::MatchRegex(const std::wstring& pattern, std::vector<CharId>& out, size_t& scanned,
+                                 const std::atomic<uint64_t>* generation, uint64_t expected) const {
+    if (Stroke::HasAnyStrokes(pattern)) {
+        if (MatchSuffix(pattern, SIZE_MAX, out)) {
+            scanned = out.size();
+            return true;
+        }
+        scanned = CountEntries();
+        return MatchAnyStrokes(pattern, SIZE_MAX, out, generation, expected);
+    }
+
+    CCharIdSet seen(_characters.GetCount());
+
+    // Pre-reserve capacity to reduce allocations (typical result size)
+    out.reserve(50);
+
+    // Intersect the positional bitmaps; the matching entries come back in rank order.
+    // Packed codes are compared in place by ScanPrefix rather than written out below.
+    std::vector<uint32_t> matches;
+    bool indexed = _positionIndex.Match(pattern, matches);
+    if (!indexed && _packed) ScanPrefix(pattern, matches);
+    if (indexed || _packed) {
+        scanned = indexed ? matches.size() : CountEntries();
+        for (uint32_t e : matches) {
+            CharId character = GetEntryCharacter(e);
+            if (seen.Insert(character)) {
+                out.push_back(character);
+            }
+        }
+        out.shrink_to_fit();
+        return true;
+    }
+    scanned = CountEntries();
+
+    // Fast wildcard matching without regex - much more efficient
+    // Split pattern into segments (non-wildcard parts)
+    std::vector<std::wstring> segments;
+    std::wstring currentSegment;
+
+    for (wchar_t ch : pattern) {
+        if (ch == Stroke::WILDCARD[0]) {
+            if (!currentSegment.empty()) {
+                segments.push_back(currentSegment);
+                currentSegment.clear();
+            }
+            segments.push_back(std::wstring(1, Stroke::WILDCARD[0]));
+        } else {
+            currentSegment.push_back(ch);
+        }
+    }
+    if (!currentSegment.empty()) {
+        segments.push_back(currentSegment);
+    }
+
+    // Iterate in insertion order instead of map order
+    for (size_t e = 0; e < _entries.size(); ++e) {
+        // Background scans check for cancellation every few thousand entries
+        if (generation && (e & 4095) == 0 && generation->load(std::memory_order_relaxed) != expected) {
+            return false;
+        }
+
+        const Entry& entry = _entries[e];
+        std::wstring_view code = entry.code;
+
+        // Fast wildcard matching with start-aligned partial match
+        // Pattern matches if all segments match sequentially from the start
+        // but the code can have additional characters after the pattern
+        bool matches = true;
+        size_t codePos = 0;
+
+        for (size_t i = 0; i < segments.size(); ++i) {
+            const auto& segment = segments[i];
+
+            if (segment == std::wstring(1, Stroke::WILDCARD[0])) {
+                // Wildcard matches any single character
+                if (codePos < code.length()) {
+                    codePos++;
+                } else {
+                    // Wildcard but no character left in code
+                    matches = false;
+                    break;
+                }
+            } else {
+                // Literal segment must match exactly at current position
+                if (codePos + segment.length() > code.length() ||
+                    code.compare(codePos, segment.length(), segment) != 0) {
+                    matches = false;
+                    break;
+                }
+                codePos += segment.length();
+            }
+        }
+
+        // Match if pattern matched from start (code can have additional characters after pattern)
+        if (matches) {
+            if (seen.Insert(entry.character)) {
+                out.push_back(entry.character);
+            }
+        }
+    }
+
+    // Shrink to actual size to save memory in cache
+    out.shrink_to_fit();
+    return true;
+}
+
+bool CDictionaryData::MatchSuffix(const std::wstring& pattern, size_t k, std::vector<CharId>& out) const {
+    // One run of ～, which means the same as a single one
+    size_t split = pattern.find(Stroke::ANY_STROKES[0]);
+    size_t rest = pattern.find_first_not_of(Stroke::ANY_STROKES[0], split);
+    if (split == std::wstring::npos || pattern.find(Stroke::ANY_STROKES[0], rest) != std::wstring::npos) return false;
+    std::wstring_view head(pattern.data(), split);
+    std::wstring_view tail = rest == std::wstring::npos ? std::wstring_view() : std::wstring_view(pattern).substr(rest);
+    if (tail.empty()) return false;
+
+    auto matchesAt = [](std::wstring_view part, std::wstring_view code) {
+        for (size_t i = 0; i < part.size(); ++i) {
+            if (part[i] != Stroke::WILDCARD[0] && part[i] != code[i]) return false;
+        }
+        return true;
+    };
+    auto literals = [](std::wstring_view part) {
+        return part.size() - std::count(part.begin(), part.end(), Stroke::WILDCARD[0]);
+    };
+
+    // Candidate entries in rank order, and the check for the end they were not found by
+    std::vector<uint32_t> entries;
+    CCharIdSet seen(_characters.GetCount());
+    std::wstring buffer;
+    auto take = [&](bool fromHead) {
+        for (uint32_t e : entries) {
+            if (out.size() >= k) break;
+            if (GetCodeLength(e) < head.size() + tail.size()) continue;
+            std::wstring_view code = GetCode(e, buffer);
+            if (!(fromHead ? matchesAt(tail, code.substr(code.size() - tail.size())) : matchesAt(head, code))) continue;
+            CharId character = GetEntryCharacter(e);
+            if (seen.Insert(character)) out.push_back(character);
+        }
+    };
+
+    if (literals(head) > literals(tail)) {
+        if (!_positionIndex.Match(head, entries)) return false;
+        take(true);
+        return true;
+    }
+
+    // Entries sharing the last few strokes are adjacent in _suffixOrder: narrow a range
+    // one stroke at a time from the end, branching on ＊
+    size_t entryCount = CountEntries();
+    if (_suffixOrder.GetSize() != entryCount) return false;
+    std::vector<std::pair<size_t, size_t>> ranges;
+    auto narrow = [&](auto&& self, size_t begin, size_t end, size_t depth) -> void {
+        if (begin == end) return;
+        if (depth == tail.size()) {
+            ranges.emplace_back(begin, end);
+            return;
+        }
+        int symbol = Stroke::ToIndex(tail[tail.size() - 1 - depth]);
+        for (int stroke = 0; stroke < Stroke::COUNT; ++stroke) {
+            if (symbol != Stroke::WILDCARD_INDEX && symbol != stroke) continue;
+            size_t lo = begin, hi = end;
+            while (lo < hi) {
+                size_t mid = lo + (hi - lo) / 2;
+                if (GetStrokeFromEnd(_suffixOrder.Get(mid), depth) <= stroke) lo = mid + 1; else hi = mid;
+            }
+            size_t first = lo;
+            for (hi = end; lo < hi;) {
+                size_t mid = lo + (hi - lo) / 2;
+                if (GetStrokeFromEnd(_suffixOrder.Get(mid), depth) <= stroke + 1) lo = mid + 1; else hi = mid;
+            }
+            self(self, first, lo, depth + 1);
+        }
+    };
+    narrow(narrow, 0, _suffixOrder.GetSize(), 0);
+
+    // With m of n entries matching, a rank-order scan meets k of them after about k*n/m
+    // entries, which for a common ending is fewer than the m to mark below
+    size_t matched = 0;
+    for (auto [begin, end] : ranges) matched += end - begin;
+    if (k != SIZE_MAX && matched * matched > k * entryCount) return false;
+
+    // Back to rank order through a bitmap over the entries, which also lets a first page
+    // stop at its k-th character without sorting the rest
+    std::vector<uint64_t> marked((entryCount + 63) / 64);
+    for (auto [begin, end] : ranges) {
+        for (size_t i = begin; i < end; ++i) {
+            uint32_t e = _suffixOrder.Get(i);
+            marked[e >> 6] |= 1ull << (e & 63);
+        }
+    }
+    for (size_t w = 0; w < marked.size() && out.size() < k; ++w) {
+        for (uint64_t bits = marked[w]; bits; bits &= bits - 1) {
+            entries.push_back(static_cast<uint32_t>(w * 64 + Bits::CountTrailingZeros(bits)));
+        }
+        take(false);
+        entries.clear();
+    }
+    return true;
+}
+
+bool CDictionaryData::MatchAnyStrokes(const std::wstring& pattern, size_t k, std::vector<CharId>& out,
+                                      const std::atomic<uint64_t>* generation, uint64_t expected) const {
+    CStrokePattern automaton(pattern);
+    if (!automaton.IsValid()) return true;
+
+    // The strokes before the first ～ sit at fixed positions, so for a full list the
+    // position index can narrow the entries down first (it keeps rank order). A first
+    // page is found sooner by scanning than by intersecting whole bitmaps.
+    std::vector<uint32_t> narrowed;
+    std::wstring_view head(pattern.data(), pattern.find(Stroke::ANY_STROKES[0]));
+    bool useNarrowed = k == SIZE_MAX && head.find_first_not_of(Stroke::WILDCARD[0]) != std::wstring_view::npos &&
+                       _positionIndex.Match(head, narrowed);
+    size_t count = useNarrowed ? narrowed.size() : CountEntries();
+
+    // One DFA step per stroke; most codes die within their first few strokes, so packed
+    // codes are stepped through in place rather than written out
+    auto matches = [this](CStrokePattern& automaton, size_t e) {
+        uint32_t state = CStrokePattern::START;
+        if (_packed) {
+            _packedCodes.ForEachStroke(e, [&](int stroke) {
+                state = automaton.Next(state, stroke);
+                return state != CStrokePattern::DEAD;
+            });
+            return automaton.IsAccepting(state);
+        }
+        for (wchar_t ch : _entries[e].code) {
+            int stroke = Stroke::ToIndex(ch);
+            state = stroke >= 0 && stroke < Stroke::COUNT ? automaton.Next(state, stroke) : CStrokePattern::DEAD;
+            if (state == CStrokePattern::DEAD) break;
+        }
+        return automaton.IsAccepting(state);
+    };
+
+    CCharIdSet seen(_characters.GetCount());
+    if (k == SIZE_MAX && _scanPool && _scanPool->GetThreadCount() > 1 && count >= CScanPool::MIN_PARALLEL_COUNT) {
+        // Each thread steps its own copy of the DFA (it fills itself in as it goes) and
+        // each chunk keeps its own matches, so joining the chunks in order restores rank
+        // order. A thread claims chunks in increasing order, so it may skip characters
+        // it already matched; duplicates across threads are dropped while joining.
+        unsigned threads = _scanPool->GetThreadCount();
+        std::vector<CStrokePattern> automata(threads, automaton);
+        std::vector<CCharIdSet> matched(threads, CCharIdSet(_characters.GetCount()));
+        std::vector<std::vector<uint32_t>> chunks(_scanPool->GetChunkCount(count));
+        std::atomic<bool> cancelled{false};
+        _scanPool->Run(count, [&](unsigned worker, size_t chunk, size_t begin, size_t end) {
+            if (generation && generation->load(std::memory_order_relaxed) != expected) {
+                cancelled.store(true, std::memory_order_relaxed);
+            }
+            if (cancelled.load(std::memory_order_relaxed)) return;
+            for (size_t i = begin; i < end; ++i) {
+                uint32_t e = useNarrowed ? narrowed[i] : static_cast<uint32_t>(i);
+                CharId character = GetEntryCharacter(e);
+                if (matched[worker].Contains(character) || !matches(automata[worker], e)) continue;
+                matched[worker].Insert(character);
+                chunks[chunk].push_back(e);
+            }
+        });
+        if (cancelled.load(std::memory_order_relaxed)) return false;
+
+        for (const auto& chunk : chunks) {
+            for (uint32_t e : chunk) {
+                CharId character = GetEntryCharacter(e);
+                if (seen.Insert(character)) out.push_back(character);
+            }
+        }
+        return true;
+    }
+
+    for (size_t i = 0; i < count && out.size() < k; ++i) {
+        if (generation && (i & 4095) == 0 && generation->load(std::memory_order_relaxed) != expected) {
+            return false;
+        }
+
+        size_t e = useNarrowed ? narrowed[i] : i;
+        CharId character = GetEntryCharacter(e);
+        if (seen.Contains(character)) continue;
+        if (matches(automaton, e)) {
+            seen.Insert(character);
+            out.push_back(character);
+        }
+    }
+    return true;
+}
+
+std::vector<std::wstring> CDictionaryData::GetCodesForCharacter(const std::wstring& character) const {
+    auto start = std::chrono::high_resolution_clock::now();
+
+    CharId id = _characters.Find(character);
+    if (id == INVALID_CHAR_ID) return {};
+
+    // Check reverse lookup cache first
+    {
+        std::lock_guard<std::mutex> lock(_cacheMutex);
+        auto cacheIt = _reverseCache.find(id);
+        if (cacheIt != _reverseCache.end()) {
+            auto end = std::chrono::high_resolution_clock::now();
+            auto duration = std::chrono::duration_cast<std::chrono::microseconds>(end - start).count();
+            Debug::Log(L"Dictionary", (L"GetCodesForCharacter (cached): " + character +
+                                       L" | Results: " + std::to_wstring(cacheIt->second.size()) +
+                                       L" | Time: " + std::to_wstring(duration / 1000) + L"." + std::to_wstring(duration % 1000) + L"ms")
+                                          .c_str());
+            return cacheIt->second;
+        }
+    }
+
+    std::vector<std::wstring> codes;
+    _trie.FindCodes(id, codes);
+    codes.shrink_to_fit();
+
+    // Cache the result for future lookups
+    {
+        std::lock_guard<std::mutex> lock(_cacheMutex);
+        if (_reverseCache.emplace(id, codes).second) {
+            _reverseCacheBytes += sizeof(std::pair<const CharId, std::vector<std::wstring>>) + 4 * sizeof(void*) +
+                                  codes.capacity() * sizeof(std::wstring);
+            ShedCache(nullptr);
+        }
+    }
+
+    auto end = std::chrono::high_resolution_clock::now();
+    auto duration = std::chrono::duration_cast<std::chrono::microseconds>(end - start).count();
+
+    Debug::Log(L"Dictionary", (L"GetCodesForCharacter: " + character +
+                               L" | Results: " + std::to_wstring(codes.size()) +
+                               L" | Time: " + std::to_wstring(duration / 1000) + L"." + std::to_wstring(duration % 1000) + L"ms")
+                                  .c_str());
+
+    return codes;
+}
+
+size_t CDictionaryData::GetBestRank(std::wstring_view character) const {
+    CharId id = _characters.Find(character);
+    if (id == INVALID_CHAR_ID) return SIZE_MAX;
+    uint32_t rank = _trie.GetBestRank(id);
+    return rank == UINT32_MAX ? SIZE_MAX : rank;
+}
+
+// Counting sort of the entries by character, which keeps rank order within each
+void CDictionaryData::GetReverseTable(std::vector<uint32_t>& offsets, std::vector<std::wstring_view>& codes,
+                                      std::wstring& storage) const {
+    std::vector<std::wstring_view> ranked;
+    GetCodes(ranked, storage);
+    offsets.assign(_characters.GetCount() + 1, 0);
+    for (size_t e = 0; e < ranked.size(); ++e) {
+        ++offsets[GetEntryCharacter(e) + 1];
+    }
+    for (size_t i = 1; i < offsets.size(); ++i) {
+        offsets[i] += offsets[i - 1];
+    }
+    codes.resize(ranked.size());
+    std::vector<uint32_t> next(offsets.begin(), offsets.end() - 1);
+    for (size_t e = 0; e < ranked.size(); ++e) {
+        codes[next[GetEntryCharacter(e)]++] = ranked[e];
+    }
+}
+
+// Only called on a freshly constructed object, before it is published
+bool CDictionaryData::LoadFromFile(const std::wstring& path) {
+    CDataFile file;
+    if (!file.Load(path)) {
+        return false;
+    }
+
+    // Optional third column: a frequency, higher first
+    std::vector<uint32_t> frequencies;
+    bool hasFrequencies = false;
+    _entries.reserve(file.GetRecords().size());
+    frequencies.reserve(file.GetRecords().size());
+    for (const auto& record : file.GetRecords()) {
+        size_t tab = record.value.find(L'\t');
+        AddEntry(record.key, record.value.substr(0, tab));
+        frequencies.push_back(tab == std::wstring_view::npos ? 0 : ParseFrequency(record.value.substr(tab + 1)));
+        hasFrequencies |= frequencies.back() != 0;
+    }
+
+    // Entry order is rank order from here on; every index reports matches in it
+    if (hasFrequencies) {
+        std::vector<uint32_t> order(_entries.size());
+        for (uint32_t i = 0; i < order.size(); ++i) order[i] = i;
+        std::stable_sort(order.begin(), order.end(),
+                         [&frequencies](uint32_t a, uint32_t b) { return frequencies[a] > frequencies[b]; });
+        std::vector<Entry> ranked;
+        ranked.reserve(_entries.size());
+        for (uint32_t i : order) ranked.push_back(_entries[i]);
+        _entries.swap(ranked);
+    }
+
+    // Prefer the structures k6tool compiled next to the data file; build them if missing or stale
+    _dataHash = file.GetContentHash();
+    if (!_trie.Load(CLoudsTrie::GetPathForDictionary(path), _dataHash)) {
+        BuildTrie();
+    }
+    std::wstring prefixTablePath = CPrefixTable::GetPathForDictionary(path);
+    BuildOptionalIndexes(&prefixTablePath);
+
+    return CountEntries() != 0;
+}
+
+// Only called on a freshly constructed object, before it is published
+bool CDictionaryData::LoadMerged(const CDictionaryData& base, const CUserDictionary::CEntries* user) {
+    static const std::vector<CUserDictionary::Entry> none;
+    const std::vector<CUserDictionary::Entry>& placed = user ? user->GetEntries() : none;
+
+    size_t count = base.CountEntries();
+    _entries.reserve(count + placed.size());
+    size_t next = 0;
+    std::wstring buffer;
+    for (size_t rank = 0; rank < count; ++rank) {
+        for (; next < placed.size() && placed[next].rank <= rank; ++next) {
+            AddEntry(placed[next].code, placed[next].character);
+        }
+        std::wstring_view code = base.GetCode(rank, buffer);
+        std::wstring_view character = base.GetCharacter(base.GetEntryCharacter(rank));
+        if (user && user->Hides(code, character)) continue;
+        AddEntry(code, character);
+    }
+    for (; next < placed.size() && placed[next].rank != CUserDictionary::REMOVED; ++next) {
+        AddEntry(placed[next].code, placed[next].character);
+    }
+
+    // Nothing on disk was built from these entries, so every index is built here. The
+    // hash covers the user's entries too, so results saved for this fold stay with it.
+    _userVersion = user ? user->GetVersion() : 0;
+    _dataHash = base._dataHash;
+    if (user && !user->IsEmpty()) {
+        std::wstring text;
+        for (const auto& entry : placed) {
+            text += entry.code + L'\t' + entry.character + L'\t' + std::to_wstring(entry.rank) + L'\n';
+        }
+        _dataHash ^= CDataFile::HashBytes(reinterpret_cast<const char*>(text.data()), text.size() * sizeof(wchar_t));
+    }
+    BuildTrie();
+    BuildOptionalIndexes(nullptr);
+    return CountEntries() != 0;
+}
+
+// Only called on a freshly constructed object, before it is published
+bool CDictionaryData::LoadFromShards(const CDictionaryShards& shards, size_t shard) {
+    std::vector<std::wstring_view> codes, characters;
+    shards.GetEntries(shard, codes, characters);
+    if (shard == CDictionaryShards::ALL) {
+        // Interned in the order LoadFromFile interns them, so the CharIds, and with them
+        // the compiled side files and saved query results, are the same
+        for (CharId id = 0; id < shards.GetCharacterCount(); ++id) _characters.Intern(shards.GetCharacter(id));
+    }
+    _entries.reserve(codes.size());
+    if (shard != CDictionaryShards::ALL) {
+        // A shard's codes are read in place from the mapped file, which outlives it. Its
+        // ranks and CharIds are its own, so nothing saved for the whole dictionary applies.
+        // Reverse lookups are answered from the file, so the character table can trade
+        // its hash map for the smaller sorted ids
+        for (size_t i = 0; i < codes.size(); ++i) _entries.push_back({codes[i], _characters.Intern(characters[i])});
+        _characters.Compact();
+        BuildTrie();
+        BuildOptionalIndexes(nullptr);
+        return CountEntries() != 0;
+    }
+    for (size_t i = 0; i < codes.size(); ++i) AddEntry(codes[i], characters[i]);
+    _dataHash = shards.GetDataHash();
+    const std::wstring& path = shards.GetDictionaryPath();
+    if (!_trie.Load(CLoudsTrie::GetPathForDictionary(path), _dataHash)) {
+        BuildTrie();
+    }
+    std::wstring prefixTablePath = CPrefixTable::GetPathForDictionary(path);
+    BuildOptionalIndexes(&prefixTablePath);
+    return CountEntries() != 0;
+}
+
+uint32_t CDictionaryData::ParseFrequency(std::wstring_view text) {
+    uint64_t value = 0;
+    for (wchar_t ch : text) {
+        if (ch < L'0' || ch > L'9') break;
+        value = (std::min)(value * 10 + static_cast<uint64_t>(ch - L'0'), static_cast<uint64_t>(UINT32_MAX));
+    }
+    return static_cast<uint32_t>(value);
+}
+
+void CDictionaryData::AddEntry(std::wstring_view code, std::wstring_view character) {
+    wchar_t* stored = _codeArena.Allocate(code.size());
+    std::copy(code.begin(), code.end(), stored);
+    _entries.push_back({std::wstring_view(stored, code.size()), _characters.Intern(character)});
+}
+
+void CDictionaryData::BuildOptionalIndexes(const std::wstring* prefixTablePath) {
+    auto loadPrefixTable = [&]() {
+        return prefixTablePath && _prefixTable.Load(*prefixTablePath, _dataHash);
+    };
+    if (_memoryBudget == 0) {
+        if (!loadPrefixTable()) BuildPrefixTable(_prefixTable, CPrefixTable::DEFAULT_MAX_LENGTH);
+        BuildPositionIndex();
+        BuildSuffixOrder();
+        return;
+    }
+
+    // The packed codes stand in for the plain store from here on; the indexes are still
+    // built from the plain one, which is dropped at the end
+    _entries.shrink_to_fit();
+    _characters.Compact();
+    std::vector<std::wstring_view> codes;
+    std::vector<uint32_t> characters;
+    std::wstring storage;
+    GetCodes(codes, storage);
+    characters.reserve(codes.size());
+    for (size_t e = 0; e < codes.size(); ++e) characters.push_back(GetEntryCharacter(e));
+    bool pack = _packedCodes.Build(codes);
+    if (pack) _entryCharacters.Build(characters);
+    codes = std::vector<std::wstring_view>();
+    characters = std::vector<uint32_t>();
+    auto used = [this, pack]() {
+        size_t store = pack ? _packedCodes.GetMemoryUsage() + _entryCharacters.GetMemoryUsage()
+                            : _entries.capacity() * sizeof(Entry) + _codeArena.GetMemoryUsage();
+        return store + _characters.GetMemoryUsage() + _trie.GetMemoryUsage() + _prefixTable.GetMemoryUsage() +
+               _positionIndex.GetMemoryUsage() + _suffixOrder.GetMemoryUsage();
+    };
+    // Each index is built and then kept only if it leaves the caches their minimum; a
+    // compiled prefix table is mapped and costs no heap
+    size_t limit = _memoryBudget > MIN_CACHE_BUDGET ? _memoryBudget - MIN_CACHE_BUDGET : 0;
+    std::wstring dropped;
+    if (!loadPrefixTable()) {
+        BuildPrefixTable(_prefixTable, CPrefixTable::DEFAULT_MAX_LENGTH);
+        if (used() > limit) {
+            _prefixTable.Clear();
+            dropped += L" prefix table";
+        }
+    }
+    BuildPositionIndex();
+    if (used() > limit) {
+        _positionIndex.Clear();
+        dropped += L" position index";
+    }
+    BuildSuffixOrder();
+    if (used() > limit) {
+        _suffixOrder = CPackedArray();
+        dropped += L" suffix order";
+    }
+    if (pack) DropPlainCodes();
+    _cacheBudget = (std::max)(_memoryBudget - (std::min)(used(), _memoryBudget), MIN_CACHE_BUDGET);
+
+    // What is left cannot be dropped, so a budget below it is only reported
+    size_t total = used() + _cacheBudget;
+    std::wstring over;
+    if (total > _memoryBudget) over = L" | Over budget by " + std::to_wstring((total - _memoryBudget + 1023) / 1024) + L"KB";
+    Debug::Log(L"Dictionary", (L"Memory budget: " + std::to_wstring(_memoryBudget / 1024) + L"KB | Structures: " +
+                               std::to_wstring(used() / 1024) + L"KB" + (pack ? L" (codes packed)" : L"") +
+                               L" | Cache: " + std::to_wstring(_cacheBudget / 1024) +
+                               L"KB | Dropped:" + (dropped.empty() ? std::wstring(L" none") : dropped) + over)
+                                  .c_str());
+}
+
+void CDictionaryData::GetCodes(std::vector<std::wstring_view>& codes, std::wstring& storage) const {
+    size_t count = CountEntries();
+    codes.clear();
+    codes.reserve(count);
+    if (!_packed) {
+        for (const auto& entry : _entries) codes.push_back(entry.code);
+        return;
+    }
+    // Written out back to back first, so growing storage moves no code a view points into
+    size_t total = 0;
+    for (size_t e = 0; e < count; ++e) total += _packedCodes.GetLength(e);
+    storage.clear();
+    storage.reserve(total);
+    std::wstring buffer;
+    for (size_t e = 0; e < count; ++e) storage += _packedCodes.Get(e, buffer);
+    for (size_t e = 0, offset = 0; e < count; ++e) {
+        size_t length = _packedCodes.GetLength(e);
+        codes.emplace_back(storage.data() + offset, length);
+        offset += length;
+    }
+}
+
+void CDictionaryData::DropPlainCodes() {
+    std::vector<Entry>().swap(_entries);
+    _codeArena = CArena<wchar_t>(64 * 1024);
+    _packed = true;
+}
+
+void CDictionaryData::ScanPrefix(std::wstring_view pattern, std::vector<uint32_t>& entries) const {
+    entries.clear();
+    if (_packed) {
+        std::vector<int> strokes;
+        for (wchar_t ch : pattern) strokes.push_back(Stroke::ToIndex(ch));
+        for (uint32_t e = 0; e < CountEntries(); ++e) {
+            if (_packedCodes.GetLength(e) < strokes.size()) continue;
+            size_t i = 0;
+            _packedCodes.ForEachStroke(e, [&](int stroke) {
+                if (i == strokes.size() || (strokes[i] != Stroke::WILDCARD_INDEX && strokes[i] != stroke)) return false;
+                ++i;
+                return true;
+            });
+            if (i == strokes.size()) entries.push_back(e);
+        }
+        return;
+    }
+    for (uint32_t e = 0; e < _entries.size(); ++e) {
+        std::wstring_view code = _entries[e].code;
+        if (code.size() < pattern.size()) continue;
+        size_t i = 0;
+        while (i < pattern.size() && (pattern[i] == Stroke::WILDCARD[0] || pattern[i] == code[i])) ++i;
+        if (i == pattern.size()) entries.push_back(e);
+    }
+}
+
+void CDictionaryData::BuildPositionIndex() {
+    std::vector<std::wstring_view> codes;
+    std::wstring storage;
+    GetCodes(codes, storage);
+    _positionIndex.Build(codes);
+}
+
+void CDictionaryData::BuildTrie() {
+    std::vector<std::wstring_view> codes;
+    std::vector<CharId> characters;
+    std::wstring storage;
+    GetCodes(codes, storage);
+    characters.reserve(codes.size());
+    for (size_t e = 0; e < codes.size(); ++e) characters.push_back(GetEntryCharacter(e));
+    _trie.Build(codes, characters, _dataHash);
+}
+
+int CDictionaryData::GetStrokeFromEnd(uint32_t e, size_t depth) const {
+    if (_packed) {
+        size_t length = _packedCodes.GetLength(e);
+        return depth < length ? _packedCodes.GetStroke(e, length - 1 - depth) + 1 : 0;
+    }
+    std::wstring_view code = _entries[e].code;
+    return depth < code.size() ? Stroke::ToIndex(code[code.size() - 1 - depth]) + 1 : 0;
+}
+
+void CDictionaryData::BuildSuffixOrder() {
+    // Sort keys hold the last 21 strokes, last first, as 3-bit digits; longer codes with
+    // equal keys compare the rest, and equal codes stay in rank order
+    constexpr size_t KEY_STROKES = 21;
+    std::vector<std::pair<uint64_t, uint32_t>> keys(CountEntries());
+    std::wstring buffer;
+    for (uint32_t e = 0; e < keys.size(); ++e) {
+        std::wstring_view code = GetCode(e, buffer);
+        size_t strokes = (std::min)(code.size(), KEY_STROKES);
+        uint64_t key = 0;
+        for (size_t depth = 0; depth < strokes; ++depth) {
+            key = key << 3 | (Stroke::ToIndex(code[code.size() - 1 - depth]) + 1);
+        }
+        keys[e] = {key << 3 * (KEY_STROKES - strokes), e};
+    }
+    std::sort(keys.begin(), keys.end(), [this](const auto& a, const auto& b) {
+        if (a.first != b.first) return a.first < b.first;
+        size_t length = (std::max)(GetCodeLength(a.second), GetCodeLength(b.second));
+        for (size_t depth = KEY_STROKES; depth < length; ++depth) {
+            int x = GetStrokeFromEnd(a.second, depth), y = GetStrokeFromEnd(b.second, depth);
+            if (x != y) return x < y;
+        }
+        return a.second < b.second;
+    });
+
+    std::vector<uint32_t> order;
+    order.reserve(keys.size());
+    for (const auto& key : keys) order.push_back(key.second);
+    _suffixOrder.Build(order);
+}
+
+void CDictionaryData::BuildPrefixTable(CPrefixTable& table, uint32_t maxLength) const {
+    std::vector<std::wstring_view> codes;
+    std::vector<CharId> characters;
+    std::wstring storage;
+    GetCodes(codes, storage);
+    characters.reserve(codes.size());
+    for (size_t e = 0; e < codes.size(); ++e) characters.push_back(GetEntryCharacter(e));
+    table.Build(codes, characters, _characters.GetCount(), _dataHash, maxLength);
+}
+
+bool CDictionaryData::CompilePrefixTable(const std::wstring& path, uint32_t maxLength) const {
+    CPrefixTable table;
+    BuildPrefixTable(table, maxLength);
+    return table.Save(path);
+}
+
+bool CDictionaryData::CompileShards(const std::wstring& path) const {
+    std::vector<std::wstring_view> codes, characters;
+    std::vector<CharId> values;
+    std::wstring storage;
+    GetCodes(codes, storage);
+    values.reserve(codes.size());
+    for (size_t e = 0; e < codes.size(); ++e) values.push_back(GetEntryCharacter(e));
+    characters.reserve(_characters.GetCount());
+    for (CharId id = 0; id < _characters.GetCount(); ++id) characters.push_back(_characters.Get(id));
+    return CDictionaryShards::Save(path, _dataHash, codes, values, characters);
+}
+
+bool CDictionaryData::LookupFirstPage(const std::wstring& pattern, std::vector<CharId>& page, size_t& total) const {
+    auto start = std::chrono::high_resolution_clock::now();
+
+    if (!_prefixTable.Lookup(pattern, page, total)) return false;
+
+    auto end = std::chrono::high_resolution_clock::now();
+    auto duration = std::chrono::duration_cast<std::chrono::microseconds>(end - start).count();
+    Debug::Log(L"Dictionary", (L"LookupFirstPage (prefix table) pattern: " + pattern +
+                               L" | Results: " + std::to_wstring(page.size()) + L"/" + std::to_wstring(total) +
+                               L" | Time: " + std::to_wstring(duration / 1000) + L"." + std::to_wstring(duration % 1000) + L"ms")
+                                  .c_str());
+    return true;
+}
+
+void CDictionaryData::ClearQueryCache() {
+    std::lock_guard<std::mutex> lock(_cacheMutex);
+    _regexCache.clear();
+    _regexCacheBytes = 0;
+}
+
+CDictionaryData::CachedQuery* CDictionaryData::FindCached(const std::wstring& pattern) const {
+    auto it = _regexCache.find(pattern);
+    if (it != _regexCache.end()) {
+        it->second.lastUse = ++_cacheClock;
+        return &it->second;
+    }
+    std::vector<CharId> ids;
+    if (!_warmCache.Find(pattern, ids)) return nullptr;
+    return AddCached(pattern, CachedQuery{std::move(ids), false});
+}
+
+CDictionaryData::CachedQuery* CDictionaryData::AddCached(const std::wstring& pattern, CachedQuery query) const {
+    auto [it, added] = _regexCache.emplace(pattern, std::move(query));
+    it->second.lastUse = ++_cacheClock;
+    if (added) {
+        _regexCacheBytes += GetCachedBytes(it->first, it->second);
+        ShedCache(&it->second);
+    }
+    return &it->second;
+}
+
+void CDictionaryData::ShedCache(const CachedQuery* keep) const {
+    if (_regexCacheBytes + _reverseCacheBytes <= _cacheBudget) return;
+
+    // Codes for a character come straight from the trie's reverse index, so they go first
+    _reverseCache.clear();
+    _reverseCacheBytes = 0;
+
+    // Then the least recently used results, down to three quarters of the budget so that
+    // the next few additions do not each pay for a sort
+    std::vector<std::pair<uint64_t, std::map<std::wstring, CachedQuery>::iterator>> order;
+    order.reserve(_regexCache.size());
+    for (auto it = _regexCache.begin(); it != _regexCache.end(); ++it) {
+        if (&it->second != keep) order.emplace_back(it->second.lastUse, it);
+    }
+    std::sort(order.begin(), order.end(), [](const auto& a, const auto& b) { return a.first < b.first; });
+    size_t target = _cacheBudget / 4 * 3;
+    size_t shed = 0;
+    for (auto& [lastUse, it] : order) {
+        if (_regexCacheBytes <= target) break;
+        _regexCacheBytes -= GetCachedBytes(it->first, it->second);
+        _regexCache.erase(it);
+        shed++;
+    }
+    Debug::Log(L"Dictionary", (L"Shed " + std::to_wstring(shed) + L" cached results | Cache: " +
+                               std::to_wstring((_regexCacheBytes + _reverseCacheBytes) / 1024) + L"KB of " +
+                               std::to_wstring(_cacheBudget / 1024) + L"KB")
+                                  .c_str());
+}
+
+size_t CDictionaryData::GetCachedBytes(const std::wstring& pattern, const CachedQuery& query) {
+    // The map node (its value plus three links and a color) and the two heap blocks
+    return sizeof(std::pair<const std::wstring, CachedQuery>) + 4 * sizeof(void*) +
+           pattern.capacity() * sizeof(wchar_t) + query.ids.capacity() * sizeof(CharId);
+}
+
+void CDictionaryData::GetMemoryReport(CMemoryReport& report, const std::wstring& prefix) const {
+    report.Add(prefix + L"/entries", _entries.capacity() * sizeof(Entry) + _entryCharacters.GetMemoryUsage());
+    report.Add(prefix + L"/codes", _codeArena.GetMemoryUsage() + _packedCodes.GetMemoryUsage());
+    report.Add(prefix + L"/characters", _characters.GetMemoryUsage());
+    report.Add(prefix + L"/trie", _trie.GetMemoryUsage(), _trie.GetMappedSize());
+    report.Add(prefix + L"/prefixTable", _prefixTable.GetMemoryUsage(), _prefixTable.GetMappedSize());
+    report.Add(prefix + L"/positionIndex", _positionIndex.GetMemoryUsage());
+    report.Add(prefix + L"/suffixOrder", _suffixOrder.GetMemoryUsage());
+
+    std::lock_guard<std::mutex> lock(_cacheMutex);
+    report.Add(prefix + L"/queryCache", _regexCacheBytes, _warmCache.GetMappedSize());
+    report.Add(prefix + L"/reverseCache", _reverseCacheBytes);
+}
+
+bool CDictionaryData::LoadQueryCache(const std::wstring& path) {
+    if (_dataHash == 0) return false;
+    return _warmCache.Load(path, _dataHash, _characters.GetCount());
+}
+
+bool CDictionaryData::SaveQueryCache(const std::wstring& path) const {
+    if (_dataHash == 0) return false;
+
+    std::map<std::wstring, CQueryCacheFile::Query> queries;
+    {
+        std::lock_guard<std::mutex> lock(_cacheMutex);
+        for (auto& [pattern, cached] : _regexCache) {
+            if (cached.hits == 0) continue;
+            queries.emplace(pattern, CQueryCacheFile::Query{pattern, cached.ids, cached.hits});
+            cached.hits = 0;
+        }
+    }
+    // Nothing used since the last save, so nothing to add or to age
+    if (queries.empty()) return false;
+
+    // Merge into what is on disk now, which other processes may have saved since this
+    // data was loaded
+    CQueryCacheFile saved;
+    if (saved.Load(path, _dataHash, _characters.GetCount())) {
+        for (size_t i = 0; i < saved.GetQueryCount(); ++i) {
+            CQueryCacheFile::Query query = saved.Get(i);
+            query.hits /= 2;
+            auto [it, added] = queries.emplace(query.pattern, query);
+            if (!added) it->second.hits += query.hits;
+        }
+        saved.Close();
+    }
+
+    std::vector<CQueryCacheFile::Query> list;
+    list.reserve(queries.size());
+    for (auto& [pattern, query] : queries) list.push_back(std::move(query));
+    return CQueryCacheFile::Save(path, _dataHash, std::move(list));
+}
+
+std::vector<std::wstring> CDictionaryData::ToStrings(const std::vector<CharId>& ids) const {
+    std::vector<std::wstring> strings;
+    strings.reserve(ids.size());
+    for (CharId id : ids) strings.emplace_back(_characters.Get(id));
+    return strings;
+}
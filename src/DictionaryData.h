@@ -0,0 +1,242 @@
+#pragma once
+#include <atomic>
+#include <cstdint>
+#include <map>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "Arena.h"
+#include "CharacterTable.h"
+#include "LoudsTrie.h"
+#include "MemoryReport.h"
+#include "PackedArray.h"
+#include "PackedCodes.h"
+#include "PositionIndex.h"
+#include "PrefixTable.h"
+#include "QueryCacheFile.h"
+#include "UserDictionary.h"
+
+class CDictionaryShards;
+class CPatternBatch;
+class CScanPool;
+
+// One immutable, fully indexed load of strokeData.txt. CDictionary publishes these as
+// snapshots; only the query caches change after LoadFromFile, and they are locked.
+class CDictionaryData {
+   public:
+    CDictionaryData();
+    ~CDictionaryData();
+
+    CDictionaryData(const CDictionaryData&) = delete;
+    CDictionaryData& operator=(const CDictionaryData&) = delete;
+
+    // Exact lookup for a full code
+    std::vector<std::wstring> Lookup(const std::wstring& code) const;
+
+    // Regex lookup with wildcard '＊' interpreted as '.' (anchored at start); a pattern
+    // holding '～' (any run of strokes) must match the whole code
+    std::vector<std::wstring> LookupRegex(const std::wstring& pattern, bool* fromPrefetch = nullptr) const;
+
+    // Same as LookupRegex, but returns interned character IDs (see GetCharacter).
+    // fromPrefetch, if given, is set when the result was cached by PrefetchRegex.
+    std::vector<CharId> LookupRegexIds(const std::wstring& pattern, bool* fromPrefetch = nullptr) const;
+
+    // LookupRegexIds for many patterns, one result list per pattern. Patterns that would
+    // each scan every entry share one pass over the codes (see CPatternBatch); the ones
+    // the indexes answer are looked up on their own.
+    std::vector<std::vector<CharId>> LookupRegexBatchIds(const std::vector<std::wstring>& patterns) const;
+
+    // Run a LookupRegexIds scan ahead of time and cache the result. Gives up as soon as
+    // generation no longer equals expected. Returns true if a result was added to the
+    // cache; cached patterns and patterns the prefix table answers are skipped.
+    bool PrefetchRegex(const std::wstring& pattern, const std::atomic<uint64_t>& generation, uint64_t expected) const;
+
+    std::wstring_view GetCharacter(CharId id) const { return _characters.Get(id); }
+    std::vector<std::wstring> ToStrings(const std::vector<CharId>& ids) const;
+
+    // First page of LookupRegexIds plus the total match count, answered from the
+    // prefix table. Returns false if the pattern is too long for the table.
+    bool LookupFirstPage(const std::wstring& pattern, std::vector<CharId>& page, size_t& total) const;
+
+    // The k best-ranked characters whose codes start with pattern, as LookupRegexIds
+    // would list them first. With exactLengthFirst, codes exactly as long as the
+    // pattern rank ahead of longer ones. A cached full result is reused when it has
+    // the right order (fromPrefetch as in LookupRegexIds). Scans over every entry stop
+    // early, with what they found so far, once generation no longer equals expected.
+    std::vector<CharId> LookupTopKIds(const std::wstring& pattern, size_t k, bool exactLengthFirst,
+                                      bool* fromPrefetch = nullptr, const std::atomic<uint64_t>* generation = nullptr,
+                                      uint64_t expected = 0) const;
+
+    // Up to k characters LookupRegexIds misses but would list if pattern had up to
+    // maxEdits stroke mistakes (see CLoudsTrie::FuzzyTopK), fewest edits first. maxEdits
+    // is capped so that more than half of the pattern stays intact.
+    std::vector<CharId> LookupFuzzyIds(const std::wstring& pattern, uint32_t maxEdits, size_t k) const;
+
+    // Reverse lookup: all stroke codes for a character, best rank first
+    std::vector<std::wstring> GetCodesForCharacter(const std::wstring& character) const;
+
+    // Rank of the character's best entry (LookupRegex lists better ranks first),
+    // SIZE_MAX for characters not in the dictionary
+    size_t GetBestRank(std::wstring_view character) const;
+
+    CharId FindCharacter(std::wstring_view character) const { return _characters.Find(character); }
+    // The character's entries as (rank, code), best rank first
+    void GetEntries(CharId id, std::vector<std::pair<uint32_t, std::wstring>>& entries) const {
+        _trie.FindEntries(id, entries);
+    }
+
+    // Every character's codes at once, best rank first: character id's codes are
+    // codes[offsets[id]] up to codes[offsets[id + 1]]. The views live as long as the data
+    // and storage, which holds the codes written out when they are packed.
+    void GetReverseTable(std::vector<uint32_t>& offsets, std::vector<std::wstring_view>& codes,
+                         std::wstring& storage) const;
+    size_t GetCharacterCount() const { return _characters.GetCount(); }
+
+    // Load dictionary from file (UTF-8 format: code<tab>character[<tab>frequency] per
+    // line). Matches are ranked by frequency when the column is present, by file order
+    // otherwise.
+    bool LoadFromFile(const std::wstring& path);
+    // The frequency column's value (leading digits, saturating), 0 if there are none
+    static uint32_t ParseFrequency(std::wstring_view text);
+
+    // Build from base's entries with the user's entries folded in: the user's placed
+    // entries go just ahead of base's entry of the same rank, and base entries the user
+    // added, moved or removed are left out. A null user copies base.
+    bool LoadMerged(const CDictionaryData& base, const CUserDictionary::CEntries* user);
+    // Build from one shard of a compiled shard file, or from all of them (ALL) into the
+    // same data LoadFromFile gives; see CDictionaryShards
+    bool LoadFromShards(const CDictionaryShards& shards, size_t shard);
+    // Version of the user entries folded in by LoadMerged, 0 for none
+    uint64_t GetUserVersion() const { return _userVersion; }
+
+    size_t GetEntryCount() const { return _trie.GetCodeCount(); }
+
+    // Share full-list ～ scans over this pool's threads (null scans on the calling
+    // thread). The pool must outlive the data; set it before lookups start.
+    void SetScanPool(CScanPool* pool) { _scanPool = pool; }
+
+    // Forget cached LookupRegexIds results, so k6tool bench times the matching itself
+    void ClearQueryCache();
+
+    // Keep this data within about bytes of heap, 0 for no limit: the character table
+    // is compacted, the codes are packed (see CPackedCodes), the optional indexes
+    // (prefix table, position index, suffix order, in that order) are kept only while
+    // they fit, and the query caches get what is left, at least MIN_CACHE_BUDGET,
+    // shedding their least recently used results. Lookups fall back to scans where an
+    // index is missing. A budget too small for even that is logged. Call before loading.
+    void SetMemoryBudget(size_t bytes) { _memoryBudget = bytes; }
+    static constexpr size_t MIN_CACHE_BUDGET = 256 * 1024;
+    // Heap and mapped bytes of every structure and cache, named prefix/structure
+    void GetMemoryReport(CMemoryReport& report, const std::wstring& prefix) const;
+
+    // Answer queries missing from the cache from results an earlier process saved for
+    // this data (see CQueryCacheFile); ignored if saved for other data. Call before
+    // lookups start.
+    bool LoadQueryCache(const std::wstring& path);
+    // Merge the results used since the last save into the file at path: hits there
+    // count half, hits since add on, and the most hit results are kept
+    bool SaveQueryCache(const std::wstring& path) const;
+
+    // Build a prefix table for this data and write it to disk (used by k6tool)
+    bool CompilePrefixTable(const std::wstring& path, uint32_t maxLength) const;
+    // Write the code trie to disk (used by k6tool)
+    bool CompileTrie(const std::wstring& path) const { return _trie.Save(path); }
+    // Write the entries split by first stroke to disk (used by k6tool)
+    bool CompileShards(const std::wstring& path) const;
+
+   private:
+    struct Entry {
+        std::wstring_view code;
+        CharId character;
+    };
+
+    CCharacterTable _characters;
+    // The codes stay beside the trie: the ～ scans and the suffix order read every code,
+    // and rebuilding all 60.7k codes from the trie takes ~55 ms (0.9 us each) against
+    // ~2.5 ms for the slowest ～ scan over the plain text. Under a memory budget they
+    // are packed instead, and the plain store is dropped once the indexes are built.
+    CArena<wchar_t> _codeArena;
+    std::vector<Entry> _entries;       // rank order (file order unless frequencies are given)
+    CPackedCodes _packedCodes;         // the same codes under a budget, see _packed
+    CPackedArray _entryCharacters;     // and their characters
+    bool _packed = false;              // entries read from _packedCodes, not _entries
+    uint64_t _dataHash = 0;       // hash of the source file (and folded user entries), for saved files
+    uint64_t _userVersion = 0;    // see GetUserVersion
+    CLoudsTrie _trie;             // exact and reverse lookups
+    CPackedArray _suffixOrder;    // entry indexes sorted by reversed code, for patterns anchored at the end
+    CPrefixTable _prefixTable;
+    CPositionIndex _positionIndex;
+    CScanPool* _scanPool = nullptr;
+    size_t _memoryBudget = 0;
+    size_t _cacheBudget = SIZE_MAX;  // for both caches together, see SetMemoryBudget
+
+    struct CachedQuery {
+        std::vector<CharId> ids;
+        bool prefetched;    // filled by PrefetchRegex rather than by a lookup
+        uint32_t hits = 0;  // lookups answered since the last SaveQueryCache
+        uint64_t lastUse = 0;
+    };
+
+    mutable std::mutex _cacheMutex;
+    mutable std::map<std::wstring, CachedQuery> _regexCache;
+    mutable std::map<CharId, std::vector<std::wstring>> _reverseCache;
+    mutable size_t _regexCacheBytes = 0;
+    mutable size_t _reverseCacheBytes = 0;
+    mutable uint64_t _cacheClock = 0;
+    CQueryCacheFile _warmCache;  // see LoadQueryCache
+
+    // The cached result for pattern, taken over from _warmCache on first use; null if
+    // neither has it. Marks it used. Caller holds _cacheMutex.
+    CachedQuery* FindCached(const std::wstring& pattern) const;
+    // Caches a result (unless pattern already has one) and sheds older results past
+    // the budget. Caller holds _cacheMutex.
+    CachedQuery* AddCached(const std::wstring& pattern, CachedQuery query) const;
+    void ShedCache(const CachedQuery* keep) const;
+    static size_t GetCachedBytes(const std::wstring& pattern, const CachedQuery& query);
+    // Prefix table, position index and suffix order: all of them, or under a budget
+    // those that fit. The trie must be in place; prefixTablePath names a compiled table.
+    void BuildOptionalIndexes(const std::wstring* prefixTablePath);
+    // The entries the position index would give for pattern, by a scan over them
+    void ScanPrefix(std::wstring_view pattern, std::vector<uint32_t>& entries) const;
+
+    // Matching behind LookupRegexIds: the position index for stroke/wildcard patterns,
+    // a linear scan otherwise. scanned receives the number of entries examined.
+    // Returns false if cancelled through generation.
+    bool MatchRegex(const std::wstring& pattern, std::vector<CharId>& out, size_t& scanned,
+                    const std::atomic<uint64_t>* generation, uint64_t expected) const;
+    // Characters whose whole code matches a pattern holding ～, in rank order, stopping
+    // at k; full lists of many entries are split across _scanPool. Returns false if
+    // cancelled through generation.
+    bool MatchAnyStrokes(const std::wstring& pattern, size_t k, std::vector<CharId>& out,
+                         const std::atomic<uint64_t>* generation, uint64_t expected) const;
+    // Full lists of all of batch's patterns in one scan (split across _scanPool when it
+    // is worth it), outs[i] receiving pattern i's characters in rank order
+    void MatchBatch(const CPatternBatch& batch, std::vector<std::vector<CharId>>& outs) const;
+    // Patterns of the form head～tail (one ～, non-empty tail) through _suffixOrder and
+    // the position index: whichever end has more literal strokes finds the entries, and
+    // the other end filters them. Returns false for other patterns, and for first pages
+    // that a rank-order scan finds sooner.
+    bool MatchSuffix(const std::wstring& pattern, size_t k, std::vector<CharId>& out) const;
+    void AddEntry(std::wstring_view code, std::wstring_view character);
+    // Entries in the plain or the packed store, one per rank
+    size_t CountEntries() const { return _packed ? _entryCharacters.GetSize() : _entries.size(); }
+    // The entry's code: a view into the plain store, or written out into buffer from
+    // the packed one, where matching only its first maxLength strokes writes out no more
+    std::wstring_view GetCode(size_t e, std::wstring& buffer, size_t maxLength = SIZE_MAX) const {
+        return _packed ? _packedCodes.Get(e, buffer, maxLength) : _entries[e].code;
+    }
+    size_t GetCodeLength(size_t e) const { return _packed ? _packedCodes.GetLength(e) : _entries[e].code.size(); }
+    CharId GetEntryCharacter(size_t e) const { return _packed ? _entryCharacters.Get(e) : _entries[e].character; }
+    // Every entry's code in rank order, packed ones written out into storage
+    void GetCodes(std::vector<std::wstring_view>& codes, std::wstring& storage) const;
+    // Swaps the plain store for packed codes, which must be built
+    void DropPlainCodes();
+    void BuildPositionIndex();
+    void BuildTrie();
+    // 1 + the stroke index depth strokes before the end of the entry's code, 0 past its start
+    int GetStrokeFromEnd(uint32_t e, size_t depth) const;
+    void BuildSuffixOrder();
+    void BuildPrefixTable(CPrefixTable& table, uint32_t maxLength) const;
+};
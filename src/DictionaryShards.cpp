@@ -0,0 +1,333 @@
+#include "DictionaryShards.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+
+#include "DataFile.h"
+#include "Debug.h"
+
+static constexpr char SHARDS_MAGIC[4] = {'K', '6', 'S', 'H'};
+static constexpr uint32_t SHARDS_VERSION = 1;
+
+// Shard of a code: its first stroke, or the last shard for anything else
+static size_t ShardOf(std::wstring_view code) {
+    int stroke = code.empty() ? Stroke::INVALID_INDEX : Stroke::ToIndex(code[0]);
+    return stroke >= 0 && stroke < Stroke::COUNT ? static_cast<size_t>(stroke) : CDictionaryShards::COUNT - 1;
+}
+
+// The codes the trie keeps, and so the ones reverse lookups report
+static bool IsStrokeCode(std::wstring_view code) {
+    for (wchar_t ch : code) {
+        int symbol = Stroke::ToIndex(ch);
+        if (symbol < 0 || symbol >= Stroke::COUNT) return false;
+    }
+    return true;
+}
+
+CDictionaryShards::CDictionaryShards()
+    : _header{},
+      _shards(nullptr),
+      _entries(nullptr),
+      _characterOffsets(nullptr),
+      _sortedCharacters(nullptr),
+      _reverseStarts(nullptr),
+      _reverseEntries(nullptr),
+      _pool(nullptr) {
+}
+
+CDictionaryShards::~CDictionaryShards() {
+}
+
+bool CDictionaryShards::Save(const std::wstring& path, uint64_t dataHash, const std::vector<std::wstring_view>& codes,
+                             const std::vector<CharId>& values, const std::vector<std::wstring_view>& characters) {
+    // Entries grouped by shard, rank order within each; a counting sort by shard
+    std::vector<Shard> shards(COUNT, Shard{0, 0});
+    for (std::wstring_view code : codes) shards[ShardOf(code)].entryCount++;
+    for (size_t s = 1; s < COUNT; ++s) shards[s].firstEntry = shards[s - 1].firstEntry + shards[s - 1].entryCount;
+    std::vector<uint32_t> byPosition(codes.size());
+    {
+        std::vector<uint32_t> fill(COUNT);
+        for (size_t s = 0; s < COUNT; ++s) fill[s] = shards[s].firstEntry;
+        for (uint32_t rank = 0; rank < codes.size(); ++rank) byPosition[fill[ShardOf(codes[rank])]++] = rank;
+    }
+
+    // Codes in entry order, so decoding a shard reads one stretch of the pool
+    std::vector<wchar_t> pool;
+    std::vector<Entry> entries(codes.size());
+    std::vector<uint32_t> positionOf(codes.size());
+    for (uint32_t i = 0; i < byPosition.size(); ++i) {
+        uint32_t rank = byPosition[i];
+        entries[i] = {rank, static_cast<uint32_t>(pool.size()), static_cast<uint32_t>(codes[rank].size()), values[rank]};
+        positionOf[rank] = i;
+        pool.insert(pool.end(), codes[rank].begin(), codes[rank].end());
+    }
+    std::vector<uint32_t> characterOffsets;
+    characterOffsets.reserve(characters.size() + 1);
+    for (std::wstring_view character : characters) {
+        characterOffsets.push_back(static_cast<uint32_t>(pool.size()));
+        pool.insert(pool.end(), character.begin(), character.end());
+    }
+    characterOffsets.push_back(static_cast<uint32_t>(pool.size()));
+
+    std::vector<CharId> sortedCharacters(characters.size());
+    for (CharId id = 0; id < sortedCharacters.size(); ++id) sortedCharacters[id] = id;
+    std::sort(sortedCharacters.begin(), sortedCharacters.end(),
+              [&characters](CharId a, CharId b) { return characters[a] < characters[b]; });
+
+    // Each character's stroke codes in rank order (a counting sort by character), and
+    // the distinct stroke codes as the trie counts them
+    std::vector<uint32_t> reverseStarts(characters.size() + 1, 0);
+    std::vector<std::wstring_view> strokeCodes;
+    for (uint32_t rank = 0; rank < codes.size(); ++rank) {
+        if (!IsStrokeCode(codes[rank])) continue;
+        reverseStarts[values[rank] + 1]++;
+        strokeCodes.push_back(codes[rank]);
+    }
+    for (size_t c = 0; c < characters.size(); ++c) reverseStarts[c + 1] += reverseStarts[c];
+    std::vector<uint32_t> reverseEntries(strokeCodes.size());
+    {
+        std::vector<uint32_t> fill(reverseStarts.begin(), reverseStarts.end() - 1);
+        for (uint32_t rank = 0; rank < codes.size(); ++rank) {
+            if (IsStrokeCode(codes[rank])) reverseEntries[fill[values[rank]]++] = positionOf[rank];
+        }
+    }
+    std::sort(strokeCodes.begin(), strokeCodes.end());
+    size_t codeCount = std::unique(strokeCodes.begin(), strokeCodes.end()) - strokeCodes.begin();
+
+    Header header = {};
+    std::memcpy(header.magic, SHARDS_MAGIC, sizeof(header.magic));
+    header.version = SHARDS_VERSION;
+    header.dataHash = dataHash;
+    header.entryCount = static_cast<uint32_t>(entries.size());
+    header.codeCount = static_cast<uint32_t>(codeCount);
+    header.characterCount = static_cast<uint32_t>(characters.size());
+    header.reverseCount = static_cast<uint32_t>(reverseEntries.size());
+    header.unitCount = static_cast<uint32_t>(pool.size());
+    header.unitSize = sizeof(wchar_t);
+
+    std::ofstream file(std::filesystem::path(path), std::ios::binary | std::ios::trunc);
+    if (!file.is_open()) return false;
+    auto write = [&file](const auto& items) {
+        file.write(reinterpret_cast<const char*>(items.data()),
+                   static_cast<std::streamsize>(items.size() * sizeof(items[0])));
+    };
+    file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+    write(shards);
+    write(entries);
+    write(characterOffsets);
+    write(sortedCharacters);
+    write(reverseStarts);
+    write(reverseEntries);
+    write(pool);
+    return file.good();
+}
+
+bool CDictionaryShards::Load(const std::wstring& dictionaryPath) {
+    auto start = std::chrono::high_resolution_clock::now();
+
+    // Hashing the source costs a read of it, but no parsing
+    uint64_t dataHash;
+    if (!CDataFile::HashFile(dictionaryPath, dataHash)) return false;
+    std::wstring path = GetPathForDictionary(dictionaryPath);
+    if (!_file.Open(path)) return false;
+
+    Header header;
+    if (_file.GetSize() < sizeof(header)) {
+        _file.Close();
+        return false;
+    }
+    std::memcpy(&header, _file.GetData(), sizeof(header));
+
+    size_t characterCount = header.characterCount;
+    size_t expectedSize = sizeof(header) + COUNT * sizeof(Shard) + static_cast<size_t>(header.entryCount) * sizeof(Entry) +
+                          (characterCount + 1) * sizeof(uint32_t) + characterCount * sizeof(CharId) +
+                          (characterCount + 1) * sizeof(uint32_t) +
+                          static_cast<size_t>(header.reverseCount) * sizeof(uint32_t) +
+                          static_cast<size_t>(header.unitCount) * sizeof(wchar_t);
+    bool valid = std::memcmp(header.magic, SHARDS_MAGIC, sizeof(header.magic)) == 0 &&
+                 header.version == SHARDS_VERSION && header.dataHash == dataHash && header.unitSize == sizeof(wchar_t) &&
+                 header.entryCount > 0 && _file.GetSize() == expectedSize;
+    if (valid) {
+        const char* data = _file.GetData() + sizeof(header);
+        _shards = reinterpret_cast<const Shard*>(data);
+        _entries = reinterpret_cast<const Entry*>(_shards + COUNT);
+        _characterOffsets = reinterpret_cast<const uint32_t*>(_entries + header.entryCount);
+        _sortedCharacters = reinterpret_cast<const CharId*>(_characterOffsets + characterCount + 1);
+        _reverseStarts = reinterpret_cast<const uint32_t*>(_sortedCharacters + characterCount);
+        _reverseEntries = _reverseStarts + characterCount + 1;
+        _pool = reinterpret_cast<const wchar_t*>(_reverseEntries + header.reverseCount);
+
+        // Only the small tables are checked here; entries are checked as their shard is
+        // decoded (see GetEntries), so loading never touches the pages of the shards
+        uint32_t next = 0;
+        for (size_t s = 0; valid && s < COUNT; ++s) {
+            valid = _shards[s].firstEntry == next && _shards[s].entryCount <= header.entryCount - next;
+            next += valid ? _shards[s].entryCount : 0;
+        }
+        valid = valid && next == header.entryCount && _characterOffsets[characterCount] <= header.unitCount &&
+                _reverseStarts[characterCount] == header.reverseCount;
+        for (size_t c = 0; valid && c < characterCount; ++c) {
+            valid = _characterOffsets[c] <= _characterOffsets[c + 1] && _reverseStarts[c] <= _reverseStarts[c + 1] &&
+                    _sortedCharacters[c] < characterCount;
+        }
+        for (size_t i = 0; valid && i < header.reverseCount; ++i) valid = _reverseEntries[i] < header.entryCount;
+    }
+    if (!valid) {
+        Debug::Log(L"DictionaryShards", (L"Ignoring stale or invalid shards: " + path).c_str());
+        _file.Close();
+        _shards = nullptr;
+        return false;
+    }
+    _header = header;
+    _dictionaryPath = dictionaryPath;
+
+    auto end = std::chrono::high_resolution_clock::now();
+    auto duration = std::chrono::duration_cast<std::chrono::microseconds>(end - start).count();
+    Debug::Log(L"DictionaryShards", (L"Loaded " + path + L" | Entries: " + std::to_wstring(header.entryCount) +
+                                     L" | Time: " + std::to_wstring(duration / 1000) + L"." + std::to_wstring(duration % 1000) + L"ms")
+                                        .c_str());
+    return true;
+}
+
+size_t CDictionaryShards::GetShard(std::wstring_view pattern) {
+    if (pattern.empty()) return ALL;
+    int stroke = Stroke::ToIndex(pattern[0]);
+    return stroke >= 0 && stroke < Stroke::COUNT ? static_cast<size_t>(stroke) : ALL;
+}
+
+CSnapshotPtr<CDictionaryData>::ReadGuard CDictionaryShards::Get(size_t shard) const {
+    {
+        auto decoded = _decoded[shard].Read();
+        if (decoded) return decoded;
+    }
+
+    std::lock_guard<std::mutex> lock(_decodeMutex);
+    {
+        auto decoded = _decoded[shard].Read();
+        if (decoded) return decoded;
+    }
+    auto start = std::chrono::high_resolution_clock::now();
+    auto data = std::make_unique<CDictionaryData>();
+    data->SetScanPool(_scanPool);
+    data->SetMemoryBudget(_memoryBudget / COUNT);
+    data->LoadFromShards(*this, shard);
+    size_t entries = _shards[shard].entryCount;
+    _decoded[shard].Publish(std::move(data));
+
+    auto end = std::chrono::high_resolution_clock::now();
+    auto duration = std::chrono::duration_cast<std::chrono::microseconds>(end - start).count();
+    Debug::Log(L"DictionaryShards", (L"Decoded shard " + std::to_wstring(shard) + L" | Entries: " + std::to_wstring(entries) +
+                                     L" | Time: " + std::to_wstring(duration / 1000) + L"." + std::to_wstring(duration % 1000) + L"ms")
+                                        .c_str());
+    return _decoded[shard].Read();
+}
+
+void CDictionaryShards::GetEntries(size_t shard, std::vector<std::wstring_view>& codes,
+                                   std::vector<std::wstring_view>& characters) const {
+    size_t first = shard == ALL ? 0 : _shards[shard].firstEntry;
+    size_t count = shard == ALL ? _header.entryCount : _shards[shard].entryCount;
+    codes.assign(count, std::wstring_view());
+    characters.assign(count, std::wstring_view());
+    for (size_t i = first; i < first + count; ++i) {
+        const Entry& entry = _entries[i];
+        // A damaged entry is dropped rather than read out of bounds
+        size_t slot = shard == ALL ? entry.rank : i - first;
+        if (slot >= count || entry.character >= _header.characterCount ||
+            entry.codeOffset > _header.unitCount || entry.codeLength > _header.unitCount - entry.codeOffset) {
+            continue;
+        }
+        codes[slot] = GetText(entry.codeOffset, entry.codeLength);
+        characters[slot] = GetCharacter(entry.character);
+    }
+    // Slots left empty by damaged entries (a code read from the pool is never null)
+    size_t kept = 0;
+    for (size_t i = 0; i < count; ++i) {
+        if (!codes[i].data()) continue;
+        codes[kept] = codes[i];
+        characters[kept++] = characters[i];
+    }
+    codes.resize(kept);
+    characters.resize(kept);
+}
+
+std::wstring_view CDictionaryShards::GetCharacter(CharId id) const {
+    return GetText(_characterOffsets[id], _characterOffsets[id + 1] - _characterOffsets[id]);
+}
+
+CharId CDictionaryShards::FindCharacter(std::wstring_view character) const {
+    const CharId* end = _sortedCharacters + _header.characterCount;
+    const CharId* it = std::lower_bound(_sortedCharacters, end, character,
+                                        [this](CharId id, std::wstring_view text) { return GetCharacter(id) < text; });
+    return it != end && GetCharacter(*it) == character ? *it : INVALID_CHAR_ID;
+}
+
+std::vector<std::wstring> CDictionaryShards::GetCodesForCharacter(std::wstring_view character) const {
+    std::vector<std::wstring> codes;
+    CharId id = FindCharacter(character);
+    if (id == INVALID_CHAR_ID) return codes;
+    // Listed best rank first, as the trie gives them; a repeated code keeps its first place
+    for (uint32_t k = _reverseStarts[id]; k < _reverseStarts[id + 1]; ++k) {
+        const Entry& entry = _entries[_reverseEntries[k]];
+        if (entry.codeOffset > _header.unitCount || entry.codeLength > _header.unitCount - entry.codeOffset) continue;
+        std::wstring_view code = GetText(entry.codeOffset, entry.codeLength);
+        if (std::find(codes.begin(), codes.end(), code) == codes.end()) codes.emplace_back(code);
+    }
+    return codes;
+}
+
+size_t CDictionaryShards::GetBestRank(std::wstring_view character) const {
+    CharId id = FindCharacter(character);
+    if (id == INVALID_CHAR_ID || _reverseStarts[id] == _reverseStarts[id + 1]) return SIZE_MAX;
+    // Listed best rank first
+    return _entries[_reverseEntries[_reverseStarts[id]]].rank;
+}
+
+bool CDictionaryShards::LookupFuzzy(const std::wstring& pattern, uint32_t maxEdits, size_t k,
+                                    std::vector<std::wstring>& out) const {
+    std::call_once(_trieOnce, [this]() {
+        auto start = std::chrono::high_resolution_clock::now();
+        _trieLoaded = _trie.Load(CLoudsTrie::GetPathForDictionary(_dictionaryPath), _header.dataHash);
+
+        auto end = std::chrono::high_resolution_clock::now();
+        auto duration = std::chrono::duration_cast<std::chrono::microseconds>(end - start).count();
+        Debug::Log(L"DictionaryShards", (std::wstring(_trieLoaded ? L"Mapped" : L"No") + L" trie for near misses" +
+                                         L" | Time: " + std::to_wstring(duration / 1000) + L"." + std::to_wstring(duration % 1000) + L"ms")
+                                            .c_str());
+    });
+    if (!_trieLoaded) return false;
+
+    auto start = std::chrono::high_resolution_clock::now();
+    out.clear();
+    if (pattern.empty()) return true;
+    // The trie holds the CharIds LoadFromFile gives, which are this file's
+    std::vector<CharId> ids;
+    _trie.FuzzyTopK(pattern, maxEdits, k, ids);
+    for (CharId id : ids) {
+        if (id < _header.characterCount) out.emplace_back(GetCharacter(id));
+    }
+
+    auto end = std::chrono::high_resolution_clock::now();
+    auto duration = std::chrono::duration_cast<std::chrono::microseconds>(end - start).count();
+    Debug::Log(L"DictionaryShards", (L"LookupFuzzy pattern: " + pattern +
+                                     L" | Edits: " + std::to_wstring(CLoudsTrie::GetMaxEdits(pattern.size(), maxEdits)) +
+                                     L" | Results: " + std::to_wstring(out.size()) +
+                                     L" | Time: " + std::to_wstring(duration / 1000) + L"." + std::to_wstring(duration % 1000) + L"ms")
+                                        .c_str());
+    return true;
+}
+
+void CDictionaryShards::GetMemoryReport(CMemoryReport& report, const std::wstring& prefix) const {
+    report.Add(prefix + L"/shards", 0, _file.GetSize());
+    if (_trieLoaded.load()) report.Add(prefix + L"/shards.trie", _trie.GetMemoryUsage(), _trie.GetMappedSize());
+    for (size_t s = 0; s < COUNT; ++s) {
+        auto decoded = _decoded[s].Read();
+        if (decoded) decoded->GetMemoryReport(report, prefix + L".shard" + std::to_wstring(s));
+    }
+}
+
+std::wstring CDictionaryShards::GetPathForDictionary(const std::wstring& dictionaryPath) {
+    return CDataFile::GetSidePath(dictionaryPath, L".shards");
+}
@@ -0,0 +1,131 @@
+#pragma once
+#include <atomic>
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "CharacterTable.h"
+#include "DictionaryData.h"
+#include "LoudsTrie.h"
+#include "MappedFile.h"
+#include "MemoryReport.h"
+#include "Snapshot.h"
+#include "Stroke.h"
+
+// The dictionary split by first stroke in a compiled side file (strokeData.shards): a
+// small header, the entries grouped into one shard per first stroke (and one for codes
+// starting with anything else), each character's text, and a reverse section listing
+// every character's entries. The file is memory-mapped; a shard is decoded into a
+// CDictionaryData of its own on the first lookup that needs it, so a process that types
+// a few characters never reads or indexes the rest. Reverse lookups read the mapped
+// file directly, and near-miss lookups the compiled trie of the whole dictionary. A
+// shard's CharIds and ranks are its own; ALL decodes the whole dictionary with the ids
+// and ranks LoadFromFile gives.
+class CDictionaryShards {
+   public:
+    static constexpr size_t COUNT = Stroke::COUNT + 1;
+    static constexpr size_t ALL = SIZE_MAX;
+
+    CDictionaryShards();
+    ~CDictionaryShards();
+
+    CDictionaryShards(const CDictionaryShards&) = delete;
+    CDictionaryShards& operator=(const CDictionaryShards&) = delete;
+
+    // codes/values are the dictionary entries in rank order and characters[id] the text
+    // of CharId id
+    static bool Save(const std::wstring& path, uint64_t dataHash, const std::vector<std::wstring_view>& codes,
+                     const std::vector<CharId>& values, const std::vector<std::wstring_view>& characters);
+
+    // Maps the file compiled for the dictionary at dictionaryPath; fails if it is
+    // missing, malformed or was built from different data
+    bool Load(const std::wstring& dictionaryPath);
+
+    // Applied to every shard decoded from now on (see CDictionaryData); call before lookups
+    void SetScanPool(CScanPool* pool) { _scanPool = pool; }
+    // Each decoded shard gets an equal part
+    void SetMemoryBudget(size_t bytes) { _memoryBudget = bytes; }
+
+    // The shard holding every code pattern can match: its first stroke's, ALL if it
+    // starts with ＊ or ～ (or is empty)
+    static size_t GetShard(std::wstring_view pattern);
+
+    // Shard i decoded, on the first call for it; safe to call from any thread
+    CSnapshotPtr<CDictionaryData>::ReadGuard Get(size_t shard) const;
+
+    // The entries of a shard (or ALL of them) in rank order, as code and character
+    void GetEntries(size_t shard, std::vector<std::wstring_view>& codes,
+                    std::vector<std::wstring_view>& characters) const;
+    size_t GetCharacterCount() const { return _header.characterCount; }
+    std::wstring_view GetCharacter(CharId id) const;
+
+    // As CDictionaryData's, from the reverse section
+    std::vector<std::wstring> GetCodesForCharacter(std::wstring_view character) const;
+    size_t GetBestRank(std::wstring_view character) const;
+    size_t GetEntryCount() const { return _header.codeCount; }
+
+    // As CDictionaryData::LookupFuzzyIds, from the compiled trie (strokeData.trie) mapped
+    // on the first call, so no shard is decoded. False if the trie is missing or stale.
+    bool LookupFuzzy(const std::wstring& pattern, uint32_t maxEdits, size_t k, std::vector<std::wstring>& out) const;
+
+    uint64_t GetDataHash() const { return _header.dataHash; }
+    const std::wstring& GetDictionaryPath() const { return _dictionaryPath; }
+
+    // The mapped file under prefix/shards, and each decoded shard under prefix.shardN/
+    void GetMemoryReport(CMemoryReport& report, const std::wstring& prefix) const;
+
+    // Side-file name used next to the dictionary
+    static std::wstring GetPathForDictionary(const std::wstring& dictionaryPath);
+
+   private:
+    struct Header {
+        char magic[4];
+        uint32_t version;
+        uint64_t dataHash;
+        uint32_t entryCount;
+        uint32_t codeCount;       // distinct all-stroke codes, what GetEntryCount reports
+        uint32_t characterCount;
+        uint32_t reverseCount;    // entries in the reverse section (all-stroke codes only)
+        uint32_t unitCount;       // wchar_t units in the text pool
+        uint32_t unitSize;        // sizeof(wchar_t) where it was written; the pool is read in place
+    };
+
+    struct Shard {
+        uint32_t firstEntry;
+        uint32_t entryCount;
+    };
+
+    struct Entry {
+        uint32_t rank;  // in the whole dictionary
+        uint32_t codeOffset;
+        uint32_t codeLength;
+        CharId character;
+    };
+
+    std::wstring_view GetText(uint32_t offset, uint32_t length) const {
+        return std::wstring_view(_pool + offset, length);
+    }
+    // The character's id, by binary search over _sortedCharacters
+    CharId FindCharacter(std::wstring_view character) const;
+
+    Header _header;
+    const Shard* _shards;
+    const Entry* _entries;              // grouped by shard, rank order within each
+    const uint32_t* _characterOffsets;  // characterCount + 1, into the pool
+    const CharId* _sortedCharacters;    // ids ordered by text
+    const uint32_t* _reverseStarts;     // characterCount + 1, into _reverseEntries
+    const uint32_t* _reverseEntries;    // entry indexes per character, best rank first
+    const wchar_t* _pool;               // codes grouped by shard, then the characters
+    std::wstring _dictionaryPath;
+    CMappedFile _file;
+
+    CScanPool* _scanPool = nullptr;
+    size_t _memoryBudget = 0;
+    mutable std::mutex _decodeMutex;
+    mutable CSnapshotPtr<CDictionaryData> _decoded[COUNT];
+    mutable std::once_flag _trieOnce;
+    mutable CLoudsTrie _trie;  // mapped by the first LookupFuzzy, read-only after
+    mutable std::atomic<bool> _trieLoaded{false};
+};
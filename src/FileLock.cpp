@@ -0,0 +1,78 @@
+#include "FileLock.h"
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/file.h>
+#include <unistd.h>
+
+#include <filesystem>
+#endif
+
+#ifdef _WIN32
+
+CFileLock::CFileLock() : _file(INVALID_HANDLE_VALUE) {
+}
+
+bool CFileLock::Open(const std::wstring& path) {
+    Close();
+    _file = CreateFileW(path.c_str(), GENERIC_READ | GENERIC_WRITE, FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE,
+                        nullptr, OPEN_ALWAYS, FILE_ATTRIBUTE_NORMAL, nullptr);
+    return _file != INVALID_HANDLE_VALUE;
+}
+
+void CFileLock::Close() {
+    if (_file != INVALID_HANDLE_VALUE) CloseHandle(_file);
+    _file = INVALID_HANDLE_VALUE;
+}
+
+void CFileLock::lock() {
+    _mutex.lock();
+    if (_file == INVALID_HANDLE_VALUE) return;
+    OVERLAPPED overlapped = {};
+    LockFileEx(_file, LOCKFILE_EXCLUSIVE_LOCK, 0, 1, 0, &overlapped);
+}
+
+void CFileLock::unlock() {
+    if (_file != INVALID_HANDLE_VALUE) {
+        OVERLAPPED overlapped = {};
+        UnlockFileEx(_file, 0, 1, 0, &overlapped);
+    }
+    _mutex.unlock();
+}
+
+#else
+
+CFileLock::CFileLock() : _fd(-1) {
+}
+
+bool CFileLock::Open(const std::wstring& path) {
+    Close();
+    _fd = open(std::filesystem::path(path).c_str(), O_RDWR | O_CREAT | O_CLOEXEC, 0600);
+    return _fd >= 0;
+}
+
+void CFileLock::Close() {
+    if (_fd >= 0) close(_fd);
+    _fd = -1;
+}
+
+void CFileLock::lock() {
+    _mutex.lock();
+    if (_fd < 0) return;
+    while (flock(_fd, LOCK_EX) != 0 && errno == EINTR) {
+    }
+}
+
+void CFileLock::unlock() {
+    if (_fd >= 0) flock(_fd, LOCK_UN);
+    _mutex.unlock();
+}
+
+#endif
+
+CFileLock::~CFileLock() {
+    Close();
+}
@@ -0,0 +1,32 @@
+#pragma once
+#include <mutex>
+#include <string>
+
+// Exclusive lock shared between processes, held on a lock file next to the data it
+// guards (LockFileEx on Windows, flock elsewhere), and between the threads of this one:
+// both lock the file per handle, not per thread. Lowercase lock/unlock so
+// std::lock_guard can hold it; without the lock file only the threads are excluded.
+class CFileLock {
+   public:
+    CFileLock();
+    ~CFileLock();
+
+    CFileLock(const CFileLock&) = delete;
+    CFileLock& operator=(const CFileLock&) = delete;
+
+    // Opens (creating if missing) the lock file at path
+    bool Open(const std::wstring& path);
+    void Close();
+
+    // Waits for other threads and processes to let go of the lock
+    void lock();
+    void unlock();
+
+   private:
+    std::mutex _mutex;
+#ifdef _WIN32
+    void* _file;
+#else
+    int _fd;
+#endif
+};
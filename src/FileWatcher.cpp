@@ -0,0 +1,77 @@
+#include "FileWatcher.h"
+
+#include <filesystem>
+
+#include "Debug.h"
+
+CFileWatcher::CFileWatcher(std::chrono::milliseconds interval) : _interval(interval) {
+}
+
+CFileWatcher::~CFileWatcher() {
+    Stop();
+}
+
+void CFileWatcher::Watch(const std::wstring& path, std::function<void(const std::wstring&)> onChanged) {
+    WatchedFile file;
+    file.path = path;
+    file.onChanged = std::move(onChanged);
+    file.loaded = ReadStamp(path);
+    file.pending = file.loaded;
+    _files.push_back(std::move(file));
+}
+
+void CFileWatcher::Start() {
+    if (_thread.joinable()) return;
+    _stopping = false;
+    _thread = std::thread(&CFileWatcher::Run, this);
+}
+
+void CFileWatcher::Stop() {
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        _stopping = true;
+    }
+    _wake.notify_all();
+    if (_thread.joinable()) _thread.join();
+}
+
+CFileWatcher::Stamp CFileWatcher::ReadStamp(const std::wstring& path) {
+    Stamp stamp;
+    std::error_code ec;
+    std::filesystem::path fsPath(path);
+    auto time = std::filesystem::last_write_time(fsPath, ec);
+    if (ec) return stamp;
+    auto size = std::filesystem::file_size(fsPath, ec);
+    if (ec) return stamp;
+    stamp.time = static_cast<long long>(time.time_since_epoch().count());
+    stamp.size = static_cast<unsigned long long>(size);
+    stamp.exists = true;
+    return stamp;
+}
+
+void CFileWatcher::Run() {
+    std::unique_lock<std::mutex> lock(_mutex);
+    while (!_stopping) {
+        _wake.wait_for(lock, _interval, [this]() { return _stopping; });
+        if (_stopping) break;
+
+        lock.unlock();
+        for (auto& file : _files) {
+            Stamp current = ReadStamp(file.path);
+            if (current == file.loaded || !current.exists) {
+                file.pending = current;
+                continue;
+            }
+            if (current != file.pending) {
+                // Changed since the last poll: wait for it to settle
+                file.pending = current;
+                continue;
+            }
+
+            Debug::Log(L"FileWatcher", (L"Data file changed, reloading: " + file.path).c_str());
+            file.loaded = current;
+            file.onChanged(file.path);
+        }
+        lock.lock();
+    }
+}
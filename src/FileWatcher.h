@@ -0,0 +1,54 @@
+#pragma once
+#include <chrono>
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+// Polls a set of files on a background thread and invokes the callback (on that thread)
+// once a file has changed and then stayed unchanged for one poll, so half-written
+// files are not picked up.
+class CFileWatcher {
+   public:
+    explicit CFileWatcher(std::chrono::milliseconds interval = std::chrono::milliseconds(2000));
+    ~CFileWatcher();
+
+    CFileWatcher(const CFileWatcher&) = delete;
+    CFileWatcher& operator=(const CFileWatcher&) = delete;
+
+    // Register before Start()
+    void Watch(const std::wstring& path, std::function<void(const std::wstring&)> onChanged);
+
+    void Start();
+    void Stop();
+
+   private:
+    struct Stamp {
+        long long time = 0;
+        unsigned long long size = 0;
+        bool exists = false;
+        bool operator==(const Stamp& other) const {
+            return time == other.time && size == other.size && exists == other.exists;
+        }
+        bool operator!=(const Stamp& other) const { return !(*this == other); }
+    };
+
+    struct WatchedFile {
+        std::wstring path;
+        std::function<void(const std::wstring&)> onChanged;
+        Stamp loaded;   // what the current data was built from
+        Stamp pending;  // last observed change, waiting to settle
+    };
+
+    static Stamp ReadStamp(const std::wstring& path);
+    void Run();
+
+    std::chrono::milliseconds _interval;
+    std::vector<WatchedFile> _files;
+    std::thread _thread;
+    std::mutex _mutex;
+    std::condition_variable _wake;
+    bool _stopping = false;
+};
@@ -0,0 +1,456 @@
+#include "InputSession.h"
+
+#include <algorithm>
+
+#include "Debug.h"
+#include "Dictionary.h"
+#include "NgramModel.h"
+#include "PhraseIndex.h"
+#include "Prefetcher.h"
+#include "Suggestions.h"
+#include "Unicode.h"
+#include "UserHistory.h"
+
+// Debug helper
+static void DebugLog(const wchar_t* msg) {
+    Debug::Log(L"InputSession", msg);
+}
+
+static void DebugLogStroke(const wchar_t* msg, const std::wstring& stroke) {
+    Debug::LogStroke(L"InputSession", msg, stroke);
+}
+
+CInputSession::CInputSession(const CDictionary& dictionary, const CSuggestions& suggestions,
+                             const CPhraseIndex& phraseIndex)
+    : _dictionary(dictionary), _suggestionDict(suggestions), _phraseIndex(phraseIndex) {}
+
+void CInputSession::SetLookupWorker(CLookupWorker* worker, std::chrono::milliseconds deadline) {
+    _lookupWorker = worker;
+    _lookupDeadline = deadline;
+}
+
+void CInputSession::SetFuzzyEdits(int fuzzyEdits) {
+    _fuzzyEdits = (std::max)(0, (std::min)(2, fuzzyEdits));
+}
+
+CInputSession::Effect CInputSession::OnKeyDown(const InputAction& action) {
+    Effect effect;
+    if (action.changeNextState) {
+        _state = action.nextState;
+    }
+
+    // Anything but another stroke edit acts on the current results, so they must be up to date
+    if (!IsStrokeEdit(action)) {
+        bool flushed = FlushPendingQuery();
+        bool completed = CompleteLookup();
+        effect.redraw = flushed || completed;
+    }
+    effect.passThrough = action.type == InputActionType::NOOP_PASS_THROUGH_KEYPRESS;
+
+    switch (action.type) {
+        case InputActionType::NOOP_PASS_THROUGH_KEYPRESS: {
+            DebugLog(L"Action: NOOP_PASS_THROUGH_KEYPRESS");
+            break;
+        }
+
+        case InputActionType::NOOP_CONSUME_KEYPRESS: {
+            DebugLog(L"Action: NOOP_CONSUME_KEYPRESS");
+            effect.redraw = true;
+            break;
+        }
+
+        case InputActionType::ADD_STROKE: {
+            DebugLog(L"Action: ADD_STROKE");
+            DebugLogStroke(L"ADD_STROKE details", std::wstring(1, action.stroke));
+            if (_state == InputState::TYPING) {
+                _ghostStrokeInput.clear();
+                _strokeinput.push_back(action.stroke);
+                _page = 0;
+                _selectedCandidate = 0;
+                RequestQueryResults();
+                effect.redraw = effect.redraw || !_queryPending;
+            }
+            break;
+        }
+
+        case InputActionType::DELETE_STROKE: {
+            DebugLog(L"Action: DELETE_STROKE");
+            if (!_strokeinput.empty()) {
+                _strokeinput.pop_back();
+                _page = 0;
+                _selectedCandidate = 0;
+                RequestQueryResults();
+                effect.redraw = effect.redraw || !_queryPending;
+            } else {
+                // Backspace goes to the application and edits the text we would predict from
+                _ghostStrokeInput.clear();
+                _suggestions.clear();
+                _suggestionFilter.Clear();
+                _recentText.clear();
+                effect.passThrough = true;
+                UpdateQueryResults();
+                effect.redraw = true;
+            }
+            break;
+        }
+
+        case InputActionType::CLEAR_STROKE: {
+            DebugLog(L"Action: CLEAR_STROKE");
+            ClearInput();
+            effect.redraw = true;
+            break;
+        }
+
+        case InputActionType::SELECT_CHARACTER: {
+            DebugLog(L"Action: SELECT_CHARACTER");
+            const auto& list = GetList();
+            size_t idx = (_page * PAGE_SIZE) + static_cast<size_t>(action.index);
+            if (idx < list.size()) {
+                const std::wstring chosen = list[idx];
+                if (_history) {
+                    if (!_candidates.empty()) {
+                        _history->Record(CUserHistory::Kind::STROKES, _strokeinput, chosen);
+                    }
+                    // Whatever follows the recent text, typed or suggested, teaches the suggestions
+                    for (const auto& context : GetSuggestionContexts()) {
+                        _history->Record(CUserHistory::Kind::SUGGESTION, context, chosen);
+                    }
+                }
+                effect.commit = chosen;
+                SetGhostFromCharacter(chosen);
+                ClearStrokeInput();
+                _candidates.clear();
+                _page = 0;
+                _selectedCandidate = 0;
+                _recentText = Unicode::LastCharacters(_recentText + chosen, CNgramModel::MAX_ORDER - 1);
+                ShowSuggestions();
+                effect.redraw = true;
+            }
+            break;
+        }
+
+        case InputActionType::NEXT_SELECTION_PAGE: {
+            DebugLog(L"Action: NEXT_SELECTION_PAGE");
+            if ((_page + 1) * PAGE_SIZE < (_candidates.empty() ? _suggestions.size() : _candidateTotal)) {
+                EnsureAllCandidates();
+                if ((_page + 1) * PAGE_SIZE < GetList().size()) {
+                    _page++;
+                }
+            }
+            effect.redraw = true;
+            break;
+        }
+
+        case InputActionType::PREVIOUS_SELECTION_PAGE: {
+            DebugLog(L"Action: PREVIOUS_SELECTION_PAGE");
+            if (_page > 0) {
+                _page--;
+            }
+            effect.redraw = true;
+            break;
+        }
+
+        case InputActionType::SUBSTITUTE_CHARACTER: {
+            DebugLog(L"Action: SUBSTITUTE_CHARACTER");
+            effect.commit = action.character;
+            _recentText.clear();  // punctuation ends the phrase
+            ClearInput();
+            effect.redraw = true;
+            break;
+        }
+
+        default:
+            break;
+    }
+    return effect;
+}
+
+bool CInputSession::OnKeyUp() {
+    // The key-down that was expected to take over a put-off lookup may never come
+    // (focus moved, or the application ate it); the burst ends with the last key-up
+    if (_queryPending && !IsStrokeEditQueued()) {
+        return FlushPendingQuery();
+    }
+    return false;
+}
+
+bool CInputSession::OnLookupResult() {
+    // A result for an input typed over since, or already taken by Wait, is ignored
+    CLookupWorker::Result result;
+    if (!_lookupSequence || !_lookupWorker->TakeResult(result) || result.sequence != _lookupSequence) return false;
+    ApplyLookupResult(result);
+    return true;
+}
+
+void CInputSession::ClearInput() {
+    _ghostStrokeInput.clear();
+    ClearStrokeInput();
+    _candidates.clear();
+    _suggestions.clear();
+    _suggestionFilter.Clear();
+    _page = 0;
+    _selectedCandidate = 0;
+}
+
+void CInputSession::Reset(InputState state) {
+    _queryPending = false;
+    ClearInput();
+    _recentText.clear();
+    _state = state;
+}
+
+bool CInputSession::IsStrokeEdit(const InputAction& action) const {
+    // A Backspace on empty input goes to the application, so it cannot be put off
+    return action.type == InputActionType::ADD_STROKE ||
+           (action.type == InputActionType::DELETE_STROKE && !_strokeinput.empty());
+}
+
+bool CInputSession::IsStrokeEditQueued() const {
+    InputAction next;
+    return _peek && _peek(_state, next) && IsStrokeEdit(next);
+}
+
+void CInputSession::UpdateQueryResults() {
+    CancelLookup();  // whatever the worker is still doing is for an older input
+
+    if (_strokeinput.empty()) {
+        _candidates.clear();
+        _candidateTotal = 0;
+        // keep suggestions (ghost mode), or bring back the list strokes were filtering
+        if (_suggestions.empty() && _suggestionFilter.IsActive()) {
+            _suggestions = _suggestionFilter.GetSuggestions();
+        }
+    } else {
+        // Only the first page is looked up: short patterns come straight from the prefix
+        // table, longer ones from a top-K search. The full list is fetched once the user
+        // pages past it.
+        bool fromPrefetch = false;
+        bool complete = true;
+        if (_exactLengthFirst || !_dictionary.LookupFirstPage(_strokeinput, _candidates, _candidateTotal)) {
+            complete = FetchFirstPage(fromPrefetch);
+        }
+        FinishCandidates(complete);
+        _suggestions.clear();
+        if (_prefetcher && complete) {
+            _prefetcher->RecordKeystroke(fromPrefetch);
+        }
+    }
+
+    // Start on the queries the next stroke could produce (an empty input just cancels)
+    if (_prefetcher) {
+        _prefetcher->Schedule(_strokeinput);
+    }
+
+    // Reset selection/page if overflow
+    if (_page * PAGE_SIZE >= GetList().size()) {
+        _page = 0;
+        _selectedCandidate = 0;
+    }
+}
+
+void CInputSession::RequestQueryResults() {
+    // Auto-repeat and fast bursts queue key-downs faster than lookups run; each result
+    // would be replaced before it is seen, so only the last edit of a burst looks up
+    if (IsStrokeEditQueued()) {
+        _queryPending = true;
+        _coalescedLookups++;
+        CancelLookup();
+        return;
+    }
+    _queryPending = false;
+    UpdateQueryResults();
+}
+
+bool CInputSession::FlushPendingQuery() {
+    if (!_queryPending) return false;
+    _queryPending = false;
+    UpdateQueryResults();
+    return true;
+}
+
+bool CInputSession::FetchFirstPage(bool& fromPrefetch) {
+    // One candidate past the page tells whether there is a next page
+    uint64_t sequence = _lookupWorker ? _lookupWorker->Submit(_strokeinput, PAGE_SIZE + 1, _exactLengthFirst) : 0;
+    if (sequence == 0) {
+        _candidates = _dictionary.LookupTopK(_strokeinput, PAGE_SIZE + 1, _exactLengthFirst, &fromPrefetch);
+        _candidateTotal = _candidates.size();
+        return true;
+    }
+
+    CLookupWorker::Result result;
+    if (_lookupWorker->Wait(sequence, _lookupDeadline, result)) {
+        _candidates = std::move(result.candidates);
+        _candidateTotal = _candidates.size();
+        fromPrefetch = result.fromPrefetch;
+        return true;
+    }
+    // Past the deadline: show what needs no scan, and fill in the characters when the
+    // result is posted
+    _lookupSequence = sequence;
+    _candidates.clear();
+    _candidateTotal = 0;
+    return false;
+}
+
+void CInputSession::FinishCandidates(bool complete) {
+    MergePhrases();
+    RerankCandidates();
+    if (complete) AddFuzzyMatches();
+    MergeSuggestionMatches();
+    if (_candidates.size() > PAGE_SIZE) _candidates.resize(PAGE_SIZE);
+}
+
+void CInputSession::ApplyLookupResult(CLookupWorker::Result& result) {
+    _lookupSequence = 0;
+    _candidates = std::move(result.candidates);
+    _candidateTotal = _candidates.size();
+    FinishCandidates(true);
+    if (_prefetcher) {
+        _prefetcher->RecordKeystroke(result.fromPrefetch);
+    }
+}
+
+void CInputSession::CancelLookup() {
+    if (!_lookupSequence) return;
+    _lookupWorker->Cancel();
+    _lookupSequence = 0;
+}
+
+bool CInputSession::CompleteLookup() {
+    if (!_lookupSequence) return false;
+    CLookupWorker::Result result;
+    if (_lookupWorker->Wait(_lookupSequence, CLookupWorker::NO_DEADLINE, result)) {
+        ApplyLookupResult(result);
+    } else {
+        UpdateQueryResults();  // the worker stopped, so this one runs here
+    }
+    return true;
+}
+
+void CInputSession::ClearStrokeInput() {
+    _strokeinput.clear();
+    if (_prefetcher) {
+        _prefetcher->Cancel();
+    }
+    CancelLookup();
+}
+
+void CInputSession::EnsureAllCandidates() {
+    if (!_strokeinput.empty() && _candidates.size() < _candidateTotal) {
+        _candidates = _exactLengthFirst ? _dictionary.LookupTopK(_strokeinput, SIZE_MAX, true)
+                                        : _dictionary.LookupRegex(_strokeinput);
+        _candidateTotal = _candidates.size();
+        MergePhrases();
+        RerankCandidates();
+        MergeSuggestionMatches();
+        _candidateTotal = _candidates.size();
+    }
+}
+
+void CInputSession::RerankCandidates() {
+    if (!_history) return;
+    // Picked characters that are not on the fetched page are pulled in if they still match
+    _history->Rerank(CUserHistory::Kind::STROKES, _strokeinput, _candidates,
+                     [this](const std::wstring& ch) { return _dictionary.MatchesPattern(_strokeinput, ch); });
+    _candidateTotal = (std::max)(_candidateTotal, _candidates.size());
+}
+
+void CInputSession::MergeSuggestionMatches() {
+    if (!_suggestionFilter.IsActive()) return;
+    std::vector<std::wstring> matches;
+    _suggestionFilter.Match(_strokeinput, matches);
+    if (matches.empty()) return;
+
+    // A single-character match is also a dictionary result (already counted in the
+    // total); phrases are extra
+    size_t phrases = 0;
+    for (const auto& match : matches) {
+        if (Unicode::FirstCharacter(match).size() != match.size()) phrases++;
+    }
+    for (auto& candidate : _candidates) {
+        if (std::find(matches.begin(), matches.end(), candidate) == matches.end()) {
+            matches.push_back(std::move(candidate));
+        }
+    }
+    _candidates = std::move(matches);
+    _candidateTotal = (std::max)(_candidateTotal + phrases, _candidates.size());
+}
+
+void CInputSession::MergePhrases() {
+    if (!_phraseInput || _strokeinput.size() < CPhraseIndex::MIN_PATTERN_LENGTH) return;
+    std::vector<std::wstring> phrases;
+    std::vector<size_t> ranks;
+    _phraseIndex.Lookup(_strokeinput, phrases, ranks);
+    if (phrases.empty()) return;
+
+    // Both lists are in rank order: a phrase goes in front of the first character that
+    // ranks below the phrase's first character
+    std::vector<std::wstring> merged;
+    merged.reserve(_candidates.size() + phrases.size());
+    size_t next = 0;
+    for (auto& candidate : _candidates) {
+        if (next < phrases.size()) {
+            size_t rank = _dictionary.GetBestRank(candidate);
+            while (next < phrases.size() && ranks[next] <= rank) merged.push_back(std::move(phrases[next++]));
+        }
+        merged.push_back(std::move(candidate));
+    }
+    // The rest rank below every character fetched so far; with only the first page
+    // fetched they wait for EnsureAllCandidates
+    if (_candidates.size() >= _candidateTotal) {
+        while (next < phrases.size()) merged.push_back(std::move(phrases[next++]));
+    }
+    _candidates = std::move(merged);
+    _candidateTotal += phrases.size();
+}
+
+void CInputSession::AddFuzzyMatches() {
+    // Only when every match is already on a page that still has room; near misses
+    // come after all of them
+    if (_fuzzyEdits == 0 || _candidates.size() < _candidateTotal || _candidates.size() >= PAGE_SIZE) return;
+    auto matches =
+        _dictionary.LookupFuzzy(_strokeinput, static_cast<uint32_t>(_fuzzyEdits), PAGE_SIZE - _candidates.size());
+    for (auto& match : matches) {
+        if (std::find(_candidates.begin(), _candidates.end(), match) == _candidates.end()) {
+            _candidates.push_back(std::move(match));
+        }
+    }
+    _candidateTotal = _candidates.size();
+}
+
+void CInputSession::SetGhostFromCharacter(const std::wstring& ch) {
+    if (ch.empty()) {
+        _ghostStrokeInput.clear();
+        return;
+    }
+    std::wstring key(Unicode::LastCharacter(ch));
+    _ghostStrokeInput = _dictionary.GetRandomStrokeForCharacter(key);
+}
+
+void CInputSession::ShowSuggestions() {
+    if (_recentText.empty()) {
+        _suggestions.clear();
+        _suggestionFilter.Clear();
+        return;
+    }
+    // The last three characters pick the n-gram context; learned picks for the last one
+    // and then the last two characters go in front
+    _suggestions = _suggestionDict.Lookup(_recentText);
+    if (_history) {
+        for (const auto& context : GetSuggestionContexts()) {
+            _history->Rerank(CUserHistory::Kind::SUGGESTION, context, _suggestions);
+        }
+    }
+    if (_filterSuggestions) {
+        _suggestionFilter.Build(_suggestions, _dictionary);
+    }
+}
+
+std::vector<std::wstring> CInputSession::GetSuggestionContexts() const {
+    std::vector<std::wstring> contexts;
+    std::wstring_view last = Unicode::LastCharacter(_recentText);
+    std::wstring_view lastTwo = Unicode::LastCharacters(_recentText, 2);
+    if (!last.empty()) contexts.emplace_back(last);
+    if (lastTwo.size() > last.size()) contexts.emplace_back(lastTwo);
+    return contexts;
+}
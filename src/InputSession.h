@@ -0,0 +1,135 @@
+#pragma once
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <string>
+#include <vector>
+
+#include "InputAction.h"
+#include "LookupWorker.h"
+#include "SuggestionFilter.h"
+
+class CDictionary;
+class CPhraseIndex;
+class CPrefetcher;
+class CSuggestions;
+class CUserHistory;
+
+// The query and selection state of the text service, and what each key action does to
+// it: the strokes typed, the candidate and suggestion lists, the page shown, and the
+// lookups behind them. Nothing here touches a window or a document, so the same code
+// runs in the text service and in k6tool replay; the caller shows the lists and commits
+// the text each action hands back. Not thread safe: everything but the lookup worker's
+// notify callback runs on the caller's thread.
+class CInputSession {
+   public:
+    static constexpr size_t PAGE_SIZE = 9;
+
+    // What the caller has to do after a key action
+    struct Effect {
+        std::wstring commit;       // text to insert into the document
+        bool passThrough = false;  // the key goes on to the application
+        bool redraw = false;       // the input, the lists or the page changed
+    };
+
+    // Looks at the next key-down already queued behind the one being handled, without
+    // taking it, and gives the action it will have in state; false if none is queued
+    using PeekAction = std::function<bool(InputState state, InputAction& next)>;
+
+    CInputSession(const CDictionary& dictionary, const CSuggestions& suggestions, const CPhraseIndex& phraseIndex);
+
+    CInputSession(const CInputSession&) = delete;
+    CInputSession& operator=(const CInputSession&) = delete;
+
+    // Optional parts; set before the first key
+    void SetPrefetcher(CPrefetcher* prefetcher) { _prefetcher = prefetcher; }
+    void SetHistory(CUserHistory* history) { _history = history; }
+    // First pages past the deadline are shown when the worker's result is taken with
+    // OnLookupResult
+    void SetLookupWorker(CLookupWorker* worker, std::chrono::milliseconds deadline);
+    // Without it every stroke edit is looked up as it is handled
+    void SetPeekAction(PeekAction peek) { _peek = std::move(peek); }
+
+    void SetExactLengthFirst(bool exactLengthFirst) { _exactLengthFirst = exactLengthFirst; }
+    void SetFilterSuggestions(bool filterSuggestions) { _filterSuggestions = filterSuggestions; }
+    void SetPhraseInput(bool phraseInput) { _phraseInput = phraseInput; }
+    void SetFuzzyEdits(int fuzzyEdits);
+
+    // A key-down: takes the action's state change, brings the lists up to date unless
+    // the action is another stroke edit, and acts
+    Effect OnKeyDown(const InputAction& action);
+    // A key-up: a burst of stroke edits ends with it if no key-down follows, so a
+    // lookup they put off runs now. True if the lists changed.
+    bool OnKeyUp();
+    // The lookup worker posted a result. True if it was for the input shown.
+    bool OnLookupResult();
+
+    // Drops the input and both lists, keeping the recent text and the state
+    void ClearInput();
+    // Drops everything, including the recent text, and starts over in state
+    void Reset(InputState state);
+
+    InputState GetState() const { return _state; }
+    void SetState(InputState state) { _state = state; }
+    const std::wstring& GetStrokeInput() const { return _strokeinput; }
+    const std::wstring& GetGhostStrokeInput() const { return _ghostStrokeInput; }
+    const std::vector<std::wstring>& GetCandidates() const { return _candidates; }
+    const std::vector<std::wstring>& GetSuggestions() const { return _suggestions; }
+    // What the candidate window lists: the candidates, or the suggestions when there are none
+    const std::vector<std::wstring>& GetList() const { return _candidates.empty() ? _suggestions : _candidates; }
+    size_t GetSelection() const { return _selectedCandidate; }
+    size_t GetPage() const { return _page; }
+    bool IsQueryPending() const { return _queryPending; }
+    bool IsLookupPending() const { return _lookupSequence != 0; }
+    uint64_t GetCoalescedLookups() const { return _coalescedLookups; }
+
+   private:
+    const CDictionary& _dictionary;
+    const CSuggestions& _suggestionDict;
+    const CPhraseIndex& _phraseIndex;
+    CPrefetcher* _prefetcher = nullptr;
+    CUserHistory* _history = nullptr;
+    CLookupWorker* _lookupWorker = nullptr;
+    PeekAction _peek;
+
+    std::wstring _strokeinput;               // current query strokes
+    std::wstring _ghostStrokeInput;          // ghost strokes after commit
+    std::vector<std::wstring> _candidates;   // character results (may be only the first page)
+    size_t _candidateTotal = 0;              // character results for _strokeinput (a lower bound
+                                             // until EnsureAllCandidates has run)
+    std::vector<std::wstring> _suggestions;  // suggestion results
+    std::wstring _recentText;                // last few committed characters, for suggestions
+    size_t _selectedCandidate = 0;           // index in current page [0..8]
+    size_t _page = 0;                        // page for candidates/suggestions
+    InputState _state = InputState::TYPING;
+    bool _exactLengthFirst = false;  // list codes exactly as long as the input first
+    bool _filterSuggestions = true;  // strokes typed over suggestions put the matching ones first
+    CSuggestionFilter _suggestionFilter;  // first-character codes of the last suggestion list
+    bool _phraseInput = true;             // abbreviations list whole phrases among the characters
+    int _fuzzyEdits = 1;                  // stroke mistakes tolerated when few characters match (0 = off)
+    bool _queryPending = false;           // _strokeinput changed, but its lookup waits for queued strokes
+    uint64_t _coalescedLookups = 0;       // lookups skipped because another stroke edit was queued
+    uint64_t _lookupSequence = 0;         // worker request the shown characters still wait for (0 = none)
+    std::chrono::milliseconds _lookupDeadline{CLookupWorker::DEFAULT_DEADLINE_MS};
+
+    bool IsStrokeEdit(const InputAction& action) const;  // edits _strokeinput, so can be put off
+    bool IsStrokeEditQueued() const;
+    void UpdateQueryResults();
+    void RequestQueryResults();  // UpdateQueryResults, unless another stroke edit is already queued
+    bool FlushPendingQuery();    // runs the lookup RequestQueryResults put off
+    bool FetchFirstPage(bool& fromPrefetch);  // false if the worker missed the deadline
+    void FinishCandidates(bool complete);     // merges phrases, picks and suggestions into the page
+    void ApplyLookupResult(CLookupWorker::Result& result);
+    void CancelLookup();
+    bool CompleteLookup();  // waits out a lookup that missed the deadline
+    void EnsureAllCandidates();
+    void RerankCandidates();        // moves the user's usual picks for _strokeinput to the front
+    void MergeSuggestionMatches();  // puts suggestions that start with _strokeinput first
+    void MergePhrases();            // adds phrases abbreviated by _strokeinput, in rank order
+    void AddFuzzyMatches();         // fills a short first page with near misses of _strokeinput
+    void ClearStrokeInput();        // also drops prefetch and lookup work for the old input
+    void SetGhostFromCharacter(const std::wstring& ch);
+    void ShowSuggestions();                                   // for _recentText
+    std::vector<std::wstring> GetSuggestionContexts() const;  // last one and two characters
+};
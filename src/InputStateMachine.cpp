@@ -92,6 +92,11 @@ bool InputStateMachine::IsStrokeKey(WPARAM wParam, wchar_t& outStroke) const {
         outStroke = L'＊';
         return true;
     }
+    // Numpad* -> ANY_STROKES (～)
+    if (wParam == VK_MULTIPLY) {
+        outStroke = L'～';
+        return true;
+    }
     return false;
 }
 
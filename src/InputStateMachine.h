@@ -5,39 +5,7 @@
 #include <string>
 #include <vector>
 
-// Mirrors the TypeScript State enum
-enum class InputState {
-    DISABLED,
-    TYPING,
-    SELECTING,
-};
-
-// Mirrors the TypeScript ActionType enum
-enum class InputActionType {
-    NOOP_PASS_THROUGH_KEYPRESS,
-    NOOP_CONSUME_KEYPRESS,
-    ADD_STROKE,
-    DELETE_STROKE,
-    CLEAR_STROKE,
-    NEXT_SELECTION_PAGE,
-    PREVIOUS_SELECTION_PAGE,
-    SELECT_CHARACTER,
-    SUBSTITUTE_CHARACTER,
-    TOGGLE_ENABLE,
-};
-
-// Mirrors the TypeScript Action union type
-struct InputAction {
-    InputActionType type;
-    wchar_t stroke = 0;
-    int index = 0;
-    std::wstring character;
-    bool changeNextState = false;
-    InputState nextState;
-
-    InputAction() : type(InputActionType::NOOP_PASS_THROUGH_KEYPRESS) {}
-    explicit InputAction(InputActionType t) : type(t) {}
-};
+#include "InputAction.h"
 
 class InputStateMachine {
    public:
@@ -0,0 +1,127 @@
+#include "LookupClient.h"
+
+#include "Unicode.h"
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <errno.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include <cstring>
+#endif
+
+CLookupClient::CLookupClient() {
+}
+
+CLookupClient::~CLookupClient() {
+    Close();
+}
+
+bool CLookupClient::Send(const LookupProtocol::Request& request) {
+    std::string frame;
+    LookupProtocol::AppendFrame(frame, LookupProtocol::EncodeRequest(request));
+    return WriteAll(frame.data(), frame.size());
+}
+
+bool CLookupClient::Receive(LookupProtocol::Response& response) {
+    for (;;) {
+        std::string_view payload;
+        size_t frameSize;
+        bool tooLarge;
+        if (LookupProtocol::NextFrame(_input, payload, frameSize, tooLarge)) {
+            bool ok = LookupProtocol::DecodeResponse(payload, response);
+            _input.erase(0, frameSize);
+            return ok;
+        }
+        if (tooLarge || !ReadSome()) return false;
+    }
+}
+
+#ifdef _WIN32
+
+bool CLookupClient::Connect(const std::wstring& address) {
+    Close();
+    HANDLE pipe = CreateFileW(address.c_str(), GENERIC_READ | GENERIC_WRITE, 0, nullptr, OPEN_EXISTING, 0, nullptr);
+    if (pipe == INVALID_HANDLE_VALUE && GetLastError() == ERROR_PIPE_BUSY && WaitNamedPipeW(address.c_str(), 2000)) {
+        pipe = CreateFileW(address.c_str(), GENERIC_READ | GENERIC_WRITE, 0, nullptr, OPEN_EXISTING, 0, nullptr);
+    }
+    if (pipe == INVALID_HANDLE_VALUE) return false;
+    _pipe = pipe;
+    return true;
+}
+
+void CLookupClient::Close() {
+    if (_pipe) CloseHandle(_pipe);
+    _pipe = nullptr;
+    _input.clear();
+}
+
+bool CLookupClient::WriteAll(const char* data, size_t size) {
+    while (size > 0) {
+        DWORD written = 0;
+        if (!_pipe || !WriteFile(_pipe, data, static_cast<DWORD>(size), &written, nullptr)) return false;
+        data += written;
+        size -= written;
+    }
+    return true;
+}
+
+bool CLookupClient::ReadSome() {
+    char buffer[64 * 1024];
+    DWORD read = 0;
+    if (!_pipe || !ReadFile(_pipe, buffer, sizeof(buffer), &read, nullptr) || read == 0) return false;
+    _input.append(buffer, read);
+    return true;
+}
+
+#else
+
+bool CLookupClient::Connect(const std::wstring& address) {
+    Close();
+    std::string path = Unicode::WideToUtf8(address);
+    sockaddr_un addr{};
+    addr.sun_family = AF_UNIX;
+    if (path.empty() || path.size() >= sizeof(addr.sun_path)) return false;
+    std::memcpy(addr.sun_path, path.c_str(), path.size() + 1);
+
+    _fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (_fd < 0) return false;
+    if (connect(_fd, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) != 0) {
+        Close();
+        return false;
+    }
+    return true;
+}
+
+void CLookupClient::Close() {
+    if (_fd >= 0) close(_fd);
+    _fd = -1;
+    _input.clear();
+}
+
+bool CLookupClient::WriteAll(const char* data, size_t size) {
+    while (size > 0) {
+        ssize_t sent = send(_fd, data, size, MSG_NOSIGNAL);
+        if (sent < 0 && errno == EINTR) continue;
+        if (sent <= 0) return false;
+        data += sent;
+        size -= static_cast<size_t>(sent);
+    }
+    return true;
+}
+
+bool CLookupClient::ReadSome() {
+    char buffer[64 * 1024];
+    for (;;) {
+        ssize_t got = recv(_fd, buffer, sizeof(buffer), 0);
+        if (got < 0 && errno == EINTR) continue;
+        if (got <= 0) return false;
+        _input.append(buffer, static_cast<size_t>(got));
+        return true;
+    }
+}
+
+#endif
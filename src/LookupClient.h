@@ -0,0 +1,34 @@
+#pragma once
+#include <string>
+
+#include "LookupProtocol.h"
+
+// Blocking client of CLookupServer, for k6tool and other local tools. Requests may be
+// pipelined: send several, then receive their responses in the same order.
+class CLookupClient {
+   public:
+    CLookupClient();
+    ~CLookupClient();
+
+    CLookupClient(const CLookupClient&) = delete;
+    CLookupClient& operator=(const CLookupClient&) = delete;
+
+    // A socket path, or a \\.\pipe\ name on Windows (see CLookupServer::GetDefaultAddress)
+    bool Connect(const std::wstring& address);
+    void Close();
+
+    bool Send(const LookupProtocol::Request& request);
+    bool Receive(LookupProtocol::Response& response);
+
+   private:
+    bool WriteAll(const char* data, size_t size);
+    // Appends up to one read's worth of bytes to _input; false on EOF or error
+    bool ReadSome();
+
+    std::string _input;
+#ifdef _WIN32
+    void* _pipe = nullptr;
+#else
+    int _fd = -1;
+#endif
+};
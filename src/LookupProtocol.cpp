@@ -0,0 +1,444 @@
+#include "LookupProtocol.h"
+
+#include <algorithm>
+#include <cctype>
+
+#include "Unicode.h"
+
+namespace LookupProtocol {
+
+namespace {
+
+const size_t REQUEST_HEADER_SIZE = 8;
+const size_t RESPONSE_HEADER_SIZE = 8;
+
+void PutU16(std::string& out, uint16_t value) {
+    out.push_back(static_cast<char>(value & 0xFF));
+    out.push_back(static_cast<char>(value >> 8));
+}
+
+void PutU32(std::string& out, uint32_t value) {
+    for (int shift = 0; shift < 32; shift += 8) out.push_back(static_cast<char>((value >> shift) & 0xFF));
+}
+
+uint16_t GetU16(const char* p) {
+    return static_cast<uint16_t>(static_cast<uint8_t>(p[0]) | static_cast<uint8_t>(p[1]) << 8);
+}
+
+uint32_t GetU32(const char* p) {
+    return static_cast<uint32_t>(static_cast<uint8_t>(p[0])) | static_cast<uint32_t>(static_cast<uint8_t>(p[1])) << 8 |
+           static_cast<uint32_t>(static_cast<uint8_t>(p[2])) << 16 | static_cast<uint32_t>(static_cast<uint8_t>(p[3])) << 24;
+}
+
+// u16 length + UTF-8, cut short (at a code point boundary) if longer than a u16 allows
+void PutString(std::string& out, std::string_view utf8) {
+    size_t length = (std::min)(utf8.size(), static_cast<size_t>(UINT16_MAX));
+    while (length < utf8.size() && length > 0 && (static_cast<uint8_t>(utf8[length]) & 0xC0) == 0x80) length--;
+    PutU16(out, static_cast<uint16_t>(length));
+    out.append(utf8.data(), length);
+}
+
+const char* OpName(Op op) {
+    switch (op) {
+        case Op::Suggest:
+            return "suggest";
+        case Op::Codes:
+            return "codes";
+        default:
+            return "lookup";
+    }
+}
+
+bool ParseOp(std::string_view name, Op& op) {
+    if (name == "lookup") {
+        op = Op::Lookup;
+    } else if (name == "suggest") {
+        op = Op::Suggest;
+    } else if (name == "codes") {
+        op = Op::Codes;
+    } else {
+        return false;
+    }
+    return true;
+}
+
+bool IsKnownOp(uint8_t op) {
+    return op >= static_cast<uint8_t>(Op::Lookup) && op <= static_cast<uint8_t>(Op::Codes);
+}
+
+void AppendJsonString(std::string& out, std::string_view utf8) {
+    static const char HEX[] = "0123456789abcdef";
+    out.push_back('"');
+    for (char ch : utf8) {
+        auto byte = static_cast<uint8_t>(ch);
+        if (ch == '"' || ch == '\\') {
+            out.push_back('\\');
+            out.push_back(ch);
+        } else if (byte < 0x20) {
+            out += "\\u00";
+            out.push_back(HEX[byte >> 4]);
+            out.push_back(HEX[byte & 15]);
+        } else {
+            out.push_back(ch);
+        }
+    }
+    out.push_back('"');
+}
+
+// Just enough JSON for the protocol: one flat object whose values are strings,
+// non-negative integers or arrays of strings; anything else is skipped over
+class CJsonReader {
+   public:
+    explicit CJsonReader(std::string_view text) : _text(text) {}
+
+    bool Consume(char ch) {
+        SkipSpace();
+        if (_pos >= _text.size() || _text[_pos] != ch) return false;
+        _pos++;
+        return true;
+    }
+
+    bool AtEnd() {
+        SkipSpace();
+        return _pos == _text.size();
+    }
+
+    bool ReadString(std::string& out) {
+        out.clear();
+        if (!Consume('"')) return false;
+        while (_pos < _text.size()) {
+            char ch = _text[_pos++];
+            if (ch == '"') return true;
+            if (ch != '\\') {
+                out.push_back(ch);
+                continue;
+            }
+            if (_pos >= _text.size()) return false;
+            switch (char escape = _text[_pos++]) {
+                case 'b':
+                    out.push_back('\b');
+                    break;
+                case 'f':
+                    out.push_back('\f');
+                    break;
+                case 'n':
+                    out.push_back('\n');
+                    break;
+                case 'r':
+                    out.push_back('\r');
+                    break;
+                case 't':
+                    out.push_back('\t');
+                    break;
+                case 'u': {
+                    char32_t cp;
+                    if (!ReadHex4(cp)) return false;
+                    // A high surrogate needs its low half as the next escape
+                    if (cp >= 0xD800 && cp < 0xDC00) {
+                        char32_t low;
+                        if (_text.substr(_pos, 2) != "\\u") return false;
+                        _pos += 2;
+                        if (!ReadHex4(low) || low < 0xDC00 || low >= 0xE000) return false;
+                        cp = 0x10000 + ((cp - 0xD800) << 10) + (low - 0xDC00);
+                    } else if (cp >= 0xDC00 && cp < 0xE000) {
+                        return false;
+                    }
+                    out += Unicode::WideToUtf8(Unicode::FromCodePoints(std::u32string_view(&cp, 1)));
+                    break;
+                }
+                default:
+                    if (escape != '"' && escape != '\\' && escape != '/') return false;
+                    out.push_back(escape);
+                    break;
+            }
+        }
+        return false;
+    }
+
+    bool ReadNumber(uint64_t& value) {
+        SkipSpace();
+        size_t start = _pos;
+        value = 0;
+        while (_pos < _text.size() && _text[_pos] >= '0' && _text[_pos] <= '9') {
+            if (value > UINT32_MAX) return false;
+            value = value * 10 + static_cast<uint64_t>(_text[_pos++] - '0');
+        }
+        return _pos > start;
+    }
+
+    bool ReadStringArray(std::vector<std::string>& out) {
+        out.clear();
+        if (!Consume('[')) return false;
+        if (Consume(']')) return true;
+        do {
+            out.emplace_back();
+            if (!ReadString(out.back())) return false;
+        } while (Consume(','));
+        return Consume(']');
+    }
+
+    bool SkipValue(int depth = 0) {
+        if (depth > 16) return false;
+        SkipSpace();
+        if (_pos >= _text.size()) return false;
+        char ch = _text[_pos];
+        if (ch == '"') {
+            std::string ignored;
+            return ReadString(ignored);
+        }
+        if (ch == '[' || ch == '{') {
+            char close = ch == '[' ? ']' : '}';
+            _pos++;
+            if (Consume(close)) return true;
+            do {
+                if (ch == '{') {
+                    std::string key;
+                    if (!ReadString(key) || !Consume(':')) return false;
+                }
+                if (!SkipValue(depth + 1)) return false;
+            } while (Consume(','));
+            return Consume(close);
+        }
+        // Numbers and literals
+        size_t start = _pos;
+        while (_pos < _text.size() && (std::isalnum(static_cast<unsigned char>(_text[_pos])) || _text[_pos] == '-' ||
+                                       _text[_pos] == '+' || _text[_pos] == '.')) {
+            _pos++;
+        }
+        return _pos > start;
+    }
+
+   private:
+    void SkipSpace() {
+        while (_pos < _text.size() && (_text[_pos] == ' ' || _text[_pos] == '\t' || _text[_pos] == '\n' || _text[_pos] == '\r')) {
+            _pos++;
+        }
+    }
+
+    bool ReadHex4(char32_t& value) {
+        if (_pos + 4 > _text.size()) return false;
+        value = 0;
+        for (int i = 0; i < 4; ++i) {
+            char ch = _text[_pos++];
+            int digit = ch >= '0' && ch <= '9'   ? ch - '0'
+                        : ch >= 'a' && ch <= 'f' ? ch - 'a' + 10
+                        : ch >= 'A' && ch <= 'F' ? ch - 'A' + 10
+                                                 : -1;
+            if (digit < 0) return false;
+            value = value << 4 | static_cast<char32_t>(digit);
+        }
+        return true;
+    }
+
+    std::string_view _text;
+    size_t _pos = 0;
+};
+
+// Calls onField(key, reader) for every field of the top-level object; onField reads
+// the value or returns false to have it skipped
+template <typename OnField>
+bool ReadObject(std::string_view payload, OnField onField, std::string& error) {
+    CJsonReader reader(payload);
+    if (!reader.Consume('{')) {
+        error = "expected a JSON object";
+        return false;
+    }
+    if (!reader.Consume('}')) {
+        do {
+            std::string key;
+            if (!reader.ReadString(key) || !reader.Consume(':')) {
+                error = "malformed JSON";
+                return false;
+            }
+            int handled = onField(key, reader);
+            if (handled < 0) {
+                error = "bad value for \"" + key + "\"";
+                return false;
+            }
+            if (handled == 0 && !reader.SkipValue()) {
+                error = "malformed JSON";
+                return false;
+            }
+        } while (reader.Consume(','));
+        if (!reader.Consume('}')) {
+            error = "malformed JSON";
+            return false;
+        }
+    }
+    if (!reader.AtEnd()) {
+        error = "trailing data after JSON object";
+        return false;
+    }
+    return true;
+}
+
+bool DecodeJsonRequest(std::string_view payload, Request& request, std::string& error) {
+    request.json = true;
+    bool hasText = false;
+    bool ok = ReadObject(
+        payload,
+        [&](const std::string& key, CJsonReader& reader) {
+            uint64_t number;
+            std::string text;
+            if (key == "id") {
+                if (!reader.ReadNumber(number)) return -1;
+                request.id = static_cast<uint32_t>(number);
+            } else if (key == "k") {
+                if (!reader.ReadNumber(number) || number > UINT16_MAX) return -1;
+                request.k = static_cast<uint16_t>(number);
+            } else if (key == "op") {
+                if (!reader.ReadString(text) || !ParseOp(text, request.op)) return -1;
+            } else if (key == "text") {
+                if (!reader.ReadString(text)) return -1;
+                request.text = Unicode::Utf8ToWide(text);
+                hasText = true;
+            } else {
+                return 0;
+            }
+            return 1;
+        },
+        error);
+    if (ok && !hasText) {
+        error = "missing \"text\"";
+        return false;
+    }
+    return ok;
+}
+
+}  // namespace
+
+void AppendFrame(std::string& out, std::string_view payload) {
+    PutU32(out, static_cast<uint32_t>(payload.size()));
+    out.append(payload.data(), payload.size());
+}
+
+bool NextFrame(std::string_view buffer, std::string_view& payload, size_t& frameSize, bool& tooLarge) {
+    tooLarge = false;
+    if (buffer.size() < FRAME_HEADER_SIZE) return false;
+    size_t length = GetU32(buffer.data());
+    if (length > MAX_FRAME_SIZE) {
+        tooLarge = true;
+        return false;
+    }
+    if (buffer.size() < FRAME_HEADER_SIZE + length) return false;
+    payload = buffer.substr(FRAME_HEADER_SIZE, length);
+    frameSize = FRAME_HEADER_SIZE + length;
+    return true;
+}
+
+bool DecodeRequest(std::string_view payload, Request& request, std::string& error) {
+    request = Request();
+    if (!payload.empty() && payload[0] == '{') return DecodeJsonRequest(payload, request, error);
+
+    if (payload.size() < REQUEST_HEADER_SIZE) {
+        error = "request too short";
+        return false;
+    }
+    request.id = GetU32(payload.data() + 4);
+    if (!IsKnownOp(static_cast<uint8_t>(payload[0]))) {
+        error = "unknown op";
+        return false;
+    }
+    request.op = static_cast<Op>(payload[0]);
+    request.k = GetU16(payload.data() + 2);
+    request.text = Unicode::Utf8ToWide(payload.substr(REQUEST_HEADER_SIZE));
+    return true;
+}
+
+std::string EncodeResponse(const Response& response, bool json) {
+    std::string out;
+    if (json) {
+        out = "{\"id\":" + std::to_string(response.id);
+        if (!response.error.empty()) {
+            out += ",\"error\":";
+            AppendJsonString(out, response.error);
+        } else {
+            out += ",\"results\":[";
+            for (size_t i = 0; i < response.results.size(); ++i) {
+                if (i > 0) out.push_back(',');
+                AppendJsonString(out, Unicode::WideToUtf8(response.results[i]));
+            }
+            out.push_back(']');
+        }
+        out.push_back('}');
+        return out;
+    }
+
+    bool failed = !response.error.empty();
+    size_t count = failed ? 1 : (std::min)(response.results.size(), static_cast<size_t>(UINT16_MAX));
+    out.push_back(failed ? 1 : 0);
+    out.push_back(0);
+    PutU16(out, static_cast<uint16_t>(count));
+    PutU32(out, response.id);
+    if (failed) {
+        PutString(out, response.error);
+    } else {
+        for (size_t i = 0; i < count; ++i) PutString(out, Unicode::WideToUtf8(response.results[i]));
+    }
+    return out;
+}
+
+std::string EncodeRequest(const Request& request) {
+    std::string out;
+    std::string text = Unicode::WideToUtf8(request.text);
+    if (request.json) {
+        out = "{\"id\":" + std::to_string(request.id) + ",\"op\":\"" + OpName(request.op) + "\",\"text\":";
+        AppendJsonString(out, text);
+        out += ",\"k\":" + std::to_string(request.k) + "}";
+        return out;
+    }
+    out.push_back(static_cast<char>(request.op));
+    out.push_back(0);
+    PutU16(out, request.k);
+    PutU32(out, request.id);
+    out += text;
+    return out;
+}
+
+bool DecodeResponse(std::string_view payload, Response& response) {
+    response = Response();
+    if (!payload.empty() && payload[0] == '{') {
+        std::string error;
+        return ReadObject(
+            payload,
+            [&](const std::string& key, CJsonReader& reader) {
+                uint64_t number;
+                std::vector<std::string> results;
+                if (key == "id") {
+                    if (!reader.ReadNumber(number)) return -1;
+                    response.id = static_cast<uint32_t>(number);
+                } else if (key == "results") {
+                    if (!reader.ReadStringArray(results)) return -1;
+                    for (const auto& result : results) response.results.push_back(Unicode::Utf8ToWide(result));
+                } else if (key == "error") {
+                    if (!reader.ReadString(response.error)) return -1;
+                } else {
+                    return 0;
+                }
+                return 1;
+            },
+            error);
+    }
+
+    if (payload.size() < RESPONSE_HEADER_SIZE) return false;
+    bool failed = payload[0] != 0;
+    size_t count = GetU16(payload.data() + 2);
+    response.id = GetU32(payload.data() + 4);
+    size_t pos = RESPONSE_HEADER_SIZE;
+    for (size_t i = 0; i < count; ++i) {
+        if (pos + 2 > payload.size()) return false;
+        size_t length = GetU16(payload.data() + pos);
+        pos += 2;
+        if (pos + length > payload.size()) return false;
+        std::string_view text = payload.substr(pos, length);
+        pos += length;
+        if (failed) {
+            response.error.assign(text.data(), text.size());
+        } else {
+            response.results.push_back(Unicode::Utf8ToWide(text));
+        }
+    }
+    return pos == payload.size();
+}
+
+}  // namespace LookupProtocol
@@ -0,0 +1,61 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <vector>
+
+// Wire format of the lookup server (see CLookupServer). Every message is a frame: a
+// 4-byte little-endian payload length, then the payload. A payload starting with '{'
+// is JSON, anything else binary; the server answers in the encoding it was asked in.
+//
+// Binary request:  u8 op, u8 0, u16 k, u32 id, UTF-8 text
+// Binary response: u8 status (0 ok, 1 error), u8 0, u16 count, u32 id, then count
+//                  results (ok) or one error message, each as u16 length + UTF-8
+// JSON request:    {"id": 7, "op": "lookup", "text": "一丨", "k": 10}
+// JSON response:   {"id": 7, "results": ["丁", ...]} or {"id": 7, "error": "..."}
+//
+// All integers are little-endian. k = 0 asks for every result.
+namespace LookupProtocol {
+
+constexpr size_t FRAME_HEADER_SIZE = 4;
+constexpr size_t MAX_FRAME_SIZE = 1 << 20;
+
+enum class Op : uint8_t {
+    Lookup = 1,   // LookupRegex of a stroke pattern, best k
+    Suggest = 2,  // suggestions following the text, best k
+    Codes = 3,    // stroke codes of a character, best rank first
+};
+
+struct Request {
+    uint32_t id = 0;
+    Op op = Op::Lookup;
+    uint16_t k = 0;
+    std::wstring text;
+    bool json = false;  // how it was (or is to be) encoded
+};
+
+struct Response {
+    uint32_t id = 0;
+    std::vector<std::wstring> results;
+    std::string error;  // empty on success
+};
+
+// Appends payload to out as one frame
+void AppendFrame(std::string& out, std::string_view payload);
+
+// If buffer starts with a whole frame, sets payload and frameSize (header included) and
+// returns true. tooLarge is set for a length over MAX_FRAME_SIZE, which the reader
+// cannot recover from.
+bool NextFrame(std::string_view buffer, std::string_view& payload, size_t& frameSize, bool& tooLarge);
+
+// Server side: parse a request payload; on failure error says why and request.id is
+// whatever could be read (0 if nothing)
+bool DecodeRequest(std::string_view payload, Request& request, std::string& error);
+std::string EncodeResponse(const Response& response, bool json);
+
+// Client side
+std::string EncodeRequest(const Request& request);
+bool DecodeResponse(std::string_view payload, Response& response);
+
+}  // namespace LookupProtocol
@@ -0,0 +1,530 @@
+#include "LookupServer.h"
+
+#include <algorithm>
+#include <chrono>
+#include <tuple>
+
+#include "Debug.h"
+#include "Dictionary.h"
+#include "Suggestions.h"
+#include "Unicode.h"
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include <cstdlib>
+#include <cstring>
+#endif
+
+using LookupProtocol::Op;
+using LookupProtocol::Request;
+using LookupProtocol::Response;
+
+CLookupServer::CLookupServer(const CDictionary& dictionary, const CSuggestions& suggestions)
+    : _dictionary(dictionary), _suggestions(suggestions) {
+}
+
+CLookupServer::Stats CLookupServer::GetStats() const {
+    Stats stats;
+    stats.connections = _connections.load(std::memory_order_relaxed);
+    stats.requests = _requests.load(std::memory_order_relaxed);
+    stats.batches = _batches.load(std::memory_order_relaxed);
+    stats.evaluations = _evaluations.load(std::memory_order_relaxed);
+    stats.largestBatch = _largestBatch.load(std::memory_order_relaxed);
+    stats.errors = _errors.load(std::memory_order_relaxed);
+    return stats;
+}
+
+void CLookupServer::LogStats() const {
+    Stats stats = GetStats();
+    Debug::Log(L"LookupServer", (L"Connections: " + std::to_wstring(stats.connections) +
+                                 L" | Requests: " + std::to_wstring(stats.requests) +
+                                 L" | Batches: " + std::to_wstring(stats.batches) +
+                                 L" | Evaluations: " + std::to_wstring(stats.evaluations) +
+                                 L" | Largest batch: " + std::to_wstring(stats.largestBatch) +
+                                 L" | Errors: " + std::to_wstring(stats.errors))
+                                    .c_str());
+}
+
+void CLookupServer::DecodeFrames(std::string& input, uint64_t client, std::vector<Pending>& batch, bool& fatal) {
+    size_t consumed = 0;
+    std::string_view payload;
+    size_t frameSize;
+    bool tooLarge;
+    while (LookupProtocol::NextFrame(std::string_view(input).substr(consumed), payload, frameSize, tooLarge)) {
+        Pending pending;
+        pending.client = client;
+        if (!LookupProtocol::DecodeRequest(payload, pending.request, pending.error) && pending.error.empty()) {
+            pending.error = "malformed request";
+        }
+        batch.push_back(std::move(pending));
+        consumed += frameSize;
+    }
+    input.erase(0, consumed);
+    fatal = tooLarge;
+}
+
+void CLookupServer::ProcessBatch(std::vector<Pending>& batch) {
+    auto start = std::chrono::high_resolution_clock::now();
+
+    // Identical requests differ at most in id and encoding, so each is looked up once.
+    // Full lists share one pass over the dictionary (see LookupRegexBatchIds).
+    auto snapshot = _dictionary.Acquire();
+    std::map<std::tuple<Op, uint16_t, std::wstring>, Response> answers;
+    std::vector<std::wstring> fullLists;
+    for (const auto& pending : batch) {
+        const Request& request = pending.request;
+        if (!pending.error.empty()) continue;
+        auto [it, added] = answers.emplace(std::make_tuple(request.op, request.k, request.text), Response());
+        if (!added) continue;
+        if (request.op == Op::Lookup && request.k == 0 && !request.text.empty()) {
+            fullLists.push_back(request.text);
+        } else {
+            it->second = Evaluate(*snapshot, request);
+        }
+    }
+    if (!fullLists.empty()) {
+        auto lists = snapshot->LookupRegexBatchIds(fullLists);
+        for (size_t i = 0; i < fullLists.size(); ++i) {
+            answers[std::make_tuple(Op::Lookup, uint16_t(0), fullLists[i])].results = snapshot->ToStrings(lists[i]);
+        }
+    }
+
+    size_t errors = 0;
+    for (auto& pending : batch) {
+        Response response;
+        if (!pending.error.empty()) {
+            response.error = pending.error;
+        } else {
+            response = answers[std::make_tuple(pending.request.op, pending.request.k, pending.request.text)];
+        }
+        if (!response.error.empty()) errors++;
+        response.id = pending.request.id;
+        pending.response = LookupProtocol::EncodeResponse(response, pending.request.json);
+    }
+
+    _requests.fetch_add(batch.size(), std::memory_order_relaxed);
+    _batches.fetch_add(1, std::memory_order_relaxed);
+    _evaluations.fetch_add(answers.size(), std::memory_order_relaxed);
+    _errors.fetch_add(errors, std::memory_order_relaxed);
+    if (batch.size() > _largestBatch.load(std::memory_order_relaxed)) {
+        _largestBatch.store(batch.size(), std::memory_order_relaxed);
+    }
+
+    auto end = std::chrono::high_resolution_clock::now();
+    auto duration = std::chrono::duration_cast<std::chrono::microseconds>(end - start).count();
+    Debug::Log(L"LookupServer", (L"Batch: " + std::to_wstring(batch.size()) +
+                                 L" | Evaluations: " + std::to_wstring(answers.size()) +
+                                 L" | Time: " + std::to_wstring(duration / 1000) + L"." + std::to_wstring(duration % 1000) + L"ms")
+                                    .c_str());
+}
+
+Response CLookupServer::Evaluate(const CDictionaryData& data, const Request& request) const {
+    Response response;
+    if (request.text.empty()) {
+        response.error = "empty text";
+        return response;
+    }
+    size_t k = request.k == 0 ? SIZE_MAX : request.k;
+    switch (request.op) {
+        case Op::Lookup:
+            response.results = data.ToStrings(data.LookupTopKIds(request.text, k, false));
+            break;
+        case Op::Suggest:
+            response.results = _suggestions.Lookup(request.text);
+            break;
+        case Op::Codes:
+            response.results = data.GetCodesForCharacter(request.text);
+            break;
+    }
+    if (response.results.size() > k) response.results.resize(k);
+    return response;
+}
+
+#ifdef _WIN32
+
+CLookupServer::~CLookupServer() {
+    Stop();
+    if (_listenPipe) CloseHandle(_listenPipe);
+}
+
+std::wstring CLookupServer::GetDefaultAddress() {
+    return L"\\\\.\\pipe\\k6-lookup";
+}
+
+void* CLookupServer::CreatePipeInstance(bool first) {
+    const DWORD BUFFER_SIZE = 64 * 1024;
+    HANDLE pipe = CreateNamedPipeW(_pipeName.c_str(), PIPE_ACCESS_DUPLEX | (first ? FILE_FLAG_FIRST_PIPE_INSTANCE : 0),
+                                   PIPE_TYPE_BYTE | PIPE_READMODE_BYTE | PIPE_WAIT | PIPE_REJECT_REMOTE_CLIENTS,
+                                   PIPE_UNLIMITED_INSTANCES, BUFFER_SIZE, BUFFER_SIZE, 0, nullptr);
+    return pipe == INVALID_HANDLE_VALUE ? nullptr : pipe;
+}
+
+bool CLookupServer::Listen(const std::wstring& address) {
+    _pipeName = address;
+    _listenPipe = CreatePipeInstance(true);
+    if (!_listenPipe) {
+        Debug::Log(L"LookupServer", (L"Cannot create pipe: " + address).c_str());
+        return false;
+    }
+    return true;
+}
+
+void CLookupServer::Run() {
+    std::thread batcher(&CLookupServer::RunBatches, this);
+
+    HANDLE pipe = _listenPipe;
+    _listenPipe = nullptr;
+    while (!_stopping.load(std::memory_order_acquire)) {
+        if (!pipe) pipe = CreatePipeInstance(false);
+        if (!pipe) break;
+        bool connected = ConnectNamedPipe(pipe, nullptr) || GetLastError() == ERROR_PIPE_CONNECTED;
+        if (!connected || _stopping.load(std::memory_order_acquire)) {
+            CloseHandle(pipe);
+            pipe = nullptr;
+            continue;
+        }
+
+        _connections.fetch_add(1, std::memory_order_relaxed);
+        std::lock_guard<std::mutex> lock(_mutex);
+        uint64_t client = _nextClient++;
+        _pipes[client] = pipe;
+        _clientThreads.emplace_back(&CLookupServer::ServeClient, this, client, pipe);
+        pipe = nullptr;
+    }
+    if (pipe) CloseHandle(pipe);
+
+    // A client thread may be just about to start a read, so keep cancelling until all left
+    for (;;) {
+        {
+            std::lock_guard<std::mutex> lock(_mutex);
+            if (_pipes.empty()) break;
+            for (const auto& [client, clientPipe] : _pipes) CancelIoEx(clientPipe, nullptr);
+        }
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    }
+    for (auto& thread : _clientThreads) thread.join();
+    _clientThreads.clear();
+
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        _clientsDone = true;
+    }
+    _batchReady.notify_all();
+    batcher.join();
+}
+
+void CLookupServer::Stop() {
+    if (_stopping.exchange(true, std::memory_order_acq_rel)) return;
+
+    // Connect once so that Run's ConnectNamedPipe returns and sees the flag
+    HANDLE wake = CreateFileW(_pipeName.c_str(), GENERIC_READ | GENERIC_WRITE, 0, nullptr, OPEN_EXISTING, 0, nullptr);
+    if (wake != INVALID_HANDLE_VALUE) CloseHandle(wake);
+}
+
+void CLookupServer::ServeClient(uint64_t client, void* pipe) {
+    std::string input;
+    std::vector<char> buffer(64 * 1024);
+    for (;;) {
+        DWORD read = 0;
+        if (_stopping.load(std::memory_order_acquire) ||
+            !ReadFile(pipe, buffer.data(), static_cast<DWORD>(buffer.size()), &read, nullptr) || read == 0) {
+            break;
+        }
+        input.append(buffer.data(), read);
+
+        std::vector<Pending> requests;
+        bool fatal = false;
+        DecodeFrames(input, client, requests, fatal);
+        if (!requests.empty()) {
+            Answer(requests);
+            std::string output;
+            for (const auto& pending : requests) LookupProtocol::AppendFrame(output, pending.response);
+
+            size_t written = 0;
+            while (written < output.size()) {
+                DWORD chunk = 0;
+                if (!WriteFile(pipe, output.data() + written, static_cast<DWORD>(output.size() - written), &chunk, nullptr)) {
+                    fatal = true;
+                    break;
+                }
+                written += chunk;
+            }
+        }
+        if (fatal) break;
+    }
+
+    std::lock_guard<std::mutex> lock(_mutex);
+    _pipes.erase(client);
+    DisconnectNamedPipe(pipe);
+    CloseHandle(pipe);
+}
+
+void CLookupServer::Answer(std::vector<Pending>& requests) {
+    Submission submission{&requests};
+    std::unique_lock<std::mutex> lock(_mutex);
+    _queue.push_back(&submission);
+    _batchReady.notify_one();
+    _batchDone.wait(lock, [&submission]() { return submission.done; });
+}
+
+void CLookupServer::RunBatches() {
+    std::unique_lock<std::mutex> lock(_mutex);
+    for (;;) {
+        // Keep answering after Stop until the client threads stop asking
+        _batchReady.wait(lock, [this]() { return !_queue.empty() || _clientsDone; });
+        if (_queue.empty()) return;
+        std::vector<Submission*> taken;
+        taken.swap(_queue);
+        lock.unlock();
+
+        std::vector<Pending> batch;
+        for (Submission* submission : taken) {
+            for (auto& pending : *submission->requests) batch.push_back(std::move(pending));
+        }
+        ProcessBatch(batch);
+        size_t next = 0;
+        for (Submission* submission : taken) {
+            for (auto& pending : *submission->requests) pending = std::move(batch[next++]);
+        }
+
+        lock.lock();
+        for (Submission* submission : taken) submission->done = true;
+        _batchDone.notify_all();
+    }
+}
+
+#else
+
+namespace {
+
+const uint64_t LISTEN_ID = 0;
+const uint64_t WAKE_ID = 1;
+// A client that stops reading its answers is not read from until it catches up
+const size_t MAX_PENDING_OUTPUT = 4 << 20;
+
+}  // namespace
+
+CLookupServer::~CLookupServer() {
+    Shutdown();
+}
+
+std::wstring CLookupServer::GetDefaultAddress() {
+    const char* runtimeDir = std::getenv("XDG_RUNTIME_DIR");
+    if (runtimeDir && *runtimeDir) return Unicode::Utf8ToWide(std::string(runtimeDir) + "/k6-lookup.sock");
+    return Unicode::Utf8ToWide("/tmp/k6-lookup-" + std::to_string(getuid()) + ".sock");
+}
+
+bool CLookupServer::Listen(const std::wstring& address) {
+    Shutdown();
+    std::string path = Unicode::WideToUtf8(address);
+    sockaddr_un addr{};
+    addr.sun_family = AF_UNIX;
+    if (path.empty() || path.size() >= sizeof(addr.sun_path)) return false;
+    std::memcpy(addr.sun_path, path.c_str(), path.size() + 1);
+
+    // Replace a socket left behind by a server that did not shut down, but nothing else
+    struct stat existing;
+    if (lstat(path.c_str(), &existing) == 0) {
+        if (!S_ISSOCK(existing.st_mode)) return false;
+        unlink(path.c_str());
+    }
+
+    _listenFd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (_listenFd < 0) return false;
+    if (bind(_listenFd, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) != 0) {
+        Shutdown();
+        return false;
+    }
+    _socketPath = path;
+    chmod(path.c_str(), 0600);  // the same user's clients only
+    if (listen(_listenFd, SOMAXCONN) != 0) {
+        Shutdown();
+        return false;
+    }
+
+    _epollFd = epoll_create1(EPOLL_CLOEXEC);
+    _wakeFd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (_epollFd < 0 || _wakeFd < 0) {
+        Shutdown();
+        return false;
+    }
+    epoll_event event{};
+    event.events = EPOLLIN;
+    event.data.u64 = LISTEN_ID;
+    epoll_ctl(_epollFd, EPOLL_CTL_ADD, _listenFd, &event);
+    event.data.u64 = WAKE_ID;
+    epoll_ctl(_epollFd, EPOLL_CTL_ADD, _wakeFd, &event);
+    return true;
+}
+
+void CLookupServer::Run() {
+    if (_epollFd < 0) return;
+
+    epoll_event events[64];
+    std::vector<Pending> batch;
+    std::vector<uint64_t> touched;
+    while (!_stopping.load(std::memory_order_acquire)) {
+        int count = epoll_wait(_epollFd, events, 64, -1);
+        if (count < 0) {
+            if (errno == EINTR) continue;
+            break;
+        }
+
+        // Everything that arrived since the last batch goes into the next one
+        batch.clear();
+        touched.clear();
+        for (int i = 0; i < count; ++i) {
+            uint64_t id = events[i].data.u64;
+            if (id == LISTEN_ID) {
+                Accept();
+                continue;
+            }
+            if (id == WAKE_ID) {
+                uint64_t ignored;
+                while (read(_wakeFd, &ignored, sizeof(ignored)) > 0) {
+                }
+                continue;
+            }
+            auto it = _clients.find(id);
+            if (it == _clients.end()) continue;
+            touched.push_back(id);
+            if ((events[i].events & (EPOLLIN | EPOLLHUP | EPOLLRDHUP | EPOLLERR)) && !Read(it->second, id, batch)) {
+                Close(id);
+            }
+        }
+
+        if (!batch.empty()) {
+            ProcessBatch(batch);
+            for (const auto& pending : batch) {
+                auto it = _clients.find(pending.client);
+                if (it != _clients.end()) LookupProtocol::AppendFrame(it->second.output, pending.response);
+            }
+        }
+
+        // Write the answers straight away; only what does not fit waits for EPOLLOUT
+        for (uint64_t id : touched) {
+            auto it = _clients.find(id);
+            if (it == _clients.end()) continue;
+            Client& client = it->second;
+            if (!Flush(client) || (client.readClosed && client.output.empty())) {
+                Close(id);
+            } else {
+                UpdateEvents(client, id);
+            }
+        }
+    }
+    Shutdown();
+}
+
+void CLookupServer::Stop() {
+    _stopping.store(true, std::memory_order_release);
+    if (_wakeFd >= 0) {
+        uint64_t one = 1;
+        ssize_t ignored = write(_wakeFd, &one, sizeof(one));
+        (void)ignored;
+    }
+}
+
+void CLookupServer::Accept() {
+    for (;;) {
+        int fd = accept4(_listenFd, nullptr, nullptr, SOCK_NONBLOCK | SOCK_CLOEXEC);
+        if (fd < 0) return;  // EAGAIN once the backlog is empty
+
+        uint64_t id = _nextClient++;
+        Client& client = _clients[id];
+        client.fd = fd;
+        client.events = EPOLLIN | EPOLLRDHUP;
+        epoll_event event{};
+        event.events = client.events;
+        event.data.u64 = id;
+        if (epoll_ctl(_epollFd, EPOLL_CTL_ADD, fd, &event) != 0) {
+            close(fd);
+            _clients.erase(id);
+            continue;
+        }
+        _connections.fetch_add(1, std::memory_order_relaxed);
+    }
+}
+
+bool CLookupServer::Read(Client& client, uint64_t id, std::vector<Pending>& batch) {
+    char buffer[64 * 1024];
+    while (!client.readClosed && client.output.size() < MAX_PENDING_OUTPUT) {
+        ssize_t got = recv(client.fd, buffer, sizeof(buffer), 0);
+        if (got > 0) {
+            client.input.append(buffer, static_cast<size_t>(got));
+            bool fatal = false;
+            DecodeFrames(client.input, id, batch, fatal);
+            if (fatal) return false;
+            continue;
+        }
+        if (got == 0) {
+            // The client finished sending; answer what it asked before closing
+            client.readClosed = true;
+            break;
+        }
+        if (errno == EINTR) continue;
+        return errno == EAGAIN || errno == EWOULDBLOCK;
+    }
+    return true;
+}
+
+bool CLookupServer::Flush(Client& client) {
+    size_t written = 0;
+    while (written < client.output.size()) {
+        ssize_t sent = send(client.fd, client.output.data() + written, client.output.size() - written, MSG_NOSIGNAL);
+        if (sent > 0) {
+            written += static_cast<size_t>(sent);
+        } else if (sent < 0 && errno == EINTR) {
+            continue;
+        } else if (sent < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+            break;
+        } else {
+            return false;
+        }
+    }
+    client.output.erase(0, written);
+    return true;
+}
+
+void CLookupServer::UpdateEvents(Client& client, uint64_t id) {
+    uint32_t events = 0;
+    if (!client.readClosed && client.output.size() < MAX_PENDING_OUTPUT) events |= EPOLLIN | EPOLLRDHUP;
+    if (!client.output.empty()) events |= EPOLLOUT;
+    if (events == client.events) return;
+    client.events = events;
+    epoll_event event{};
+    event.events = events;
+    event.data.u64 = id;
+    epoll_ctl(_epollFd, EPOLL_CTL_MOD, client.fd, &event);
+}
+
+void CLookupServer::Close(uint64_t id) {
+    auto it = _clients.find(id);
+    if (it == _clients.end()) return;
+    epoll_ctl(_epollFd, EPOLL_CTL_DEL, it->second.fd, nullptr);
+    close(it->second.fd);
+    _clients.erase(it);
+}
+
+void CLookupServer::Shutdown() {
+    for (auto& [id, client] : _clients) close(client.fd);
+    _clients.clear();
+    if (_listenFd >= 0) close(_listenFd);
+    if (_epollFd >= 0) close(_epollFd);
+    if (_wakeFd >= 0) close(_wakeFd);
+    _listenFd = _epollFd = _wakeFd = -1;
+    if (!_socketPath.empty()) unlink(_socketPath.c_str());
+    _socketPath.clear();
+}
+
+#endif
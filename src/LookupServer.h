@@ -0,0 +1,128 @@
+#pragma once
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <map>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+#include "LookupProtocol.h"
+
+class CDictionary;
+class CDictionaryData;
+class CSuggestions;
+
+// Serves lookups to local clients (see LookupProtocol for the wire format) over a Unix
+// domain socket driven by one epoll loop on Linux, or a named pipe on Windows. Requests
+// that arrive together are answered as one batch: identical requests share a single
+// evaluation, full lists share one pass over the dictionary, and the whole batch reads
+// one snapshot. While a batch is being answered new requests queue up, so batches grow
+// with the load.
+class CLookupServer {
+   public:
+    struct Stats {
+        uint64_t connections = 0;
+        uint64_t requests = 0;
+        uint64_t batches = 0;
+        uint64_t evaluations = 0;  // distinct requests looked up
+        uint64_t largestBatch = 0;
+        uint64_t errors = 0;  // malformed requests and failed lookups
+    };
+
+    CLookupServer(const CDictionary& dictionary, const CSuggestions& suggestions);
+    ~CLookupServer();
+
+    CLookupServer(const CLookupServer&) = delete;
+    CLookupServer& operator=(const CLookupServer&) = delete;
+
+    // A socket path (a stale socket there is replaced) or a \\.\pipe\ name
+    bool Listen(const std::wstring& address);
+    // Serves clients on the calling thread until Stop
+    void Run();
+    // Any thread; on Linux also safe in a signal handler
+    void Stop();
+
+    Stats GetStats() const;
+    void LogStats() const;
+
+    // $XDG_RUNTIME_DIR/k6-lookup.sock (else /tmp/k6-lookup-<uid>.sock), \\.\pipe\k6-lookup on Windows
+    static std::wstring GetDefaultAddress();
+
+   private:
+    struct Pending {
+        uint64_t client = 0;
+        LookupProtocol::Request request;
+        std::string error;     // set when the request could not be decoded
+        std::string response;  // encoded payload, filled in by ProcessBatch
+    };
+
+    // Moves the whole frames at the front of input into batch; fatal is set when the
+    // stream cannot be parsed any further
+    static void DecodeFrames(std::string& input, uint64_t client, std::vector<Pending>& batch, bool& fatal);
+    void ProcessBatch(std::vector<Pending>& batch);
+    LookupProtocol::Response Evaluate(const CDictionaryData& data, const LookupProtocol::Request& request) const;
+
+    const CDictionary& _dictionary;
+    const CSuggestions& _suggestions;
+    std::atomic<bool> _stopping{false};
+
+    std::atomic<uint64_t> _connections{0};
+    std::atomic<uint64_t> _requests{0};
+    std::atomic<uint64_t> _batches{0};
+    std::atomic<uint64_t> _evaluations{0};
+    std::atomic<uint64_t> _largestBatch{0};
+    std::atomic<uint64_t> _errors{0};
+
+#ifdef _WIN32
+    // One thread per connected pipe reads its requests and writes the answers; a batch
+    // thread answers everything the client threads have queued
+    struct Submission {
+        std::vector<Pending>* requests;
+        bool done = false;
+    };
+
+    void* CreatePipeInstance(bool first);
+    void ServeClient(uint64_t client, void* pipe);
+    void Answer(std::vector<Pending>& requests);
+    void RunBatches();
+
+    std::wstring _pipeName;
+    void* _listenPipe = nullptr;  // first instance, created by Listen
+
+    std::mutex _mutex;
+    std::condition_variable _batchReady;
+    std::condition_variable _batchDone;
+    std::vector<Submission*> _queue;
+    std::map<uint64_t, void*> _pipes;  // connected clients, for cancelling their reads on Stop
+    std::vector<std::thread> _clientThreads;  // Run's thread only
+    bool _clientsDone = false;                // every client thread has finished
+    uint64_t _nextClient = 1;
+#else
+    struct Client {
+        int fd = -1;
+        std::string input;
+        std::string output;
+        uint32_t events = 0;  // what epoll is watching for
+        bool readClosed = false;
+    };
+
+    void Accept();
+    // Reads what the client sent and decodes it into batch; false once the connection broke
+    bool Read(Client& client, uint64_t id, std::vector<Pending>& batch);
+    // Writes what it can; false once the connection broke
+    bool Flush(Client& client);
+    void UpdateEvents(Client& client, uint64_t id);
+    void Close(uint64_t id);
+    void Shutdown();
+
+    std::string _socketPath;
+    int _listenFd = -1;
+    int _epollFd = -1;
+    int _wakeFd = -1;  // eventfd that interrupts epoll_wait for Stop
+    std::unordered_map<uint64_t, Client> _clients;
+    uint64_t _nextClient = 2;  // 0 and 1 tag the listening socket and _wakeFd
+#endif
+};
@@ -0,0 +1,139 @@
+#include "LookupWorker.h"
+
+#include "Debug.h"
+#include "Dictionary.h"
+
+CLookupWorker::CLookupWorker(const CDictionary& dictionary, std::function<void()> notify)
+    : _dictionary(dictionary), _notify(std::move(notify)) {
+}
+
+CLookupWorker::~CLookupWorker() {
+    Stop();
+}
+
+void CLookupWorker::Start() {
+    if (_thread.joinable()) return;
+    _stopping = false;
+    _thread = std::thread(&CLookupWorker::Run, this);
+}
+
+void CLookupWorker::Stop() {
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        _stopping = true;
+    }
+    Cancel();
+    _wakeWorker.notify_all();
+    _resultReady.notify_all();
+    if (_thread.joinable()) _thread.join();
+
+    // Nothing runs any more, so the UI thread may drain the worker's side too
+    Request request;
+    while (_requests.Pop(request)) {
+    }
+    delete _mailbox.exchange(nullptr, std::memory_order_acq_rel);
+}
+
+uint64_t CLookupWorker::Submit(const std::wstring& pattern, size_t k, bool exactLengthFirst) {
+    uint64_t sequence = ++_nextSequence;
+    _latest.store(sequence, std::memory_order_release);
+    if (!_thread.joinable() || !_requests.Push({sequence, pattern, k, exactLengthFirst})) return 0;
+    _submitted.fetch_add(1, std::memory_order_relaxed);
+
+    // Taking the lock orders the push before the worker's check for an empty queue
+    { std::lock_guard<std::mutex> lock(_mutex); }
+    _wakeWorker.notify_one();
+    return sequence;
+}
+
+void CLookupWorker::Cancel() {
+    _latest.store(++_nextSequence, std::memory_order_release);
+}
+
+bool CLookupWorker::TakeNewest(Result& result) {
+    std::unique_ptr<Result> taken(_mailbox.exchange(nullptr, std::memory_order_acq_rel));
+    if (!taken) return false;
+    result = std::move(*taken);
+    return true;
+}
+
+bool CLookupWorker::Wait(uint64_t sequence, std::chrono::milliseconds timeout, Result& result) {
+    auto deadline = std::chrono::steady_clock::now() + (timeout == NO_DEADLINE ? std::chrono::milliseconds(0) : timeout);
+    std::unique_lock<std::mutex> lock(_mutex);
+    for (;;) {
+        // Sequences only grow, so a result for a newer request means ours will never come
+        if (TakeNewest(result)) {
+            if (result.sequence == sequence) return true;
+            if (result.sequence > sequence) return false;
+        }
+        if (_stopping) return false;
+        if (timeout == NO_DEADLINE) {
+            _resultReady.wait(lock);
+        } else if (_resultReady.wait_until(lock, deadline) == std::cv_status::timeout) {
+            if (TakeNewest(result) && result.sequence == sequence) return true;
+            _deadlineMisses.fetch_add(1, std::memory_order_relaxed);
+            return false;
+        }
+    }
+}
+
+bool CLookupWorker::TakeResult(Result& result) {
+    return TakeNewest(result) && result.sequence == _latest.load(std::memory_order_acquire);
+}
+
+CLookupWorker::Stats CLookupWorker::GetStats() const {
+    Stats stats;
+    stats.submitted = _submitted.load(std::memory_order_relaxed);
+    stats.completed = _completed.load(std::memory_order_relaxed);
+    stats.cancelled = _cancelled.load(std::memory_order_relaxed);
+    stats.deadlineMisses = _deadlineMisses.load(std::memory_order_relaxed);
+    return stats;
+}
+
+void CLookupWorker::LogStats() const {
+    Stats stats = GetStats();
+    Debug::Log(L"LookupWorker", (L"Submitted: " + std::to_wstring(stats.submitted) +
+                                 L" | Completed: " + std::to_wstring(stats.completed) +
+                                 L" | Cancelled: " + std::to_wstring(stats.cancelled) +
+                                 L" | Past deadline: " + std::to_wstring(stats.deadlineMisses))
+                                    .c_str());
+}
+
+void CLookupWorker::Run() {
+    for (;;) {
+        {
+            std::unique_lock<std::mutex> lock(_mutex);
+            _wakeWorker.wait(lock, [this]() { return _stopping || !_requests.IsEmpty(); });
+            if (_stopping) return;
+        }
+
+        // Everything but the newest queued request is already out of date
+        Request request, next;
+        bool first = true;
+        while (_requests.Pop(next)) {
+            if (!first) _cancelled.fetch_add(1, std::memory_order_relaxed);
+            request = std::move(next);
+            first = false;
+        }
+        if (request.sequence != _latest.load(std::memory_order_acquire)) {
+            _cancelled.fetch_add(1, std::memory_order_relaxed);
+            continue;
+        }
+
+        auto result = std::make_unique<Result>();
+        result->sequence = request.sequence;
+        result->pattern = request.pattern;
+        result->candidates = _dictionary.LookupTopK(request.pattern, request.k, request.exactLengthFirst,
+                                                    &result->fromPrefetch, &_latest, request.sequence);
+        if (_latest.load(std::memory_order_acquire) != request.sequence) {
+            _cancelled.fetch_add(1, std::memory_order_relaxed);
+            continue;
+        }
+
+        delete _mailbox.exchange(result.release(), std::memory_order_acq_rel);
+        _completed.fetch_add(1, std::memory_order_relaxed);
+        { std::lock_guard<std::mutex> lock(_mutex); }  // see Submit
+        _resultReady.notify_all();
+        if (_notify) _notify();
+    }
+}
@@ -0,0 +1,95 @@
+#pragma once
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "SpscQueue.h"
+
+class CDictionary;
+
+// Runs the UI thread's first-page lookups on a worker thread. Requests travel over a
+// lock-free single-producer queue and carry a sequence number; submitting a new one
+// cancels the older ones, including a scan already running (the engine checks the
+// sequence as its cancellation token). Only the newest finished result is kept, in a
+// lock-free mailbox the UI thread takes it from.
+class CLookupWorker {
+   public:
+    static constexpr int DEFAULT_DEADLINE_MS = 30;
+    static constexpr auto NO_DEADLINE = std::chrono::milliseconds::max();
+
+    struct Result {
+        uint64_t sequence = 0;
+        std::wstring pattern;
+        std::vector<std::wstring> candidates;
+        bool fromPrefetch = false;
+    };
+
+    struct Stats {
+        uint64_t submitted = 0;
+        uint64_t completed = 0;       // results published
+        uint64_t cancelled = 0;       // requests dropped or scans abandoned for a newer one
+        uint64_t deadlineMisses = 0;  // Wait calls that ran out of time
+    };
+
+    // notify runs on the worker thread after each result is published
+    CLookupWorker(const CDictionary& dictionary, std::function<void()> notify);
+    ~CLookupWorker();
+
+    CLookupWorker(const CLookupWorker&) = delete;
+    CLookupWorker& operator=(const CLookupWorker&) = delete;
+
+    void Start();
+    void Stop();
+
+    // UI thread only. Returns the request's sequence number, or 0 if the queue is full
+    // (the caller then looks up itself); either way older requests are cancelled.
+    uint64_t Submit(const std::wstring& pattern, size_t k, bool exactLengthFirst);
+    void Cancel();
+
+    // UI thread only. Waits up to timeout for the result of sequence; results of older
+    // requests are discarded on the way.
+    bool Wait(uint64_t sequence, std::chrono::milliseconds timeout, Result& result);
+    // UI thread only. Takes the published result, if it is for the newest request.
+    bool TakeResult(Result& result);
+
+    Stats GetStats() const;
+    void LogStats() const;
+
+   private:
+    struct Request {
+        uint64_t sequence = 0;
+        std::wstring pattern;
+        size_t k = 0;
+        bool exactLengthFirst = false;
+    };
+
+    void Run();
+    bool TakeNewest(Result& result);
+
+    const CDictionary& _dictionary;
+    std::function<void()> _notify;
+
+    CSpscQueue<Request, 16> _requests;     // UI thread -> worker
+    std::atomic<Result*> _mailbox{nullptr};  // worker -> UI thread, newest result only
+    std::atomic<uint64_t> _latest{0};       // sequence of the newest request; older work stops
+    uint64_t _nextSequence = 0;             // UI thread only
+
+    // Only for sleeping: the worker waits for requests, the UI thread in Wait for results
+    std::mutex _mutex;
+    std::condition_variable _wakeWorker;
+    std::condition_variable _resultReady;
+    bool _stopping = false;
+    std::thread _thread;
+
+    std::atomic<uint64_t> _submitted{0};
+    std::atomic<uint64_t> _completed{0};
+    std::atomic<uint64_t> _cancelled{0};
+    std::atomic<uint64_t> _deadlineMisses{0};
+};
@@ -0,0 +1,468 @@
+#include "LoudsTrie.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <deque>
+#include <filesystem>
+#include <fstream>
+#include <functional>
+#include <queue>
+
+#include "DataFile.h"
+#include "Debug.h"
+
+static constexpr char LOUDS_TRIE_MAGIC[4] = {'K', '6', 'L', 'T'};
+static constexpr uint32_t LOUDS_TRIE_VERSION = 3;
+
+CLoudsTrie::CLoudsTrie() {
+}
+
+CLoudsTrie::~CLoudsTrie() {
+}
+
+void CLoudsTrie::Clear() {
+    _children = CBitVector();
+    _terminal = CBitVector();
+    _valueStarts = CBitVector();
+    _values = CPackedArray();
+    _valueRanks = CPackedArray();
+    _bestRanks = CPackedArray();
+    _characterStarts = CPackedArray();
+    _valuesByCharacter = CPackedArray();
+    _file.Close();
+}
+
+void CLoudsTrie::Build(const std::vector<std::wstring_view>& codes, const std::vector<CharId>& values,
+                       uint64_t dataHash) {
+    auto start = std::chrono::high_resolution_clock::now();
+    Clear();
+    _dataHash = dataHash;
+
+    // Codes as stroke-index strings, sorted; stable so values keep rank order per code
+    std::vector<std::string> digits(codes.size());
+    std::vector<uint32_t> order;
+    order.reserve(codes.size());
+    for (uint32_t e = 0; e < codes.size(); ++e) {
+        bool valid = true;
+        for (wchar_t ch : codes[e]) {
+            int symbol = Stroke::ToIndex(ch);
+            if (symbol < 0 || symbol >= Stroke::COUNT) valid = false;
+            digits[e].push_back(static_cast<char>(symbol));
+        }
+        if (valid) order.push_back(e);
+    }
+    std::stable_sort(order.begin(), order.end(), [&digits](uint32_t a, uint32_t b) { return digits[a] < digits[b]; });
+
+    // Level order: each queued node owns the sorted range of codes sharing its prefix
+    struct Range {
+        size_t begin, end, depth;
+    };
+    std::deque<Range> queue{{0, order.size(), 0}};
+    std::vector<uint32_t> packedValues, valueRanks, bestRanks;
+
+    while (!queue.empty()) {
+        Range range = queue.front();
+        queue.pop_front();
+
+        // An entry's rank is its index, so the subtree's best is the smallest index in range
+        uint32_t best = UINT32_MAX;
+        for (size_t r = range.begin; r < range.end; ++r) best = (std::min)(best, order[r]);
+        bestRanks.push_back(best);
+
+        // Codes ending here sort before longer ones
+        size_t i = range.begin;
+        bool terminal = false;
+        for (; i < range.end && digits[order[i]].size() == range.depth; ++i) {
+            _valueStarts.PushBack(!terminal);
+            packedValues.push_back(values[order[i]]);
+            valueRanks.push_back(order[i]);
+            terminal = true;
+        }
+        _terminal.PushBack(terminal);
+
+        for (int stroke = 0; stroke < Stroke::COUNT; ++stroke) {
+            size_t j = i;
+            while (j < range.end && digits[order[j]][range.depth] == stroke) ++j;
+            if (j > i) queue.push_back({i, j, range.depth + 1});
+            _children.PushBack(j > i);
+            i = j;
+        }
+    }
+
+    _children.Finish();
+    _terminal.Finish();
+    _valueStarts.Finish();
+    _values.Build(packedValues);
+    _valueRanks.Build(valueRanks);
+    _rankShift = 0;
+    while ((static_cast<uint64_t>(order.size()) >> _rankShift) >= (1ull << BEST_RANK_BITS)) _rankShift++;
+    for (uint32_t& rank : bestRanks) rank >>= _rankShift;
+    _bestRanks.Build(bestRanks);
+    BuildReverseIndex();
+
+    auto end = std::chrono::high_resolution_clock::now();
+    auto duration = std::chrono::duration_cast<std::chrono::microseconds>(end - start).count();
+    Debug::Log(L"LoudsTrie", (L"Built " + std::to_wstring(GetNodeCount()) + L" nodes, " +
+                              std::to_wstring(GetCodeCount()) + L" codes" +
+                              L" | Memory: " + std::to_wstring(GetMemoryUsage() / 1024) + L"KB" +
+                              L" | Time: " + std::to_wstring(duration / 1000) + L"." + std::to_wstring(duration % 1000) + L"ms")
+                                 .c_str());
+}
+
+bool CLoudsTrie::Save(const std::wstring& path) const {
+    if (_terminal.GetSize() == 0) return false;
+
+    std::vector<uint64_t> words;
+    Write(words);
+
+    Header header = {};
+    std::memcpy(header.magic, LOUDS_TRIE_MAGIC, sizeof(header.magic));
+    header.version = LOUDS_TRIE_VERSION;
+    header.dataHash = _dataHash;
+    header.wordCount = words.size();
+
+    std::ofstream file(std::filesystem::path(path), std::ios::binary | std::ios::trunc);
+    if (!file.is_open()) return false;
+    file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+    file.write(reinterpret_cast<const char*>(words.data()), static_cast<std::streamsize>(words.size() * sizeof(uint64_t)));
+    return file.good();
+}
+
+bool CLoudsTrie::Load(const std::wstring& path, uint64_t dataHash) {
+    Clear();
+    if (!_file.Open(path)) return false;
+
+    Header header;
+    bool valid = _file.GetSize() >= sizeof(header);
+    if (valid) {
+        std::memcpy(&header, _file.GetData(), sizeof(header));
+        valid = std::memcmp(header.magic, LOUDS_TRIE_MAGIC, sizeof(header.magic)) == 0 &&
+                header.version == LOUDS_TRIE_VERSION && header.dataHash == dataHash &&
+                _file.GetSize() == sizeof(header) + header.wordCount * sizeof(uint64_t);
+    }
+    if (valid) {
+        // The mapping is page aligned and the header is a multiple of 8 bytes
+        const uint64_t* data = reinterpret_cast<const uint64_t*>(_file.GetData() + sizeof(header));
+        const uint64_t* end = data + header.wordCount;
+        valid = Read(data, end) && data == end;
+    }
+    if (!valid) {
+        Debug::Log(L"LoudsTrie", (L"Ignoring stale or invalid trie: " + path).c_str());
+        Clear();
+        return false;
+    }
+    _dataHash = dataHash;
+    return true;
+}
+
+void CLoudsTrie::Write(std::vector<uint64_t>& out) const {
+    out.push_back(_rankShift);
+    _children.Write(out);
+    _terminal.Write(out);
+    _valueStarts.Write(out);
+    _values.Write(out);
+    _valueRanks.Write(out);
+    _bestRanks.Write(out);
+}
+
+bool CLoudsTrie::Read(const uint64_t*& data, const uint64_t* end) {
+    if (data == end || *data >= 32) return false;
+    uint32_t rankShift = static_cast<uint32_t>(*data++);
+    bool valid = _children.Read(data, end) && _terminal.Read(data, end) && _valueStarts.Read(data, end) &&
+                 _values.Read(data, end) && _valueRanks.Read(data, end) && _bestRanks.Read(data, end) &&
+                 _children.GetSize() == _terminal.GetSize() * Stroke::COUNT &&
+                 _children.GetOneCount() + 1 == _terminal.GetSize() && _valueStarts.GetSize() == _values.GetSize() &&
+                 _valueRanks.GetSize() == _values.GetSize() && _bestRanks.GetSize() == _terminal.GetSize();
+    if (!valid) return false;
+
+    _rankShift = rankShift;
+    BuildReverseIndex();
+    return true;
+}
+
+void CLoudsTrie::BuildReverseIndex() {
+    // Counting sort of the value indexes by CharId
+    size_t characterCount = 0;
+    for (size_t i = 0; i < _values.GetSize(); ++i) {
+        characterCount = (std::max)(characterCount, static_cast<size_t>(_values.Get(i)) + 1);
+    }
+    std::vector<uint32_t> starts(characterCount + 1, 0);
+    for (size_t i = 0; i < _values.GetSize(); ++i) starts[_values.Get(i) + 1]++;
+    for (size_t c = 0; c < characterCount; ++c) starts[c + 1] += starts[c];
+
+    std::vector<uint32_t> byCharacter(_values.GetSize());
+    std::vector<uint32_t> fill(starts.begin(), starts.end() - 1);
+    for (size_t i = 0; i < _values.GetSize(); ++i) byCharacter[fill[_values.Get(i)]++] = static_cast<uint32_t>(i);
+
+    _characterStarts.Build(starts);
+    _valuesByCharacter.Build(byCharacter);
+}
+
+bool CLoudsTrie::Lookup(std::wstring_view code, std::vector<CharId>& values) const {
+    values.clear();
+    if (_terminal.GetSize() == 0) return false;
+
+    uint32_t node = ROOT;
+    for (wchar_t ch : code) {
+        int stroke = Stroke::ToIndex(ch);
+        if (stroke < 0 || stroke >= Stroke::COUNT) return false;
+        node = GetChild(node, stroke);
+        if (node == ROOT) return false;
+    }
+
+    if (!_terminal.Get(node)) return false;
+    GetValues(node, values);
+    return true;
+}
+
+void CLoudsTrie::GetValueRange(uint32_t node, size_t& begin, size_t& end) const {
+    begin = end = 0;
+    if (!_terminal.Get(node)) return;
+    size_t t = _terminal.Rank1(node);
+    begin = _valueStarts.Select1(t);
+    end = t + 1 < _valueStarts.GetOneCount() ? _valueStarts.Select1(t + 1) : _values.GetSize();
+}
+
+void CLoudsTrie::GetValues(uint32_t node, std::vector<CharId>& values) const {
+    size_t begin, end;
+    GetValueRange(node, begin, end);
+    for (size_t i = begin; i < end; ++i) values.push_back(_values.Get(i));
+}
+
+void CLoudsTrie::TopK(std::wstring_view pattern, size_t k, bool exactLengthFirst, std::vector<CharId>& out) const {
+    out.clear();
+    if (_terminal.GetSize() == 0 || k == 0) return;
+
+    std::vector<int> symbols;
+    for (wchar_t ch : pattern) {
+        int symbol = Stroke::ToIndex(ch);
+        if (symbol == Stroke::INVALID_INDEX) return;
+        symbols.push_back(symbol);
+    }
+
+    // Queue items are either a node (keyed by a lower bound on its subtree's ranks) or a
+    // single value; value ranks are unique, so values pop out best first
+    struct Item {
+        uint32_t rank;
+        uint32_t node;
+        uint32_t depth;
+        uint32_t value;  // NO_VALUE for node items
+        bool operator>(const Item& other) const { return rank > other.rank; }
+    };
+    static constexpr uint32_t NO_VALUE = UINT32_MAX;
+
+    std::vector<uint64_t> seen(((size_t(1) << _values.GetWidth()) + 63) / 64, 0);
+    auto search = [&](bool exactOnly) {
+        std::priority_queue<Item, std::vector<Item>, std::greater<Item>> queue;
+        queue.push({_bestRanks.Get(ROOT) << _rankShift, ROOT, 0, NO_VALUE});
+        while (!queue.empty() && out.size() < k) {
+            Item item = queue.top();
+            queue.pop();
+
+            if (item.value != NO_VALUE) {
+                CharId id = _values.Get(item.value);
+                uint64_t mask = 1ull << (id & 63);
+                if (!(seen[id >> 6] & mask)) {
+                    seen[id >> 6] |= mask;
+                    out.push_back(id);
+                }
+                continue;
+            }
+
+            if (item.depth >= symbols.size() && (!exactOnly || item.depth == symbols.size())) {
+                size_t begin, end;
+                GetValueRange(item.node, begin, end);
+                for (size_t i = begin; i < end; ++i) {
+                    queue.push({_valueRanks.Get(i), item.node, item.depth, static_cast<uint32_t>(i)});
+                }
+            }
+            if (exactOnly && item.depth == symbols.size()) continue;
+
+            for (int stroke = 0; stroke < Stroke::COUNT; ++stroke) {
+                if (item.depth < symbols.size() && symbols[item.depth] != Stroke::WILDCARD_INDEX &&
+                    symbols[item.depth] != stroke) {
+                    continue;
+                }
+                uint32_t child = GetChild(item.node, stroke);
+                if (child != ROOT) queue.push({_bestRanks.Get(child) << _rankShift, child, item.depth + 1, NO_VALUE});
+            }
+        }
+    };
+
+    if (exactLengthFirst) search(true);
+    search(false);
+}
+
+void CLoudsTrie::FuzzyTopK(std::wstring_view pattern, uint32_t maxEdits, size_t k, std::vector<CharId>& out) const {
+    out.clear();
+    maxEdits = GetMaxEdits(pattern.size(), maxEdits);
+    if (_terminal.GetSize() == 0 || k == 0 || maxEdits == 0) return;
+
+    std::vector<int> symbols;
+    for (wchar_t ch : pattern) {
+        int symbol = Stroke::ToIndex(ch);
+        if (symbol == Stroke::INVALID_INDEX) return;
+        symbols.push_back(symbol);
+    }
+    const size_t m = symbols.size();
+    if (m <= maxEdits) return;
+    auto same = [&](size_t j, int stroke) { return symbols[j] == stroke || symbols[j] == Stroke::WILDCARD_INDEX; };
+
+    // Automaton states: the edit-distance row (pattern position -> edits) of a code
+    // prefix, its last stroke and its parent state, which the swap rule looks back at
+    struct State {
+        uint32_t parent;
+        int stroke;
+    };
+    static constexpr uint32_t NO_STATE = UINT32_MAX;
+    std::vector<State> states{{NO_STATE, -1}};
+    std::vector<uint8_t> rows(m + 1);
+    for (size_t j = 0; j <= m; ++j) rows[j] = static_cast<uint8_t>((std::min)(j, size_t(UINT8_MAX)));
+
+    // Queue items are ordered by (edits, rank), both lower bounds for nodes. A node keeps
+    // its state while a prefix below it could still come closer to the pattern; after
+    // that its whole subtree matches with `matched` edits.
+    struct Item {
+        uint32_t edits;
+        uint32_t rank;
+        uint32_t node;
+        uint32_t value;  // NO_VALUE for node items
+        uint32_t state;  // NO_STATE once the edit count is settled
+        uint32_t matched;
+        bool operator>(const Item& other) const {
+            return edits != other.edits ? edits > other.edits : rank > other.rank;
+        }
+    };
+    static constexpr uint32_t NO_VALUE = UINT32_MAX;
+
+    std::vector<uint64_t> seen(((size_t(1) << _values.GetWidth()) + 63) / 64, 0);
+    std::vector<std::wstring> codes;
+    auto matchesExactly = [&](CharId id) {
+        FindCodes(id, codes);
+        for (const auto& code : codes) {
+            size_t j = 0;
+            while (j < m && j < code.size() && same(j, Stroke::ToIndex(code[j]))) ++j;
+            if (j == m) return true;
+        }
+        return false;
+    };
+
+    std::vector<Item> storage;
+    storage.reserve(1024);
+    std::priority_queue<Item, std::vector<Item>, std::greater<Item>> queue(std::greater<Item>(), std::move(storage));
+    queue.push({0, _bestRanks.Get(ROOT) << _rankShift, ROOT, NO_VALUE, 0, static_cast<uint32_t>(m)});
+    std::vector<uint8_t> row(m + 1);
+    while (!queue.empty() && out.size() < k) {
+        Item item = queue.top();
+        queue.pop();
+
+        if (item.value != NO_VALUE) {
+            CharId id = _values.Get(item.value);
+            uint64_t mask = 1ull << (id & 63);
+            if (!(seen[id >> 6] & mask)) {
+                seen[id >> 6] |= mask;
+                if (!matchesExactly(id)) out.push_back(id);
+            }
+            continue;
+        }
+
+        if (item.matched <= maxEdits) {
+            size_t begin, end;
+            GetValueRange(item.node, begin, end);
+            for (size_t i = begin; i < end; ++i) {
+                queue.push({item.matched, _valueRanks.Get(i), item.node, static_cast<uint32_t>(i), NO_STATE, item.matched});
+            }
+        }
+
+        for (int stroke = 0; stroke < Stroke::COUNT; ++stroke) {
+            uint32_t child = GetChild(item.node, stroke);
+            if (child == ROOT) continue;
+            uint32_t rank = _bestRanks.Get(child) << _rankShift;
+            if (item.state == NO_STATE) {
+                queue.push({item.matched, rank, child, NO_VALUE, NO_STATE, item.matched});
+                continue;
+            }
+
+            // One automaton step: the child's row from its parent's (and grandparent's)
+            const uint8_t* previous = &rows[item.state * (m + 1)];
+            const State& parent = states[item.state];
+            const uint8_t* beforeParent = parent.parent != NO_STATE ? &rows[parent.parent * (m + 1)] : nullptr;
+            row[0] = static_cast<uint8_t>((std::min)(previous[0] + 1, int(UINT8_MAX)));
+            uint32_t best = row[0];
+            for (size_t j = 1; j <= m; ++j) {
+                int cost = (std::min)(previous[j] + 1, row[j - 1] + 1);
+                cost = (std::min)(cost, previous[j - 1] + (same(j - 1, stroke) ? 0 : 1));
+                if (beforeParent && j > 1 && same(j - 1, parent.stroke) && same(j - 2, stroke)) {
+                    cost = (std::min)(cost, beforeParent[j - 2] + 1);
+                }
+                row[j] = static_cast<uint8_t>((std::min)(cost, int(UINT8_MAX)));
+                best = (std::min)(best, uint32_t(row[j]));
+            }
+
+            // An exact prefix: everything below is an exact match, not a fuzzy one
+            if (row[m] == 0) continue;
+            uint32_t matched = (std::min)(item.matched, uint32_t(row[m]));
+            if (best >= matched) {
+                if (matched <= maxEdits) queue.push({matched, rank, child, NO_VALUE, NO_STATE, matched});
+            } else if (best <= maxEdits) {
+                uint32_t state = static_cast<uint32_t>(states.size());
+                states.push_back({item.state, stroke});
+                rows.insert(rows.end(), row.begin(), row.end());
+                queue.push({best, rank, child, NO_VALUE, state, matched});
+            }
+        }
+    }
+}
+
+std::wstring CLoudsTrie::GetCode(uint32_t node) const {
+    // Node n (n > 0) hangs off the n-th set child bit, which encodes parent and stroke
+    std::wstring code;
+    while (node != ROOT) {
+        size_t bit = _children.Select1(node - 1);
+        code.push_back(Stroke::FromIndex(static_cast<int>(bit % Stroke::COUNT)));
+        node = static_cast<uint32_t>(bit / Stroke::COUNT);
+    }
+    std::reverse(code.begin(), code.end());
+    return code;
+}
+
+void CLoudsTrie::FindCodes(CharId id, std::vector<std::wstring>& codes) const {
+    std::vector<std::pair<uint32_t, std::wstring>> entries;
+    FindEntries(id, entries);
+    codes.clear();
+    for (auto& entry : entries) {
+        // A code listed twice for the character keeps its better rank
+        if (std::find(codes.begin(), codes.end(), entry.second) == codes.end()) codes.push_back(std::move(entry.second));
+    }
+}
+
+void CLoudsTrie::FindEntries(CharId id, std::vector<std::pair<uint32_t, std::wstring>>& entries) const {
+    entries.clear();
+    if (static_cast<size_t>(id) + 1 >= _characterStarts.GetSize()) return;
+    for (size_t k = _characterStarts.Get(id); k < _characterStarts.Get(id + 1); ++k) {
+        size_t i = _valuesByCharacter.Get(k);
+        size_t t = _valueStarts.Rank1(i + 1) - 1;
+        entries.emplace_back(static_cast<uint32_t>(_valueRanks.Get(i)), GetCode(static_cast<uint32_t>(_terminal.Select1(t))));
+    }
+    std::sort(entries.begin(), entries.end());
+}
+
+uint32_t CLoudsTrie::GetBestRank(CharId id) const {
+    uint32_t best = UINT32_MAX;
+    if (static_cast<size_t>(id) + 1 >= _characterStarts.GetSize()) return best;
+    for (size_t k = _characterStarts.Get(id); k < _characterStarts.Get(id + 1); ++k) {
+        best = (std::min)(best, _valueRanks.Get(_valuesByCharacter.Get(k)));
+    }
+    return best;
+}
+
+std::wstring CLoudsTrie::GetPathForDictionary(const std::wstring& dictionaryPath) {
+    return CDataFile::GetSidePath(dictionaryPath, L".trie");
+}
+
+size_t CLoudsTrie::GetMemoryUsage() const {
+    return _children.GetMemoryUsage() + _terminal.GetMemoryUsage() + _valueStarts.GetMemoryUsage() +
+           _values.GetMemoryUsage() + _valueRanks.GetMemoryUsage() + _bestRanks.GetMemoryUsage() +
+           _characterStarts.GetMemoryUsage() + _valuesByCharacter.GetMemoryUsage();
+}
@@ -0,0 +1,156 @@
+#pragma once
+#include <algorithm>
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+#include "BitVector.h"
+#include "CharacterTable.h"
+#include "MappedFile.h"
+#include "PackedArray.h"
+#include "Stroke.h"
+
+// Succinct trie over the stroke codes in the LOUDS-Dense layout: nodes are numbered in
+// level order and each has a 5-bit child bitmap (one bit per stroke) plus a terminal
+// bit; each code's CharIds are bit-packed. A child's number is the rank of its bit, a
+// parent is found by select, so the trie is a few flat arrays with no labels or
+// pointers and can be memory-mapped from the compiled side file. Every value keeps its
+// rank and every node the best rank below it, for best-first top-K searches.
+class CLoudsTrie {
+   public:
+    CLoudsTrie();
+    ~CLoudsTrie();
+
+    CLoudsTrie(const CLoudsTrie&) = delete;
+    CLoudsTrie& operator=(const CLoudsTrie&) = delete;
+
+    // codes/values are the dictionary entries in rank order (best first); an entry's
+    // rank is its index. Codes holding symbols other than the five strokes are left out.
+    void Build(const std::vector<std::wstring_view>& codes, const std::vector<CharId>& values, uint64_t dataHash);
+
+    bool Save(const std::wstring& path) const;
+    // Fails if the file is missing, malformed or was built from different data
+    bool Load(const std::wstring& path, uint64_t dataHash);
+
+    // The trie as words, for files that hold it among other data (Save puts a header of
+    // its own in front). Read leaves data just past the trie and keeps pointing at it,
+    // so the buffer must outlive this object.
+    void Write(std::vector<uint64_t>& out) const;
+    bool Read(const uint64_t*& data, const uint64_t* end);
+
+    // CharIds stored for exactly this code, in rank order
+    bool Lookup(std::wstring_view code, std::vector<CharId>& values) const;
+
+    // Calls visit(node) for every code that starts with pattern ('＊' matches any
+    // stroke), in stroke order (一丨丿丶フ)
+    template <typename Visit>
+    void ForEachMatch(std::wstring_view pattern, Visit&& visit) const;
+
+    // Up to k distinct CharIds whose codes start with pattern, best rank first. Only
+    // subtrees that can still beat the k-th result are opened. With exactLengthFirst,
+    // codes exactly as long as the pattern come before longer ones.
+    void TopK(std::wstring_view pattern, size_t k, bool exactLengthFirst, std::vector<CharId>& out) const;
+
+    // Up to k distinct CharIds with a code that starts within maxEdits edits of pattern
+    // (an insertion, deletion, substitution or swap of two adjacent strokes is one
+    // edit), fewest edits first, then best rank. Characters with a code starting with
+    // pattern itself are left out. The walk carries one edit-distance row per trie
+    // depth, a Levenshtein automaton run over the trie, and drops every subtree whose
+    // row already exceeds maxEdits, which is capped by GetMaxEdits.
+    void FuzzyTopK(std::wstring_view pattern, uint32_t maxEdits, size_t k, std::vector<CharId>& out) const;
+    // Two edits in a four-stroke pattern would match nearly anything
+    static uint32_t GetMaxEdits(size_t patternLength, uint32_t maxEdits) {
+        return patternLength == 0 ? 0 : (std::min)(maxEdits, static_cast<uint32_t>((patternLength - 1) / 2));
+    }
+
+    void GetValues(uint32_t node, std::vector<CharId>& values) const;
+    std::wstring GetCode(uint32_t node) const;
+
+    // Every code stored for the character, best rank first and without duplicates
+    void FindCodes(CharId id, std::vector<std::wstring>& codes) const;
+
+    // Every (rank, code) stored for the character, best rank first
+    void FindEntries(CharId id, std::vector<std::pair<uint32_t, std::wstring>>& entries) const;
+
+    // Best (lowest) rank among the character's values, UINT32_MAX if it has none
+    uint32_t GetBestRank(CharId id) const;
+
+    // Side-file name used next to the dictionary
+    static std::wstring GetPathForDictionary(const std::wstring& dictionaryPath);
+
+    size_t GetCodeCount() const { return _terminal.GetOneCount(); }
+    size_t GetNodeCount() const { return _terminal.GetSize(); }
+    bool IsMapped() const { return _file.IsOpen(); }
+    size_t GetMemoryUsage() const;
+    size_t GetMappedSize() const { return _file.GetSize(); }
+
+   private:
+    struct Header {
+        char magic[4];
+        uint32_t version;
+        uint64_t dataHash;
+        uint64_t wordCount;
+        uint64_t reserved;
+    };
+
+    // Subtree bounds are stored as rank >> _rankShift in this many bits; a rounded-down
+    // bound still never hides a better value, it only opens a few extra nodes
+    static constexpr uint32_t BEST_RANK_BITS = 10;
+
+    static constexpr uint32_t ROOT = 0;
+
+    // The child reached from node by stroke, or ROOT if there is none
+    uint32_t GetChild(uint32_t node, int stroke) const {
+        size_t bit = static_cast<size_t>(node) * Stroke::COUNT + stroke;
+        return _children.Get(bit) ? static_cast<uint32_t>(_children.Rank1(bit) + 1) : ROOT;
+    }
+    void Clear();
+    // Range of node's values in _values, empty for non-terminal nodes
+    void GetValueRange(uint32_t node, size_t& begin, size_t& end) const;
+
+    CBitVector _children;      // Stroke::COUNT bits per node in level order
+    CBitVector _terminal;      // per node: a code ends here
+    CBitVector _valueStarts;   // per value: first value of its code
+    CPackedArray _values;      // CharIds, grouped by terminal node
+    CPackedArray _valueRanks;  // rank of each value
+    CPackedArray _bestRanks;   // per node: best (lowest) rank in its subtree >> _rankShift
+
+    // Reverse index, always built in memory: the value indexes of character c are
+    // _valuesByCharacter[_characterStarts[c] .. _characterStarts[c + 1])
+    void BuildReverseIndex();
+    CPackedArray _characterStarts;
+    CPackedArray _valuesByCharacter;
+
+    uint32_t _rankShift = 0;
+    uint64_t _dataHash = 0;
+    CMappedFile _file;
+};
+
+template <typename Visit>
+void CLoudsTrie::ForEachMatch(std::wstring_view pattern, Visit&& visit) const {
+    if (_terminal.GetSize() == 0) return;
+
+    std::vector<int> symbols;
+    for (wchar_t ch : pattern) {
+        int symbol = Stroke::ToIndex(ch);
+        if (symbol == Stroke::INVALID_INDEX) return;
+        symbols.push_back(symbol);
+    }
+
+    // Depth-first, pushing children in reverse so they pop in label order
+    std::vector<std::pair<uint32_t, uint32_t>> stack{{ROOT, 0}};
+    while (!stack.empty()) {
+        auto [node, depth] = stack.back();
+        stack.pop_back();
+
+        if (depth >= symbols.size() && _terminal.Get(node)) visit(node);
+
+        for (int stroke = Stroke::COUNT; stroke-- > 0;) {
+            if (depth < symbols.size() && symbols[depth] != Stroke::WILDCARD_INDEX && symbols[depth] != stroke) continue;
+            uint32_t child = GetChild(node, stroke);
+            if (child != ROOT) stack.push_back({child, depth + 1});
+        }
+    }
+}
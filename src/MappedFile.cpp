@@ -0,0 +1,115 @@
+#include "MappedFile.h"
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <filesystem>
+#endif
+
+CMappedFile::CMappedFile()
+    : _data(nullptr),
+      _size(0),
+      _opened(false)
+#ifdef _WIN32
+      ,
+      _file(INVALID_HANDLE_VALUE),
+      _mapping(nullptr)
+#endif
+{
+}
+
+CMappedFile::~CMappedFile() {
+    Close();
+}
+
+#ifdef _WIN32
+
+bool CMappedFile::Open(const std::wstring& path) {
+    Close();
+
+    HANDLE file = CreateFileW(path.c_str(), GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE,
+                              nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL | FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+    if (file == INVALID_HANDLE_VALUE) return false;
+
+    LARGE_INTEGER size;
+    if (!GetFileSizeEx(file, &size)) {
+        CloseHandle(file);
+        return false;
+    }
+
+    _file = file;
+    _opened = true;
+    _size = static_cast<size_t>(size.QuadPart);
+    if (_size == 0) return true;
+
+    _mapping = CreateFileMappingW(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+    if (!_mapping) {
+        Close();
+        return false;
+    }
+
+    _data = static_cast<const char*>(MapViewOfFile(_mapping, FILE_MAP_READ, 0, 0, 0));
+    if (!_data) {
+        Close();
+        return false;
+    }
+    return true;
+}
+
+void CMappedFile::Close() {
+    if (_data) UnmapViewOfFile(_data);
+    if (_mapping) CloseHandle(_mapping);
+    if (_file != INVALID_HANDLE_VALUE) CloseHandle(_file);
+    _data = nullptr;
+    _mapping = nullptr;
+    _file = INVALID_HANDLE_VALUE;
+    _size = 0;
+    _opened = false;
+}
+
+#else
+
+bool CMappedFile::Open(const std::wstring& path) {
+    Close();
+
+    int fd = open(std::filesystem::path(path).c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0) return false;
+
+    struct stat st;
+    if (fstat(fd, &st) != 0) {
+        close(fd);
+        return false;
+    }
+
+    _opened = true;
+    _size = static_cast<size_t>(st.st_size);
+    if (_size == 0) {
+        close(fd);
+        return true;
+    }
+
+    void* mapped = mmap(nullptr, _size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (mapped == MAP_FAILED) {
+        Close();
+        return false;
+    }
+
+    madvise(mapped, _size, MADV_SEQUENTIAL);
+    _data = static_cast<const char*>(mapped);
+    return true;
+}
+
+void CMappedFile::Close() {
+    if (_data) munmap(const_cast<char*>(_data), _size);
+    _data = nullptr;
+    _size = 0;
+    _opened = false;
+}
+
+#endif
@@ -0,0 +1,29 @@
+#pragma once
+#include <cstddef>
+#include <string>
+
+// Read-only memory mapping of a whole file (CreateFileMapping on Windows, mmap elsewhere)
+class CMappedFile {
+   public:
+    CMappedFile();
+    ~CMappedFile();
+
+    CMappedFile(const CMappedFile&) = delete;
+    CMappedFile& operator=(const CMappedFile&) = delete;
+
+    bool Open(const std::wstring& path);
+    void Close();
+
+    const char* GetData() const { return _data; }
+    size_t GetSize() const { return _size; }
+    bool IsOpen() const { return _opened; }
+
+   private:
+    const char* _data;
+    size_t _size;
+    bool _opened;  // an empty file opens successfully but has no mapping
+#ifdef _WIN32
+    void* _file;
+    void* _mapping;
+#endif
+};
@@ -0,0 +1,25 @@
+#include "MemoryReport.h"
+
+size_t CMemoryReport::GetHeapBytes() const {
+    size_t bytes = 0;
+    for (const Item& item : _items) bytes += item.heapBytes;
+    return bytes;
+}
+
+size_t CMemoryReport::GetMappedBytes() const {
+    size_t bytes = 0;
+    for (const Item& item : _items) bytes += item.mappedBytes;
+    return bytes;
+}
+
+std::wstring CMemoryReport::ToString() const {
+    std::wstring text;
+    for (const Item& item : _items) {
+        text += item.name + L": " + std::to_wstring(item.heapBytes / 1024) + L"KB";
+        if (item.mappedBytes) text += L" + " + std::to_wstring(item.mappedBytes / 1024) + L"KB mapped";
+        text += L"\n";
+    }
+    text += L"Total: " + std::to_wstring(GetHeapBytes() / 1024) + L"KB + " + std::to_wstring(GetMappedBytes() / 1024) +
+            L"KB mapped\n";
+    return text;
+}
@@ -0,0 +1,30 @@
+#pragma once
+#include <cstddef>
+#include <string>
+#include <vector>
+
+// Memory held per structure, as collected by the GetMemoryReport methods. Heap bytes
+// are the process's own; mapped bytes are file pages the system shares between the
+// processes that map the same file and can drop under pressure.
+class CMemoryReport {
+   public:
+    struct Item {
+        std::wstring name;  // component/structure, e.g. dictionary/trie
+        size_t heapBytes;
+        size_t mappedBytes;
+    };
+
+    void Add(const std::wstring& name, size_t heapBytes, size_t mappedBytes = 0) {
+        _items.push_back({name, heapBytes, mappedBytes});
+    }
+
+    const std::vector<Item>& GetItems() const { return _items; }
+    size_t GetHeapBytes() const;
+    size_t GetMappedBytes() const;
+
+    // One line per item, then the totals, in KB
+    std::wstring ToString() const;
+
+   private:
+    std::vector<Item> _items;
+};
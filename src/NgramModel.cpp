@@ -0,0 +1,218 @@
+#include "NgramModel.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <tuple>
+
+#include "Debug.h"
+
+// Score multiplier for each character of context dropped ("stupid backoff")
+static constexpr float BACKOFF = 0.4f;
+
+CNgramModel::CNgramModel() {
+}
+
+CNgramModel::~CNgramModel() {
+}
+
+void CNgramModel::Build(std::vector<Ngram> ngrams) {
+    auto start = std::chrono::high_resolution_clock::now();
+
+    // Contexts are stored newest character first
+    struct Entry {
+        std::u32string key;
+        CharId item;
+        float weight;
+        uint32_t first;  // position of the first occurrence, breaks score ties
+    };
+    std::vector<Entry> entries;
+    entries.reserve(ngrams.size());
+    for (uint32_t i = 0; i < ngrams.size(); ++i) {
+        auto& ngram = ngrams[i];
+        if (ngram.context.empty() || ngram.context.size() >= MAX_ORDER) continue;
+        std::reverse(ngram.context.begin(), ngram.context.end());
+        entries.push_back({std::move(ngram.context), ngram.item, ngram.weight, i});
+    }
+    std::stable_sort(entries.begin(), entries.end(), [](const Entry& a, const Entry& b) {
+        return std::tie(a.key, a.item) < std::tie(b.key, b.item);
+    });
+
+    // Merge repeats
+    size_t merged = 0;
+    for (size_t i = 0; i < entries.size(); ++i) {
+        if (merged > 0 && entries[merged - 1].key == entries[i].key && entries[merged - 1].item == entries[i].item) {
+            entries[merged - 1].weight += entries[i].weight;
+        } else {
+            if (merged != i) entries[merged] = std::move(entries[i]);
+            merged++;
+        }
+    }
+    entries.resize(merged);
+
+    // Per depth: the sorted distinct key prefixes of that length are the trie nodes
+    std::vector<std::u32string> nodes[MAX_ORDER - 1];
+    for (size_t d = 0; d < MAX_ORDER - 1; ++d) {
+        for (const auto& entry : entries) {
+            if (entry.key.size() <= d) continue;
+            std::u32string_view prefix(entry.key.data(), d + 1);
+            if (nodes[d].empty() || nodes[d].back() != prefix) nodes[d].emplace_back(prefix);
+        }
+    }
+
+    for (size_t d = 0; d < MAX_ORDER - 1; ++d) {
+        std::vector<uint32_t> codePoints, childStarts, itemStarts, items, scores;
+        size_t child = 0, e = 0;
+        childStarts.push_back(0);
+        itemStarts.push_back(0);
+
+        for (const auto& node : nodes[d]) {
+            codePoints.push_back(node.back());
+
+            if (d + 1 < MAX_ORDER - 1) {
+                const auto& next = nodes[d + 1];
+                while (child < next.size() && next[child].compare(0, d + 1, node) == 0) child++;
+            }
+            childStarts.push_back(static_cast<uint32_t>(child));
+
+            // This node's items are the entries whose whole key is the node
+            while (e < entries.size() && entries[e].key < node) e++;
+            size_t groupEnd = e;
+            float total = 0.0f;
+            while (groupEnd < entries.size() && entries[groupEnd].key == node) total += entries[groupEnd++].weight;
+
+            std::vector<std::pair<uint32_t, const Entry*>> group;
+            for (size_t g = e; g < groupEnd; ++g) {
+                float share = entries[g].weight / total;
+                group.emplace_back(static_cast<uint32_t>((std::clamp)(std::lround(share * 255.0f), 1L, 255L)),
+                                   &entries[g]);
+            }
+            std::sort(group.begin(), group.end(), [](const auto& a, const auto& b) {
+                return a.first != b.first ? a.first > b.first : a.second->first < b.second->first;
+            });
+            for (const auto& [score, entry] : group) {
+                items.push_back(entry->item);
+                scores.push_back(score);
+            }
+            itemStarts.push_back(static_cast<uint32_t>(items.size()));
+            e = groupEnd;
+        }
+
+        Level& level = _levels[d];
+        level.codePoints.Build(codePoints);
+        level.childStarts.Build(childStarts);
+        level.itemStarts.Build(itemStarts);
+        level.items.Build(items);
+        level.scores.Build(scores);
+    }
+
+    auto end = std::chrono::high_resolution_clock::now();
+    auto duration = std::chrono::duration_cast<std::chrono::microseconds>(end - start).count();
+    std::wstring orders;
+    for (size_t order = 2; order <= MAX_ORDER; ++order) {
+        orders += L" | Order " + std::to_wstring(order) + L": " + std::to_wstring(GetContextCount(order)) +
+                  L" contexts, " + std::to_wstring(GetItemCount(order)) + L" items, " +
+                  std::to_wstring(GetMemoryUsage(order) / 1024) + L"KB";
+    }
+    Debug::Log(L"NgramModel", (L"Built" + orders +
+                               L" | Time: " + std::to_wstring(duration / 1000) + L"." + std::to_wstring(duration % 1000) + L"ms")
+                                  .c_str());
+}
+
+size_t CNgramModel::Find(const Level& level, size_t begin, size_t end, char32_t codePoint) {
+    while (begin < end) {
+        size_t mid = begin + (end - begin) / 2;
+        uint32_t value = level.codePoints.Get(mid);
+        if (value == codePoint) return mid;
+        if (value < codePoint) {
+            begin = mid + 1;
+        } else {
+            end = mid;
+        }
+    }
+    return SIZE_MAX;
+}
+
+void CNgramModel::Lookup(std::u32string_view history, size_t maxResults, std::vector<CharId>& out) const {
+    out.clear();
+
+    // Walk back from the newest character as far as the trie has contexts
+    size_t found[MAX_ORDER - 1];
+    size_t depth = 0;
+    size_t begin = 0, end = _levels[0].codePoints.GetSize();
+    while (depth < MAX_ORDER - 1 && depth < history.size()) {
+        const Level& level = _levels[depth];
+        size_t node = Find(level, begin, end, history[history.size() - 1 - depth]);
+        if (node == SIZE_MAX) break;
+        found[depth++] = node;
+        begin = level.childStarts.Get(node);
+        end = level.childStarts.Get(node + 1);
+    }
+    if (depth == 0) return;
+
+    // An item predicted by several contexts keeps its best score
+    struct Candidate {
+        float score;
+        size_t depth;
+        size_t position;
+        CharId item;
+    };
+    std::vector<Candidate> candidates;
+    float weight = 1.0f;
+    for (size_t d = depth; d-- > 0;) {
+        const Level& level = _levels[d];
+        size_t first = level.itemStarts.Get(found[d]), last = level.itemStarts.Get(found[d] + 1);
+        for (size_t i = first; i < last; ++i) {
+            candidates.push_back({weight * level.scores.Get(i), d, i - first, level.items.Get(i)});
+        }
+        weight *= BACKOFF;
+    }
+
+    auto better = [](const Candidate& a, const Candidate& b) {
+        if (a.score != b.score) return a.score > b.score;
+        if (a.depth != b.depth) return a.depth > b.depth;
+        return a.position < b.position;
+    };
+    if (depth > 1) {
+        std::sort(candidates.begin(), candidates.end(), [&](const Candidate& a, const Candidate& b) {
+            return a.item != b.item ? a.item < b.item : better(a, b);
+        });
+        candidates.erase(std::unique(candidates.begin(), candidates.end(),
+                                     [](const Candidate& a, const Candidate& b) { return a.item == b.item; }),
+                         candidates.end());
+        std::sort(candidates.begin(), candidates.end(), better);
+    }
+
+    size_t count = (std::min)(maxResults, candidates.size());
+    out.reserve(count);
+    for (size_t i = 0; i < count; ++i) out.push_back(candidates[i].item);
+}
+
+void CNgramModel::GetBigrams(std::vector<std::pair<char32_t, CharId>>& out) const {
+    out.clear();
+    const Level& level = _levels[0];
+    out.reserve(level.items.GetSize());
+    for (size_t node = 0; node < level.codePoints.GetSize(); ++node) {
+        for (size_t i = level.itemStarts.Get(node); i < level.itemStarts.Get(node + 1); ++i) {
+            out.emplace_back(level.codePoints.Get(node), level.items.Get(i));
+        }
+    }
+}
+
+size_t CNgramModel::GetContextCount(size_t order) const {
+    if (order < 2 || order > MAX_ORDER) return 0;
+    return _levels[order - 2].codePoints.GetSize();
+}
+
+size_t CNgramModel::GetItemCount(size_t order) const {
+    if (order < 2 || order > MAX_ORDER) return 0;
+    return _levels[order - 2].items.GetSize();
+}
+
+size_t CNgramModel::GetMemoryUsage(size_t order) const {
+    if (order < 2 || order > MAX_ORDER) return 0;
+    const Level& level = _levels[order - 2];
+    return level.codePoints.GetMemoryUsage() + level.childStarts.GetMemoryUsage() + level.itemStarts.GetMemoryUsage() +
+           level.items.GetMemoryUsage() + level.scores.GetMemoryUsage();
+}
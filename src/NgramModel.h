@@ -0,0 +1,61 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+#include "CharacterTable.h"
+#include "PackedArray.h"
+
+// Next-phrase model over the last few committed characters. Contexts live in a trie
+// keyed by code point, newest character first, so one walk from the root reaches the
+// bigram, trigram and 4-gram context of the text typed so far. Each trie level is a
+// run of packed code points (sorted within every parent) with packed child and item
+// offsets; item scores are relative frequencies quantized to 8 bits.
+class CNgramModel {
+   public:
+    static constexpr size_t MAX_ORDER = 4;  // up to three characters of context
+
+    struct Ngram {
+        std::u32string context;  // oldest character first, 1 to MAX_ORDER - 1 long
+        CharId item;
+        float weight;
+    };
+
+    CNgramModel();
+    ~CNgramModel();
+
+    CNgramModel(CNgramModel&&) = default;
+    CNgramModel& operator=(CNgramModel&&) = default;
+
+    // Repeated (context, item) pairs add up; ties keep the order of first appearance
+    void Build(std::vector<Ngram> ngrams);
+
+    // Items predicted after history (oldest character first), best first. The longest
+    // matching context scores in full and each shorter one backs off by a constant factor.
+    void Lookup(std::u32string_view history, size_t maxResults, std::vector<CharId>& out) const;
+
+    // Every (character, item) pair of order 2, best first within a character
+    void GetBigrams(std::vector<std::pair<char32_t, CharId>>& out) const;
+
+    // order is 2 (one character of context) to MAX_ORDER
+    size_t GetContextCount(size_t order) const;
+    size_t GetItemCount(size_t order) const;
+    size_t GetMemoryUsage(size_t order) const;
+
+   private:
+    struct Level {
+        CPackedArray codePoints;   // one per context node
+        CPackedArray childStarts;  // node i's children are [childStarts[i], childStarts[i+1]) one level down
+        CPackedArray itemStarts;   // node i's items are [itemStarts[i], itemStarts[i+1])
+        CPackedArray items;        // best first within a node
+        CPackedArray scores;       // 1-255, share of the node's total weight
+    };
+
+    // Index of codePoint among nodes [begin, end) of level, or SIZE_MAX
+    static size_t Find(const Level& level, size_t begin, size_t end, char32_t codePoint);
+
+    Level _levels[MAX_ORDER - 1];
+};
@@ -0,0 +1,45 @@
+#include "PackedArray.h"
+
+CPackedArray::CPackedArray() {
+}
+
+CPackedArray::~CPackedArray() {
+}
+
+void CPackedArray::Build(const std::vector<uint32_t>& values) {
+    uint32_t maxValue = 0;
+    for (uint32_t value : values) maxValue = value > maxValue ? value : maxValue;
+    _width = 0;
+    while (_width < 32 && (maxValue >> _width) != 0) _width++;
+    _size = values.size();
+
+    _owned.assign(WordCount(_size, _width), 0);
+    for (size_t i = 0; i < _size && _width; ++i) {
+        size_t bit = i * _width;
+        size_t word = bit >> 6, offset = bit & 63;
+        _owned[word] |= static_cast<uint64_t>(values[i]) << offset;
+        if (offset + _width > 64) _owned[word + 1] |= static_cast<uint64_t>(values[i]) >> (64 - offset);
+    }
+    _words = _owned.data();
+}
+
+void CPackedArray::Write(std::vector<uint64_t>& out) const {
+    out.push_back(_size);
+    out.push_back(_width);
+    out.insert(out.end(), _words, _words + WordCount(_size, _width));
+}
+
+bool CPackedArray::Read(const uint64_t*& data, const uint64_t* end) {
+    if (end - data < 2) return false;
+    size_t size = static_cast<size_t>(data[0]);
+    uint32_t width = static_cast<uint32_t>(data[1]);
+    if (width > 32 || static_cast<size_t>(end - data - 2) < WordCount(size, width)) return false;
+
+    _owned.clear();
+    _owned.shrink_to_fit();
+    _size = size;
+    _width = width;
+    _words = data + 2;
+    data += 2 + WordCount(size, width);
+    return true;
+}
@@ -0,0 +1,42 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+// Array of unsigned integers stored with the fewest bits that fit the largest value.
+// Like CBitVector it can be a view into a compiled file.
+class CPackedArray {
+   public:
+    CPackedArray();
+    ~CPackedArray();
+
+    CPackedArray(CPackedArray&&) = default;
+    CPackedArray& operator=(CPackedArray&&) = default;
+
+    void Build(const std::vector<uint32_t>& values);
+
+    uint32_t Get(size_t i) const {
+        if (_width == 0) return 0;
+        size_t bit = i * _width;
+        size_t word = bit >> 6, offset = bit & 63;
+        uint64_t value = _words[word] >> offset;
+        if (offset + _width > 64) value |= _words[word + 1] << (64 - offset);
+        return static_cast<uint32_t>(value & ((1ull << _width) - 1));
+    }
+
+    size_t GetSize() const { return _size; }
+    uint32_t GetWidth() const { return _width; }
+    size_t GetMemoryUsage() const { return _owned.capacity() * sizeof(uint64_t); }
+
+    // Serialized as {size, width, words...}; see CBitVector::Read
+    void Write(std::vector<uint64_t>& out) const;
+    bool Read(const uint64_t*& data, const uint64_t* end);
+
+   private:
+    static size_t WordCount(size_t size, uint32_t width) { return (size * width + 63) / 64; }
+
+    const uint64_t* _words = nullptr;
+    std::vector<uint64_t> _owned;
+    size_t _size = 0;
+    uint32_t _width = 0;
+};
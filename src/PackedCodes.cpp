@@ -0,0 +1,60 @@
+#include "PackedCodes.h"
+
+#include <algorithm>
+
+#include "Stroke.h"
+
+CPackedCodes::CPackedCodes() {
+}
+
+CPackedCodes::~CPackedCodes() {
+}
+
+bool CPackedCodes::Build(const std::vector<std::wstring_view>& codes) {
+    Clear();
+    size_t total = 0;
+    for (std::wstring_view code : codes) total += code.size();
+    if (total > UINT32_MAX) return false;
+
+    std::vector<uint64_t> strokes((total + STROKES_PER_WORD - 1) / STROKES_PER_WORD, 0);
+    std::vector<uint32_t> offsets;
+    offsets.reserve(codes.size() + 1);
+    size_t p = 0;
+    for (std::wstring_view code : codes) {
+        offsets.push_back(static_cast<uint32_t>(p));
+        for (wchar_t ch : code) {
+            int stroke = Stroke::ToIndex(ch);
+            if (stroke < 0 || stroke >= Stroke::COUNT) return false;
+            strokes[p / STROKES_PER_WORD] |= static_cast<uint64_t>(stroke) << (3 * (p % STROKES_PER_WORD));
+            ++p;
+        }
+    }
+    offsets.push_back(static_cast<uint32_t>(p));
+
+    _strokes = std::move(strokes);
+    _offsets.Build(offsets);
+    return true;
+}
+
+void CPackedCodes::Clear() {
+    std::vector<uint64_t>().swap(_strokes);
+    _offsets = CPackedArray();
+}
+
+std::wstring_view CPackedCodes::Get(size_t i, std::wstring& buffer, size_t maxLength) const {
+    size_t begin = _offsets.Get(i), end = _offsets.Get(i + 1);
+    end = begin + (std::min)(end - begin, maxLength);
+    buffer.resize(end - begin);
+    size_t word = begin / STROKES_PER_WORD, shift = 3 * (begin % STROKES_PER_WORD);
+    uint64_t bits = begin < end ? _strokes[word] >> shift : 0;
+    for (size_t p = begin; p < end; ++p) {
+        if (shift == 3 * STROKES_PER_WORD) {
+            bits = _strokes[++word];
+            shift = 0;
+        }
+        buffer[p - begin] = Stroke::FromIndex(static_cast<int>(bits & 7));
+        bits >>= 3;
+        shift += 3;
+    }
+    return std::wstring_view(buffer.data(), buffer.size());
+}
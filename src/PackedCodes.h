@@ -0,0 +1,53 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "PackedArray.h"
+
+// Stroke codes at three bits a stroke, 21 strokes to a word, found by their offsets: a
+// tenth of the plain text on 4-byte wchar_t. CDictionaryData scans these under a memory
+// budget instead of its plain code store.
+class CPackedCodes {
+   public:
+    CPackedCodes();
+    ~CPackedCodes();
+
+    CPackedCodes(CPackedCodes&&) = default;
+    CPackedCodes& operator=(CPackedCodes&&) = default;
+
+    // Fails, leaving the store empty, if a code holds anything but the five strokes
+    bool Build(const std::vector<std::wstring_view>& codes);
+    void Clear();
+
+    size_t GetSize() const { return _offsets.GetSize() ? _offsets.GetSize() - 1 : 0; }
+    size_t GetLength(size_t i) const { return _offsets.Get(i + 1) - _offsets.Get(i); }
+
+    // Stroke index (see Stroke::ToIndex) of code i's stroke at position
+    int GetStroke(size_t i, size_t position) const {
+        size_t p = _offsets.Get(i) + position;
+        return static_cast<int>(_strokes[p / STROKES_PER_WORD] >> (3 * (p % STROKES_PER_WORD)) & 7);
+    }
+
+    // Code i written out into buffer, or its first maxLength strokes
+    std::wstring_view Get(size_t i, std::wstring& buffer, size_t maxLength = SIZE_MAX) const;
+
+    // Calls visit(stroke index) for code i's strokes in order while it returns true
+    template <typename Visit>
+    void ForEachStroke(size_t i, Visit&& visit) const {
+        size_t begin = _offsets.Get(i), end = _offsets.Get(i + 1);
+        for (size_t p = begin; p < end; ++p) {
+            if (!visit(static_cast<int>(_strokes[p / STROKES_PER_WORD] >> (3 * (p % STROKES_PER_WORD)) & 7))) return;
+        }
+    }
+
+    size_t GetMemoryUsage() const { return _strokes.capacity() * sizeof(uint64_t) + _offsets.GetMemoryUsage(); }
+
+   private:
+    static constexpr size_t STROKES_PER_WORD = 21;
+
+    std::vector<uint64_t> _strokes;
+    CPackedArray _offsets;  // GetSize() + 1 of them, into the strokes
+};
@@ -0,0 +1,43 @@
+#include "PatternBatch.h"
+
+bool CPatternBatch::Add(std::wstring_view pattern) {
+    // Symbols (stroke index or WILDCARD_INDEX) and, per position, whether ～ follows
+    std::vector<int> symbols;
+    std::vector<bool> loops(1, false);
+    for (wchar_t ch : pattern) {
+        if (ch == Stroke::ANY_STROKES[0]) {
+            loops.back() = true;
+            continue;
+        }
+        int symbol = Stroke::ToIndex(ch);
+        if (symbol == Stroke::INVALID_INDEX) return false;
+        symbols.push_back(symbol);
+        loops.push_back(false);
+    }
+    if (pattern.empty() || symbols.size() >= 64) return false;
+    if (!Stroke::HasAnyStrokes(pattern)) loops.back() = true;
+
+    uint32_t bits = static_cast<uint32_t>(symbols.size()) + 1;
+    if (_words.empty() || _words.back().used + bits > 64) {
+        _words.emplace_back();
+        _words.back().first = _count;
+    }
+    Word& word = _words.back();
+    uint32_t offset = word.used;
+    word.start |= 1ull << offset;
+    for (size_t i = 0; i < loops.size(); ++i) {
+        if (loops[i]) word.loop |= 1ull << (offset + i);
+    }
+    for (size_t i = 0; i < symbols.size(); ++i) {
+        uint64_t bit = 1ull << (offset + i + 1);
+        for (int stroke = 0; stroke < Stroke::COUNT; ++stroke) {
+            if (symbols[i] == stroke || symbols[i] == Stroke::WILDCARD_INDEX) word.advance[stroke] |= bit;
+        }
+    }
+    uint32_t last = offset + bits - 1;
+    word.accept |= 1ull << last;
+    word.patternAt[last] = static_cast<uint8_t>(_count - word.first);
+    word.used += bits;
+    _count++;
+    return true;
+}
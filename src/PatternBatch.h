@@ -0,0 +1,61 @@
+#pragma once
+#include <array>
+#include <cstdint>
+#include <string_view>
+#include <vector>
+
+#include "Bits.h"
+#include "Stroke.h"
+
+// Several lookup patterns matched against a code together, shift-and style. Pattern p
+// with m strokes/＊ owns m + 1 adjacent bits of a 64-bit word, bit i meaning "the first
+// i symbols matched"; a ～ after symbol i lets bit i stay set on any stroke. One stroke
+// then advances every pattern in the word at once:
+//
+//     live = ((live << 1) & advance[stroke]) | (live & loop)
+//
+// A pattern's first bit is never in advance, so the bit shifted in from the pattern
+// below is dropped. Patterns mean what they mean to LookupRegex: without ～ only the
+// start is anchored (as if the pattern ended with ～).
+class CPatternBatch {
+   public:
+    // Returns false, adding nothing, for symbols other than strokes, ＊ and ～ and for
+    // patterns of 64 symbols or more. Patterns are numbered in the order they are added.
+    bool Add(std::wstring_view pattern);
+
+    size_t GetCount() const { return _count; }
+
+    // Calls onMatch(index) for every pattern matching the whole code
+    template <typename OnMatch>
+    void Match(std::wstring_view code, OnMatch&& onMatch) const {
+        for (const Word& word : _words) {
+            uint64_t live = word.start;
+            for (wchar_t ch : code) {
+                int stroke = Stroke::ToIndex(ch);
+                if (stroke < 0 || stroke >= Stroke::COUNT) {
+                    live = 0;
+                    break;
+                }
+                live = ((live << 1) & word.advance[stroke]) | (live & word.loop);
+                if (!live) break;
+            }
+            for (uint64_t hits = live & word.accept; hits; hits &= hits - 1) {
+                onMatch(word.first + word.patternAt[Bits::CountTrailingZeros(hits)]);
+            }
+        }
+    }
+
+   private:
+    struct Word {
+        uint64_t start = 0;   // first bit of every pattern
+        uint64_t loop = 0;    // bits followed by ～
+        uint64_t accept = 0;  // last bit of every pattern
+        std::array<uint64_t, Stroke::COUNT> advance{};
+        std::array<uint8_t, 64> patternAt{};  // accept bit -> pattern, counted from first
+        size_t first = 0;                     // index of the word's first pattern
+        uint32_t used = 0;                    // bits taken
+    };
+
+    std::vector<Word> _words;
+    size_t _count = 0;
+};
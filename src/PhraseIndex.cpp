@@ -0,0 +1,277 @@
+#include "PhraseIndex.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <memory>
+#include <unordered_map>
+
+#include "DataFile.h"
+#include "Debug.h"
+#include "Dictionary.h"
+#include "Suggestions.h"
+#include "Unicode.h"
+
+static constexpr char PHRASE_INDEX_MAGIC[4] = {'K', '6', 'P', 'I'};
+static constexpr uint32_t PHRASE_INDEX_VERSION = 1;
+
+// Characters with several codes can give a phrase several abbreviations; keep a few
+static constexpr size_t MAX_VARIANTS = 4;
+
+CPhraseIndex::CPhraseIndex() : _data(std::make_unique<Data>()) {
+}
+
+CPhraseIndex::~CPhraseIndex() {
+    if (_builder.joinable()) _builder.join();
+}
+
+void CPhraseIndex::BuildInBackground(const CSuggestions& suggestions, const CDictionary& dictionary) {
+    if (_builder.joinable()) _builder.join();
+    _builder = std::thread([this, &suggestions, &dictionary] { Build(suggestions, dictionary); });
+}
+
+void CPhraseIndex::Build(const CSuggestions& suggestions, const CDictionary& dictionary) {
+    std::lock_guard<std::mutex> lock(_buildMutex);
+    auto start = std::chrono::high_resolution_clock::now();
+
+    std::vector<std::wstring> phrases = suggestions.GetPhrases();
+
+    // Distinct one- and two-stroke code prefixes per character, from its best code on, so
+    // the variants MAX_VARIANTS keeps are the likeliest ones. Only reverse lookups, which
+    // a sharded dictionary answers without decoding a shard.
+    struct Prefixes {
+        std::vector<std::wstring> strokes[2];
+    };
+    std::unordered_map<std::wstring, Prefixes> prefixes;
+    auto getPrefixes = [&](const std::wstring& character) -> const Prefixes& {
+        auto it = prefixes.find(character);
+        if (it != prefixes.end()) return it->second;
+        Prefixes entry;
+        for (const auto& code : dictionary.GetCodesForCharacter(character)) {
+            for (size_t width = 1; width <= 2; ++width) {
+                auto& list = entry.strokes[width - 1];
+                std::wstring prefix = code.substr(0, width);
+                if (prefix.size() == width && std::find(list.begin(), list.end(), prefix) == list.end()) {
+                    list.push_back(prefix);
+                }
+            }
+        }
+        return prefixes.emplace(character, std::move(entry)).first->second;
+    };
+
+    CCharacterTable table;
+    std::vector<uint32_t> ranks;
+    std::vector<std::pair<std::wstring, CharId>> entries;  // abbreviation, phrase
+    std::vector<std::wstring> characters;
+    for (const auto& phrase : phrases) {
+        characters.clear();
+        for (std::wstring_view rest(phrase); !rest.empty();) {
+            std::wstring_view first = Unicode::FirstCharacter(rest);
+            characters.emplace_back(first);
+            rest.remove_prefix(first.size());
+        }
+        if (characters.size() < 2) continue;
+
+        size_t rank = dictionary.GetBestRank(characters[0]);
+        if (rank == SIZE_MAX) continue;
+        CharId id = table.Intern(phrase);
+        if (id < ranks.size()) continue;  // already seen under another key
+        ranks.push_back(static_cast<uint32_t>(rank));
+
+        for (size_t width = 2; width >= 1; --width) {
+            if (width == 1 && characters.size() < MIN_PATTERN_LENGTH) break;
+            std::vector<std::wstring> variants{std::wstring()};
+            for (const auto& character : characters) {
+                const auto& options = getPrefixes(character).strokes[width - 1];
+                std::vector<std::wstring> extended;
+                for (const auto& variant : variants) {
+                    for (const auto& option : options) {
+                        if (extended.size() < MAX_VARIANTS) extended.push_back(variant + option);
+                    }
+                }
+                variants = std::move(extended);
+            }
+            for (auto& variant : variants) entries.emplace_back(std::move(variant), id);
+        }
+    }
+
+    // The trie wants its entries in rank order
+    std::stable_sort(entries.begin(), entries.end(),
+                     [&](const auto& a, const auto& b) { return ranks[a.second] < ranks[b.second]; });
+    std::vector<std::wstring_view> codes;
+    std::vector<CharId> values;
+    codes.reserve(entries.size());
+    values.reserve(entries.size());
+    for (const auto& [code, id] : entries) {
+        codes.push_back(code);
+        values.push_back(id);
+    }
+    CLoudsTrie trie;
+    trie.Build(codes, values, 0);
+
+    // Serialized as Data::Read expects them
+    std::vector<uint32_t> starts;
+    std::string bytes;
+    for (CharId id = 0; id < table.GetCount(); ++id) {
+        starts.push_back(static_cast<uint32_t>(bytes.size()));
+        bytes += Unicode::WideToUtf8(table.Get(id));
+    }
+    starts.push_back(static_cast<uint32_t>(bytes.size()));
+    CPackedArray packed;
+    auto next = std::make_unique<Data>();
+    trie.Write(next->built);
+    packed.Build(ranks);
+    packed.Write(next->built);
+    packed.Build(starts);
+    packed.Write(next->built);
+    next->built.push_back(bytes.size());
+    size_t offset = next->built.size();
+    next->built.resize(offset + (bytes.size() + 7) / 8, 0);
+    std::memcpy(next->built.data() + offset, bytes.data(), bytes.size());
+    if (!next->Read(next->built.data(), next->built.size())) return;
+
+    size_t phraseCount = next->ranks.GetSize();
+    size_t memory = next->built.size() * sizeof(uint64_t) + next->trie.GetMemoryUsage();
+    _data.Publish(std::move(next));
+
+    auto end = std::chrono::high_resolution_clock::now();
+    auto duration = std::chrono::duration_cast<std::chrono::microseconds>(end - start).count();
+    Debug::Log(L"PhraseIndex", (L"Built " + std::to_wstring(phraseCount) + L" phrases, " +
+                                std::to_wstring(entries.size()) + L" abbreviations" +
+                                L" | Memory: " + std::to_wstring(memory / 1024) + L"KB" +
+                                L" | Time: " + std::to_wstring(duration / 1000) + L"." + std::to_wstring(duration % 1000) + L"ms")
+                                   .c_str());
+}
+
+bool CPhraseIndex::Data::Read(const uint64_t* data, size_t count) {
+    words = data;
+    wordCount = count;
+    const uint64_t* end = data + count;
+    const uint64_t* section = data;
+    if (!trie.Read(data, end)) return false;
+    trieWords = static_cast<size_t>(data - section);
+    section = data;
+    if (!ranks.Read(data, end)) return false;
+    rankWords = static_cast<size_t>(data - section);
+    section = data;
+    if (!phraseStarts.Read(data, end) || data == end) return false;
+    size_t byteCount = static_cast<size_t>(*data++);
+    if (static_cast<size_t>(end - data) != (byteCount + 7) / 8 || phraseStarts.GetSize() != ranks.GetSize() + 1 ||
+        phraseStarts.Get(ranks.GetSize()) != byteCount) {
+        return false;
+    }
+    phraseBytes = reinterpret_cast<const char*>(data);
+    phraseWords = static_cast<size_t>(end - section);
+    return true;
+}
+
+std::wstring CPhraseIndex::Data::GetPhrase(CharId id) const {
+    uint32_t begin = phraseStarts.Get(id), end = phraseStarts.Get(id + 1);
+    if (end < begin) return std::wstring();
+    return Unicode::Utf8ToWide(std::string_view(phraseBytes + begin, end - begin));
+}
+
+bool CPhraseIndex::Load(const std::wstring& path, uint64_t dataHash) {
+    std::lock_guard<std::mutex> lock(_buildMutex);
+    auto start = std::chrono::high_resolution_clock::now();
+
+    auto next = std::make_unique<Data>();
+    if (!next->file.Open(path)) return false;
+    Header header;
+    bool valid = next->file.GetSize() >= sizeof(header);
+    if (valid) {
+        std::memcpy(&header, next->file.GetData(), sizeof(header));
+        valid = std::memcmp(header.magic, PHRASE_INDEX_MAGIC, sizeof(header.magic)) == 0 &&
+                header.version == PHRASE_INDEX_VERSION && header.dataHash == dataHash &&
+                next->file.GetSize() == sizeof(header) + header.wordCount * sizeof(uint64_t);
+    }
+    // The mapping is page aligned and the header is a multiple of 8 bytes
+    if (valid) {
+        valid = next->Read(reinterpret_cast<const uint64_t*>(next->file.GetData() + sizeof(header)),
+                           static_cast<size_t>(header.wordCount));
+    }
+    if (!valid) {
+        Debug::Log(L"PhraseIndex", (L"Ignoring stale or invalid phrase index: " + path).c_str());
+        return false;
+    }
+
+    size_t phraseCount = next->ranks.GetSize();
+    _data.Publish(std::move(next));
+
+    auto end = std::chrono::high_resolution_clock::now();
+    auto duration = std::chrono::duration_cast<std::chrono::microseconds>(end - start).count();
+    Debug::Log(L"PhraseIndex", (L"Mapped " + std::to_wstring(phraseCount) + L" phrases: " + path +
+                                L" | Time: " + std::to_wstring(duration / 1000) + L"." + std::to_wstring(duration % 1000) + L"ms")
+                                   .c_str());
+    return true;
+}
+
+bool CPhraseIndex::Save(const std::wstring& path, uint64_t dataHash) const {
+    auto data = _data.Read();
+    if (!data->words) return false;
+
+    Header header = {};
+    std::memcpy(header.magic, PHRASE_INDEX_MAGIC, sizeof(header.magic));
+    header.version = PHRASE_INDEX_VERSION;
+    header.dataHash = dataHash;
+    header.wordCount = data->wordCount;
+
+    std::ofstream file(std::filesystem::path(path), std::ios::binary | std::ios::trunc);
+    if (!file.is_open()) return false;
+    file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+    file.write(reinterpret_cast<const char*>(data->words),
+               static_cast<std::streamsize>(data->wordCount * sizeof(uint64_t)));
+    return file.good();
+}
+
+bool CPhraseIndex::GetDataHash(const std::wstring& suggestionsPath, const std::wstring& dictionaryPath,
+                               uint64_t& hash) {
+    uint64_t hashes[2];
+    if (!CDataFile::HashFile(suggestionsPath, hashes[0]) || !CDataFile::HashFile(dictionaryPath, hashes[1])) return false;
+    hash = CDataFile::HashBytes(reinterpret_cast<const char*>(hashes), sizeof(hashes));
+    return true;
+}
+
+std::wstring CPhraseIndex::GetPathForSuggestions(const std::wstring& suggestionsPath) {
+    return CDataFile::GetSidePath(suggestionsPath, L".phrases");
+}
+
+void CPhraseIndex::Lookup(const std::wstring& pattern, std::vector<std::wstring>& phrases,
+                          std::vector<size_t>& ranks) const {
+    phrases.clear();
+    ranks.clear();
+    if (pattern.size() < MIN_PATTERN_LENGTH) return;
+
+    auto data = _data.Read();
+    std::vector<CharId> ids;
+    if (!data->trie.Lookup(pattern, ids)) return;
+    for (CharId id : ids) {
+        phrases.push_back(data->GetPhrase(id));
+        ranks.push_back(data->ranks.Get(id));
+    }
+}
+
+size_t CPhraseIndex::GetPhraseCount() const {
+    auto data = _data.Read();
+    return data->ranks.GetSize();
+}
+
+void CPhraseIndex::GetMemoryReport(CMemoryReport& report) const {
+    auto data = _data.Read();
+    // Sections of the compiled file are mapped; a built index holds them on the heap
+    bool mapped = data->file.IsOpen();
+    auto add = [&](const wchar_t* name, size_t heapBytes, size_t words) {
+        size_t bytes = words * sizeof(uint64_t);
+        report.Add(name, heapBytes + (mapped ? 0 : bytes), mapped ? bytes : 0);
+    };
+    add(L"phraseIndex/phrases", 0, data->phraseWords);
+    add(L"phraseIndex/ranks", 0, data->rankWords);
+    add(L"phraseIndex/trie", data->trie.GetMemoryUsage(), data->trieWords);
+}
+
+size_t CPhraseIndex::GetMemoryUsage() const {
+    auto data = _data.Read();
+    return data->built.capacity() * sizeof(uint64_t) + data->trie.GetMemoryUsage();
+}
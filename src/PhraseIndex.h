@@ -0,0 +1,90 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "CharacterTable.h"
+#include "LoudsTrie.h"
+#include "MappedFile.h"
+#include "MemoryReport.h"
+#include "PackedArray.h"
+#include "Snapshot.h"
+
+class CDictionary;
+class CSuggestions;
+
+// Multi-character phrases from suggestionsData.txt (each key + suggestion), typed by
+// abbreviation: the first two strokes of every character, or for phrases of three or
+// more characters just the first stroke of each. Abbreviations go into a CLoudsTrie,
+// the same structure as the dictionary's codes. A phrase ranks like the best entry of
+// its first character, so candidate pages can merge phrases and characters by rank.
+// k6tool compile builds the index for the shipped files and writes it next to the
+// suggestions, where every process maps it instead of building its own.
+class CPhraseIndex {
+   public:
+    // Shorter inputs would match far too many phrases
+    static constexpr size_t MIN_PATTERN_LENGTH = 3;
+
+    CPhraseIndex();
+    ~CPhraseIndex();
+
+    // Rebuilds from the current data; safe to call while other threads are looking up
+    void Build(const CSuggestions& suggestions, const CDictionary& dictionary);
+
+    // Build() on a background thread, which takes most of a second on the full data;
+    // lookups find nothing (or the previous phrases) until it is done
+    void BuildInBackground(const CSuggestions& suggestions, const CDictionary& dictionary);
+
+    // Map the index k6tool compile wrote to path; fails if it is missing, malformed or
+    // was built from other data (see GetDataHash). Safe to call while other threads are
+    // looking up.
+    bool Load(const std::wstring& path, uint64_t dataHash);
+    bool Save(const std::wstring& path, uint64_t dataHash) const;
+
+    // What a compiled index is checked against: both files it is built from
+    static bool GetDataHash(const std::wstring& suggestionsPath, const std::wstring& dictionaryPath, uint64_t& hash);
+    // suggestionsData.phrases next to suggestionsData.txt
+    static std::wstring GetPathForSuggestions(const std::wstring& suggestionsPath);
+
+    // Phrases whose abbreviation is exactly pattern, best rank first, with their ranks
+    // on the CDictionary::GetBestRank scale
+    void Lookup(const std::wstring& pattern, std::vector<std::wstring>& phrases, std::vector<size_t>& ranks) const;
+
+    size_t GetPhraseCount() const;
+    size_t GetMemoryUsage() const;
+    // The phrases, their ranks and the abbreviation trie, under phraseIndex/
+    void GetMemoryReport(CMemoryReport& report) const;
+
+   private:
+    struct Header {
+        char magic[4];
+        uint32_t version;
+        uint64_t dataHash;
+        uint64_t wordCount;
+    };
+
+    // Built here or mapped from the compiled file, the index is the same words: the
+    // trie, the ranks, then the phrases as UTF-8
+    struct Data {
+        std::vector<uint64_t> built;  // the words of a built index
+        CMappedFile file;             // or the compiled file holding them
+        const uint64_t* words = nullptr;
+        size_t wordCount = 0;
+
+        CLoudsTrie trie;                    // abbreviation -> phrase ids
+        CPackedArray ranks;                 // per phrase id
+        CPackedArray phraseStarts;          // per phrase id, plus the end: offsets into phraseBytes
+        const char* phraseBytes = nullptr;
+        size_t trieWords = 0, rankWords = 0, phraseWords = 0;  // section sizes, for the memory report
+
+        bool Read(const uint64_t* data, size_t count);
+        std::wstring GetPhrase(CharId id) const;
+    };
+
+    CSnapshotPtr<Data> _data;
+    std::mutex _buildMutex;
+    std::thread _builder;
+};
@@ -0,0 +1,78 @@
+#include "PositionIndex.h"
+
+#include <algorithm>
+#include <chrono>
+#include <string>
+
+#include "Debug.h"
+#include "Stroke.h"
+
+CPositionIndex::CPositionIndex() {
+}
+
+CPositionIndex::~CPositionIndex() {
+}
+
+void CPositionIndex::Build(const std::vector<std::wstring_view>& codes) {
+    auto start = std::chrono::high_resolution_clock::now();
+
+    size_t maxLength = 0;
+    for (const auto& code : codes) maxLength = (std::max)(maxLength, code.size());
+
+    _strokes.clear();
+    _minLength.clear();
+    _strokes.resize(maxLength * Stroke::COUNT);
+    _minLength.resize(maxLength);
+
+    for (uint32_t e = 0; e < codes.size(); ++e) {
+        std::wstring_view code = codes[e];
+        for (size_t position = 0; position < code.size(); ++position) {
+            // Symbols other than the five strokes only ever match a wildcard
+            int stroke = Stroke::ToIndex(code[position]);
+            if (stroke >= 0 && stroke < Stroke::COUNT) _strokes[position * Stroke::COUNT + stroke].Append(e);
+            _minLength[position].Append(e);
+        }
+    }
+    for (auto& bitmap : _strokes) bitmap.Optimize();
+    for (auto& bitmap : _minLength) bitmap.Optimize();
+    _built = true;
+
+    auto end = std::chrono::high_resolution_clock::now();
+    auto duration = std::chrono::duration_cast<std::chrono::microseconds>(end - start).count();
+    Debug::Log(L"PositionIndex", (L"Built " + std::to_wstring(_strokes.size()) + L" position bitmaps" +
+                                  L" | Memory: " + std::to_wstring(GetMemoryUsage() / 1024) + L"KB" +
+                                  L" | Time: " + std::to_wstring(duration / 1000) + L"." + std::to_wstring(duration % 1000) + L"ms")
+                                     .c_str());
+}
+
+bool CPositionIndex::Match(std::wstring_view pattern, std::vector<uint32_t>& entries) const {
+    entries.clear();
+    if (!_built) return false;
+    if (pattern.empty()) return true;
+
+    std::vector<const CCompressedBitmap*> bitmaps;
+    for (size_t position = 0; position < pattern.size(); ++position) {
+        int stroke = Stroke::ToIndex(pattern[position]);
+        if (stroke == Stroke::INVALID_INDEX) return false;
+        if (position >= _minLength.size()) return true;  // longer than any code
+        if (stroke != Stroke::WILDCARD_INDEX) bitmaps.push_back(&_strokes[position * Stroke::COUNT + stroke]);
+    }
+    // A literal in the last position already implies the length
+    if (Stroke::ToIndex(pattern.back()) == Stroke::WILDCARD_INDEX) bitmaps.push_back(&_minLength[pattern.size() - 1]);
+
+    CCompressedBitmap::Intersect(std::move(bitmaps), entries);
+    return true;
+}
+
+void CPositionIndex::Clear() {
+    std::vector<CCompressedBitmap>().swap(_strokes);
+    std::vector<CCompressedBitmap>().swap(_minLength);
+    _built = false;
+}
+
+size_t CPositionIndex::GetMemoryUsage() const {
+    size_t bytes = (_strokes.capacity() + _minLength.capacity()) * sizeof(CCompressedBitmap);
+    for (const auto& bitmap : _strokes) bytes += bitmap.GetMemoryUsage();
+    for (const auto& bitmap : _minLength) bytes += bitmap.GetMemoryUsage();
+    return bytes;
+}
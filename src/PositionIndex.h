@@ -0,0 +1,35 @@
+#pragma once
+#include <cstdint>
+#include <string_view>
+#include <vector>
+
+#include "CompressedBitmap.h"
+
+// Inverted index over dictionary entries: one compressed bitmap per (position, stroke)
+// and one per minimum code length. A wildcard pattern becomes an intersection of the
+// bitmaps for its literal positions, so leading/mid '＊' queries cost about as much
+// as their output instead of a scan over every entry.
+class CPositionIndex {
+   public:
+    CPositionIndex();
+    ~CPositionIndex();
+
+    // codes are the dictionary entries in rank order; entry numbers are their indices
+    void Build(const std::vector<std::wstring_view>& codes);
+
+    // Ascending entry numbers whose code starts with pattern ('＊' matching any one
+    // stroke). Returns false if the pattern holds symbols the index does not cover, or
+    // if the index was not built.
+    bool Match(std::wstring_view pattern, std::vector<uint32_t>& entries) const;
+
+    bool IsBuilt() const { return _built; }
+    // Frees the bitmaps; Match fails until the next Build
+    void Clear();
+
+    size_t GetMemoryUsage() const;
+
+   private:
+    bool _built = false;
+    std::vector<CCompressedBitmap> _strokes;    // [position * Stroke::COUNT + stroke]
+    std::vector<CCompressedBitmap> _minLength;  // [n - 1]: codes at least n strokes long
+};
@@ -0,0 +1,131 @@
+#include "Prefetcher.h"
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <time.h>
+#endif
+
+#include "Debug.h"
+#include "Dictionary.h"
+#include "Stroke.h"
+
+CPrefetcher::CPrefetcher(const CDictionary& dictionary, std::chrono::milliseconds budget)
+    : _dictionary(dictionary), _budget(budget) {
+}
+
+CPrefetcher::~CPrefetcher() {
+    Stop();
+}
+
+void CPrefetcher::Start() {
+    if (_thread.joinable()) return;
+    _stopping = false;
+    _thread = std::thread(&CPrefetcher::Run, this);
+}
+
+void CPrefetcher::Stop() {
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        _stopping = true;
+        _pending.clear();
+    }
+    _generation.fetch_add(1, std::memory_order_relaxed);
+    _wake.notify_all();
+    if (_thread.joinable()) _thread.join();
+}
+
+void CPrefetcher::Schedule(const std::wstring& strokeInput) {
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        _pending = strokeInput;
+        // Bumped under the lock so the worker always pairs a pattern with its generation
+        _generation.fetch_add(1, std::memory_order_relaxed);
+    }
+    _wake.notify_one();
+}
+
+void CPrefetcher::RecordKeystroke(bool servedByPrefetch) {
+    _keystrokes.fetch_add(1, std::memory_order_relaxed);
+    if (servedByPrefetch) _prefetchHits.fetch_add(1, std::memory_order_relaxed);
+}
+
+CPrefetcher::Stats CPrefetcher::GetStats() const {
+    Stats stats;
+    stats.keystrokes = _keystrokes.load(std::memory_order_relaxed);
+    stats.prefetchHits = _prefetchHits.load(std::memory_order_relaxed);
+    stats.queriesRun = _queriesRun.load(std::memory_order_relaxed);
+    stats.queriesCancelled = _queriesCancelled.load(std::memory_order_relaxed);
+    stats.roundsOverBudget = _roundsOverBudget.load(std::memory_order_relaxed);
+    stats.cpuMicroseconds = _cpuMicroseconds.load(std::memory_order_relaxed);
+    return stats;
+}
+
+void CPrefetcher::LogStats() const {
+    Stats stats = GetStats();
+    uint64_t share = stats.keystrokes ? stats.prefetchHits * 100 / stats.keystrokes : 0;
+    Debug::Log(L"Prefetcher", (L"Keystrokes: " + std::to_wstring(stats.keystrokes) +
+                               L" | Served by prefetch: " + std::to_wstring(stats.prefetchHits) + L" (" + std::to_wstring(share) + L"%)" +
+                               L" | Queries: " + std::to_wstring(stats.queriesRun) +
+                               L" | Cancelled: " + std::to_wstring(stats.queriesCancelled) +
+                               L" | Over budget: " + std::to_wstring(stats.roundsOverBudget) +
+                               L" | CPU: " + std::to_wstring(stats.cpuMicroseconds / 1000) + L"." + std::to_wstring(stats.cpuMicroseconds % 1000) + L"ms")
+                                  .c_str());
+}
+
+uint64_t CPrefetcher::GetThreadCpuMicroseconds() {
+#ifdef _WIN32
+    FILETIME creation, exit, kernel, user;
+    if (!GetThreadTimes(GetCurrentThread(), &creation, &exit, &kernel, &user)) return 0;
+    ULARGE_INTEGER k, u;
+    k.LowPart = kernel.dwLowDateTime;
+    k.HighPart = kernel.dwHighDateTime;
+    u.LowPart = user.dwLowDateTime;
+    u.HighPart = user.dwHighDateTime;
+    return (k.QuadPart + u.QuadPart) / 10;  // 100ns units
+#else
+    timespec ts;
+    if (clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts) != 0) return 0;
+    return static_cast<uint64_t>(ts.tv_sec) * 1000000 + static_cast<uint64_t>(ts.tv_nsec) / 1000;
+#endif
+}
+
+void CPrefetcher::Run() {
+#ifdef _WIN32
+    // Never compete with the UI thread for a core
+    SetThreadPriority(GetCurrentThread(), THREAD_PRIORITY_BELOW_NORMAL);
+#endif
+    const uint64_t budget = static_cast<uint64_t>(_budget.count()) * 1000;
+
+    std::unique_lock<std::mutex> lock(_mutex);
+    while (!_stopping) {
+        _wake.wait(lock, [this]() { return _stopping || !_pending.empty(); });
+        if (_stopping) break;
+
+        std::wstring input;
+        input.swap(_pending);
+        uint64_t generation = _generation.load(std::memory_order_relaxed);
+        lock.unlock();
+
+        uint64_t roundStart = GetThreadCpuMicroseconds();
+        uint64_t used = 0;
+        for (int i = 0; i <= Stroke::COUNT; ++i) {
+            if (_generation.load(std::memory_order_relaxed) != generation) break;
+            if (used >= budget) {
+                _roundsOverBudget.fetch_add(1, std::memory_order_relaxed);
+                break;
+            }
+
+            std::wstring pattern = input + Stroke::FromIndex(i);
+            if (_dictionary.PrefetchRegex(pattern, _generation, generation)) {
+                _queriesRun.fetch_add(1, std::memory_order_relaxed);
+            } else if (_generation.load(std::memory_order_relaxed) != generation) {
+                _queriesCancelled.fetch_add(1, std::memory_order_relaxed);
+            }
+            used = GetThreadCpuMicroseconds() - roundStart;
+        }
+        _cpuMicroseconds.fetch_add(used, std::memory_order_relaxed);
+
+        lock.lock();
+    }
+}
@@ -0,0 +1,69 @@
+#pragma once
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <thread>
+
+class CDictionary;
+
+// Looks up the six queries the next keystroke can produce (each stroke plus '＊')
+// on a background thread, so the result is already in the dictionary's query cache
+// when the key arrives. Work for an older _strokeinput is dropped as soon as a newer
+// one is scheduled, and each round stops once it has used its CPU budget.
+class CPrefetcher {
+   public:
+    static constexpr int DEFAULT_BUDGET_MS = 50;
+
+    struct Stats {
+        uint64_t keystrokes = 0;        // lookups recorded through RecordKeystroke
+        uint64_t prefetchHits = 0;      // ... of which were answered by a prefetched result
+        uint64_t queriesRun = 0;        // successor queries scanned and cached
+        uint64_t queriesCancelled = 0;  // scans abandoned because the input moved on
+        uint64_t roundsOverBudget = 0;  // rounds cut short by the budget
+        uint64_t cpuMicroseconds = 0;   // worker thread CPU time spent prefetching
+    };
+
+    CPrefetcher(const CDictionary& dictionary, std::chrono::milliseconds budget);
+    ~CPrefetcher();
+
+    CPrefetcher(const CPrefetcher&) = delete;
+    CPrefetcher& operator=(const CPrefetcher&) = delete;
+
+    void Start();
+    void Stop();
+
+    // Called on the UI thread whenever the stroke input changes; an empty input only
+    // cancels outstanding work
+    void Schedule(const std::wstring& strokeInput);
+    void Cancel() { Schedule(std::wstring()); }
+
+    // Called on the UI thread for every keystroke that ran a lookup
+    void RecordKeystroke(bool servedByPrefetch);
+
+    Stats GetStats() const;
+    void LogStats() const;
+
+   private:
+    static uint64_t GetThreadCpuMicroseconds();
+    void Run();
+
+    const CDictionary& _dictionary;
+    std::chrono::milliseconds _budget;
+
+    std::atomic<uint64_t> _generation{0};  // bumped by every Schedule; scans compare against it
+    std::wstring _pending;                 // guarded by _mutex
+    std::thread _thread;
+    std::mutex _mutex;
+    std::condition_variable _wake;
+    bool _stopping = false;
+
+    std::atomic<uint64_t> _keystrokes{0};
+    std::atomic<uint64_t> _prefetchHits{0};
+    std::atomic<uint64_t> _queriesRun{0};
+    std::atomic<uint64_t> _queriesCancelled{0};
+    std::atomic<uint64_t> _roundsOverBudget{0};
+    std::atomic<uint64_t> _cpuMicroseconds{0};
+};
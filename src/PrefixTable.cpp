@@ -0,0 +1,193 @@
+#include "PrefixTable.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+
+#include "DataFile.h"
+#include "Debug.h"
+#include "Stroke.h"
+
+static constexpr char PREFIX_TABLE_MAGIC[4] = {'K', '6', 'P', 'T'};
+static constexpr uint32_t PREFIX_TABLE_VERSION = 1;
+
+CPrefixTable::CPrefixTable()
+    : _maxLength(0), _pageSize(0), _patternCount(0), _dataHash(0), _records(nullptr) {
+}
+
+CPrefixTable::~CPrefixTable() {
+}
+
+uint32_t CPrefixTable::LengthBase(uint32_t length) {
+    // 6 + 36 + ... + 6^(length-1)
+    uint32_t base = 0, power = 1;
+    for (uint32_t l = 1; l < length; ++l) {
+        power *= Stroke::COUNT + 1;
+        base += power;
+    }
+    return base;
+}
+
+uint32_t CPrefixTable::PatternCount(uint32_t maxLength) {
+    return LengthBase(maxLength + 1);
+}
+
+void CPrefixTable::Build(const std::vector<std::wstring_view>& codes, const std::vector<CharId>& characters,
+                         size_t characterCount, uint64_t dataHash, uint32_t maxLength, uint32_t pageSize) {
+    auto start = std::chrono::high_resolution_clock::now();
+
+    _file.Close();
+    _maxLength = maxLength;
+    _pageSize = pageSize;
+    _patternCount = PatternCount(maxLength);
+    _dataHash = dataHash;
+
+    const uint32_t stride = 1 + pageSize;
+    _owned.assign(static_cast<size_t>(_patternCount) * stride, INVALID_CHAR_ID);
+    for (uint32_t p = 0; p < _patternCount; ++p) _owned[p * stride] = 0;
+
+    // Group entries by character (counting sort keeps rank order within a character) so
+    // each (pattern, character) pair is seen first at its earliest entry
+    std::vector<uint32_t> offsets(characterCount + 1, 0);
+    for (CharId id : characters) offsets[id + 1]++;
+    for (size_t i = 0; i < characterCount; ++i) offsets[i + 1] += offsets[i];
+    std::vector<uint32_t> byCharacter(characters.size());
+    {
+        std::vector<uint32_t> fill(offsets.begin(), offsets.end() - 1);
+        for (uint32_t e = 0; e < characters.size(); ++e) byCharacter[fill[characters[e]]++] = e;
+    }
+
+    // Per pattern, the first-page candidates as (entry, character) ordered by entry
+    std::vector<std::vector<std::pair<uint32_t, CharId>>> pages(_patternCount);
+    std::vector<uint32_t> stamp(_patternCount, INVALID_CHAR_ID);
+    int digits[64];
+
+    for (CharId ch = 0; ch < characterCount; ++ch) {
+        for (uint32_t k = offsets[ch]; k < offsets[ch + 1]; ++k) {
+            uint32_t entry = byCharacter[k];
+            std::wstring_view code = codes[entry];
+            uint32_t length = (std::min)(static_cast<uint32_t>(code.size()), maxLength);
+
+            bool valid = true;
+            for (uint32_t i = 0; i < length; ++i) {
+                digits[i] = Stroke::ToIndex(code[i]);
+                if (digits[i] < 0 || digits[i] >= Stroke::COUNT) valid = false;
+            }
+            if (!valid) continue;
+
+            // Every prefix, with every subset of its positions replaced by the wildcard
+            for (uint32_t l = 1; l <= length; ++l) {
+                for (uint32_t mask = 0; mask < (1u << l); ++mask) {
+                    uint32_t index = 0;
+                    for (uint32_t i = 0; i < l; ++i) {
+                        index = index * (Stroke::COUNT + 1) + ((mask >> i) & 1 ? Stroke::WILDCARD_INDEX : digits[i]);
+                    }
+                    index += LengthBase(l);
+                    if (stamp[index] == ch) continue;
+                    stamp[index] = ch;
+
+                    _owned[index * stride]++;
+                    auto& page = pages[index];
+                    if (page.size() < pageSize || entry < page.back().first) {
+                        auto pos = std::upper_bound(page.begin(), page.end(), std::make_pair(entry, ch));
+                        page.insert(pos, {entry, ch});
+                        if (page.size() > pageSize) page.pop_back();
+                    }
+                }
+            }
+        }
+    }
+
+    for (uint32_t p = 0; p < _patternCount; ++p) {
+        for (size_t i = 0; i < pages[p].size(); ++i) _owned[p * stride + 1 + i] = pages[p][i].second;
+    }
+    _records = _owned.data();
+
+    auto end = std::chrono::high_resolution_clock::now();
+    auto duration = std::chrono::duration_cast<std::chrono::microseconds>(end - start).count();
+    Debug::Log(L"PrefixTable", (L"Built " + std::to_wstring(_patternCount) + L" patterns up to length " +
+                                std::to_wstring(maxLength) +
+                                L" | Time: " + std::to_wstring(duration / 1000) + L"." + std::to_wstring(duration % 1000) + L"ms")
+                                   .c_str());
+}
+
+void CPrefixTable::Clear() {
+    _records = nullptr;
+    std::vector<uint32_t>().swap(_owned);
+    _file.Close();
+}
+
+bool CPrefixTable::Save(const std::wstring& path) const {
+    if (!_records) return false;
+
+    Header header = {};
+    std::memcpy(header.magic, PREFIX_TABLE_MAGIC, sizeof(header.magic));
+    header.version = PREFIX_TABLE_VERSION;
+    header.maxLength = _maxLength;
+    header.pageSize = _pageSize;
+    header.dataHash = _dataHash;
+    header.patternCount = _patternCount;
+
+    std::ofstream file(std::filesystem::path(path), std::ios::binary | std::ios::trunc);
+    if (!file.is_open()) return false;
+    file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+    file.write(reinterpret_cast<const char*>(_records),
+               static_cast<std::streamsize>(_patternCount) * (1 + _pageSize) * sizeof(uint32_t));
+    return file.good();
+}
+
+bool CPrefixTable::Load(const std::wstring& path, uint64_t dataHash) {
+    _records = nullptr;
+    _owned.clear();
+    if (!_file.Open(path)) return false;
+
+    Header header;
+    if (_file.GetSize() < sizeof(header)) {
+        _file.Close();
+        return false;
+    }
+    std::memcpy(&header, _file.GetData(), sizeof(header));
+
+    size_t expectedSize = sizeof(header) + static_cast<size_t>(header.patternCount) * (1 + header.pageSize) * sizeof(uint32_t);
+    if (std::memcmp(header.magic, PREFIX_TABLE_MAGIC, sizeof(header.magic)) != 0 ||
+        header.version != PREFIX_TABLE_VERSION || header.dataHash != dataHash || header.maxLength == 0 ||
+        header.maxLength > 8 || header.patternCount != PatternCount(header.maxLength) ||
+        _file.GetSize() != expectedSize) {
+        Debug::Log(L"PrefixTable", (L"Ignoring stale or invalid table: " + path).c_str());
+        _file.Close();
+        return false;
+    }
+
+    _maxLength = header.maxLength;
+    _pageSize = header.pageSize;
+    _patternCount = header.patternCount;
+    _dataHash = header.dataHash;
+    _records = reinterpret_cast<const uint32_t*>(_file.GetData() + sizeof(header));
+    return true;
+}
+
+bool CPrefixTable::Lookup(std::wstring_view pattern, std::vector<CharId>& page, size_t& total) const {
+    if (!_records || pattern.empty() || pattern.size() > _maxLength) return false;
+
+    uint32_t index = 0;
+    for (wchar_t ch : pattern) {
+        int digit = Stroke::ToIndex(ch);
+        if (digit < 0) return false;
+        index = index * (Stroke::COUNT + 1) + digit;
+    }
+    index += LengthBase(static_cast<uint32_t>(pattern.size()));
+
+    const uint32_t* record = _records + static_cast<size_t>(index) * (1 + _pageSize);
+    total = record[0];
+    page.clear();
+    for (uint32_t i = 0; i < _pageSize && record[1 + i] != INVALID_CHAR_ID; ++i) {
+        page.push_back(record[1 + i]);
+    }
+    return true;
+}
+
+std::wstring CPrefixTable::GetPathForDictionary(const std::wstring& dictionaryPath) {
+    return CDataFile::GetSidePath(dictionaryPath, L".prefix");
+}
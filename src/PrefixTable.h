@@ -0,0 +1,72 @@
+#pragma once
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "CharacterTable.h"
+#include "MappedFile.h"
+
+// First page of candidates and the total match count for every stroke/wildcard
+// pattern up to a fixed length (6^1 + ... + 6^L patterns). Built once by k6tool and
+// memory-mapped next to the dictionary, or built in memory if that file is missing.
+class CPrefixTable {
+   public:
+    static constexpr uint32_t DEFAULT_MAX_LENGTH = 4;
+    static constexpr uint32_t DEFAULT_PAGE_SIZE = 9;
+
+    CPrefixTable();
+    ~CPrefixTable();
+
+    CPrefixTable(const CPrefixTable&) = delete;
+    CPrefixTable& operator=(const CPrefixTable&) = delete;
+
+    // codes/characters are the dictionary entries in rank order
+    void Build(const std::vector<std::wstring_view>& codes, const std::vector<CharId>& characters,
+               size_t characterCount, uint64_t dataHash, uint32_t maxLength = DEFAULT_MAX_LENGTH,
+               uint32_t pageSize = DEFAULT_PAGE_SIZE);
+
+    bool Save(const std::wstring& path) const;
+
+    // Fails if the file is missing, malformed or was built from different data
+    bool Load(const std::wstring& path, uint64_t dataHash);
+
+    // If the pattern is covered, fills page with up to GetPageSize() IDs and total with
+    // the number of distinct matching characters
+    bool Lookup(std::wstring_view pattern, std::vector<CharId>& page, size_t& total) const;
+
+    bool IsLoaded() const { return _records != nullptr; }
+    uint32_t GetMaxLength() const { return _maxLength; }
+    uint32_t GetPageSize() const { return _pageSize; }
+    bool IsMapped() const { return _file.IsOpen(); }
+    size_t GetMemoryUsage() const { return _owned.capacity() * sizeof(uint32_t); }
+    size_t GetMappedSize() const { return _file.GetSize(); }
+    // Drops the table; Lookup fails until the next Build or Load
+    void Clear();
+
+    // Side-file name used next to the dictionary
+    static std::wstring GetPathForDictionary(const std::wstring& dictionaryPath);
+
+   private:
+    struct Header {
+        char magic[4];
+        uint32_t version;
+        uint32_t maxLength;
+        uint32_t pageSize;
+        uint64_t dataHash;
+        uint32_t patternCount;
+        uint32_t reserved;
+    };
+
+    static uint32_t PatternCount(uint32_t maxLength);
+    // Index of the first pattern of the given length
+    static uint32_t LengthBase(uint32_t length);
+
+    uint32_t _maxLength;
+    uint32_t _pageSize;
+    uint32_t _patternCount;
+    uint64_t _dataHash;
+    const uint32_t* _records;  // per pattern: total, then pageSize ids (INVALID_CHAR_ID padded)
+    std::vector<uint32_t> _owned;
+    CMappedFile _file;
+};
@@ -1,10 +1,8 @@
 #include "Punctuation.h"
 
-#include <windows.h>
-
-#include <fstream>
 #include <sstream>
 
+#include "DataFile.h"
 #include "Debug.h"
 
 CPunctuation::CPunctuation() {
@@ -23,40 +21,23 @@ bool CPunctuation::Lookup(wchar_t asciiChar, std::wstring& outSymbol) const {
 }
 
 bool CPunctuation::LoadFromFile(const std::wstring& path) {
-    // Open file in binary mode and handle UTF-8 decoding manually
-    std::ifstream file(path, std::ios::binary);
-    if (!file.is_open()) {
+    CDataFile file;
+    if (!file.Load(path, "#")) {
         Debug::LogDirect(L"[IME] Failed to open punctuation file\n");
         return false;
     }
 
     _substitutionMap.clear();
 
-    std::string line;
-    while (std::getline(file, line)) {
-        // Skip empty lines and comments
-        if (line.empty() || line[0] == '#') {
-            continue;
-        }
-
-        // Convert UTF-8 line to wide string for processing
-        int size_needed = MultiByteToWideChar(CP_UTF8, 0, &line[0], (int)line.size(), NULL, 0);
-        std::wstring wline(size_needed, 0);
-        MultiByteToWideChar(CP_UTF8, 0, &line[0], (int)line.size(), &wline[0], size_needed);
-
+    for (const auto& record : file.GetRecords()) {
         // Parse format: ASCII_char<tab>Chinese_char
-        std::wstringstream ss(wline);
-        std::wstring asciiStr, chineseStr;
-
-        if (!std::getline(ss, asciiStr, L'\t')) continue;
-        if (!std::getline(ss, chineseStr, L'\t')) continue;
-
-        if (asciiStr.empty() || chineseStr.empty()) {
+        std::wstring_view chineseStr = record.value.substr(0, record.value.find(L'\t'));
+        if (chineseStr.empty()) {
             continue;
         }
 
-        wchar_t asciiChar = asciiStr[0];
-        _substitutionMap[asciiChar] = chineseStr;
+        wchar_t asciiChar = record.key[0];
+        _substitutionMap[asciiChar] = std::wstring(chineseStr);
 
         std::wstringstream debugSS;
         debugSS << L"[IME] Loaded punctuation: '" << asciiChar << L"' -> '" << chineseStr << L"'";
@@ -64,8 +45,6 @@ bool CPunctuation::LoadFromFile(const std::wstring& path) {
         Debug::LogDirect(L"\n");
     }
 
-    file.close();
-
     std::wstringstream ss;
     ss << L"[IME] Punctuation map loaded: " << _substitutionMap.size() << L" entries";
     Debug::LogDirect(ss.str().c_str());
@@ -75,27 +54,12 @@ bool CPunctuation::LoadFromFile(const std::wstring& path) {
 }
 
 std::wstring CPunctuation::GetDefaultPunctuationPath() {
-    wchar_t dllPath[MAX_PATH];
-    HMODULE hModule = nullptr;
-
-    // Get handle to our DLL
-    GetModuleHandleEx(GET_MODULE_HANDLE_EX_FLAG_FROM_ADDRESS | GET_MODULE_HANDLE_EX_FLAG_UNCHANGED_REFCOUNT,
-                      (LPCWSTR)&CPunctuation::GetDefaultPunctuationPath, &hModule);
+    std::wstring path = CDataFile::GetModuleRelativePath(L"punctuationData.txt");
 
-    if (hModule && GetModuleFileName(hModule, dllPath, MAX_PATH)) {
-        std::wstring path(dllPath);
-        size_t lastSlash = path.find_last_of(L"\\/");
-        if (lastSlash != std::wstring::npos) {
-            path = path.substr(0, lastSlash + 1) + L"punctuationData.txt";
-        }
-
-        std::wstringstream ss;
-        ss << L"[IME] Punctuation file path: " << path;
-        Debug::LogDirect(ss.str().c_str());
-        Debug::LogDirect(L"\n");
-
-        return path;
-    }
+    std::wstringstream ss;
+    ss << L"[IME] Punctuation file path: " << path;
+    Debug::LogDirect(ss.str().c_str());
+    Debug::LogDirect(L"\n");
 
-    return L"punctuationData.txt";
+    return path;
 }
@@ -0,0 +1,177 @@
+#include "QueryCacheFile.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+
+#include "DataFile.h"
+#include "Debug.h"
+
+static constexpr char QUERY_CACHE_MAGIC[4] = {'K', '6', 'Q', 'C'};
+static constexpr uint32_t QUERY_CACHE_VERSION = 1;
+
+CQueryCacheFile::CQueryCacheFile() : _records(nullptr), _patterns(nullptr), _ids(nullptr), _queryCount(0) {
+}
+
+CQueryCacheFile::~CQueryCacheFile() {
+}
+
+bool CQueryCacheFile::Save(const std::wstring& path, uint64_t dataHash, std::vector<Query> queries) {
+    auto start = std::chrono::high_resolution_clock::now();
+
+    // Most hits first; a query too big for what is left of the budget makes way for smaller ones
+    std::sort(queries.begin(), queries.end(), [](const Query& a, const Query& b) {
+        return a.hits != b.hits ? a.hits > b.hits : a.pattern < b.pattern;
+    });
+    std::vector<const Query*> kept;
+    size_t idCount = 0;
+    for (const Query& query : queries) {
+        if (kept.size() == MAX_QUERIES) break;
+        if (query.hits == 0 || query.pattern.empty() || idCount + query.ids.size() > MAX_IDS) continue;
+        if (std::any_of(query.pattern.begin(), query.pattern.end(), [](wchar_t ch) { return ch > 0xFFFF; })) continue;
+        kept.push_back(&query);
+        idCount += query.ids.size();
+    }
+    std::sort(kept.begin(), kept.end(), [](const Query* a, const Query* b) { return a->pattern < b->pattern; });
+
+    std::vector<Record> records;
+    std::vector<uint16_t> patterns;
+    std::vector<CharId> ids;
+    ids.reserve(idCount);
+    for (const Query* query : kept) {
+        records.push_back({static_cast<uint32_t>(patterns.size()), static_cast<uint32_t>(query->pattern.size()),
+                           static_cast<uint32_t>(ids.size()), static_cast<uint32_t>(query->ids.size()), query->hits});
+        patterns.insert(patterns.end(), query->pattern.begin(), query->pattern.end());
+        ids.insert(ids.end(), query->ids.begin(), query->ids.end());
+    }
+    // Keeps the ids 4-byte aligned
+    if (patterns.size() % 2) patterns.push_back(0);
+
+    Header header = {};
+    std::memcpy(header.magic, QUERY_CACHE_MAGIC, sizeof(header.magic));
+    header.version = QUERY_CACHE_VERSION;
+    header.dataHash = dataHash;
+    header.queryCount = static_cast<uint32_t>(records.size());
+    header.patternUnits = static_cast<uint32_t>(patterns.size());
+    header.idCount = static_cast<uint32_t>(ids.size());
+
+    std::wstring tempPath = path + L".tmp";
+    bool written;
+    {
+        std::ofstream file(std::filesystem::path(tempPath), std::ios::binary | std::ios::trunc);
+        file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+        file.write(reinterpret_cast<const char*>(records.data()), records.size() * sizeof(Record));
+        file.write(reinterpret_cast<const char*>(patterns.data()), patterns.size() * sizeof(uint16_t));
+        file.write(reinterpret_cast<const char*>(ids.data()), ids.size() * sizeof(CharId));
+        file.flush();
+        written = file.good();
+    }
+    std::error_code error;
+    if (written) {
+        std::filesystem::rename(std::filesystem::path(tempPath), std::filesystem::path(path), error);
+        // Windows will not rename over a file other processes still map; it does let the
+        // old name go (they opened it with FILE_SHARE_DELETE) and keep their view
+        if (error) {
+            std::filesystem::remove(std::filesystem::path(path), error);
+            std::filesystem::rename(std::filesystem::path(tempPath), std::filesystem::path(path), error);
+        }
+    }
+    if (!written || error) {
+        std::filesystem::remove(std::filesystem::path(tempPath), error);
+        Debug::Log(L"QueryCache", (L"Failed to save " + path).c_str());
+        return false;
+    }
+
+    auto end = std::chrono::high_resolution_clock::now();
+    auto duration = std::chrono::duration_cast<std::chrono::microseconds>(end - start).count();
+    Debug::Log(L"QueryCache", (L"Saved " + path + L" | Queries: " + std::to_wstring(records.size()) +
+                               L" | Characters: " + std::to_wstring(ids.size()) +
+                               L" | Time: " + std::to_wstring(duration / 1000) + L"." + std::to_wstring(duration % 1000) + L"ms")
+                                  .c_str());
+    return true;
+}
+
+bool CQueryCacheFile::Load(const std::wstring& path, uint64_t dataHash, size_t characterCount) {
+    Close();
+    if (!_file.Open(path)) return false;
+
+    Header header;
+    if (_file.GetSize() < sizeof(header)) {
+        _file.Close();
+        return false;
+    }
+    std::memcpy(&header, _file.GetData(), sizeof(header));
+
+    size_t expectedSize = sizeof(header) + static_cast<size_t>(header.queryCount) * sizeof(Record) +
+                          static_cast<size_t>(header.patternUnits) * sizeof(uint16_t) +
+                          static_cast<size_t>(header.idCount) * sizeof(CharId);
+    bool valid = std::memcmp(header.magic, QUERY_CACHE_MAGIC, sizeof(header.magic)) == 0 &&
+                 header.version == QUERY_CACHE_VERSION && header.dataHash == dataHash &&
+                 header.patternUnits % 2 == 0 && _file.GetSize() == expectedSize;
+    if (valid) {
+        _records = reinterpret_cast<const Record*>(_file.GetData() + sizeof(header));
+        _patterns = reinterpret_cast<const uint16_t*>(_records + header.queryCount);
+        _ids = reinterpret_cast<const CharId*>(_patterns + header.patternUnits);
+        _queryCount = header.queryCount;
+        // Every slice in bounds, so a damaged file cannot send a lookup astray
+        for (size_t i = 0; valid && i < _queryCount; ++i) {
+            const Record& r = _records[i];
+            valid = r.patternLength > 0 && r.patternOffset <= header.patternUnits &&
+                    r.patternLength <= header.patternUnits - r.patternOffset && r.idsOffset <= header.idCount &&
+                    r.idsCount <= header.idCount - r.idsOffset;
+        }
+        for (size_t i = 0; valid && i < header.idCount; ++i) valid = _ids[i] < characterCount;
+    }
+    if (!valid) {
+        Debug::Log(L"QueryCache", (L"Ignoring stale or invalid cache: " + path).c_str());
+        Close();
+        return false;
+    }
+
+    Debug::Log(L"QueryCache", (L"Loaded " + path + L" | Queries: " + std::to_wstring(_queryCount)).c_str());
+    return true;
+}
+
+void CQueryCacheFile::Close() {
+    _records = nullptr;
+    _patterns = nullptr;
+    _ids = nullptr;
+    _queryCount = 0;
+    _file.Close();
+}
+
+CQueryCacheFile::Query CQueryCacheFile::Get(size_t i) const {
+    const Record& r = _records[i];
+    Query query;
+    query.pattern.assign(_patterns + r.patternOffset, _patterns + r.patternOffset + r.patternLength);
+    query.ids.assign(_ids + r.idsOffset, _ids + r.idsOffset + r.idsCount);
+    query.hits = r.hits;
+    return query;
+}
+
+int CQueryCacheFile::Compare(const Record& r, std::wstring_view pattern) const {
+    size_t length = (std::min)(static_cast<size_t>(r.patternLength), pattern.size());
+    for (size_t i = 0; i < length; ++i) {
+        uint32_t a = _patterns[r.patternOffset + i];
+        uint32_t b = static_cast<uint32_t>(pattern[i]);
+        if (a != b) return a < b ? -1 : 1;
+    }
+    if (r.patternLength == pattern.size()) return 0;
+    return r.patternLength < pattern.size() ? -1 : 1;
+}
+
+bool CQueryCacheFile::Find(std::wstring_view pattern, std::vector<CharId>& ids) const {
+    if (!_records) return false;
+    const Record* end = _records + _queryCount;
+    const Record* it = std::lower_bound(_records, end, pattern,
+                                        [this](const Record& r, std::wstring_view p) { return Compare(r, p) < 0; });
+    if (it == end || Compare(*it, pattern) != 0) return false;
+    ids.assign(_ids + it->idsOffset, _ids + it->idsOffset + it->idsCount);
+    return true;
+}
+
+std::wstring CQueryCacheFile::GetDefaultPath() {
+    return CDataFile::GetUserDataPath(L"queryCache.bin");
+}
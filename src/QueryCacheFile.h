@@ -0,0 +1,79 @@
+#pragma once
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "CharacterTable.h"
+#include "MappedFile.h"
+
+// Full LookupRegexIds results saved by one process so the next one starts warm: the
+// most used patterns with their characters and hit counts, sorted by pattern and
+// memory-mapped on load. The file records the hash of the data the results came from,
+// so a changed data file (or a different user dictionary fold) makes Load ignore it.
+class CQueryCacheFile {
+   public:
+    struct Query {
+        std::wstring pattern;
+        std::vector<CharId> ids;
+        uint32_t hits;
+    };
+
+    // What Save keeps at most, most hits first: queries, and characters over all of them
+    static constexpr size_t MAX_QUERIES = 2048;
+    static constexpr size_t MAX_IDS = 512 * 1024;
+
+    CQueryCacheFile();
+    ~CQueryCacheFile();
+
+    CQueryCacheFile(const CQueryCacheFile&) = delete;
+    CQueryCacheFile& operator=(const CQueryCacheFile&) = delete;
+
+    // Writes the most hit queries (in any order; patterns must be UTF-16 code units) to
+    // a temporary file renamed over path, so readers see the old file or the new one
+    static bool Save(const std::wstring& path, uint64_t dataHash, std::vector<Query> queries);
+
+    // Fails if the file is missing, malformed or was saved for different data; ids must
+    // be below characterCount
+    bool Load(const std::wstring& path, uint64_t dataHash, size_t characterCount);
+    void Close();
+
+    bool IsLoaded() const { return _records != nullptr; }
+    size_t GetMappedSize() const { return _file.GetSize(); }
+    size_t GetQueryCount() const { return _queryCount; }
+    // Query i in pattern order
+    Query Get(size_t i) const;
+    // The saved result for pattern, if there is one
+    bool Find(std::wstring_view pattern, std::vector<CharId>& ids) const;
+
+    // queryCache.bin in the user data directory
+    static std::wstring GetDefaultPath();
+
+   private:
+    struct Header {
+        char magic[4];
+        uint32_t version;
+        uint64_t dataHash;
+        uint32_t queryCount;
+        uint32_t patternUnits;  // UTF-16 code units in the pattern pool
+        uint32_t idCount;
+        uint32_t reserved;
+    };
+
+    struct Record {
+        uint32_t patternOffset;
+        uint32_t patternLength;
+        uint32_t idsOffset;
+        uint32_t idsCount;
+        uint32_t hits;
+    };
+
+    // Orders the pattern of record r against pattern
+    int Compare(const Record& r, std::wstring_view pattern) const;
+
+    const Record* _records;  // queryCount records sorted by pattern
+    const uint16_t* _patterns;
+    const CharId* _ids;
+    size_t _queryCount;
+    CMappedFile _file;
+};
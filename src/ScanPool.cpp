@@ -0,0 +1,81 @@
+#include "ScanPool.h"
+
+#include <algorithm>
+
+CScanPool::CScanPool(unsigned threads) : _threadCount((std::max)(threads, 1u)) {}
+
+CScanPool::~CScanPool() {
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        _stopping = true;
+    }
+    _wake.notify_all();
+    for (auto& thread : _threads) thread.join();
+}
+
+void CScanPool::Run(size_t count, const Scan& scan) {
+    std::unique_lock<std::mutex> runLock(_runMutex, std::defer_lock);
+    if (_threadCount == 1 || count < MIN_PARALLEL_COUNT || !runLock.try_lock()) {
+        for (size_t chunk = 0, chunks = GetChunkCount(count); chunk < chunks; ++chunk) {
+            scan(0, chunk, chunk * CHUNK_SIZE, (std::min)(count, (chunk + 1) * CHUNK_SIZE));
+        }
+        return;
+    }
+    if (_threads.empty()) StartThreads();
+
+    {
+        // A worker that woke too late for the previous scan may still be looking at it
+        std::unique_lock<std::mutex> lock(_mutex);
+        _done.wait(lock, [this]() { return _active == 0; });
+        _scan = &scan;
+        _count = count;
+        _chunks = GetChunkCount(count);
+        _nextChunk.store(0, std::memory_order_relaxed);
+        _chunksDone = 0;
+        _job++;
+    }
+    _wake.notify_all();
+
+    RunChunks(0);
+
+    std::unique_lock<std::mutex> lock(_mutex);
+    _done.wait(lock, [this]() { return _chunksDone == _chunks; });
+}
+
+void CScanPool::StartThreads() {
+    for (unsigned worker = 1; worker < _threadCount; ++worker) {
+        _threads.emplace_back(&CScanPool::Work, this, worker);
+    }
+}
+
+void CScanPool::RunChunks(unsigned worker) {
+    size_t completed = 0;
+    for (;;) {
+        size_t chunk = _nextChunk.fetch_add(1, std::memory_order_relaxed);
+        if (chunk >= _chunks) break;
+        (*_scan)(worker, chunk, chunk * CHUNK_SIZE, (std::min)(_count, (chunk + 1) * CHUNK_SIZE));
+        completed++;
+    }
+    if (completed == 0) return;
+
+    std::lock_guard<std::mutex> lock(_mutex);
+    _chunksDone += completed;
+    if (_chunksDone == _chunks) _done.notify_all();
+}
+
+void CScanPool::Work(unsigned worker) {
+    uint64_t seen = 0;
+    std::unique_lock<std::mutex> lock(_mutex);
+    for (;;) {
+        _wake.wait(lock, [&]() { return _stopping || _job != seen; });
+        if (_stopping) return;
+        seen = _job;
+        _active++;
+        lock.unlock();
+
+        RunChunks(worker);
+
+        lock.lock();
+        if (--_active == 0) _done.notify_all();
+    }
+}
@@ -0,0 +1,63 @@
+#pragma once
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// A fixed set of threads that share out a scan over a range of entries. The range is cut
+// into chunks and every thread, the caller included, keeps claiming the next unclaimed
+// chunk, so a thread that drew cheap chunks takes over work the others have not reached
+// instead of waiting for them. One scan runs at a time; a caller that finds the pool
+// busy scans on its own thread. The threads are started by the first scan large enough
+// to share, so a process that never makes one pays nothing for the pool.
+class CScanPool {
+   public:
+    // Ranges below this are scanned by the caller alone
+    static constexpr size_t MIN_PARALLEL_COUNT = 16384;
+    static constexpr size_t CHUNK_SIZE = 2048;
+    // Threads (the caller included) when the settings leave it to us: every process
+    // with K6 loaded has a pool, and few scans are long enough to keep more busy
+    static constexpr unsigned DEFAULT_MAX_THREADS = 4;
+
+    // threads counts the caller, so 1 starts no threads and scans everything inline
+    explicit CScanPool(unsigned threads);
+    ~CScanPool();
+
+    CScanPool(const CScanPool&) = delete;
+    CScanPool& operator=(const CScanPool&) = delete;
+
+    unsigned GetThreadCount() const { return _threadCount; }
+    size_t GetChunkCount(size_t count) const { return (count + CHUNK_SIZE - 1) / CHUNK_SIZE; }
+
+    // scan(worker, chunk, begin, end) for every chunk of [0, count); worker is below
+    // GetThreadCount(), and within one Run no two calls with the same worker overlap,
+    // so per-worker scratch state needs no lock. Returns when every chunk is done.
+    using Scan = std::function<void(unsigned worker, size_t chunk, size_t begin, size_t end)>;
+    void Run(size_t count, const Scan& scan);
+
+   private:
+    void StartThreads();  // under _runMutex
+    void Work(unsigned worker);
+    void RunChunks(unsigned worker);
+
+    unsigned _threadCount;
+    std::vector<std::thread> _threads;  // empty until the first parallel scan
+    std::mutex _runMutex;               // one scan at a time
+
+    std::mutex _mutex;
+    std::condition_variable _wake;
+    std::condition_variable _done;
+    uint64_t _job = 0;     // bumped for every scan, so workers see each one once
+    unsigned _active = 0;  // workers that took the current scan and have not finished it
+    bool _stopping = false;
+
+    // The current scan, valid while _job is unchanged
+    const Scan* _scan = nullptr;
+    size_t _count = 0;
+    size_t _chunks = 0;
+    std::atomic<size_t> _nextChunk{0};
+    size_t _chunksDone = 0;  // guarded by _mutex
+};
@@ -0,0 +1,48 @@
+#include "Settings.h"
+
+#include <cwchar>
+
+#include "DataFile.h"
+#include "Debug.h"
+
+CSettings::CSettings() {
+}
+
+CSettings::~CSettings() {
+}
+
+bool CSettings::LoadFromFile(const std::wstring& path) {
+    CDataFile file;
+    if (!file.Load(path)) {
+        return false;
+    }
+
+    _values.clear();
+    for (const auto& record : file.GetRecords()) {
+        // Later lines override earlier ones
+        _values[std::wstring(record.key)] = std::wstring(record.value.substr(0, record.value.find(L'\t')));
+    }
+
+    Debug::Log(L"Settings", (L"Loaded: " + path + L" | Entries: " + std::to_wstring(_values.size())).c_str());
+    return true;
+}
+
+bool CSettings::GetBool(const std::wstring& key, bool defaultValue) const {
+    auto it = _values.find(key);
+    if (it == _values.end()) return defaultValue;
+    if (it->second == L"1" || it->second == L"true" || it->second == L"on") return true;
+    if (it->second == L"0" || it->second == L"false" || it->second == L"off") return false;
+    return defaultValue;
+}
+
+int CSettings::GetInt(const std::wstring& key, int defaultValue) const {
+    auto it = _values.find(key);
+    if (it == _values.end()) return defaultValue;
+    wchar_t* end = nullptr;
+    long value = std::wcstol(it->second.c_str(), &end, 10);
+    return (end && *end == L'\0' && end != it->second.c_str()) ? static_cast<int>(value) : defaultValue;
+}
+
+std::wstring CSettings::GetDefaultSettingsPath() {
+    return CDataFile::GetModuleRelativePath(L"settingsData.txt");
+}
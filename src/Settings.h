@@ -0,0 +1,24 @@
+#pragma once
+#include <string>
+#include <unordered_map>
+
+// Optional user settings from settingsData.txt (UTF-8, key<tab>value per line).
+// Keys missing from the file keep the default passed by the caller.
+class CSettings {
+   public:
+    CSettings();
+    ~CSettings();
+
+    bool LoadFromFile(const std::wstring& path);
+
+    bool GetBool(const std::wstring& key, bool defaultValue) const;
+    int GetInt(const std::wstring& key, int defaultValue) const;
+
+    // Get the settings file path next to the DLL
+    static std::wstring GetDefaultSettingsPath();
+
+    size_t GetEntryCount() const { return _values.size(); }
+
+   private:
+    std::unordered_map<std::wstring, std::wstring> _values;
+};
@@ -0,0 +1,124 @@
+#pragma once
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <utility>
+#include <vector>
+
+// Publishes an immutable T with an atomic pointer swap. Readers never block; each one
+// announces the epoch it entered in, and a replaced snapshot is only deleted once no
+// reader that could still see it remains (epoch-based reclamation): by the next Publish,
+// or by the last such reader on its way out.
+template <typename T>
+class CSnapshotPtr {
+   public:
+    class ReadGuard {
+       public:
+        ReadGuard(ReadGuard&& other) noexcept : _owner(other._owner), _slot(other._slot), _ptr(other._ptr) {
+            other._slot = nullptr;
+        }
+        ReadGuard(const ReadGuard&) = delete;
+        ReadGuard& operator=(const ReadGuard&) = delete;
+        ~ReadGuard() {
+            if (!_slot) return;
+            // Sequentially consistent with Publish: either it sees this slot empty or this
+            // reader sees what it retired and frees it
+            _slot->store(0);
+            if (_owner->_retiredCount.load() != 0) _owner->Reclaim();
+        }
+
+        const T* get() const { return _ptr; }
+        const T* operator->() const { return _ptr; }
+        const T& operator*() const { return *_ptr; }
+        explicit operator bool() const { return _ptr != nullptr; }
+
+       private:
+        friend class CSnapshotPtr;
+        ReadGuard(const CSnapshotPtr* owner, std::atomic<uint64_t>* slot, const T* ptr)
+            : _owner(owner), _slot(slot), _ptr(ptr) {}
+        const CSnapshotPtr* _owner;
+        std::atomic<uint64_t>* _slot;
+        const T* _ptr;
+    };
+
+    CSnapshotPtr() : _current(nullptr), _epoch(1), _retiredCount(0) {
+        for (auto& slot : _readers) slot.store(0);
+    }
+
+    explicit CSnapshotPtr(std::unique_ptr<T> initial) : CSnapshotPtr() { _current.store(initial.release()); }
+
+    ~CSnapshotPtr() {
+        // Owner guarantees no readers are left at destruction
+        delete _current.load();
+        for (auto& retired : _retired) delete retired.second;
+    }
+
+    CSnapshotPtr(const CSnapshotPtr&) = delete;
+    CSnapshotPtr& operator=(const CSnapshotPtr&) = delete;
+
+    ReadGuard Read() const {
+        static thread_local size_t hint = std::hash<std::thread::id>()(std::this_thread::get_id());
+        for (;;) {
+            uint64_t epoch = _epoch.load();
+            for (size_t i = 0; i < READER_SLOTS; ++i) {
+                auto& slot = _readers[(hint + i) % READER_SLOTS];
+                uint64_t expected = 0;
+                if (slot.compare_exchange_strong(expected, epoch)) {
+                    hint = (hint + i) % READER_SLOTS;
+                    return ReadGuard(this, &slot, _current.load());
+                }
+            }
+            std::this_thread::yield();  // more concurrent readers than slots
+        }
+    }
+
+    // Swap in the next snapshot. The previous one is freed once its readers are gone.
+    void Publish(std::unique_ptr<T> next) {
+        T* previous = _current.exchange(next.release());
+        uint64_t retireEpoch = _epoch.fetch_add(1) + 1;
+
+        std::lock_guard<std::mutex> lock(_retireMutex);
+        if (previous) _retired.emplace_back(retireEpoch, previous);
+        _retiredCount.store(_retired.size());
+        ReclaimLocked();
+    }
+
+    // Free retired snapshots that no reader can still hold
+    void Reclaim() const {
+        std::lock_guard<std::mutex> lock(_retireMutex);
+        ReclaimLocked();
+    }
+
+    size_t GetRetiredCount() const { return _retiredCount.load(); }
+
+   private:
+    static constexpr size_t READER_SLOTS = 64;
+
+    void ReclaimLocked() const {
+        uint64_t oldestReader = UINT64_MAX;
+        for (const auto& slot : _readers) {
+            uint64_t epoch = slot.load();
+            if (epoch != 0 && epoch < oldestReader) oldestReader = epoch;
+        }
+        // A reader that entered before retireEpoch may still hold the old pointer
+        auto it = _retired.begin();
+        while (it != _retired.end()) {
+            if (it->first <= oldestReader) {
+                delete it->second;
+                it = _retired.erase(it);
+            } else {
+                ++it;
+            }
+        }
+        _retiredCount.store(_retired.size());
+    }
+
+    std::atomic<T*> _current;
+    std::atomic<uint64_t> _epoch;
+    mutable std::atomic<uint64_t> _readers[READER_SLOTS];
+    mutable std::mutex _retireMutex;
+    mutable std::vector<std::pair<uint64_t, T*>> _retired;
+    mutable std::atomic<size_t> _retiredCount;
+};
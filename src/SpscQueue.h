@@ -0,0 +1,39 @@
+#pragma once
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <utility>
+
+// Fixed-capacity ring for exactly one producer thread and one consumer thread. Neither
+// side takes a lock: each owns one index and only reads the other's.
+template <typename T, size_t Capacity>
+class CSpscQueue {
+    static_assert((Capacity & (Capacity - 1)) == 0, "capacity must be a power of two");
+
+   public:
+    // Producer only; false if the queue is full
+    bool Push(T value) {
+        size_t tail = _tail.load(std::memory_order_relaxed);
+        if (tail - _head.load(std::memory_order_acquire) == Capacity) return false;
+        _slots[tail & (Capacity - 1)] = std::move(value);
+        _tail.store(tail + 1, std::memory_order_release);
+        return true;
+    }
+
+    // Consumer only; false if the queue is empty
+    bool Pop(T& value) {
+        size_t head = _head.load(std::memory_order_relaxed);
+        if (head == _tail.load(std::memory_order_acquire)) return false;
+        value = std::move(_slots[head & (Capacity - 1)]);
+        _head.store(head + 1, std::memory_order_release);
+        return true;
+    }
+
+    bool IsEmpty() const { return _head.load(std::memory_order_acquire) == _tail.load(std::memory_order_acquire); }
+
+   private:
+    std::array<T, Capacity> _slots;
+    // On separate cache lines, so the two threads do not bounce one line between them
+    alignas(64) std::atomic<size_t> _head{0};
+    alignas(64) std::atomic<size_t> _tail{0};
+};
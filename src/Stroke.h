@@ -1,4 +1,6 @@
 #pragma once
+#include <array>
+#include <string_view>
 
 namespace Stroke {
 static constexpr const wchar_t* POSITIVE_DIAGONAL = L"丿";
@@ -8,4 +10,49 @@ static constexpr const wchar_t* HORIZONTAL = L"一";
 static constexpr const wchar_t* COMPOUND = L"フ";
 static constexpr const wchar_t* EMPTY = L"";
 static constexpr const wchar_t* WILDCARD = L"＊";
+// Any run of strokes, including none. A pattern holding it must match the whole code,
+// so 一～丶 means "starts with 一, ends with 丶"; end it with ～ to leave the end open.
+static constexpr const wchar_t* ANY_STROKES = L"～";
+
+// Compact symbol numbering used by the indexes: the five strokes in the usual
+// 一丨丿丶フ order, then the wildcard
+static constexpr int COUNT = 5;
+static constexpr int WILDCARD_INDEX = 5;
+static constexpr int INVALID_INDEX = -1;
+
+// The low five bits of the six symbols all differ, so ToIndex is one table probe
+// instead of a chain of compares that mispredicts on every stroke of a scan
+struct IndexSlot {
+    wchar_t symbol;
+    int index;
+};
+
+constexpr std::array<IndexSlot, 32> MakeIndexSlots() {
+    std::array<IndexSlot, 32> slots{};
+    for (auto& slot : slots) slot = {0, INVALID_INDEX};
+    const wchar_t symbols[] = {HORIZONTAL[0], VERTICAL[0], POSITIVE_DIAGONAL[0], NEGATIVE_DIAGONAL[0], COMPOUND[0], WILDCARD[0]};
+    for (int i = 0; i <= WILDCARD_INDEX; ++i) slots[symbols[i] & 31] = {symbols[i], i};
+    return slots;
+}
+
+inline constexpr std::array<IndexSlot, 32> INDEX_SLOTS = MakeIndexSlots();
+static_assert(INDEX_SLOTS[HORIZONTAL[0] & 31].index == 0 && INDEX_SLOTS[VERTICAL[0] & 31].index == 1 &&
+                  INDEX_SLOTS[POSITIVE_DIAGONAL[0] & 31].index == 2 && INDEX_SLOTS[NEGATIVE_DIAGONAL[0] & 31].index == 3 &&
+                  INDEX_SLOTS[COMPOUND[0] & 31].index == 4 && INDEX_SLOTS[WILDCARD[0] & 31].index == WILDCARD_INDEX,
+              "two stroke symbols share an INDEX_SLOTS slot");
+
+inline int ToIndex(wchar_t ch) {
+    const IndexSlot& slot = INDEX_SLOTS[ch & 31];
+    return slot.symbol == ch ? slot.index : INVALID_INDEX;
+}
+
+inline wchar_t FromIndex(int index) {
+    static constexpr const wchar_t* SYMBOLS[] = {HORIZONTAL, VERTICAL, POSITIVE_DIAGONAL, NEGATIVE_DIAGONAL, COMPOUND, WILDCARD};
+    return SYMBOLS[index][0];
+}
+
+inline bool HasAnyStrokes(std::wstring_view pattern) {
+    return pattern.find(ANY_STROKES[0]) != std::wstring_view::npos;
+}
+
 }  // namespace Stroke
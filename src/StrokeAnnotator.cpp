@@ -0,0 +1,263 @@
+#include "StrokeAnnotator.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <map>
+#include <mutex>
+#include <thread>
+
+#include "DictionaryData.h"
+#include "Unicode.h"
+
+namespace {
+
+// Unbounded queue that blocks the consumer. Run bounds the work in flight by the number
+// of buffers it hands out, not by the queues.
+template <typename T>
+class CBlockingQueue {
+   public:
+    void Push(T value) {
+        {
+            std::lock_guard<std::mutex> lock(_mutex);
+            _items.push_back(std::move(value));
+        }
+        _ready.notify_one();
+    }
+
+    // False once the queue is closed and empty
+    bool Pop(T& value) {
+        std::unique_lock<std::mutex> lock(_mutex);
+        _ready.wait(lock, [this]() { return !_items.empty() || _closed; });
+        if (_items.empty()) return false;
+        value = std::move(_items.front());
+        _items.pop_front();
+        return true;
+    }
+
+    void Close() {
+        {
+            std::lock_guard<std::mutex> lock(_mutex);
+            _closed = true;
+        }
+        _ready.notify_all();
+    }
+
+   private:
+    std::mutex _mutex;
+    std::condition_variable _ready;
+    std::deque<T> _items;
+    bool _closed = false;
+};
+
+struct Chunk {
+    uint64_t sequence = 0;
+    std::string text;
+};
+
+// Length of the UTF-8 sequence a lead byte starts (1 for ASCII and for stray bytes)
+inline size_t SequenceLength(unsigned char lead) {
+    if (lead < 0xC2) return 1;
+    if (lead < 0xE0) return 2;
+    if (lead < 0xF0) return 3;
+    if (lead < 0xF5) return 4;
+    return 1;
+}
+
+// Decodes the sequence at text (length from SequenceLength, at most end - text);
+// UINT32_MAX for a malformed one
+inline uint32_t Decode(const unsigned char* text, size_t length) {
+    uint32_t codePoint = text[0] & (0x7F >> length);
+    for (size_t i = 1; i < length; ++i) {
+        if ((text[i] & 0xC0) != 0x80) return UINT32_MAX;
+        codePoint = (codePoint << 6) | (text[i] & 0x3F);
+    }
+    // Overlong 3- and 4-byte forms, surrogates and code points past U+10FFFF
+    if ((length == 3 && (codePoint < 0x800 || (codePoint >= 0xD800 && codePoint < 0xE000))) ||
+        (length == 4 && (codePoint < 0x10000 || codePoint > 0x10FFFF))) {
+        return UINT32_MAX;
+    }
+    return codePoint;
+}
+
+// How much of text to annotate now: all of it, less a sequence cut off at the end
+size_t CompleteLength(const std::string& text) {
+    size_t size = text.size();
+    size_t lead = size;
+    while (lead > 0 && size - lead < 3 && (static_cast<unsigned char>(text[lead - 1]) & 0xC0) == 0x80) {
+        --lead;
+    }
+    if (lead == 0) return size;
+    --lead;
+    size_t length = SequenceLength(static_cast<unsigned char>(text[lead]));
+    return lead + length > size ? lead : size;
+}
+
+}  // namespace
+
+CStrokeAnnotator::CStrokeAnnotator(const CDictionaryData& data, Codes codes, Format format) : _format(format) {
+    std::vector<uint32_t> offsets;
+    std::vector<std::wstring_view> reverse;
+    std::wstring storage;
+    data.GetReverseTable(offsets, reverse, storage);
+
+    _pageIndex.assign(CODE_POINT_LIMIT >> PAGE_BITS, 0);
+    _pages.assign(PAGE_SIZE, 0);
+    _offsets.push_back(0);
+    for (CharId id = 0; id + 1 < offsets.size(); ++id) {
+        if (offsets[id] == offsets[id + 1]) continue;
+        // Only characters of one code point can be found by code point
+        std::u32string codePoints = Unicode::ToCodePoints(data.GetCharacter(id));
+        if (codePoints.size() != 1 || codePoints[0] >= CODE_POINT_LIMIT) continue;
+        uint32_t codePoint = codePoints[0];
+
+        _text += Unicode::WideToUtf8(data.GetCharacter(id));
+        _text += _format == Format::Inline ? '(' : '\t';
+        uint32_t last = codes == Codes::All ? offsets[id + 1] : offsets[id] + 1;
+        for (uint32_t i = offsets[id]; i < last; ++i) {
+            if (i > offsets[id]) _text += _format == Format::Inline ? '/' : '\t';
+            _text += Unicode::WideToUtf8(reverse[i]);
+        }
+        _text += _format == Format::Inline ? ')' : '\n';
+        _offsets.push_back(static_cast<uint32_t>(_text.size()));
+
+        uint32_t& page = _pageIndex[codePoint >> PAGE_BITS];
+        if (page == 0) {
+            page = static_cast<uint32_t>(_pages.size() >> PAGE_BITS);
+            _pages.resize(_pages.size() + PAGE_SIZE, 0);
+        }
+        _pages[(static_cast<size_t>(page) << PAGE_BITS) | (codePoint & (PAGE_SIZE - 1))] =
+            static_cast<uint32_t>(_offsets.size() - 1);
+    }
+    _pages.shrink_to_fit();
+    _text.shrink_to_fit();
+}
+
+uint64_t CStrokeAnnotator::Annotate(std::string_view text, std::string& out) const {
+    const unsigned char* p = reinterpret_cast<const unsigned char*>(text.data());
+    const unsigned char* end = p + text.size();
+    bool copy = _format == Format::Inline;
+    uint64_t annotated = 0;
+    while (p < end) {
+        // Runs of ASCII are never in the dictionary
+        if (*p < 0x80) {
+            const unsigned char* run = p;
+            while (p < end && *p < 0x80) ++p;
+            if (copy) out.append(reinterpret_cast<const char*>(run), p - run);
+            continue;
+        }
+
+        // A malformed sequence is passed over one byte at a time
+        size_t length = (std::min)(SequenceLength(*p), static_cast<size_t>(end - p));
+        uint32_t codePoint = length > 1 ? Decode(p, length) : UINT32_MAX;
+        if (codePoint == UINT32_MAX) length = 1;
+        uint32_t annotation = codePoint != UINT32_MAX ? Find(codePoint) : 0;
+        if (annotation != 0) {
+            out.append(_text, _offsets[annotation - 1], _offsets[annotation] - _offsets[annotation - 1]);
+            ++annotated;
+        } else if (copy) {
+            out.append(reinterpret_cast<const char*>(p), length);
+        }
+        p += length;
+    }
+    return annotated;
+}
+
+bool CStrokeAnnotator::Run(FILE* in, FILE* out, unsigned annotators, Stats& stats) const {
+    auto start = std::chrono::steady_clock::now();
+    annotators = (std::max)(annotators, 1u);
+
+    // Every chunk holds one input buffer from being read until it is annotated, and one
+    // output buffer from then until it is written, so these counts bound the memory.
+    // Annotators take their output buffer before their chunk: chunks are taken in order,
+    // so the one the writer waits for never waits for a buffer held behind it.
+    const size_t bufferCount = 2 * static_cast<size_t>(annotators) + 2;
+    CBlockingQueue<std::string> freeInputs;
+    CBlockingQueue<std::string> freeOutputs;
+    CBlockingQueue<Chunk> read;
+    CBlockingQueue<Chunk> annotated;
+    for (size_t i = 0; i < bufferCount; ++i) {
+        freeInputs.Push(std::string());
+        freeOutputs.Push(std::string());
+    }
+
+    std::atomic<bool> failed{false};
+    std::atomic<uint64_t> bytesIn{0};
+    std::atomic<uint64_t> annotatedCount{0};
+
+    std::thread reader([&]() {
+        std::string carry;  // a sequence cut off at the end of the previous chunk
+        uint64_t sequence = 0;
+        while (!failed.load(std::memory_order_relaxed)) {
+            std::string buffer;
+            freeInputs.Pop(buffer);
+            buffer.assign(carry);
+            size_t filled = buffer.size();
+            buffer.resize(filled + CHUNK_SIZE);
+            size_t got = std::fread(&buffer[filled], 1, CHUNK_SIZE, in);
+            buffer.resize(filled + got);
+            bytesIn.fetch_add(got, std::memory_order_relaxed);
+            if (got == 0) {
+                if (std::ferror(in)) failed.store(true);
+                if (!buffer.empty()) read.Push(Chunk{sequence++, std::move(buffer)});
+                break;
+            }
+            size_t complete = CompleteLength(buffer);
+            carry.assign(buffer, complete, std::string::npos);
+            buffer.resize(complete);
+            read.Push(Chunk{sequence++, std::move(buffer)});
+        }
+        read.Close();
+    });
+
+    std::atomic<unsigned> running{annotators};
+    std::vector<std::thread> workers;
+    for (unsigned i = 0; i < annotators; ++i) {
+        workers.emplace_back([&]() {
+            std::string output;
+            Chunk chunk;
+            while (freeOutputs.Pop(output) && read.Pop(chunk)) {
+                output.clear();
+                annotatedCount.fetch_add(Annotate(chunk.text, output), std::memory_order_relaxed);
+                freeInputs.Push(std::move(chunk.text));
+                annotated.Push(Chunk{chunk.sequence, std::move(output)});
+            }
+            if (running.fetch_sub(1) == 1) annotated.Close();
+        });
+    }
+
+    // Write chunks back in input order. After a failure, keep taking them (and handing
+    // the buffers back) so that the reader and the annotators can finish.
+    std::map<uint64_t, std::string> waiting;
+    uint64_t next = 0;
+    Chunk chunk;
+    while (annotated.Pop(chunk)) {
+        waiting.emplace(chunk.sequence, std::move(chunk.text));
+        for (auto it = waiting.begin(); it != waiting.end() && it->first == next; it = waiting.erase(it), ++next) {
+            if (!failed.load(std::memory_order_relaxed)) {
+                if (std::fwrite(it->second.data(), 1, it->second.size(), out) != it->second.size()) {
+                    failed.store(true);
+                }
+                stats.bytesOut += it->second.size();
+            }
+            freeOutputs.Push(std::move(it->second));
+        }
+    }
+
+    reader.join();
+    for (auto& worker : workers) worker.join();
+    if (std::fflush(out) != 0) failed.store(true);
+
+    stats.bytesIn += bytesIn.load();
+    stats.annotated += annotatedCount.load();
+    stats.chunks += next;
+    stats.seconds += std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    return !failed.load();
+}
+
+size_t CStrokeAnnotator::GetMemoryUsage() const {
+    return _pageIndex.capacity() * sizeof(uint32_t) + _pages.capacity() * sizeof(uint32_t) +
+           _offsets.capacity() * sizeof(uint32_t) + _text.capacity();
+}
@@ -0,0 +1,66 @@
+#pragma once
+#include <cstdint>
+#include <cstdio>
+#include <string>
+#include <string_view>
+#include <vector>
+
+class CDictionaryData;
+
+// Writes UTF-8 text back out with the stroke codes of every dictionary character in it.
+// The codes are laid out once, at construction, as ready-made UTF-8 annotations behind a
+// two-level table indexed by code point, so annotating a character is one table read
+// and one copy. Run streams a whole file through reader, annotator and writer threads.
+class CStrokeAnnotator {
+   public:
+    enum class Codes {
+        Canonical,  // the code of the character's best-ranked entry
+        All,        // every code, best rank first
+    };
+
+    enum class Format {
+        Inline,  // 我(丿一丨一フ丿丶), everything else copied through
+        Lines,   // 我<tab>丿一丨一フ丿丶 per dictionary character, everything else dropped
+    };
+
+    struct Stats {
+        uint64_t bytesIn = 0;
+        uint64_t bytesOut = 0;
+        uint64_t annotated = 0;  // characters found in the dictionary
+        uint64_t chunks = 0;
+        double seconds = 0;
+    };
+
+    // Input is read in chunks of this size (cut back to a code point boundary)
+    static constexpr size_t CHUNK_SIZE = 1 << 20;
+
+    // The annotations are built from data; data is not used afterwards
+    CStrokeAnnotator(const CDictionaryData& data, Codes codes, Format format);
+
+    // Annotates text, which should end on a code point boundary (a sequence cut short is
+    // copied through as invalid), appending to out. Returns the characters annotated.
+    uint64_t Annotate(std::string_view text, std::string& out) const;
+
+    // Annotates in up to its end into out: one thread reads chunks, `annotators` threads
+    // annotate them side by side, and the calling thread writes the results in input
+    // order. Returns false on a read or write error.
+    bool Run(FILE* in, FILE* out, unsigned annotators, Stats& stats) const;
+
+    size_t GetMemoryUsage() const;
+
+   private:
+    static constexpr uint32_t PAGE_BITS = 8;
+    static constexpr uint32_t PAGE_SIZE = 1u << PAGE_BITS;
+    static constexpr uint32_t CODE_POINT_LIMIT = 0x110000;
+
+    // 1 + annotation number of the code point, 0 if it has none
+    uint32_t Find(uint32_t codePoint) const {
+        return _pages[(static_cast<size_t>(_pageIndex[codePoint >> PAGE_BITS]) << PAGE_BITS) | (codePoint & (PAGE_SIZE - 1))];
+    }
+
+    Format _format;
+    std::vector<uint32_t> _pageIndex;  // page of each block of PAGE_SIZE code points; page 0 is all zeros
+    std::vector<uint32_t> _pages;
+    std::vector<uint32_t> _offsets;  // annotation i is _text[_offsets[i], _offsets[i + 1])
+    std::string _text;
+};
@@ -0,0 +1,62 @@
+#include "StrokePattern.h"
+
+CStrokePattern::CStrokePattern(std::wstring_view pattern) {
+    for (wchar_t ch : pattern) {
+        int symbol = ch == Stroke::ANY_STROKES[0] ? ANY_RUN : Stroke::ToIndex(ch);
+        if (symbol == Stroke::INVALID_INDEX) _valid = false;
+        // Runs of ～ mean the same as one
+        if (symbol == ANY_RUN && !_symbols.empty() && _symbols.back() == ANY_RUN) continue;
+        _symbols.push_back(symbol);
+    }
+    // One bit per position, including the accepting one past the end
+    if (_symbols.size() >= 64) _valid = false;
+    if (!_valid) _symbols.clear();
+
+    AddState(0);
+    AddState(Close(1));
+}
+
+uint64_t CStrokePattern::Close(uint64_t positions) const {
+    // A live ～ position is also past the ～, having matched no strokes
+    for (size_t j = 0; j < _symbols.size(); ++j) {
+        if ((positions >> j & 1) && _symbols[j] == ANY_RUN) positions |= 1ull << (j + 1);
+    }
+    return positions;
+}
+
+uint32_t CStrokePattern::AddState(uint64_t positions) {
+    auto [it, added] = _states.emplace(positions, static_cast<uint32_t>(_positions.size()));
+    if (added) {
+        _positions.push_back(positions);
+        _transitions.emplace_back().fill(positions == 0 ? DEAD : UNKNOWN);
+    }
+    return it->second;
+}
+
+uint32_t CStrokePattern::Step(uint32_t state, int stroke) {
+    uint64_t positions = _positions[state];
+    uint64_t next = 0;
+    for (size_t j = 0; j < _symbols.size(); ++j) {
+        if (!(positions >> j & 1)) continue;
+        if (_symbols[j] == ANY_RUN) {
+            next |= 1ull << j;
+        } else if (_symbols[j] == stroke || _symbols[j] == Stroke::WILDCARD_INDEX) {
+            next |= 1ull << (j + 1);
+        }
+    }
+    uint32_t target = AddState(Close(next));
+    _transitions[state][stroke] = target;
+    return target;
+}
+
+bool CStrokePattern::Matches(std::wstring_view code) {
+    if (!_valid) return false;
+    uint32_t state = START;
+    for (wchar_t ch : code) {
+        int stroke = Stroke::ToIndex(ch);
+        if (stroke < 0 || stroke >= Stroke::COUNT) return false;
+        state = Next(state, stroke);
+        if (state == DEAD) return false;
+    }
+    return IsAccepting(state);
+}
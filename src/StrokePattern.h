@@ -0,0 +1,50 @@
+#pragma once
+#include <array>
+#include <cstdint>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+#include "Stroke.h"
+
+// A lookup pattern holding '～' (any run of strokes, including none) and possibly '＊',
+// matched against whole codes. The pattern is an NFA whose positions are "the first j
+// symbols matched"; each set of live positions becomes one DFA state the first time a
+// code reaches it, and each (state, stroke) step is worked out once and remembered, so
+// runs of ～ never make matching backtrack.
+class CStrokePattern {
+   public:
+    static constexpr uint32_t DEAD = 0;  // no code continuing from here can match
+    static constexpr uint32_t START = 1;
+
+    explicit CStrokePattern(std::wstring_view pattern);
+
+    // False for symbols other than strokes, ＊ and ～, or patterns too long to compile
+    bool IsValid() const { return _valid; }
+
+    uint32_t Next(uint32_t state, int stroke) {
+        uint32_t target = _transitions[state][stroke];
+        return target != UNKNOWN ? target : Step(state, stroke);
+    }
+    bool IsAccepting(uint32_t state) const { return (_positions[state] >> _symbols.size()) & 1; }
+
+    // Whether the whole code matches
+    bool Matches(std::wstring_view code);
+
+    size_t GetStateCount() const { return _positions.size(); }
+
+   private:
+    static constexpr int ANY_RUN = Stroke::WILDCARD_INDEX + 1;
+    static constexpr uint32_t UNKNOWN = UINT32_MAX;
+
+    uint32_t Step(uint32_t state, int stroke);
+    uint64_t Close(uint64_t positions) const;
+    uint32_t AddState(uint64_t positions);
+
+    std::vector<int> _symbols;  // stroke indexes, WILDCARD_INDEX or ANY_RUN
+    bool _valid = true;
+
+    std::vector<uint64_t> _positions;  // per state: bit j set if position j is live
+    std::vector<std::array<uint32_t, Stroke::COUNT>> _transitions;
+    std::unordered_map<uint64_t, uint32_t> _states;
+};
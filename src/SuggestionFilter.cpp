@@ -0,0 +1,113 @@
+#include "SuggestionFilter.h"
+
+#include <chrono>
+#include <unordered_map>
+
+#include "Debug.h"
+#include "Dictionary.h"
+#include "Stroke.h"
+#include "StrokePattern.h"
+#include "Unicode.h"
+
+CSuggestionFilter::CSuggestionFilter() {
+}
+
+CSuggestionFilter::~CSuggestionFilter() {
+}
+
+void CSuggestionFilter::Build(const std::vector<std::wstring>& suggestions, const CDictionary& dictionary) {
+    auto start = std::chrono::high_resolution_clock::now();
+    Clear();
+    _suggestions = suggestions;
+
+    // Many suggestions share a first character
+    std::unordered_map<std::wstring, std::vector<std::wstring>> codesByCharacter;
+    for (uint32_t s = 0; s < _suggestions.size(); ++s) {
+        std::wstring first(Unicode::FirstCharacter(_suggestions[s]));
+
+        auto it = codesByCharacter.find(first);
+        if (it == codesByCharacter.end()) {
+            it = codesByCharacter.emplace(first, dictionary.GetCodesForCharacter(first)).first;
+        }
+
+        for (const auto& code : it->second) {
+            Code packed = {0, static_cast<uint32_t>(code.size()), s};
+            bool valid = true;
+            for (size_t i = 0; i < code.size() && i < MAX_STROKES; ++i) {
+                int digit = Stroke::ToIndex(code[i]);
+                if (digit < 0 || digit >= Stroke::COUNT) valid = false;
+                packed.strokes |= static_cast<uint64_t>(digit & 7) << (3 * i);
+            }
+            if (!valid) continue;
+            _codes.push_back(packed);
+            if (code.size() > MAX_STROKES) _longCodes.push_back(code);
+        }
+    }
+
+    auto end = std::chrono::high_resolution_clock::now();
+    auto duration = std::chrono::duration_cast<std::chrono::microseconds>(end - start).count();
+    Debug::Log(L"SuggestionFilter", (L"Built: " + std::to_wstring(_suggestions.size()) + L" suggestions, " +
+                                     std::to_wstring(_codes.size()) + L" codes" +
+                                     L" | Time: " + std::to_wstring(duration / 1000) + L"." + std::to_wstring(duration % 1000) + L"ms")
+                                        .c_str());
+}
+
+void CSuggestionFilter::Clear() {
+    _suggestions.clear();
+    _codes.clear();
+    _longCodes.clear();
+}
+
+void CSuggestionFilter::Match(const std::wstring& pattern, std::vector<std::wstring>& out) const {
+    out.clear();
+    if (pattern.empty()) return;
+    if (Stroke::HasAnyStrokes(pattern)) {
+        MatchAnyStrokes(pattern, out);
+        return;
+    }
+    if (pattern.size() > MAX_STROKES) return;
+
+    // Wildcard positions stay out of the mask
+    uint64_t mask = 0, value = 0;
+    for (size_t i = 0; i < pattern.size(); ++i) {
+        int digit = Stroke::ToIndex(pattern[i]);
+        if (digit < 0) return;
+        if (digit == Stroke::WILDCARD_INDEX) continue;
+        mask |= 7ull << (3 * i);
+        value |= static_cast<uint64_t>(digit) << (3 * i);
+    }
+
+    uint32_t last = UINT32_MAX;
+    for (const Code& code : _codes) {
+        if (code.suggestion == last || code.length < pattern.size() || (code.strokes & mask) != value) continue;
+        last = code.suggestion;
+        out.push_back(_suggestions[code.suggestion]);
+    }
+}
+
+void CSuggestionFilter::MatchAnyStrokes(const std::wstring& pattern, std::vector<std::wstring>& out) const {
+    // ～ has to match the whole code, which no mask can say
+    CStrokePattern automaton(pattern);
+    if (!automaton.IsValid()) return;
+
+    uint32_t last = UINT32_MAX;
+    size_t longCode = 0;
+    for (const Code& code : _codes) {
+        const std::wstring* full = code.length > MAX_STROKES ? &_longCodes[longCode++] : nullptr;
+        if (code.suggestion == last) continue;
+
+        bool matches;
+        if (full) {
+            matches = automaton.Matches(*full);
+        } else {
+            uint32_t state = CStrokePattern::START;
+            for (uint32_t i = 0; i < code.length && state != CStrokePattern::DEAD; ++i) {
+                state = automaton.Next(state, static_cast<int>((code.strokes >> (3 * i)) & 7));
+            }
+            matches = automaton.IsAccepting(state);
+        }
+        if (!matches) continue;
+        last = code.suggestion;
+        out.push_back(_suggestions[code.suggestion]);
+    }
+}
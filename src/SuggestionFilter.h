@@ -0,0 +1,43 @@
+#pragma once
+#include <cstdint>
+#include <string>
+#include <vector>
+
+class CDictionary;
+
+// Stroke codes of the first character of every suggestion on screen, so strokes typed
+// over a suggestion list can narrow it down instead of starting from scratch. Built once
+// per list; matching a keystroke is one mask compare per code, or a walk of the pattern's
+// automaton over the code when it holds ～.
+class CSuggestionFilter {
+   public:
+    // Codes longer than this are packed cut short (and kept in full for ～); longer
+    // patterns without ～ match nothing
+    static constexpr uint32_t MAX_STROKES = 21;
+
+    CSuggestionFilter();
+    ~CSuggestionFilter();
+
+    void Build(const std::vector<std::wstring>& suggestions, const CDictionary& dictionary);
+    void Clear();
+
+    bool IsActive() const { return !_suggestions.empty(); }
+    const std::vector<std::wstring>& GetSuggestions() const { return _suggestions; }
+
+    // Suggestions whose first character has a code matching pattern (the same rules as
+    // CDictionary::LookupRegex), in list order
+    void Match(const std::wstring& pattern, std::vector<std::wstring>& out) const;
+
+   private:
+    void MatchAnyStrokes(const std::wstring& pattern, std::vector<std::wstring>& out) const;
+
+    struct Code {
+        uint64_t strokes;     // 3 bits per stroke index, first stroke lowest
+        uint32_t length;      // strokes in the full code
+        uint32_t suggestion;  // index into _suggestions
+    };
+
+    std::vector<std::wstring> _suggestions;
+    std::vector<Code> _codes;  // grouped by suggestion, in list order
+    std::vector<std::wstring> _longCodes;  // codes of more than MAX_STROKES strokes, in _codes order
+};
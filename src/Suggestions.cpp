@@ -1,84 +1,108 @@
 #include "Suggestions.h"
 
-#include <windows.h>
-
-#include <fstream>
-#include <sstream>
-#include <string>
-
-static std::wstring Utf8ToWideS(const std::string& utf8) {
-    if (utf8.empty()) return std::wstring();
-    int size = MultiByteToWideChar(CP_UTF8, 0, utf8.c_str(), (int)utf8.size(), nullptr, 0);
-    if (size <= 0) return std::wstring();
-    std::wstring wide(size, 0);
-    MultiByteToWideChar(CP_UTF8, 0, utf8.c_str(), (int)utf8.size(), &wide[0], size);
-    return wide;
+#include <cstdint>
+#include <memory>
+
+#include "DataFile.h"
+#include "Unicode.h"
+
+static bool IsAsciiSpace(wchar_t ch) {
+    return ch == L' ' || ch == L'\t' || ch == L'\v' || ch == L'\f' || ch == L'\r' || ch == L'\n';
 }
 
-CSuggestions::CSuggestions() {}
+CSuggestions::CSuggestions() : _data(std::make_unique<Data>()) {}
 CSuggestions::~CSuggestions() {}
 
-void CSuggestions::AddEntry(const std::wstring& character, const std::wstring& suggestion) {
-    _suggestions[character].push_back(suggestion);
-}
+std::vector<std::wstring> CSuggestions::Lookup(const std::wstring& text) const {
+    auto data = _data.Read();
+    std::u32string history = Unicode::ToCodePoints(Unicode::LastCharacters(text, CNgramModel::MAX_ORDER - 1));
+    std::vector<CharId> ids;
+    data->model.Lookup(history, SIZE_MAX, ids);
 
-std::vector<std::wstring> CSuggestions::Lookup(const std::wstring& character) const {
-    auto it = _suggestions.find(character);
-    if (it != _suggestions.end()) return it->second;
-    return {};
+    std::vector<std::wstring> result;
+    result.reserve(ids.size());
+    for (CharId id : ids) result.emplace_back(data->strings.Get(id));
+    return result;
 }
 
-std::wstring CSuggestions::GetDefaultSuggestionsPath() {
-    wchar_t dllPath[MAX_PATH];
-    HMODULE hModule = nullptr;
+size_t CSuggestions::GetEntryCount() const {
+    auto data = _data.Read();
+    return data->model.GetContextCount(2);
+}
 
-    GetModuleHandleEx(GET_MODULE_HANDLE_EX_FLAG_FROM_ADDRESS | GET_MODULE_HANDLE_EX_FLAG_UNCHANGED_REFCOUNT,
-                      (LPCWSTR)&CSuggestions::GetDefaultSuggestionsPath, &hModule);
+std::vector<std::wstring> CSuggestions::GetPhrases() const {
+    auto data = _data.Read();
+    std::vector<std::pair<char32_t, CharId>> bigrams;
+    data->model.GetBigrams(bigrams);
 
-    if (hModule && GetModuleFileName(hModule, dllPath, MAX_PATH)) {
-        std::wstring path(dllPath);
-        size_t lastSlash = path.find_last_of(L"\\/");
-        if (lastSlash != std::wstring::npos) {
-            return path.substr(0, lastSlash + 1) + L"suggestionsData.txt";
-        }
+    std::vector<std::wstring> phrases;
+    phrases.reserve(bigrams.size());
+    for (const auto& [key, item] : bigrams) {
+        phrases.push_back(Unicode::FromCodePoints(std::u32string(1, key)));
+        phrases.back() += data->strings.Get(item);
     }
-    return L"suggestionsData.txt";
+    return phrases;
 }
 
-bool CSuggestions::LoadFromFile(const std::wstring& path) {
-    _suggestions.clear();
-
-    std::ifstream file(path, std::ios::binary);
-    if (!file.is_open()) return false;
+size_t CSuggestions::GetMemoryUsage(size_t order) const {
+    auto data = _data.Read();
+    return data->model.GetMemoryUsage(order);
+}
 
-    // Skip BOM if present
-    char bom[3] = {0};
-    file.read(bom, 3);
-    if (!(bom[0] == '\xEF' && bom[1] == '\xBB' && bom[2] == '\xBF')) {
-        file.seekg(0);
-    }
+void CSuggestions::GetMemoryReport(CMemoryReport& report) const {
+    auto data = _data.Read();
+    size_t model = 0;
+    for (size_t order = 2; order <= CNgramModel::MAX_ORDER; ++order) model += data->model.GetMemoryUsage(order);
+    report.Add(L"suggestions/strings", data->strings.GetMemoryUsage());
+    report.Add(L"suggestions/model", model);
+}
 
-    std::string line;
-    while (std::getline(file, line)) {
-        if (line.empty() || line[0] == '#' || line[0] == ';') continue;
-        if (!line.empty() && line.back() == '\r') line.pop_back();
+std::wstring CSuggestions::GetDefaultSuggestionsPath() {
+    return CDataFile::GetModuleRelativePath(L"suggestionsData.txt");
+}
 
-        size_t tabPos = line.find('\t');
-        if (tabPos == std::string::npos || tabPos == 0) continue;
+bool CSuggestions::LoadFromFile(const std::wstring& path) {
+    std::lock_guard<std::mutex> lock(_loadMutex);
 
-        std::string ch = line.substr(0, tabPos);
-        std::string rhs = line.substr(tabPos + 1);
-        if (ch.empty() || rhs.empty()) continue;
+    CDataFile file;
+    if (!file.Load(path)) return false;
 
+    auto next = std::make_unique<Data>();
+    std::vector<CNgramModel::Ngram> ngrams;
+    for (const auto& record : file.GetRecords()) {
         // New format: <character>\t<suggestion1> <suggestion2> ...
-        // Split RHS by ASCII whitespace and add each suggestion while preserving order.
-        std::istringstream iss(rhs);
-        std::string token;
-        while (iss >> token) {
-            if (!token.empty()) {
-                AddEntry(Utf8ToWideS(ch), Utf8ToWideS(token));
+        // Split RHS by ASCII whitespace; earlier suggestions weigh more.
+        std::u32string key = Unicode::ToCodePoints(record.key);
+        std::wstring_view rhs = record.value;
+        size_t pos = 0;
+        float rank = 1.0f;
+        while (pos < rhs.size()) {
+            while (pos < rhs.size() && IsAsciiSpace(rhs[pos])) pos++;
+            size_t tokenStart = pos;
+            while (pos < rhs.size() && !IsAsciiSpace(rhs[pos])) pos++;
+            if (pos == tokenStart) continue;
+
+            // key + suggestion is a phrase; besides key -> suggestion it also yields
+            // key + first character -> rest, and so on, for the longer contexts
+            std::wstring_view suggestion = rhs.substr(tokenStart, pos - tokenStart);
+            std::u32string characters = Unicode::ToCodePoints(suggestion);
+            std::u32string phrase = key;
+            size_t offset = 0;  // in wchar_t
+            for (size_t n = 0; n + 1 < CNgramModel::MAX_ORDER && n < characters.size(); ++n) {
+                std::u32string_view context(phrase);
+                if (context.size() > CNgramModel::MAX_ORDER - 1) {
+                    context.remove_prefix(context.size() - (CNgramModel::MAX_ORDER - 1));
+                }
+                ngrams.push_back({std::u32string(context), next->strings.Intern(suggestion.substr(offset)), 1.0f / rank});
+                offset += (sizeof(wchar_t) == 2 && characters[n] > 0xFFFF) ? 2 : 1;
+                phrase += characters[n];
             }
+            rank += 1.0f;
         }
     }
+    next->model.Build(std::move(ngrams));
+    if (_compact) next->strings.Compact();
+
+    _data.Publish(std::move(next));
     return true;
 }
@@ -1,19 +1,44 @@
 #pragma once
-#include <map>
+#include <mutex>
 #include <string>
 #include <vector>
 
+#include "CharacterTable.h"
+#include "MemoryReport.h"
+#include "NgramModel.h"
+#include "Snapshot.h"
+
 class CSuggestions {
    public:
     CSuggestions();
     ~CSuggestions();
 
-    std::vector<std::wstring> Lookup(const std::wstring& character) const;
+    // Suggestions to follow text, the most recently committed characters: the last
+    // three characters are matched as a 4-gram/trigram/bigram context, backing off to
+    // the list for the last character alone
+    std::vector<std::wstring> Lookup(const std::wstring& text) const;
+    // Safe to call while other threads are looking up (see CDictionary::LoadFromFile)
     bool LoadFromFile(const std::wstring& path);
     static std::wstring GetDefaultSuggestionsPath();
-    size_t GetEntryCount() const { return _suggestions.size(); }
+    size_t GetEntryCount() const;
+
+    // Every key + suggestion as one phrase, grouped by key, best first within a key
+    std::vector<std::wstring> GetPhrases() const;
+    size_t GetMemoryUsage(size_t order) const;  // n-gram model only, see CNgramModel
+    // The suggestion texts and the model, under suggestions/
+    void GetMemoryReport(CMemoryReport& report) const;
+
+    // Compact the suggestion texts of every load from now on (see CCharacterTable::Compact)
+    void SetCompact(bool compact) { _compact = compact; }
 
    private:
-    std::map<std::wstring, std::vector<std::wstring>> _suggestions;
-    void AddEntry(const std::wstring& character, const std::wstring& suggestion);
+    struct Data {
+        // Suggestion texts, interned once; most repeat across keys
+        CCharacterTable strings;
+        CNgramModel model;
+    };
+
+    CSnapshotPtr<Data> _data;
+    std::mutex _loadMutex;
+    bool _compact = false;
 };
@@ -1,14 +1,19 @@
 #include "TextService.h"
 
+#include <algorithm>
+#include <cstdint>
 #include <cwctype>
 #include <map>
 #include <new>
 #include <sstream>
+#include <thread>
 
 #include "CandidateWindow.h"
 #include "Debug.h"
 #include "EditSession.h"
 #include "IndicatorWindow.h"
+#include "MemoryReport.h"
+#include "QueryCacheFile.h"
 
 // Debug helper
 static void DebugLog(const wchar_t* msg) {
@@ -19,14 +24,13 @@ static void DebugLogWParam(const wchar_t* msg, WPARAM wParam) {
     Debug::Log(L"TextService", msg, wParam);
 }
 
-static void DebugLogStroke(const wchar_t* msg, const std::wstring& stroke) {
-    Debug::LogStroke(L"TextService", msg, stroke);
-}
-
 static void DebugLogAction(const wchar_t* msg, const InputAction& action) {
     Debug::LogAction(L"TextService", msg, action);
 }
 
+static const wchar_t* NOTIFY_WINDOW_CLASS = L"ChineseIMELookupNotifyWindow";
+static const UINT WM_LOOKUP_RESULT = WM_APP + 1;
+
 CTextService::CTextService()
     : _refCount(1),
       _threadMgr(nullptr),
@@ -34,17 +38,87 @@ CTextService::CTextService()
       _keystrokeMgr(nullptr),
       _candidateWindow(nullptr),
       _indicatorWindow(nullptr),
-      _selectedCandidate(0),
-      _page(0),
-      _state(InputState::TYPING),
       _enabled(TRUE),
+      _session(_dictionary, _suggestionDict, _phraseIndex),
       _stateMachine(std::make_unique<InputStateMachine>()) {
     Debug::LogDirect(L"CTextService constructor started\n");
     _candidateWindow = new CCandidateWindow();
     _indicatorWindow = new CIndicatorWindow();
+    _settings.LoadFromFile(CSettings::GetDefaultSettingsPath());
+    _session.SetExactLengthFirst(_settings.GetBool(L"exactLengthFirst", false));
+    _session.SetFilterSuggestions(_settings.GetBool(L"filterSuggestions", true));
+    bool phraseInput = _settings.GetBool(L"phraseInput", true);
+    _session.SetPhraseInput(phraseInput);
+    _session.SetFuzzyEdits(_settings.GetInt(L"fuzzyEdits", 1));
+    _session.SetPeekAction([this](InputState state, InputAction& next) { return PeekQueuedAction(state, next); });
+    int scanThreads = _settings.GetInt(L"scanThreads", 0);
+    if (scanThreads <= 0) {
+        scanThreads = static_cast<int>(
+            (std::min)(std::thread::hardware_concurrency(), CScanPool::DEFAULT_MAX_THREADS));
+    }
+    if (scanThreads > 1) {
+        _scanPool = std::make_unique<CScanPool>(static_cast<unsigned>(scanThreads));
+        _dictionary.SetScanPool(_scanPool.get());
+    }
+    bool userDictionary = _settings.GetBool(L"userDictionary", true);
+    if (userDictionary) {
+        _userDictionary.Open(CUserDictionary::GetDefaultPath());
+        _dictionary.SetUserDictionary(&_userDictionary);
+    }
+    if (_settings.GetBool(L"queryCache", true)) {
+        _dictionary.SetQueryCachePath(CQueryCacheFile::GetDefaultPath());
+    }
+    // Most processes type a few characters at most; decode only the shards they need
+    _dictionary.SetSharded(_settings.GetBool(L"shardedDictionary", true));
+    // Every GUI process loads its own copy, so on a crowded desktop these add up
+    size_t memoryBudget = static_cast<size_t>((std::max)(0, _settings.GetInt(L"memoryBudgetKB", 0))) * 1024;
+    if (memoryBudget > 0) {
+        _dictionary.SetMemoryBudget(memoryBudget);
+        _suggestionDict.SetCompact(true);
+    }
     _dictionary.LoadFromFile(CDictionary::GetDefaultDictionaryPath());
     _suggestionDict.LoadFromFile(CSuggestions::GetDefaultSuggestionsPath());
     bool punctLoaded = _punctuationMap.LoadFromFile(CPunctuation::GetDefaultPunctuationPath());
+    if (phraseInput) LoadPhraseIndex(true);
+
+    // Phrase abbreviations and ranks come from both files, so either reload rebuilds them
+    _dataWatcher = std::make_unique<CFileWatcher>();
+    _dataWatcher->Watch(CDictionary::GetDefaultDictionaryPath(), [this, phraseInput](const std::wstring& path) {
+        _dictionary.LoadFromFile(path);
+        if (phraseInput) LoadPhraseIndex(false);
+    });
+    _dataWatcher->Watch(CSuggestions::GetDefaultSuggestionsPath(), [this, phraseInput](const std::wstring& path) {
+        _suggestionDict.LoadFromFile(path);
+        if (phraseInput) LoadPhraseIndex(false);
+    });
+    if (userDictionary) {
+        // Edits made with k6tool or by hand; lookups merge them until the next fold
+        _dataWatcher->Watch(CUserDictionary::GetDefaultPath(),
+                            [this](const std::wstring& path) { _userDictionary.Open(path); });
+    }
+
+    if (_settings.GetBool(L"prefetch", true)) {
+        int budget = _settings.GetInt(L"prefetchBudgetMs", CPrefetcher::DEFAULT_BUDGET_MS);
+        _prefetcher = std::make_unique<CPrefetcher>(_dictionary, std::chrono::milliseconds(budget));
+        _session.SetPrefetcher(_prefetcher.get());
+    }
+
+    if (_settings.GetBool(L"asyncLookup", true)) {
+        auto deadline = std::chrono::milliseconds(
+            (std::max)(0, _settings.GetInt(L"lookupDeadlineMs", CLookupWorker::DEFAULT_DEADLINE_MS)));
+        _lookupWorker = std::make_unique<CLookupWorker>(_dictionary, [this] {
+            if (_notifyWindow) PostMessage(_notifyWindow, WM_LOOKUP_RESULT, 0, 0);
+        });
+        _session.SetLookupWorker(_lookupWorker.get(), deadline);
+    }
+
+    if (_settings.GetBool(L"history", true)) {
+        _history = std::make_unique<CUserHistory>(
+            _settings.GetInt(L"historyHalfLifeDays", CUserHistory::DEFAULT_HALF_LIFE_DAYS),
+            static_cast<size_t>(_settings.GetInt(L"historyMaxContexts", CUserHistory::DEFAULT_MAX_CONTEXTS)));
+        _history->Open(CUserHistory::GetDefaultHistoryPath());
+        _session.SetHistory(_history.get());
+    }
 
     std::wstringstream ss;
     ss << L"Punctuation loaded: " << (punctLoaded ? L"SUCCESS" : L"FAILED")
@@ -54,6 +128,10 @@ CTextService::CTextService()
 }
 
 CTextService::~CTextService() {
+    _dataWatcher.reset();  // joins the reload thread before the data it touches goes away
+    _prefetcher.reset();
+    _lookupWorker.reset();
+    _history.reset();  // waits for a running log compaction
     delete _candidateWindow;
     delete _indicatorWindow;
 }
@@ -110,10 +188,48 @@ STDMETHODIMP CTextService::Activate(ITfThreadMgr* ptim, TfClientId tid) {
     if (_indicatorWindow && _enabled) {
         _indicatorWindow->Show();
     }
+    if (_dataWatcher) {
+        _dataWatcher->Start();
+    }
+    if (_prefetcher) {
+        _prefetcher->Start();
+    }
+    if (_lookupWorker) {
+        WNDCLASSEX wc = {sizeof(wc)};
+        wc.lpfnWndProc = NotifyWindowProc;
+        wc.hInstance = GetModuleHandle(nullptr);
+        wc.lpszClassName = NOTIFY_WINDOW_CLASS;
+        RegisterClassEx(&wc);
+        _notifyWindow = CreateWindowEx(0, NOTIFY_WINDOW_CLASS, L"", 0, 0, 0, 0, 0, HWND_MESSAGE, nullptr,
+                                       GetModuleHandle(nullptr), nullptr);
+        if (_notifyWindow) {
+            SetWindowLongPtr(_notifyWindow, GWLP_USERDATA, reinterpret_cast<LONG_PTR>(this));
+        }
+        _lookupWorker->Start();
+    }
     return S_OK;
 }
 
 STDMETHODIMP CTextService::Deactivate() {
+    if (_dataWatcher) {
+        _dataWatcher->Stop();
+    }
+    if (_prefetcher) {
+        _prefetcher->Stop();
+        _prefetcher->LogStats();
+    }
+    if (_lookupWorker) {
+        _lookupWorker->Stop();  // no more posts once it returns
+        _lookupWorker->LogStats();
+    }
+    // Hand this session's most used results to the next process that loads K6
+    _dictionary.SaveQueryCache();
+    LogMemoryReport();
+    if (_notifyWindow) {
+        DestroyWindow(_notifyWindow);
+        _notifyWindow = nullptr;
+    }
+    Debug::Log(L"TextService", (L"Lookups coalesced into a later keystroke: " + std::to_wstring(_session.GetCoalescedLookups())).c_str());
     if (_keystrokeMgr) {
         _keystrokeMgr->UnadviseKeyEventSink(_clientId);
         _keystrokeMgr->Release();
@@ -137,124 +253,28 @@ STDMETHODIMP CTextService::OnSetFocus(BOOL fForeground) {
 }
 
 void CTextService::HandleInputAction(ITfContext* pContext, const InputAction& action, BOOL* pfEaten) {
-    switch (action.type) {
-        case InputActionType::NOOP_PASS_THROUGH_KEYPRESS: {
-            DebugLog(L"Action: NOOP_PASS_THROUGH_KEYPRESS");
-            break;
-        }
-
-        case InputActionType::NOOP_CONSUME_KEYPRESS: {
-            DebugLog(L"Action: NOOP_CONSUME_KEYPRESS");
-            UpdateCandidateWindow();
-            break;
-        }
-
-        case InputActionType::ADD_STROKE: {
-            DebugLog(L"Action: ADD_STROKE");
-            DebugLogStroke(L"ADD_STROKE details", std::wstring(1, action.stroke));
-            if (_state == InputState::TYPING) {
-                _ghostStrokeInput.clear();
-                _strokeinput.push_back(action.stroke);
-                _page = 0;
-                _selectedCandidate = 0;
-                UpdateQueryResults();
-            }
-            break;
-        }
-
-        case InputActionType::DELETE_STROKE: {
-            DebugLog(L"Action: DELETE_STROKE");
-            if (!_strokeinput.empty()) {
-                _strokeinput.pop_back();
-                _page = 0;
-                _selectedCandidate = 0;
-            } else {
-                _ghostStrokeInput.clear();
-                _suggestions.clear();
-                *pfEaten = FALSE;
-            }
-            UpdateQueryResults();
-            break;
-        }
-
-        case InputActionType::CLEAR_STROKE: {
-            DebugLog(L"Action: CLEAR_STROKE");
-            _ghostStrokeInput.clear();
-            _strokeinput.clear();
-            _candidates.clear();
-            _suggestions.clear();
-            _page = 0;
-            _selectedCandidate = 0;
-            UpdateCandidateWindow();
-            break;
+    if (action.type == InputActionType::TOGGLE_ENABLE) {
+        DebugLog(L"Action: TOGGLE_ENABLE");
+        if (action.changeNextState) {
+            _session.SetState(action.nextState);
         }
-
-        case InputActionType::TOGGLE_ENABLE: {
-            DebugLog(L"Action: TOGGLE_ENABLE");
-            _enabled = !_enabled;
-            if (!_enabled) {
-                _ghostStrokeInput.clear();
-                _strokeinput.clear();
-                _candidates.clear();
-                _suggestions.clear();
-                _page = 0;
-                _selectedCandidate = 0;
-            }
-            UpdateCandidateWindow();
-            break;
-        }
-
-        case InputActionType::SELECT_CHARACTER: {
-            DebugLog(L"Action: SELECT_CHARACTER");
-            const auto& list = _candidates.empty() ? _suggestions : _candidates;
-            UINT idx = (_page * 9) + action.index;
-            if (idx < list.size()) {
-                const std::wstring chosen = list[idx];
-                CommitText(pContext, chosen);
-                SetGhostFromCharacter(chosen);
-                _strokeinput.clear();
-                _candidates.clear();
-                _page = 0;
-                _selectedCandidate = 0;
-                ShowSuggestionsForCharacter(chosen);
-                UpdateCandidateWindow();
-            }
-            break;
-        }
-
-        case InputActionType::NEXT_SELECTION_PAGE: {
-            DebugLog(L"Action: NEXT_SELECTION_PAGE");
-            if ((_page + 1) * 9 < (_candidates.empty() ? _suggestions.size() : _candidates.size())) {
-                _page++;
-            }
-            UpdateCandidateWindow();
-            break;
-        }
-
-        case InputActionType::PREVIOUS_SELECTION_PAGE: {
-            DebugLog(L"Action: PREVIOUS_SELECTION_PAGE");
-            if (_page > 0) {
-                _page--;
-            }
-            UpdateCandidateWindow();
-            break;
-        }
-
-        case InputActionType::SUBSTITUTE_CHARACTER: {
-            DebugLog(L"Action: SUBSTITUTE_CHARACTER");
-            CommitText(pContext, action.character);
-            _ghostStrokeInput.clear();
-            _strokeinput.clear();
-            _candidates.clear();
-            _suggestions.clear();
-            _page = 0;
-            _selectedCandidate = 0;
-            UpdateCandidateWindow();
-            break;
+        _enabled = !_enabled;
+        if (!_enabled) {
+            _session.ClearInput();
         }
+        UpdateCandidateWindow();
+        return;
+    }
 
-        default:
-            break;
+    CInputSession::Effect effect = _session.OnKeyDown(action);
+    if (effect.passThrough) {
+        *pfEaten = FALSE;
+    }
+    if (!effect.commit.empty()) {
+        CommitText(pContext, effect.commit);
+    }
+    if (effect.redraw) {
+        UpdateCandidateWindow();
     }
 }
 
@@ -267,7 +287,7 @@ STDMETHODIMP CTextService::OnTestKeyDown(ITfContext*, WPARAM wParam, LPARAM, BOO
     }
 
     // Use state machine to determine if key should be consumed
-    InputAction action = _stateMachine->ProcessKey(_state, wParam);
+    InputAction action = _stateMachine->ProcessKey(_session.GetState(), wParam);
 
     // Consume the key if the state machine says to (but not on NOOP_PASS_THROUGH_KEYPRESS)
     if (action.type != InputActionType::NOOP_PASS_THROUGH_KEYPRESS) {
@@ -282,42 +302,26 @@ STDMETHODIMP CTextService::OnTestKeyUp(ITfContext*, WPARAM, LPARAM, BOOL* pfEate
     return S_OK;
 }
 
-void CTextService::UpdateQueryResults() {
-    if (_strokeinput.empty()) {
-        _candidates.clear();
-        // keep suggestions (ghost mode)
-    } else {
-        _candidates = _dictionary.LookupRegex(_strokeinput);
-        _suggestions.clear();
-    }
-
-    // Reset selection/page if overflow
-    const auto& list = _candidates.empty() ? _suggestions : _candidates;
-    if (_page * 9 >= list.size()) {
-        _page = 0;
-        _selectedCandidate = 0;
+void CTextService::OnLookupResult() {
+    if (_session.OnLookupResult()) {
+        UpdateCandidateWindow();
     }
-
-    UpdateCandidateWindow();
 }
 
-void CTextService::SetGhostFromCharacter(const std::wstring& ch) {
-    if (ch.empty()) {
-        _ghostStrokeInput.clear();
-        return;
+LRESULT CALLBACK CTextService::NotifyWindowProc(HWND hwnd, UINT uMsg, WPARAM wParam, LPARAM lParam) {
+    if (uMsg == WM_LOOKUP_RESULT) {
+        CTextService* pThis = reinterpret_cast<CTextService*>(GetWindowLongPtr(hwnd, GWLP_USERDATA));
+        if (pThis) pThis->OnLookupResult();
+        return 0;
     }
-    std::wstring key(1, ch.back());
-    _ghostStrokeInput = _dictionary.GetRandomStrokeForCharacter(key);
+    return DefWindowProc(hwnd, uMsg, wParam, lParam);
 }
 
-void CTextService::ShowSuggestionsForCharacter(const std::wstring& ch) {
-    if (ch.empty()) {
-        _suggestions.clear();
-        return;
-    }
-    // Use only the last character for lookup, per request.
-    std::wstring key(1, ch.back());
-    _suggestions = _suggestionDict.Lookup(key);
+bool CTextService::PeekQueuedAction(InputState state, InputAction& next) const {
+    MSG msg;
+    if (!PeekMessage(&msg, nullptr, WM_KEYDOWN, WM_KEYDOWN, PM_NOREMOVE | PM_NOYIELD)) return false;
+    next = _stateMachine->ProcessKey(state, msg.wParam);
+    return true;
 }
 
 STDMETHODIMP CTextService::OnKeyDown(ITfContext* pContext, WPARAM wParam, LPARAM, BOOL* pfEaten) {
@@ -342,11 +346,8 @@ STDMETHODIMP CTextService::OnKeyDown(ITfContext* pContext, WPARAM wParam, LPARAM
         return S_OK;
     }
 
-    // Use state machine to determine action
-    InputAction action = _stateMachine->ProcessKey(_state, wParam);
-    if (action.changeNextState) {
-        _state = action.nextState;
-    }
+    // Use state machine to determine action; the session takes its state change
+    InputAction action = _stateMachine->ProcessKey(_session.GetState(), wParam);
     DebugLogAction(L"OnKeyDown Action", action);
 
     // Handle the action
@@ -372,6 +373,11 @@ STDMETHODIMP CTextService::OnKeyUp(ITfContext* pContext, WPARAM wParam, LPARAM,
         _shiftUsedAsModifier = FALSE;
     }
 
+    // A lookup put off for a burst of strokes runs once the burst is over
+    if (_session.OnKeyUp()) {
+        UpdateCandidateWindow();
+    }
+
     return S_OK;
 }
 
@@ -393,21 +399,21 @@ void CTextService::UpdateCandidateWindow() {
     {
         std::wstringstream ss;
         ss << L"[IME][TS->CW] UpdateCandidateWindow strokeinput='";
-        for (wchar_t c : _strokeinput) {
+        for (wchar_t c : _session.GetStrokeInput()) {
             ss << c << L"(0x" << std::hex << static_cast<int>(c) << std::dec << L") ";
         }
-        ss << L"' ghost='" << _ghostStrokeInput << L"' cand=" << _candidates.size() << L" sugg=" << _suggestions.size()
-           << L" page=" << _page;
+        ss << L"' ghost='" << _session.GetGhostStrokeInput() << L"' cand=" << _session.GetCandidates().size()
+           << L" sugg=" << _session.GetSuggestions().size() << L" page=" << _session.GetPage();
         Debug::LogDirect(ss.str().c_str());
         Debug::LogDirect(L"\n");
     }
 
-    _candidateWindow->SetStrokeInput(_strokeinput);
-    _candidateWindow->SetGhostStrokeInput(_ghostStrokeInput);
-    _candidateWindow->SetCandidates(_candidates.empty() ? _suggestions : _candidates);
-    _candidateWindow->SetSelection(_selectedCandidate);
-    _candidateWindow->SetPage(_page);
-    _candidateWindow->SetState(_state);
+    _candidateWindow->SetStrokeInput(_session.GetStrokeInput());
+    _candidateWindow->SetGhostStrokeInput(_session.GetGhostStrokeInput());
+    _candidateWindow->SetCandidates(_session.GetList());
+    _candidateWindow->SetSelection(static_cast<UINT>(_session.GetSelection()));
+    _candidateWindow->SetPage(static_cast<UINT>(_session.GetPage()));
+    _candidateWindow->SetState(_session.GetState());
 
     POINT pt;
     GetCaretPos(&pt);
@@ -416,22 +422,42 @@ void CTextService::UpdateCandidateWindow() {
 }
 
 void CTextService::Reset() {
-    _strokeinput.clear();
-    _ghostStrokeInput.clear();
-    _candidates.clear();
-    _suggestions.clear();
-    _selectedCandidate = 0;
-    _page = 0;
-    _state = _enabled ? InputState::TYPING : InputState::DISABLED;
+    _session.Reset(_enabled ? InputState::TYPING : InputState::DISABLED);
     _candidateWindow->Hide();
     if (!_enabled && _indicatorWindow) {
         _indicatorWindow->Hide();
     }
 }
 
+void CTextService::LogMemoryReport() {
+    CMemoryReport report;
+    _dictionary.GetMemoryReport(report);
+    _suggestionDict.GetMemoryReport(report);
+    _phraseIndex.GetMemoryReport(report);
+    if (_history) report.Add(L"history", _history->GetMemoryUsage());
+    Debug::Log(L"TextService", (L"Memory:\n" + report.ToString()).c_str());
+}
+
+void CTextService::LoadPhraseIndex(bool background) {
+    // k6tool compile builds it from the shipped files, so user entries (which can move
+    // a phrase's first character or give it new codes) need a build of our own
+    std::wstring suggestionsPath = CSuggestions::GetDefaultSuggestionsPath();
+    uint64_t hash;
+    if (_userDictionary.GetVersion() == 0 &&
+        CPhraseIndex::GetDataHash(suggestionsPath, CDictionary::GetDefaultDictionaryPath(), hash) &&
+        _phraseIndex.Load(CPhraseIndex::GetPathForSuggestions(suggestionsPath), hash)) {
+        return;
+    }
+    if (background) {
+        _phraseIndex.BuildInBackground(_suggestionDict, _dictionary);
+    } else {
+        _phraseIndex.Build(_suggestionDict, _dictionary);
+    }
+}
+
 void CTextService::ToggleEnabled() {
     _enabled = !_enabled;
-    _state = _enabled ? InputState::TYPING : InputState::DISABLED;
+    _session.SetState(_enabled ? InputState::TYPING : InputState::DISABLED);
     if (!_enabled) {
         Reset();
     }
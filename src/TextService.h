@@ -7,10 +7,20 @@
 #include <vector>
 
 #include "Dictionary.h"
+#include "FileWatcher.h"
+#include "InputSession.h"
 #include "InputStateMachine.h"
+#include "LookupWorker.h"
+#include "PhraseIndex.h"
+#include "Prefetcher.h"
 #include "Punctuation.h"
+#include "ScanPool.h"
+#include "Settings.h"
 #include "Stroke.h"
+#include "SuggestionFilter.h"
 #include "Suggestions.h"
+#include "UserDictionary.h"
+#include "UserHistory.h"
 #include "guid.h"
 
 class CCandidateWindow;
@@ -52,14 +62,6 @@ class CTextService : public ITfTextInputProcessor, public ITfKeyEventSink {
     // State machine
     std::unique_ptr<InputStateMachine> _stateMachine;
 
-    // Query / selection state
-    std::wstring _strokeinput;               // current query strokes
-    std::wstring _ghostStrokeInput;          // ghost strokes after commit
-    std::vector<std::wstring> _candidates;   // character results
-    std::vector<std::wstring> _suggestions;  // suggestion results
-    UINT _selectedCandidate;                 // index in current page [0..8]
-    UINT _page;                              // page for candidates/suggestions
-    InputState _state;
     BOOL _enabled;  // overall IME enabled
 
     // Shift-toggle tracking
@@ -67,9 +69,32 @@ class CTextService : public ITfTextInputProcessor, public ITfKeyEventSink {
     BOOL _shiftUsedAsModifier = FALSE;  // whether a non-Shift key was pressed while Shift held
 
     CCandidateWindow* _candidateWindow;
+    // Threads for full-list ～ scans (null when one core or scanThreads 1), started by the
+    // first such scan; declared before _dictionary so it outlives the snapshots that use it
+    std::unique_ptr<CScanPool> _scanPool;
+    // The user's own entries, layered over _dictionary (which must not outlive them)
+    CUserDictionary _userDictionary;
     CDictionary _dictionary;
     CSuggestions _suggestionDict;
+    CPhraseIndex _phraseIndex;  // built from the two above, so declared (and destroyed) after them
+    // Query / selection state and the lookups behind it, over the data above
+    CInputSession _session;
     CPunctuation _punctuationMap;
+    CSettings _settings;
+
+    // Reloads the dictionary/suggestions in the background when their files change
+    std::unique_ptr<CFileWatcher> _dataWatcher;
+
+    // Background lookups of the next keystroke's queries (null when disabled in settings)
+    std::unique_ptr<CPrefetcher> _prefetcher;
+
+    // Learned picks that re-rank candidates and suggestions (null when disabled in settings)
+    std::unique_ptr<CUserHistory> _history;
+
+    // First-page lookups off the key handler (null when disabled in settings); results
+    // that miss the deadline are posted to the message-only _notifyWindow
+    std::unique_ptr<CLookupWorker> _lookupWorker;
+    HWND _notifyWindow = nullptr;
 
     // Small top-left indicator window
     CIndicatorWindow* _indicatorWindow;
@@ -77,12 +102,13 @@ class CTextService : public ITfTextInputProcessor, public ITfKeyEventSink {
     void CommitText(ITfContext* pContext, const std::wstring& text);
     void UpdateCandidateWindow();
     void Reset();
+    void LogMemoryReport();  // per-structure memory of the loaded data, to the debug log
+    void LoadPhraseIndex(bool background);  // maps the compiled phrase index, else builds it
     void ToggleEnabled();
 
-    // Query update helpers
-    void UpdateQueryResults();
-    void SetGhostFromCharacter(const std::wstring& ch);
-    void ShowSuggestionsForCharacter(const std::wstring& ch);
+    bool PeekQueuedAction(InputState state, InputAction& next) const;  // the next key-down in the queue
+    void OnLookupResult();  // the worker posted a result
+    static LRESULT CALLBACK NotifyWindowProc(HWND hwnd, UINT uMsg, WPARAM wParam, LPARAM lParam);
 
     // State machine action handler
     void HandleInputAction(ITfContext* pContext, const InputAction& action, BOOL* pfEaten);
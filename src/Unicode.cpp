@@ -0,0 +1,188 @@
+#include "Unicode.h"
+
+#include <cstdint>
+#include <cstring>
+
+namespace Unicode {
+
+static constexpr wchar_t REPLACEMENT_CHARACTER = 0xFFFD;
+
+static inline void PutCodepoint(wchar_t*& out, uint32_t cp) {
+    if constexpr (sizeof(wchar_t) == 2) {
+        if (cp >= 0x10000) {
+            cp -= 0x10000;
+            *out++ = static_cast<wchar_t>(0xD800 + (cp >> 10));
+            *out++ = static_cast<wchar_t>(0xDC00 + (cp & 0x3FF));
+            return;
+        }
+    }
+    *out++ = static_cast<wchar_t>(cp);
+}
+
+size_t Utf8ToWide(const char* src, size_t length, wchar_t* dst) {
+    const uint8_t* in = reinterpret_cast<const uint8_t*>(src);
+    const uint8_t* end = in + length;
+    wchar_t* out = dst;
+
+    while (in < end) {
+        // ASCII runs: test eight bytes at a time and widen them without branching per byte
+        while (end - in >= 8) {
+            uint64_t word;
+            std::memcpy(&word, in, 8);
+            if (word & 0x8080808080808080ull) break;
+            for (int i = 0; i < 8; ++i) out[i] = static_cast<wchar_t>(in[i]);
+            in += 8;
+            out += 8;
+        }
+        if (in >= end) break;
+
+        uint8_t lead = *in;
+        if (lead < 0x80) {
+            *out++ = lead;
+            in++;
+            continue;
+        }
+
+        // Three-byte sequences cover the whole BMP CJK range, and stroke data is almost
+        // entirely made of them, so decode whole runs of them in one tight loop.
+        if ((lead & 0xF0) == 0xE0) {
+            const uint8_t* runStart = in;
+            while (end - in >= 3 && (in[0] & 0xF0) == 0xE0 && (in[1] & 0xC0) == 0x80 && (in[2] & 0xC0) == 0x80) {
+                uint32_t cp = ((in[0] & 0x0F) << 12) | ((in[1] & 0x3F) << 6) | (in[2] & 0x3F);
+                bool valid = cp >= 0x800 && (cp < 0xD800 || cp > 0xDFFF);
+                *out++ = valid ? static_cast<wchar_t>(cp) : REPLACEMENT_CHARACTER;
+                in += 3;
+            }
+            if (in != runStart) continue;
+        }
+
+        if ((lead & 0xE0) == 0xC0 && end - in >= 2 && (in[1] & 0xC0) == 0x80) {
+            uint32_t cp = ((lead & 0x1F) << 6) | (in[1] & 0x3F);
+            *out++ = cp >= 0x80 ? static_cast<wchar_t>(cp) : REPLACEMENT_CHARACTER;
+            in += 2;
+            continue;
+        }
+
+        if ((lead & 0xF8) == 0xF0 && end - in >= 4 && (in[1] & 0xC0) == 0x80 && (in[2] & 0xC0) == 0x80 &&
+            (in[3] & 0xC0) == 0x80) {
+            uint32_t cp = ((lead & 0x07) << 18) | ((in[1] & 0x3F) << 12) | ((in[2] & 0x3F) << 6) | (in[3] & 0x3F);
+            if (cp >= 0x10000 && cp <= 0x10FFFF) {
+                PutCodepoint(out, cp);
+            } else {
+                *out++ = REPLACEMENT_CHARACTER;
+            }
+            in += 4;
+            continue;
+        }
+
+        // Invalid or truncated sequence: consume one byte
+        *out++ = REPLACEMENT_CHARACTER;
+        in++;
+    }
+
+    return static_cast<size_t>(out - dst);
+}
+
+std::wstring Utf8ToWide(std::string_view utf8) {
+    if (utf8.empty()) return std::wstring();
+    std::wstring wide(utf8.size(), 0);
+    wide.resize(Utf8ToWide(utf8.data(), utf8.size(), &wide[0]));
+    return wide;
+}
+
+std::string WideToUtf8(std::wstring_view wide) {
+    std::string out;
+    out.reserve(wide.size() * 3);
+    for (size_t i = 0; i < wide.size(); ++i) {
+        uint32_t cp = static_cast<uint32_t>(wide[i]);
+        if constexpr (sizeof(wchar_t) == 2) {
+            if (cp >= 0xD800 && cp <= 0xDBFF && i + 1 < wide.size()) {
+                uint32_t low = static_cast<uint32_t>(wide[i + 1]);
+                if (low >= 0xDC00 && low <= 0xDFFF) {
+                    cp = 0x10000 + ((cp - 0xD800) << 10) + (low - 0xDC00);
+                    ++i;
+                }
+            }
+        }
+        if (cp < 0x80) {
+            out.push_back(static_cast<char>(cp));
+        } else if (cp < 0x800) {
+            out.push_back(static_cast<char>(0xC0 | (cp >> 6)));
+            out.push_back(static_cast<char>(0x80 | (cp & 0x3F)));
+        } else if (cp < 0x10000) {
+            out.push_back(static_cast<char>(0xE0 | (cp >> 12)));
+            out.push_back(static_cast<char>(0x80 | ((cp >> 6) & 0x3F)));
+            out.push_back(static_cast<char>(0x80 | (cp & 0x3F)));
+        } else {
+            out.push_back(static_cast<char>(0xF0 | (cp >> 18)));
+            out.push_back(static_cast<char>(0x80 | ((cp >> 12) & 0x3F)));
+            out.push_back(static_cast<char>(0x80 | ((cp >> 6) & 0x3F)));
+            out.push_back(static_cast<char>(0x80 | (cp & 0x3F)));
+        }
+    }
+    return out;
+}
+
+std::wstring_view LastCharacter(std::wstring_view text) {
+    return LastCharacters(text, 1);
+}
+
+std::wstring_view FirstCharacter(std::wstring_view text) {
+    if (text.empty()) return text;
+    size_t length = 1;
+    if constexpr (sizeof(wchar_t) == 2) {
+        wchar_t high = text[0];
+        if (high >= 0xD800 && high <= 0xDBFF && text.size() >= 2 && text[1] >= 0xDC00 && text[1] <= 0xDFFF) length = 2;
+    }
+    return text.substr(0, length);
+}
+
+std::wstring_view LastCharacters(std::wstring_view text, size_t count) {
+    size_t start = text.size();
+    for (size_t n = 0; n < count && start > 0; ++n) {
+        start--;
+        if constexpr (sizeof(wchar_t) == 2) {
+            wchar_t low = text[start];
+            if (low >= 0xDC00 && low <= 0xDFFF && start > 0) {
+                wchar_t high = text[start - 1];
+                if (high >= 0xD800 && high <= 0xDBFF) start--;
+            }
+        }
+    }
+    return text.substr(start);
+}
+
+std::u32string ToCodePoints(std::wstring_view text) {
+    std::u32string out;
+    out.reserve(text.size());
+    for (size_t i = 0; i < text.size(); ++i) {
+        char32_t cp = static_cast<char32_t>(text[i]);
+        if constexpr (sizeof(wchar_t) == 2) {
+            if (cp >= 0xD800 && cp <= 0xDBFF && i + 1 < text.size()) {
+                char32_t low = static_cast<char32_t>(text[i + 1]);
+                if (low >= 0xDC00 && low <= 0xDFFF) {
+                    cp = 0x10000 + ((cp - 0xD800) << 10) + (low - 0xDC00);
+                    ++i;
+                }
+            }
+        }
+        out.push_back(cp);
+    }
+    return out;
+}
+
+std::wstring FromCodePoints(std::u32string_view codePoints) {
+    std::wstring out;
+    out.reserve(codePoints.size());
+    for (char32_t cp : codePoints) {
+        if (sizeof(wchar_t) == 2 && cp >= 0x10000) {
+            out.push_back(static_cast<wchar_t>(0xD800 + ((cp - 0x10000) >> 10)));
+            out.push_back(static_cast<wchar_t>(0xDC00 + ((cp - 0x10000) & 0x3FF)));
+        } else {
+            out.push_back(static_cast<wchar_t>(cp));
+        }
+    }
+    return out;
+}
+
+}  // namespace Unicode
@@ -0,0 +1,33 @@
+#pragma once
+#include <cstddef>
+#include <string>
+#include <string_view>
+
+// Platform-independent UTF-8 <-> wchar_t conversion.
+// wchar_t is UTF-16 on Windows (supplementary characters become surrogate pairs)
+// and UTF-32 elsewhere.
+namespace Unicode {
+
+// Decode UTF-8 into dst, which must have room for at least `length` wchar_t.
+// Invalid sequences decode to U+FFFD. Returns the number of wchar_t written.
+size_t Utf8ToWide(const char* src, size_t length, wchar_t* dst);
+
+std::wstring Utf8ToWide(std::string_view utf8);
+std::string WideToUtf8(std::wstring_view wide);
+
+// The last code point of text, keeping a UTF-16 surrogate pair together
+std::wstring_view LastCharacter(std::wstring_view text);
+
+// The first code point of text, keeping a UTF-16 surrogate pair together
+std::wstring_view FirstCharacter(std::wstring_view text);
+
+// The last count code points of text (all of it if shorter)
+std::wstring_view LastCharacters(std::wstring_view text, size_t count);
+
+// Code points of text, with UTF-16 surrogate pairs combined
+std::u32string ToCodePoints(std::wstring_view text);
+
+// Inverse of ToCodePoints
+std::wstring FromCodePoints(std::u32string_view codePoints);
+
+}  // namespace Unicode
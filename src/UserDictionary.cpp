@@ -0,0 +1,177 @@
+#include "UserDictionary.h"
+
+#include <algorithm>
+#include <filesystem>
+#include <fstream>
+
+#include "DataFile.h"
+#include "Debug.h"
+#include "Stroke.h"
+#include "Unicode.h"
+
+static bool IsStrokeCode(std::wstring_view code) {
+    if (code.empty()) return false;
+    for (wchar_t ch : code) {
+        int index = Stroke::ToIndex(ch);
+        if (index < 0 || index >= Stroke::COUNT) return false;
+    }
+    return true;
+}
+
+static bool IsCharacter(std::wstring_view character) {
+    return !character.empty() && character.find_first_of(L"\t\r\n") == std::wstring_view::npos;
+}
+
+const std::vector<uint32_t>* CUserDictionary::CEntries::Find(std::wstring_view character) const {
+    auto it = _byCharacter.find(std::wstring(character));
+    return it == _byCharacter.end() ? nullptr : &it->second;
+}
+
+bool CUserDictionary::CEntries::Hides(std::wstring_view code, std::wstring_view character) const {
+    const std::vector<uint32_t>* indexes = Find(character);
+    if (!indexes) return false;
+    for (uint32_t i : *indexes) {
+        if (_entries[i].code == code) return true;
+    }
+    return false;
+}
+
+void CUserDictionary::CEntries::Index() {
+    _byCharacter.clear();
+    for (uint32_t i = 0; i < _entries.size(); ++i) {
+        _byCharacter[_entries[i].character].push_back(i);
+    }
+}
+
+CUserDictionary::CUserDictionary() : _entries(std::make_unique<CEntries>()) {
+}
+
+CUserDictionary::~CUserDictionary() {
+}
+
+bool CUserDictionary::Open(const std::wstring& path) {
+    std::lock_guard<std::mutex> lock(_editMutex);
+    _path = path;
+
+    std::vector<Entry> entries;
+    CDataFile file;
+    if (std::filesystem::exists(std::filesystem::path(path)) && file.Load(path)) {
+        for (const auto& record : file.GetRecords()) {
+            size_t tab = record.value.find(L'\t');
+            if (tab == std::wstring_view::npos) continue;
+            std::wstring_view character = record.value.substr(0, tab);
+            std::wstring_view rank = record.value.substr(tab + 1);
+            if (!IsStrokeCode(record.key) || !IsCharacter(character) || rank.empty()) continue;
+
+            Entry entry{std::wstring(record.key), std::wstring(character), 0};
+            if (rank == L"-") {
+                entry.rank = REMOVED;
+            } else if (rank.find_first_not_of(L"0123456789") == std::wstring_view::npos && rank.size() < 10) {
+                entry.rank = static_cast<uint32_t>(std::stoul(std::wstring(rank)));
+            } else {
+                continue;
+            }
+            // A later line for the same code and character wins
+            entries.erase(std::remove_if(entries.begin(), entries.end(),
+                                         [&entry](const Entry& e) {
+                                             return e.code == entry.code && e.character == entry.character;
+                                         }),
+                          entries.end());
+            entries.push_back(std::move(entry));
+        }
+    }
+
+    Debug::Log(L"UserDictionary", (L"Opened " + path + L" | Entries: " + std::to_wstring(entries.size())).c_str());
+    Publish(std::move(entries));
+    return true;
+}
+
+bool CUserDictionary::Add(const std::wstring& code, const std::wstring& character, uint32_t rank) {
+    if (rank == REMOVED) return false;
+    return Edit(code, character, rank, false);
+}
+
+bool CUserDictionary::Remove(const std::wstring& code, const std::wstring& character) {
+    return Edit(code, character, REMOVED, false);
+}
+
+bool CUserDictionary::Reset(const std::wstring& code, const std::wstring& character) {
+    return Edit(code, character, REMOVED, true);
+}
+
+bool CUserDictionary::Edit(const std::wstring& code, const std::wstring& character, uint32_t rank, bool reset) {
+    if (!IsStrokeCode(code) || !IsCharacter(character)) return false;
+
+    std::lock_guard<std::mutex> lock(_editMutex);
+    std::vector<Entry> entries;
+    {
+        auto current = _entries.Read();
+        entries = current->GetEntries();
+    }
+    entries.erase(std::remove_if(entries.begin(), entries.end(),
+                                 [&](const Entry& e) { return e.code == code && e.character == character; }),
+                  entries.end());
+    if (!reset) entries.push_back({code, character, rank});
+
+    if (!_path.empty() && !Save(entries)) return false;
+    Publish(std::move(entries));
+    return true;
+}
+
+// Caller holds _editMutex (or is Open)
+void CUserDictionary::Publish(std::vector<Entry> entries) {
+    std::stable_sort(entries.begin(), entries.end(), [](const Entry& a, const Entry& b) { return a.rank < b.rank; });
+    {
+        // Rereading our own save changes nothing, and should not cost a fold
+        auto current = _entries.Read();
+        const auto& old = current->GetEntries();
+        if (std::equal(entries.begin(), entries.end(), old.begin(), old.end(), [](const Entry& a, const Entry& b) {
+                return a.rank == b.rank && a.code == b.code && a.character == b.character;
+            })) {
+            return;
+        }
+    }
+
+    auto next = std::make_unique<CEntries>();
+    next->_entries = std::move(entries);
+    next->_version = next->_entries.empty() ? 0 : _nextVersion++;
+    next->Index();
+
+    uint64_t version = next->_version;
+    _entries.Publish(std::move(next));
+    _version.store(version);
+}
+
+// Written to a temporary file and renamed over the old one, so a crash leaves one or the other
+bool CUserDictionary::Save(const std::vector<Entry>& entries) const {
+    std::string text = "# K6 user dictionary: code<tab>character<tab>rank, or - to remove a shipped entry\n";
+    for (const Entry& entry : entries) {
+        text += Unicode::WideToUtf8(entry.code);
+        text += '\t';
+        text += Unicode::WideToUtf8(entry.character);
+        text += '\t';
+        text += entry.rank == REMOVED ? std::string("-") : std::to_string(entry.rank);
+        text += '\n';
+    }
+
+    std::wstring tempPath = _path + L".tmp";
+    bool written;
+    {
+        std::ofstream file(std::filesystem::path(tempPath), std::ios::binary | std::ios::trunc);
+        file.write(text.data(), static_cast<std::streamsize>(text.size()));
+        file.flush();
+        written = file.good();
+    }
+    std::error_code error;
+    if (written) std::filesystem::rename(std::filesystem::path(tempPath), std::filesystem::path(_path), error);
+    if (!written || error) {
+        std::filesystem::remove(std::filesystem::path(tempPath), error);
+        Debug::Log(L"UserDictionary", (L"Failed to save " + _path).c_str());
+        return false;
+    }
+    return true;
+}
+
+std::wstring CUserDictionary::GetDefaultPath() {
+    return CDataFile::GetUserDataPath(L"userDictionary.txt");
+}
@@ -0,0 +1,89 @@
+#pragma once
+#include <atomic>
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+#include "Snapshot.h"
+
+// The user's own entries, layered over the shipped dictionary by CDictionary. An entry
+// either places (code, character) at a rank, just ahead of the shipped entry with that
+// rank, or removes it. Either way it hides the shipped entry with the same code and
+// character, so moving an entry is adding it again at another rank. Every edit
+// publishes a new snapshot and rewrites the file, one entry per line:
+// code<tab>character<tab>rank, with - as the rank of a removal.
+class CUserDictionary {
+   public:
+    static constexpr uint32_t REMOVED = UINT32_MAX;
+
+    struct Entry {
+        std::wstring code;
+        std::wstring character;
+        uint32_t rank;  // REMOVED for a tombstone
+    };
+
+    // One published state of the overlay; never changes once published
+    class CEntries {
+       public:
+        // 0 exactly when there are no entries; otherwise different for every state
+        uint64_t GetVersion() const { return _version; }
+        bool IsEmpty() const { return _entries.empty(); }
+
+        // Placed entries in rank order (ties in the order they were made), then removals
+        const std::vector<Entry>& GetEntries() const { return _entries; }
+        // Distinct characters with entries
+        size_t GetCharacterCount() const { return _byCharacter.size(); }
+        // Indexes into GetEntries of the character's entries, null if it has none
+        const std::vector<uint32_t>* Find(std::wstring_view character) const;
+        // Whether some entry (placed or removed) has exactly this code and character
+        bool Hides(std::wstring_view code, std::wstring_view character) const;
+
+       private:
+        friend class CUserDictionary;
+        void Index();
+
+        uint64_t _version = 0;
+        std::vector<Entry> _entries;
+        std::unordered_map<std::wstring, std::vector<uint32_t>> _byCharacter;
+    };
+    typedef CSnapshotPtr<CEntries>::ReadGuard Snapshot;
+
+    CUserDictionary();
+    ~CUserDictionary();
+
+    CUserDictionary(const CUserDictionary&) = delete;
+    CUserDictionary& operator=(const CUserDictionary&) = delete;
+
+    // Reads the entries at path (a missing file is an empty overlay) and saves every
+    // edit there. Also rereads the file after it was changed from outside.
+    bool Open(const std::wstring& path);
+
+    // Places (code, character) at rank, replacing the user's earlier entry for them.
+    // Codes must be made of the five strokes. False if invalid or not saved.
+    bool Add(const std::wstring& code, const std::wstring& character, uint32_t rank);
+    // Hides (code, character), whether shipped or added
+    bool Remove(const std::wstring& code, const std::wstring& character);
+    // Drops the user's entry for (code, character), so the shipped one shows again
+    bool Reset(const std::wstring& code, const std::wstring& character);
+
+    Snapshot Acquire() const { return _entries.Read(); }
+    uint64_t GetVersion() const { return _version.load(); }
+
+    // userDictionary.txt in the user data directory
+    static std::wstring GetDefaultPath();
+
+   private:
+    // Applies one edit to a copy of the current entries, saves and publishes it
+    bool Edit(const std::wstring& code, const std::wstring& character, uint32_t rank, bool reset);
+    void Publish(std::vector<Entry> entries);
+    bool Save(const std::vector<Entry>& entries) const;
+
+    CSnapshotPtr<CEntries> _entries;
+    std::atomic<uint64_t> _version{0};
+    uint64_t _nextVersion = 1;
+    std::mutex _editMutex;  // serialises Open and edits
+    std::wstring _path;
+};
@@ -0,0 +1,436 @@
+#include "UserHistory.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <iterator>
+
+#include "DataFile.h"
+#include "Debug.h"
+#include "Unicode.h"
+
+static constexpr char HISTORY_MAGIC[4] = {'K', '6', 'U', 'H'};
+static constexpr uint32_t HISTORY_VERSION = 1;
+
+// Items below PROMOTE_SCORE stay in their static position (one pick counts for one
+// half-life); below DROP_SCORE they are forgotten
+static constexpr float PROMOTE_SCORE = 0.5f;
+static constexpr float DROP_SCORE = 0.05f;
+
+// Compact once the log holds this many records and at least twice the live items
+static constexpr uint64_t COMPACT_MIN_RECORDS = 1024;
+
+CUserHistory::CUserHistory(int halfLifeDays, size_t maxContexts)
+    : _halfLifeMinutes((std::max)(halfLifeDays, 1) * 24.0 * 60.0), _maxContexts((std::max)(maxContexts, size_t(1))) {
+}
+
+CUserHistory::~CUserHistory() {
+    Close();
+}
+
+uint32_t CUserHistory::Now() {
+    auto now = std::chrono::system_clock::now().time_since_epoch();
+    return static_cast<uint32_t>(std::chrono::duration_cast<std::chrono::minutes>(now).count());
+}
+
+uint64_t CUserHistory::Key(Kind kind, std::wstring_view context) {
+    uint64_t hash = CDataFile::HashBytes(reinterpret_cast<const char*>(context.data()), context.size() * sizeof(wchar_t));
+    return hash ^ (static_cast<uint64_t>(kind) << 63);
+}
+
+float CUserHistory::Decayed(const Item& item, uint32_t now) const {
+    if (now <= item.minute) return item.score;
+    return item.score * static_cast<float>(std::exp2(-static_cast<double>(now - item.minute) / _halfLifeMinutes));
+}
+
+void CUserHistory::Apply(Op op, Kind kind, std::wstring_view context, std::wstring_view item, uint32_t minute,
+                         float score) {
+    auto inserted = _contexts.try_emplace(Key(kind, context));
+    Context& entry = inserted.first->second;
+    if (inserted.second) {
+        entry.text = _strings.Intern(context);
+        entry.kind = kind;
+        entry.count = 0;
+    }
+
+    CharId text = _strings.Intern(item);
+    Item* slot = nullptr;
+    for (uint8_t i = 0; i < entry.count; ++i) {
+        if (entry.items[i].text == text) slot = &entry.items[i];
+    }
+    if (!slot) {
+        if (entry.count < ITEMS_PER_CONTEXT) {
+            slot = &entry.items[entry.count++];
+        } else {
+            // Full: replace the weakest item
+            slot = &entry.items[0];
+            for (uint8_t i = 1; i < entry.count; ++i) {
+                if (Decayed(entry.items[i], minute) < Decayed(*slot, minute)) slot = &entry.items[i];
+            }
+        }
+        *slot = {text, 0.0f, minute};
+    }
+
+    slot->score = op == OP_ADD ? Decayed(*slot, minute) + score : score;
+    slot->minute = (std::max)(slot->minute, minute);
+
+    // Evicted items leave their text interned, so the string table is bounded too
+    if (_contexts.size() > _maxContexts || _strings.GetCount() > 2 * _maxContexts * (ITEMS_PER_CONTEXT + 1)) {
+        Prune(minute);
+    }
+}
+
+void CUserHistory::Prune(uint32_t now) {
+    // Keep the three quarters of the contexts with the strongest item, minus faded items
+    std::vector<std::pair<float, uint64_t>> strength;
+    strength.reserve(_contexts.size());
+    for (const auto& [key, context] : _contexts) {
+        float best = 0.0f;
+        for (uint8_t i = 0; i < context.count; ++i) best = (std::max)(best, Decayed(context.items[i], now));
+        strength.emplace_back(best, key);
+    }
+    size_t keep = (std::min)(strength.size(), _maxContexts - _maxContexts / 4);
+    std::nth_element(strength.begin(), strength.begin() + keep, strength.end(),
+                     [](const auto& a, const auto& b) { return a.first > b.first; });
+
+    std::unordered_map<uint64_t, Context> contexts;
+    CCharacterTable strings;
+    for (size_t k = 0; k < keep; ++k) {
+        if (strength[k].first < DROP_SCORE) continue;
+        Context context = _contexts[strength[k].second];
+        context.text = strings.Intern(_strings.Get(context.text));
+        uint8_t count = 0;
+        for (uint8_t i = 0; i < context.count; ++i) {
+            if (Decayed(context.items[i], now) < DROP_SCORE) continue;
+            Item item = context.items[i];
+            item.text = strings.Intern(_strings.Get(item.text));
+            context.items[count++] = item;
+        }
+        context.count = count;
+        contexts.emplace(strength[k].second, context);
+    }
+    _contexts = std::move(contexts);
+    _strings = std::move(strings);
+}
+
+void CUserHistory::AppendRecord(std::string& out, Op op, Kind kind, std::wstring_view context, std::wstring_view item,
+                                uint32_t minute, float score) {
+    std::string contextBytes = Unicode::WideToUtf8(context);
+    std::string itemBytes = Unicode::WideToUtf8(item);
+    if (contextBytes.size() > UINT16_MAX || itemBytes.size() > UINT16_MAX) return;
+
+    RecordHeader header = {};
+    header.op = op;
+    header.kind = static_cast<uint8_t>(kind);
+    header.contextBytes = static_cast<uint16_t>(contextBytes.size());
+    header.itemBytes = static_cast<uint16_t>(itemBytes.size());
+    header.minute = minute;
+    header.score = score;
+
+    size_t start = out.size();
+    out.append(reinterpret_cast<const char*>(&header), sizeof(header));
+    out += contextBytes;
+    out += itemBytes;
+    header.checksum = static_cast<uint32_t>(CDataFile::HashBytes(out.data() + start, out.size() - start));
+    std::memcpy(&out[start] + offsetof(RecordHeader, checksum), &header.checksum, sizeof(header.checksum));
+}
+
+size_t CUserHistory::Replay(const std::string& log, size_t from, size_t& goodBytes) {
+    size_t records = 0;
+    size_t pos = from;
+    goodBytes = pos;
+    while (pos + sizeof(RecordHeader) <= log.size()) {
+        RecordHeader header;
+        std::memcpy(&header, log.data() + pos, sizeof(header));
+        size_t end = pos + sizeof(header) + header.contextBytes + header.itemBytes;
+        if (end > log.size() || header.op > OP_SET || header.kind > static_cast<uint8_t>(Kind::SUGGESTION)) break;
+
+        std::string bytes = log.substr(pos, end - pos);
+        std::memset(&bytes[0] + offsetof(RecordHeader, checksum), 0, sizeof(header.checksum));
+        if (static_cast<uint32_t>(CDataFile::HashBytes(bytes.data(), bytes.size())) != header.checksum) break;
+
+        std::wstring context = Unicode::Utf8ToWide(std::string_view(log.data() + pos + sizeof(header), header.contextBytes));
+        std::wstring item = Unicode::Utf8ToWide(
+            std::string_view(log.data() + pos + sizeof(header) + header.contextBytes, header.itemBytes));
+        Apply(static_cast<Op>(header.op), static_cast<Kind>(header.kind), context, item, header.minute, header.score);
+
+        records++;
+        pos = end;
+        goodBytes = end;
+    }
+    return records;
+}
+
+std::string CUserHistory::Serialize(uint32_t now, size_t& records) const {
+    FileHeader fileHeader;
+    std::memcpy(fileHeader.magic, HISTORY_MAGIC, sizeof(fileHeader.magic));
+    fileHeader.version = HISTORY_VERSION;
+
+    std::string out(reinterpret_cast<const char*>(&fileHeader), sizeof(fileHeader));
+    records = 0;
+    for (const auto& [key, context] : _contexts) {
+        for (uint8_t i = 0; i < context.count; ++i) {
+            float score = Decayed(context.items[i], now);
+            if (score < DROP_SCORE) continue;
+            AppendRecord(out, OP_SET, context.kind, _strings.Get(context.text), _strings.Get(context.items[i].text), now,
+                         score);
+            records++;
+        }
+    }
+    return out;
+}
+
+bool CUserHistory::Open(const std::wstring& path) {
+    Close();
+    auto start = std::chrono::high_resolution_clock::now();
+
+    // Without the lock file (a read-only directory) this process still works alone
+    _fileLock.Open(path + L".lock");
+    std::lock_guard<CFileLock> fileLock(_fileLock);
+    std::lock_guard<std::mutex> lock(_mutex);
+    _path = path;
+    _contexts.clear();
+    _strings = CCharacterTable();
+    _compactFailed = false;
+
+    std::string log;
+    {
+        std::ifstream file(std::filesystem::path(path), std::ios::binary);
+        if (file.is_open()) log.assign(std::istreambuf_iterator<char>(file), std::istreambuf_iterator<char>());
+    }
+
+    size_t records = 0, goodBytes = 0;
+    if (log.size() >= sizeof(FileHeader) && std::memcmp(log.data(), HISTORY_MAGIC, sizeof(HISTORY_MAGIC)) == 0) {
+        records = Replay(log, sizeof(FileHeader), goodBytes);
+    }
+
+    std::error_code error;
+    bool opened = true;
+    if (goodBytes == 0) {
+        // Missing or not a history log: start a new one
+        if (!log.empty()) Debug::Log(L"UserHistory", (L"Ignoring invalid log: " + path).c_str());
+        FileHeader header;
+        std::memcpy(header.magic, HISTORY_MAGIC, sizeof(header.magic));
+        header.version = HISTORY_VERSION;
+        std::ofstream file(std::filesystem::path(path), std::ios::binary | std::ios::trunc);
+        file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+        opened = file.good();
+    } else if (goodBytes < log.size()) {
+        // Drop a torn or corrupt tail so new records follow the last good one. Appends
+        // hold the lock, so this is not another process's record half written.
+        Debug::Log(L"UserHistory", (L"Dropping " + std::to_wstring(log.size() - goodBytes) + L" bytes of damaged log").c_str());
+        std::filesystem::resize_file(std::filesystem::path(path), goodBytes, error);
+    }
+    _logRecords = records;
+
+    auto end = std::chrono::high_resolution_clock::now();
+    auto duration = std::chrono::duration_cast<std::chrono::microseconds>(end - start).count();
+    Debug::Log(L"UserHistory", (L"Loaded: " + path +
+                                L" | Records: " + std::to_wstring(records) +
+                                L" | Contexts: " + std::to_wstring(_contexts.size()) +
+                                L" | Time: " + std::to_wstring(duration / 1000) + L"." + std::to_wstring(duration % 1000) + L"ms")
+                                   .c_str());
+    return opened;
+}
+
+void CUserHistory::Close() {
+    if (_compactor.joinable()) _compactor.join();
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        _path.clear();
+    }
+    _fileLock.Close();
+}
+
+void CUserHistory::Record(Kind kind, const std::wstring& context, const std::wstring& item) {
+    Record(kind, context, item, Now());
+}
+
+void CUserHistory::Record(Kind kind, const std::wstring& context, const std::wstring& item, uint32_t now) {
+    if (context.empty() || item.empty()) return;
+
+    bool compact = false;
+    {
+        std::lock_guard<CFileLock> fileLock(_fileLock);
+        std::lock_guard<std::mutex> lock(_mutex);
+        Apply(OP_ADD, kind, context, item, now, 1.0f);
+
+        if (!_path.empty()) {
+            std::string record;
+            AppendRecord(record, OP_ADD, kind, context, item, now, 1.0f);
+            // Opened per pick: a log held open would keep other processes from replacing it
+            std::ofstream log(std::filesystem::path(_path), std::ios::binary | std::ios::app);
+            log.write(record.data(), static_cast<std::streamsize>(record.size()));
+            log.flush();
+            if (log.good()) _logRecords++;
+        }
+        size_t items = 0;
+        for (const auto& entry : _contexts) items += entry.second.count;
+        compact = !_compactFailed && _logRecords >= COMPACT_MIN_RECORDS && _logRecords >= 2 * items;
+    }
+    if (compact) ScheduleCompaction();
+}
+
+void CUserHistory::Rerank(Kind kind, const std::wstring& context, std::vector<std::wstring>& list,
+                          const std::function<bool(const std::wstring&)>& isMatch) const {
+    std::vector<std::pair<float, std::wstring>> picked;
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        auto it = _contexts.find(Key(kind, context));
+        if (it == _contexts.end()) return;
+
+        uint32_t now = Now();
+        for (uint8_t i = 0; i < it->second.count; ++i) {
+            float score = Decayed(it->second.items[i], now);
+            if (score >= PROMOTE_SCORE) picked.emplace_back(score, std::wstring(_strings.Get(it->second.items[i].text)));
+        }
+    }
+    if (picked.empty()) return;
+    std::stable_sort(picked.begin(), picked.end(), [](const auto& a, const auto& b) { return a.first > b.first; });
+
+    std::vector<std::wstring> front;
+    for (auto& [score, item] : picked) {
+        bool present = std::find(list.begin(), list.end(), item) != list.end();
+        if (present || (isMatch && isMatch(item))) front.push_back(std::move(item));
+    }
+    if (front.empty()) return;
+
+    front.reserve(front.size() + list.size());
+    for (auto& item : list) {
+        if (std::find(front.begin(), front.end(), item) == front.end()) front.push_back(std::move(item));
+    }
+    list = std::move(front);
+}
+
+float CUserHistory::GetScore(Kind kind, const std::wstring& context, const std::wstring& item, uint32_t minute) const {
+    std::lock_guard<std::mutex> lock(_mutex);
+    auto it = _contexts.find(Key(kind, context));
+    CharId text = _strings.Find(item);
+    if (it == _contexts.end() || text == INVALID_CHAR_ID) return 0.0f;
+    for (uint8_t i = 0; i < it->second.count; ++i) {
+        if (it->second.items[i].text == text) return Decayed(it->second.items[i], minute);
+    }
+    return 0.0f;
+}
+
+void CUserHistory::ScheduleCompaction() {
+    if (_compacting.exchange(true)) return;
+    if (_compactor.joinable()) _compactor.join();
+    _compactor = std::thread(&CUserHistory::Compact, this);
+}
+
+void CUserHistory::Compact() {
+    auto start = std::chrono::high_resolution_clock::now();
+
+    // Read and replay without the lock: Record takes it on the UI thread, in this and
+    // every other process, and must not wait out a rewrite
+    std::wstring path;
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        path = _path;
+    }
+    std::string log;
+    {
+        std::ifstream file(std::filesystem::path(path), std::ios::binary);
+        if (file.is_open()) log.assign(std::istreambuf_iterator<char>(file), std::istreambuf_iterator<char>());
+    }
+
+    // Rewrite from the whole log rather than this process's view of it, which lacks the
+    // picks other processes appended
+    CUserHistory merged(1, _maxContexts);
+    merged._halfLifeMinutes = _halfLifeMinutes;
+    size_t logRecords = 0, goodBytes = 0;
+    if (!path.empty() && log.size() >= sizeof(FileHeader) &&
+        std::memcmp(log.data(), HISTORY_MAGIC, sizeof(HISTORY_MAGIC)) == 0) {
+        logRecords = merged.Replay(log, sizeof(FileHeader), goodBytes);
+    }
+    size_t imageRecords = 0;
+    std::string image = merged.Serialize(Now(), imageRecords);
+
+    std::wstring tempPath = path + L".tmp";
+    bool written = goodBytes != 0;
+    bool changed = false;
+    std::error_code error;
+    std::unique_lock<CFileLock> fileLock(_fileLock, std::defer_lock);
+    if (written) {
+        // Locked only to carry over what was appended meanwhile and swap the files. The
+        // log read above must still be the head of the file: not truncated, and not
+        // replaced by another process's rewrite, whose bytes before goodBytes differ.
+        fileLock.lock();
+        std::ifstream file(std::filesystem::path(path), std::ios::binary);
+        size_t check = (std::min)(goodBytes - sizeof(FileHeader), size_t(4096));
+        std::string head(check, '\0');
+        file.seekg(static_cast<std::streamoff>(goodBytes - check));
+        file.read(&head[0], static_cast<std::streamsize>(check));
+        changed = !file.good() || std::memcmp(head.data(), log.data() + goodBytes - check, check) != 0;
+        written = !changed;
+        if (written) {
+            log.resize(goodBytes);
+            log.append(std::istreambuf_iterator<char>(file), std::istreambuf_iterator<char>());
+            file.close();
+            size_t tailBytes = 0;
+            size_t tailRecords = merged.Replay(log, goodBytes, tailBytes);
+            image.append(log, goodBytes, tailBytes - goodBytes);
+            logRecords += tailRecords;
+            imageRecords += tailRecords;
+
+            std::ofstream temp(std::filesystem::path(tempPath), std::ios::binary | std::ios::trunc);
+            temp.write(image.data(), static_cast<std::streamsize>(image.size()));
+            temp.flush();
+            written = temp.good();
+            temp.close();
+            if (written) std::filesystem::rename(std::filesystem::path(tempPath), std::filesystem::path(path), error);
+            if (!written || error) std::filesystem::remove(std::filesystem::path(tempPath), error);
+        }
+    }
+
+    bool replaced = written && !error;
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        if (replaced) {
+            // Take in what other processes picked since this one opened the log
+            _contexts = std::move(merged._contexts);
+            _strings = std::move(merged._strings);
+            _logRecords = imageRecords;
+        } else if (!changed) {
+            // Windows will not replace a log some other program holds open; retrying on
+            // every pick would rewrite it over and over, so keep appending instead
+            _compactFailed = true;
+        }
+    }
+    // Held until the picks appended meanwhile are in memory too
+    if (fileLock.owns_lock()) fileLock.unlock();
+
+    auto end = std::chrono::high_resolution_clock::now();
+    auto duration = std::chrono::duration_cast<std::chrono::microseconds>(end - start).count();
+    if (!replaced) {
+        Debug::Log(L"UserHistory", (L"Did not compact " + path +
+                                    (changed ? L"; it changed under the rewrite" : L"; appending only from now on"))
+                                       .c_str());
+    } else {
+        Debug::Log(L"UserHistory", (L"Compacted " + std::to_wstring(logRecords) + L" records to " +
+                                    std::to_wstring(imageRecords) +
+                                    L" | Time: " + std::to_wstring(duration / 1000) + L"." + std::to_wstring(duration % 1000) + L"ms")
+                                       .c_str());
+    }
+    _compacting = false;
+}
+
+size_t CUserHistory::GetContextCount() const {
+    std::lock_guard<std::mutex> lock(_mutex);
+    return _contexts.size();
+}
+
+size_t CUserHistory::GetMemoryUsage() const {
+    std::lock_guard<std::mutex> lock(_mutex);
+    // Node-based map: each element costs its pair plus a node header
+    return _contexts.size() * (sizeof(std::pair<const uint64_t, Context>) + 2 * sizeof(void*)) +
+           _contexts.bucket_count() * sizeof(void*) + _strings.GetMemoryUsage();
+}
+
+std::wstring CUserHistory::GetDefaultHistoryPath() {
+    return CDataFile::GetUserDataPath(L"userHistory.log");
+}
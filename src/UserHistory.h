@@ -0,0 +1,126 @@
+#pragma once
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+#include "CharacterTable.h"
+#include "FileLock.h"
+
+// Learns which characters the user picks for a stroke input and which suggestions they
+// pick after a character, and moves those to the front of later results. Pick counts
+// decay with a half-life so old habits fade, and at most maxContexts inputs/keys are
+// remembered. Every pick is appended to a checksummed log (a torn write loses only that
+// record); once the log has grown well past the live data it is rewritten on a
+// background thread. Every process appends to the same log: appends, the repair of a
+// torn tail and the swap of a rewritten log hold a lock file (the log's path plus
+// .lock), and nobody keeps the log open in between. A rewrite replays the whole log
+// without the lock, so other processes' picks survive it, and takes the lock only to
+// carry over the picks appended meanwhile and replace the file.
+class CUserHistory {
+   public:
+    enum class Kind : uint8_t { STROKES = 0, SUGGESTION = 1 };
+
+    static constexpr int DEFAULT_HALF_LIFE_DAYS = 14;
+    static constexpr int DEFAULT_MAX_CONTEXTS = 4096;
+    static constexpr size_t ITEMS_PER_CONTEXT = 8;
+
+    CUserHistory(int halfLifeDays, size_t maxContexts);
+    ~CUserHistory();
+
+    CUserHistory(const CUserHistory&) = delete;
+    CUserHistory& operator=(const CUserHistory&) = delete;
+
+    // Replays the log at path (creating it if missing) and appends new picks to it
+    bool Open(const std::wstring& path);
+    void Close();
+
+    // Called on the UI thread when the user commits item for context
+    void Record(Kind kind, const std::wstring& context, const std::wstring& item);
+    // As above, stamped with minute (see Now) instead of the clock; picks go in time order
+    void Record(Kind kind, const std::wstring& context, const std::wstring& item, uint32_t minute);
+
+    // Moves the items picked for this context to the front of list, most used first.
+    // Picked items missing from list are inserted if isMatch accepts them.
+    void Rerank(Kind kind, const std::wstring& context, std::vector<std::wstring>& list,
+                const std::function<bool(const std::wstring&)>& isMatch = nullptr) const;
+
+    // The item's picks for context as of minute, each halved per half-life since; 0 if none
+    float GetScore(Kind kind, const std::wstring& context, const std::wstring& item, uint32_t minute) const;
+
+    size_t GetContextCount() const;
+    size_t GetMemoryUsage() const;
+
+    // userHistory.log in the user data directory
+    static std::wstring GetDefaultHistoryPath();
+
+    // Minutes since the Unix epoch, the clock picks are stamped with
+    static uint32_t Now();
+
+   private:
+    enum Op : uint8_t { OP_ADD = 0, OP_SET = 1 };
+
+    struct Item {
+        CharId text;
+        float score;      // as of minute
+        uint32_t minute;  // minutes since the Unix epoch
+    };
+
+    struct Context {
+        CharId text;
+        Kind kind;
+        uint8_t count;
+        Item items[ITEMS_PER_CONTEXT];
+    };
+
+    struct FileHeader {
+        char magic[4];
+        uint32_t version;
+    };
+
+    struct RecordHeader {
+        uint8_t op;
+        uint8_t kind;
+        uint16_t contextBytes;  // UTF-8, follows the header
+        uint16_t itemBytes;     // UTF-8, follows the context
+        uint16_t reserved;
+        uint32_t minute;
+        float score;
+        uint32_t checksum;  // over the header (with this field zero) and both strings
+    };
+
+    static uint64_t Key(Kind kind, std::wstring_view context);
+    static void AppendRecord(std::string& out, Op op, Kind kind, std::wstring_view context, std::wstring_view item,
+                             uint32_t minute, float score);
+
+    float Decayed(const Item& item, uint32_t now) const;
+    void Apply(Op op, Kind kind, std::wstring_view context, std::wstring_view item, uint32_t minute, float score);
+    void Prune(uint32_t now);
+    // Applies the records of log from byte from on; goodBytes ends the last good one
+    size_t Replay(const std::string& log, size_t from, size_t& goodBytes);
+    std::string Serialize(uint32_t now, size_t& records) const;
+
+    void ScheduleCompaction();
+    void Compact();
+
+    double _halfLifeMinutes;
+    size_t _maxContexts;
+
+    std::unordered_map<uint64_t, Context> _contexts;  // guarded by _mutex, as is everything below
+    CCharacterTable _strings;                         // context and item texts
+    mutable std::mutex _mutex;
+
+    std::wstring _path;  // empty once closed
+    uint64_t _logRecords = 0;
+    bool _compactFailed = false;  // a rewrite could not replace the log; only append from then on
+    CFileLock _fileLock;          // taken before _mutex
+
+    std::thread _compactor;
+    std::atomic<bool> _compacting{false};
+};
@@ -0,0 +1,1734 @@
+// k6tool - command line front end to the K6 lookup engine.
+//
+//   k6tool compile <strokeData.txt> [--prefix-length N] [--suggestions suggestionsData.txt]
+//       Write the compiled side files (code trie, prefix table, shards) next to the data
+//       file, and the phrase index next to the suggestions (suggestionsData.txt beside
+//       the data by default; skipped if there is none).
+//
+//   k6tool bench <strokeData.txt> [--repeat N] [--threads N,N,...] [--budget KB] [pattern ...]
+//       Time the first page (top 10) and the full result list of each pattern, with the
+//       query cache cleared before every run. Without patterns, runs a set of worst
+//       cases for the wildcards. With --threads, runs once per scan pool size and shows
+//       the full-list speedup over the first size. Ends with all the full lists looked
+//       up in one batch against one after another, near misses (LookupFuzzy) of random
+//       stroke patterns against their exact first pages (p50 and p99), and the
+//       dictionary's heap. --budget loads under a memory budget (packed codes, fewer
+//       indexes) to time what it costs.
+//
+//   k6tool stress <strokeData.txt> [--rounds N] [--deadline-ms N]
+//       Type random stroke edits at the lookup worker the way the text service does
+//       (submit, then wait up to the deadline or move straight on to the next key) and
+//       check that every result taken is for the newest request and matches a direct
+//       lookup. Exits with 1 on a stale or wrong result.
+//
+//   k6tool verify <strokeData.txt> [--patterns N] [--seed N] [--sharded] [--budget KB]
+//       Look up N random patterns of one to seven strokes, ＊ and ～ (full lists, first
+//       pages with and without exactLengthFirst, the prefix table's page and total, and
+//       all of them in one batch) and compare each with a plain scan of the entries in
+//       rank order, then N/10 near-miss lookups (LookupFuzzy) with a brute-force edit
+//       distance over every entry. The patterns also narrow a suggestion list of
+//       characters (CSuggestionFilter, some with codes too long to pack). --sharded starts
+//       from the shards, --budget under a memory budget. Exits with 1 on the first
+//       mismatch.
+//
+//   k6tool reload-stress <strokeData.txt> [--threads N] [--reloads N] [--sharded]
+//                        [--suggestions suggestionsData.txt] [--seed N]
+//       Look up a fixed set of patterns and reverse lookups on N threads while the main
+//       thread reloads the dictionary (flipping between the file and a copy missing every
+//       seventh line, and the suggestions if given) and adds and drops a user entry,
+//       waiting past the fold delay every few rounds. Every result must equal what a
+//       single-threaded reference gives for one of the four states; build with
+//       -fsanitize=thread to check the snapshots for races. Exits with 1 on a mismatch.
+//
+//   k6tool serve <strokeData.txt> [--suggestions suggestionsData.txt] [--socket PATH]
+//                [--scan-threads N]
+//       Answer lookups from local clients over a Unix domain socket (a named pipe on
+//       Windows) until interrupted; see LookupProtocol.h for the wire format.
+//
+//   k6tool loadgen [--socket PATH] [--clients N] [--requests N] [--depth N] [--k N]
+//                  [--json] [pattern ...]
+//       Send lookups to a running server from N connections, each keeping up to depth
+//       requests in flight, and report throughput and latency percentiles.
+//
+//   k6tool user [--file PATH] add CODE CHARACTER [RANK] | remove CODE CHARACTER
+//               | reset CODE CHARACTER | list | lookup <strokeData.txt> PATTERN
+//       Edit the user dictionary (userDictionary.txt in the user data directory by
+//       default): add or move an entry to RANK (0, the front, by default), remove a
+//       shipped or added entry, or drop the user's entry again. lookup shows PATTERN's
+//       first page with the entries merged at query time and again once folded.
+//
+//   k6tool history-stress [--writers N] [--picks N]
+//       Record picks into one user history log from N histories at once, each with its
+//       own handle on the lock file as separate processes would have, so the log is
+//       appended to and compacted concurrently. Then records picks stamped one to three
+//       half-lives back and checks their scores and order after a reopen. Exits with 1
+//       unless reopening the log finds every writer's picks and every decayed score.
+//
+//   k6tool annotate <strokeData.txt> [--all] [--lines] [--threads N] [input [output]]
+//       Write UTF-8 text (standard input by default) back out with the stroke code of
+//       every dictionary character after it, or all its codes with --all; --lines writes
+//       one character and its codes per line instead. Reading, annotating (N threads)
+//       and writing overlap. Reports throughput on standard error.
+//
+//   k6tool warmstart <strokeData.txt> [--cache PATH] [--cold] [--save] [pattern ...]
+//       Time what a freshly started process takes to show the first candidates of each
+//       pattern, with the query cache saved at PATH (queryCache.bin in the user data
+//       directory by default) or, with --cold, without it, and then the full list. --save
+//       then saves the cache, as the text service does on deactivation. Without patterns,
+//       uses the bench set.
+//
+//   k6tool memory <strokeData.txt> [--suggestions suggestionsData.txt] [--budget KB]
+//                 [pattern ...]
+//       Load the dictionary (and the suggestions and phrase index) the way the text
+//       service does, under a memory budget if given, look up each pattern's full list
+//       (the bench set by default) and print memory use by structure, and whether the
+//       dictionary kept to the budget.
+//
+//   k6tool shards <strokeData.txt> [--full] [--characters N] [--seed N]
+//       Start as the text service does, from the compiled shards (or with --full from the
+//       whole dictionary), then type N characters (1 by default) through the text
+//       service's input session: a random code of two to five strokes, its first pages
+//       and near misses looked up stroke by stroke, then a pick of the first candidate.
+//       Prints the startup and typing times, the slowest key, memory by structure and
+//       the growth of the resident set. Run once per setting: a process does not hand
+//       back everything it allocated.
+//
+//   k6tool replay <strokeData.txt> [--suggestions suggestionsData.txt] [--keys FILE | --random N]
+//                 [--seed N] [--deadline-ms N]
+//       Type a recorded key sequence (numpad key names, one burst of keys typed faster
+//       than they are handled per line; !KEY is queued but never handled, as when focus
+//       moves) through the text service's input session twice: once with each stroke edit
+//       looked up as it is handled, and once with lookups put off while another stroke
+//       edit is queued, as the text service does. Without --keys, types N random bursts
+//       (200 by default). Exits with 1 unless both commit the same text and show the
+//       same list at the end of every burst.
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <csignal>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <map>
+#include <memory>
+#include <random>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <unordered_set>
+#include <vector>
+
+#ifdef _WIN32
+#include <fcntl.h>
+#include <io.h>
+#endif
+
+#include "DataFile.h"
+#include "Dictionary.h"
+#include "DictionaryData.h"
+#include "DictionaryShards.h"
+#include "InputSession.h"
+#include "LookupClient.h"
+#include "LookupServer.h"
+#include "LookupWorker.h"
+#include "LoudsTrie.h"
+#include "MemoryReport.h"
+#include "PhraseIndex.h"
+#include "PrefixTable.h"
+#include "QueryCacheFile.h"
+#include "ScanPool.h"
+#include "StrokeAnnotator.h"
+#include "SuggestionFilter.h"
+#include "Suggestions.h"
+#include "Unicode.h"
+#include "UserDictionary.h"
+#include "UserHistory.h"
+
+static int Usage() {
+    std::fprintf(stderr,
+                 "usage:\n"
+                 "  k6tool compile <strokeData.txt> [--prefix-length N] [--suggestions FILE]\n"
+                 "  k6tool bench <strokeData.txt> [--repeat N] [--threads N,N,...] [--budget KB] [pattern ...]\n"
+                 "  k6tool stress <strokeData.txt> [--rounds N] [--deadline-ms N]\n"
+                 "  k6tool verify <strokeData.txt> [--patterns N] [--seed N] [--sharded] [--budget KB]\n"
+                 "  k6tool reload-stress <strokeData.txt> [--threads N] [--reloads N] [--sharded] [--suggestions FILE] "
+                 "[--seed N]\n"
+                 "  k6tool serve <strokeData.txt> [--suggestions FILE] [--socket PATH] [--scan-threads N]\n"
+                 "  k6tool loadgen [--socket PATH] [--clients N] [--requests N] [--depth N] [--k N] [--json] "
+                 "[pattern ...]\n"
+                 "  k6tool user [--file PATH] add CODE CHARACTER [RANK] | remove CODE CHARACTER | reset CODE CHARACTER "
+                 "| list | lookup <strokeData.txt> PATTERN\n"
+                 "  k6tool history-stress [--writers N] [--picks N]\n"
+                 "  k6tool annotate <strokeData.txt> [--all] [--lines] [--threads N] [input [output]]\n"
+                 "  k6tool warmstart <strokeData.txt> [--cache PATH] [--cold] [--save] [pattern ...]\n"
+                 "  k6tool memory <strokeData.txt> [--suggestions FILE] [--budget KB] [pattern ...]\n"
+                 "  k6tool shards <strokeData.txt> [--full] [--characters N] [--seed N]\n"
+                 "  k6tool replay <strokeData.txt> [--suggestions FILE] [--keys FILE | --random N] [--seed N] "
+                 "[--deadline-ms N]\n");
+    return 2;
+}
+
+static int Compile(int argc, char** argv) {
+    if (argc < 1) return Usage();
+    std::wstring path = Unicode::Utf8ToWide(argv[0]);
+    uint32_t prefixLength = CPrefixTable::DEFAULT_MAX_LENGTH;
+    std::wstring suggestionsPath = (std::filesystem::path(path).parent_path() / "suggestionsData.txt").wstring();
+    bool suggestionsGiven = false;
+    for (int i = 1; i < argc; ++i) {
+        if (std::strcmp(argv[i], "--prefix-length") == 0 && i + 1 < argc) {
+            prefixLength = static_cast<uint32_t>(std::atoi(argv[++i]));
+        } else if (std::strcmp(argv[i], "--suggestions") == 0 && i + 1 < argc) {
+            suggestionsPath = Unicode::Utf8ToWide(argv[++i]);
+            suggestionsGiven = true;
+        } else {
+            return Usage();
+        }
+    }
+    if (prefixLength < 1 || prefixLength > 8) {
+        std::fprintf(stderr, "prefix length must be between 1 and 8\n");
+        return 2;
+    }
+
+    CDictionaryData data;
+    if (!data.LoadFromFile(path)) {
+        std::fprintf(stderr, "failed to load %s\n", argv[0]);
+        return 1;
+    }
+
+    std::wstring triePath = CLoudsTrie::GetPathForDictionary(path);
+    if (!data.CompileTrie(triePath)) {
+        std::fprintf(stderr, "failed to write %s\n", Unicode::WideToUtf8(triePath).c_str());
+        return 1;
+    }
+    std::printf("wrote %s\n", Unicode::WideToUtf8(triePath).c_str());
+
+    std::wstring prefixPath = CPrefixTable::GetPathForDictionary(path);
+    if (!data.CompilePrefixTable(prefixPath, prefixLength)) {
+        std::fprintf(stderr, "failed to write %s\n", Unicode::WideToUtf8(prefixPath).c_str());
+        return 1;
+    }
+    std::printf("wrote %s (prefix length %u)\n", Unicode::WideToUtf8(prefixPath).c_str(), prefixLength);
+
+    std::wstring shardsPath = CDictionaryShards::GetPathForDictionary(path);
+    if (!data.CompileShards(shardsPath)) {
+        std::fprintf(stderr, "failed to write %s\n", Unicode::WideToUtf8(shardsPath).c_str());
+        return 1;
+    }
+    std::printf("wrote %s\n", Unicode::WideToUtf8(shardsPath).c_str());
+
+    // The phrase index, built from the shipped files as every process would build it
+    if (!suggestionsGiven && !std::filesystem::exists(std::filesystem::path(suggestionsPath))) return 0;
+    CDictionary dictionary;
+    CSuggestions suggestions;
+    uint64_t phrasesHash;
+    if (!dictionary.LoadFromFile(path) || !suggestions.LoadFromFile(suggestionsPath) ||
+        !CPhraseIndex::GetDataHash(suggestionsPath, path, phrasesHash)) {
+        std::fprintf(stderr, "failed to load %s\n", Unicode::WideToUtf8(suggestionsPath).c_str());
+        return 1;
+    }
+    CPhraseIndex phrases;
+    phrases.Build(suggestions, dictionary);
+    std::wstring phrasesPath = CPhraseIndex::GetPathForSuggestions(suggestionsPath);
+    if (!phrases.Save(phrasesPath, phrasesHash)) {
+        std::fprintf(stderr, "failed to write %s\n", Unicode::WideToUtf8(phrasesPath).c_str());
+        return 1;
+    }
+    std::printf("wrote %s (%zu phrases)\n", Unicode::WideToUtf8(phrasesPath).c_str(), phrases.GetPhraseCount());
+    return 0;
+}
+
+// Long runs of ＊, runs of ～ between literals, patterns that keep ～ alive to the end of
+// every code without matching, and endings common and rare
+static const wchar_t* const BENCH_PATTERNS[] = {
+    L"一丨丿",
+    L"＊＊＊＊＊＊",
+    L"一＊＊丶",
+    L"～",
+    L"一～",
+    L"一～丶",
+    L"一＊＊丶～",
+    L"～～～～丶",
+    L"～丶～丶～丶～丶～丶",
+    L"＊～＊～＊～＊～",
+    L"一～＊＊＊＊＊＊＊＊",
+    L"～フフフフ",
+    L"～丶フ",
+    L"丨～丶フ",
+    L"～＊＊＊丶",
+};
+
+static int Bench(int argc, char** argv) {
+    if (argc < 1) return Usage();
+    int repeat = 20;
+    size_t budget = 0;
+    std::vector<unsigned> threadCounts{1};
+    std::vector<std::wstring> patterns;
+    for (int i = 1; i < argc; ++i) {
+        if (std::strcmp(argv[i], "--repeat") == 0 && i + 1 < argc) {
+            repeat = std::atoi(argv[++i]);
+        } else if (std::strcmp(argv[i], "--budget") == 0 && i + 1 < argc) {
+            budget = static_cast<size_t>(std::atol(argv[++i])) * 1024;
+        } else if (std::strcmp(argv[i], "--threads") == 0 && i + 1 < argc) {
+            threadCounts.clear();
+            for (char* next = argv[++i]; *next;) {
+                int threads = static_cast<int>(std::strtol(next, &next, 10));
+                if (threads < 1 || (*next && *next != ',')) return Usage();
+                threadCounts.push_back(static_cast<unsigned>(threads));
+                if (*next) next++;
+            }
+        } else {
+            patterns.push_back(Unicode::Utf8ToWide(argv[i]));
+        }
+    }
+    if (repeat < 1 || threadCounts.empty()) return Usage();
+    if (patterns.empty()) patterns.assign(std::begin(BENCH_PATTERNS), std::end(BENCH_PATTERNS));
+
+    CDictionaryData data;
+    data.SetMemoryBudget(budget);
+    if (!data.LoadFromFile(Unicode::Utf8ToWide(argv[0]))) {
+        std::fprintf(stderr, "failed to load %s\n", argv[0]);
+        return 1;
+    }
+
+    // Median and worst of repeat runs, in microseconds
+    auto time = [&](auto&& run, double& median, double& worst) {
+        std::vector<double> samples;
+        for (int r = 0; r < repeat; ++r) {
+            data.ClearQueryCache();
+            auto start = std::chrono::steady_clock::now();
+            run();
+            auto end = std::chrono::steady_clock::now();
+            samples.push_back(std::chrono::duration<double, std::micro>(end - start).count());
+        }
+        std::sort(samples.begin(), samples.end());
+        median = samples[samples.size() / 2];
+        worst = samples.back();
+    };
+
+    // Full-list medians of the first pool size, the baseline for the speedup column
+    std::vector<double> baseline;
+    for (unsigned threads : threadCounts) {
+        CScanPool pool(threads);
+        data.SetScanPool(&pool);
+        if (threadCounts.size() > 1) std::printf("%s%u thread(s)\n", baseline.empty() ? "" : "\n", threads);
+
+        std::printf("%-24s %8s %12s %12s %12s %12s %8s\n", "pattern", "results", "page med us", "page max us",
+                    "all med us", "all max us", "speedup");
+        bool first = baseline.empty();
+        for (size_t p = 0; p < patterns.size(); ++p) {
+            const auto& pattern = patterns[p];
+            size_t results = 0;
+            double pageMedian, pageWorst, allMedian, allWorst;
+            time([&] { data.LookupTopKIds(pattern, 10, false); }, pageMedian, pageWorst);
+            time([&] { results = data.LookupRegexIds(pattern).size(); }, allMedian, allWorst);
+            if (first) baseline.push_back(allMedian);
+            std::printf("%-24s %8zu %12.1f %12.1f %12.1f %12.1f %7.2fx\n", Unicode::WideToUtf8(pattern).c_str(),
+                        results, pageMedian, pageWorst, allMedian, allWorst, baseline[p] / allMedian);
+        }
+
+        // The same full lists through one LookupRegexBatchIds call
+        double sequentialMedian, sequentialWorst, batchMedian, batchWorst;
+        time([&] { for (const auto& pattern : patterns) data.LookupRegexIds(pattern); }, sequentialMedian, sequentialWorst);
+        time([&] { data.LookupRegexBatchIds(patterns); }, batchMedian, batchWorst);
+        std::printf("batch of %zu: sequential med %.1f us | batch med %.1f us | %.2fx\n", patterns.size(),
+                    sequentialMedian, batchMedian, sequentialMedian / batchMedian);
+        data.SetScanPool(nullptr);
+    }
+
+    // Near misses for random stroke patterns against the exact first page of the same
+    // patterns, which the text service shows before them
+    std::mt19937 random(38);
+    std::vector<std::wstring> strokePatterns(200);
+    for (auto& pattern : strokePatterns) {
+        for (size_t length = 3 + random() % 4; pattern.size() < length;) pattern += Stroke::FromIndex(random() % Stroke::COUNT);
+    }
+    auto percentiles = [&](auto&& run, double& p50, double& p99) {
+        std::vector<double> samples;
+        for (int r = 0; r < repeat; ++r) {
+            for (const auto& pattern : strokePatterns) {
+                auto start = std::chrono::steady_clock::now();
+                run(pattern);
+                auto end = std::chrono::steady_clock::now();
+                samples.push_back(std::chrono::duration<double, std::micro>(end - start).count());
+            }
+        }
+        std::sort(samples.begin(), samples.end());
+        p50 = samples[samples.size() / 2];
+        p99 = samples[samples.size() * 99 / 100];
+    };
+    double exactP50, exactP99, fuzzyP50, fuzzyP99;
+    percentiles([&](const std::wstring& pattern) { data.LookupTopKIds(pattern, 10, false); }, exactP50, exactP99);
+    percentiles([&](const std::wstring& pattern) { data.LookupFuzzyIds(pattern, 2, 10); }, fuzzyP50, fuzzyP99);
+    std::printf("near misses of %zu patterns (up to 2 edits, k 10): p50 %.1f us | p99 %.1f us; exact first page: p50 %.1f "
+                "us | p99 %.1f us\n",
+                strokePatterns.size(), fuzzyP50, fuzzyP99, exactP50, exactP99);
+
+    CMemoryReport report;
+    data.GetMemoryReport(report, L"dictionary");
+    std::printf("dictionary heap %zu KB (codes %s)%s\n", report.GetHeapBytes() / 1024, budget ? "packed" : "plain",
+                budget ? (", budget " + std::to_string(budget / 1024) + " KB").c_str() : "");
+    return 0;
+}
+
+static int Stress(int argc, char** argv) {
+    if (argc < 1) return Usage();
+    int rounds = 20000;
+    int deadlineMs = 1;
+    for (int i = 1; i < argc; ++i) {
+        if (std::strcmp(argv[i], "--rounds") == 0 && i + 1 < argc) {
+            rounds = std::atoi(argv[++i]);
+        } else if (std::strcmp(argv[i], "--deadline-ms") == 0 && i + 1 < argc) {
+            deadlineMs = std::atoi(argv[++i]);
+        } else {
+            return Usage();
+        }
+    }
+    if (rounds < 1 || deadlineMs < 0) return Usage();
+
+    CDictionary dictionary;
+    if (!dictionary.LoadFromFile(Unicode::Utf8ToWide(argv[0]))) {
+        std::fprintf(stderr, "failed to load %s\n", argv[0]);
+        return 1;
+    }
+    std::atomic<uint64_t> notifications{0};
+    CLookupWorker worker(dictionary, [&notifications] { notifications.fetch_add(1, std::memory_order_relaxed); });
+    worker.Start();
+
+    // Mostly plain strokes, with enough ＊ and ～ to get scans worth cancelling
+    static const wchar_t SYMBOLS[] = L"一丨丿丶フ一丨丿丶フ＊～";
+    std::mt19937 random(6);
+    std::wstring input;
+    std::map<uint64_t, std::wstring> submitted;  // sequence -> pattern
+    uint64_t newest = 0, lastTaken = 0;
+    size_t taken = 0, inTime = 0, late = 0, stale = 0, wrong = 0, full = 0;
+
+    auto check = [&](const CLookupWorker::Result& result) {
+        taken++;
+        if (result.sequence != newest || result.sequence <= lastTaken) stale++;
+        lastTaken = result.sequence;
+        if (result.pattern != submitted[result.sequence] ||
+            result.candidates != dictionary.LookupTopK(result.pattern, 10, false)) {
+            wrong++;
+        }
+    };
+
+    for (int round = 0; round < rounds; ++round) {
+        if (!input.empty() && (random() % 4 == 0 || input.size() >= 8)) {
+            input.pop_back();
+        } else {
+            input.push_back(SYMBOLS[random() % (sizeof(SYMBOLS) / sizeof(SYMBOLS[0]) - 1)]);
+        }
+        if (input.empty()) {
+            worker.Cancel();
+            continue;
+        }
+
+        uint64_t sequence = worker.Submit(input, 10, false);
+        if (sequence == 0) {
+            full++;
+            continue;
+        }
+        newest = sequence;
+        submitted[sequence] = input;
+
+        // A burst moves on to the next key (far sooner than any typist); otherwise wait as
+        // the key handler does, and take a late result as the posted message would
+        CLookupWorker::Result result;
+        switch (random() % 3) {
+            case 0:
+                std::this_thread::sleep_for(std::chrono::microseconds(200));
+                break;
+            case 1:
+                if (worker.Wait(sequence, std::chrono::milliseconds(deadlineMs), result)) {
+                    inTime++;
+                    check(result);
+                } else {
+                    late++;
+                }
+                break;
+            default:
+                if (worker.TakeResult(result)) check(result);
+                break;
+        }
+    }
+    worker.Stop();
+
+    CLookupWorker::Stats stats = worker.GetStats();
+    std::printf("rounds %d | submitted %llu | completed %llu | cancelled %llu | notified %llu\n", rounds,
+                static_cast<unsigned long long>(stats.submitted), static_cast<unsigned long long>(stats.completed),
+                static_cast<unsigned long long>(stats.cancelled),
+                static_cast<unsigned long long>(notifications.load()));
+    std::printf("taken %zu (in time %zu, past deadline %zu) | queue full %zu | stale %zu | wrong %zu\n", taken,
+                inTime, late, full, stale, wrong);
+    return stale == 0 && wrong == 0 ? 0 : 1;
+}
+
+// The lookups reload-stress checks, each with every answer a consistent snapshot can give
+// Whether code matches pattern as LookupRegex defines it, by backtracking: ＊ is one
+// stroke, ～ any number, and without ～ the pattern only has to match a prefix
+static bool MatchesByScan(std::wstring_view pattern, std::wstring_view code, bool whole) {
+    if (pattern.empty()) return !whole || code.empty();
+    if (pattern[0] == Stroke::ANY_STROKES[0]) {
+        for (size_t skip = 0; skip <= code.size(); ++skip) {
+            if (MatchesByScan(pattern.substr(1), code.substr(skip), whole)) return true;
+        }
+        return false;
+    }
+    if (code.empty() || (pattern[0] != Stroke::WILDCARD[0] && pattern[0] != code[0])) return false;
+    return MatchesByScan(pattern.substr(1), code.substr(1), whole);
+}
+
+// Fewest edits (insertions, deletions, substitutions and swaps of adjacent strokes; ＊
+// stands for any stroke) that turn pattern into some prefix of code, or more than maxEdits
+static uint32_t FuzzyEditsByScan(std::wstring_view pattern, std::wstring_view code, uint32_t maxEdits) {
+    auto same = [](wchar_t p, wchar_t c) { return p == Stroke::WILDCARD[0] || p == c; };
+    size_t m = pattern.size();
+    std::vector<uint32_t> beforePrevious(m + 1), previous(m + 1), row(m + 1);
+    for (size_t j = 0; j <= m; ++j) previous[j] = static_cast<uint32_t>(j);
+    uint32_t best = previous[m], previousMin = 0;
+    for (size_t i = 1; i <= code.size(); ++i) {
+        row[0] = static_cast<uint32_t>(i);
+        uint32_t rowMin = row[0];
+        for (size_t j = 1; j <= m; ++j) {
+            uint32_t cost = (std::min)({previous[j] + 1, row[j - 1] + 1, previous[j - 1] + (same(pattern[j - 1], code[i - 1]) ? 0 : 1)});
+            if (i > 1 && j > 1 && same(pattern[j - 1], code[i - 2]) && same(pattern[j - 2], code[i - 1])) {
+                cost = (std::min)(cost, beforePrevious[j - 2] + 1);
+            }
+            row[j] = cost;
+            rowMin = (std::min)(rowMin, cost);
+        }
+        best = (std::min)(best, row[m]);
+        // Later rows build on this one and the one before, plus one for a swap
+        if (rowMin > maxEdits && previousMin > maxEdits) break;
+        previousMin = rowMin;
+        beforePrevious.swap(previous);
+        previous.swap(row);
+    }
+    return best;
+}
+
+static int Verify(int argc, char** argv) {
+    if (argc < 1) return Usage();
+    int count = 2000;
+    unsigned seed = 39;
+    bool sharded = false;
+    size_t budget = 0;
+    for (int i = 1; i < argc; ++i) {
+        if (std::strcmp(argv[i], "--patterns") == 0 && i + 1 < argc) {
+            count = std::atoi(argv[++i]);
+        } else if (std::strcmp(argv[i], "--seed") == 0 && i + 1 < argc) {
+            seed = static_cast<unsigned>(std::atoi(argv[++i]));
+        } else if (std::strcmp(argv[i], "--sharded") == 0) {
+            sharded = true;
+        } else if (std::strcmp(argv[i], "--budget") == 0 && i + 1 < argc) {
+            budget = static_cast<size_t>(std::atol(argv[++i])) * 1024;
+        } else {
+            return Usage();
+        }
+    }
+    if (count < 1) return Usage();
+
+    // The entries in rank order, read the way LoadFromFile reads them
+    std::wstring path = Unicode::Utf8ToWide(argv[0]);
+    CDataFile file;
+    if (!file.Load(path)) {
+        std::fprintf(stderr, "failed to load %s\n", argv[0]);
+        return 1;
+    }
+    struct Entry {
+        std::wstring code;
+        std::wstring character;
+        uint32_t frequency;
+    };
+    std::vector<Entry> entries;
+    for (const auto& record : file.GetRecords()) {
+        size_t tab = record.value.find(L'\t');
+        entries.push_back({std::wstring(record.key), std::wstring(record.value.substr(0, tab)),
+                           tab == std::wstring_view::npos ? 0 : CDictionaryData::ParseFrequency(record.value.substr(tab + 1))});
+    }
+    std::stable_sort(entries.begin(), entries.end(), [](const Entry& a, const Entry& b) { return a.frequency > b.frequency; });
+
+    CDictionary dictionary;
+    dictionary.SetSharded(sharded);
+    dictionary.SetMemoryBudget(budget);
+    if (!dictionary.LoadFromFile(path)) {
+        std::fprintf(stderr, "failed to load %s\n", argv[0]);
+        return 1;
+    }
+
+    // Mostly strokes, so that many patterns still match something
+    static const wchar_t SYMBOLS[] = L"一丨丿丶フ一丨丿丶フ＊～";
+    std::mt19937 random(seed);
+    std::vector<std::wstring> patterns(count);
+    std::vector<std::vector<std::wstring>> expected(count);
+    auto fail = [](const char* what, const std::wstring& pattern, const std::vector<std::wstring>& want,
+                   const std::vector<std::wstring>& got) {
+        auto join = [](const std::vector<std::wstring>& list) {
+            std::wstring text;
+            for (size_t i = 0; i < list.size() && i < 20; ++i) text += list[i];
+            return Unicode::WideToUtf8(text) + (list.size() > 20 ? "..." : "");
+        };
+        std::printf("%s %s differs:\n  scan   %zu %s\n  lookup %zu %s\n", what, Unicode::WideToUtf8(pattern).c_str(),
+                    want.size(), join(want).c_str(), got.size(), join(got).c_str());
+        return 1;
+    };
+    size_t matched = 0, pages = 0;
+    for (int p = 0; p < count; ++p) {
+        std::wstring& pattern = patterns[p];
+        for (size_t length = 1 + random() % 7; pattern.size() < length;) {
+            pattern += SYMBOLS[random() % (sizeof(SYMBOLS) / sizeof(SYMBOLS[0]) - 1)];
+        }
+        bool whole = Stroke::HasAnyStrokes(pattern);
+
+        // Every character once, at its best matching entry; codes exactly as long as the
+        // pattern first for exactLengthFirst, which ～ patterns ignore
+        std::vector<std::wstring>& all = expected[p];
+        std::vector<std::wstring> exactFirst;
+        std::unordered_set<std::wstring> seen, seenExact;
+        for (const auto& entry : entries) {
+            if (!MatchesByScan(pattern, entry.code, whole)) continue;
+            if (seen.insert(entry.character).second) all.push_back(entry.character);
+            if (entry.code.size() == pattern.size() && seenExact.insert(entry.character).second) {
+                exactFirst.push_back(entry.character);
+            }
+        }
+        if (whole) {
+            exactFirst = all;
+        } else {
+            for (const auto& character : all) {
+                if (seenExact.insert(character).second) exactFirst.push_back(character);
+            }
+        }
+        auto firstPage = [](const std::vector<std::wstring>& list) {
+            return std::vector<std::wstring>(list.begin(), list.begin() + (std::min)(list.size(), size_t(10)));
+        };
+        matched += !all.empty();
+
+        std::vector<std::wstring> got = dictionary.LookupRegex(pattern);
+        if (got != all) return fail("LookupRegex", pattern, all, got);
+        got = dictionary.LookupTopK(pattern, 10, false);
+        if (got != firstPage(all)) return fail("LookupTopK", pattern, firstPage(all), got);
+        got = dictionary.LookupTopK(pattern, 10, true);
+        if (got != firstPage(exactFirst)) return fail("LookupTopK exactLengthFirst", pattern, firstPage(exactFirst), got);
+        size_t total = 0;
+        if (dictionary.LookupFirstPage(pattern, got, total)) {
+            pages++;
+            // A page of the size k6tool compile gives, or all of them
+            size_t size = (std::min)(all.size(), static_cast<size_t>(CPrefixTable::DEFAULT_PAGE_SIZE));
+            if (total != all.size() || got.size() < size ||
+                !std::equal(got.begin(), got.end(), all.begin(), all.begin() + (std::min)(got.size(), all.size()))) {
+                return fail("LookupFirstPage", pattern, all, got);
+            }
+        }
+    }
+
+    // Near misses: every character not matching the pattern itself, at its fewest edits
+    // and then its best rank, for maxEdits as LookupFuzzy caps it
+    static const wchar_t FUZZY_SYMBOLS[] = L"一丨丿丶フ一丨丿丶フ＊";
+    int fuzzyCount = (count + 9) / 10;
+    size_t fuzzyMatched = 0;
+    for (int p = 0; p < fuzzyCount; ++p) {
+        std::wstring pattern;
+        for (size_t length = 2 + random() % 7; pattern.size() < length;) {
+            pattern += FUZZY_SYMBOLS[random() % (sizeof(FUZZY_SYMBOLS) / sizeof(FUZZY_SYMBOLS[0]) - 1)];
+        }
+        uint32_t maxEdits = CLoudsTrie::GetMaxEdits(pattern.size(), 1 + random() % 2);
+        size_t k = random() % 2 ? 10 : 50;
+
+        std::map<std::wstring, std::pair<uint32_t, size_t>> best;  // character -> (edits, rank)
+        std::unordered_set<std::wstring> exact;
+        for (size_t rank = 0; rank < entries.size(); ++rank) {
+            const Entry& entry = entries[rank];
+            if (MatchesByScan(pattern, entry.code, false)) {
+                exact.insert(entry.character);
+                continue;
+            }
+            uint32_t edits = maxEdits ? FuzzyEditsByScan(pattern, entry.code, maxEdits) : UINT32_MAX;
+            if (edits > maxEdits) continue;
+            auto [it, added] = best.emplace(entry.character, std::make_pair(edits, rank));
+            if (!added && edits < it->second.first) it->second = {edits, rank};
+        }
+        std::vector<std::pair<std::pair<uint32_t, size_t>, std::wstring>> order;
+        for (const auto& [character, key] : best) {
+            if (!exact.count(character)) order.emplace_back(key, character);
+        }
+        std::sort(order.begin(), order.end());
+        std::vector<std::wstring> want;
+        for (size_t i = 0; i < order.size() && i < k; ++i) want.push_back(order[i].second);
+        fuzzyMatched += !want.empty();
+
+        std::vector<std::wstring> got = dictionary.LookupFuzzy(pattern, maxEdits, k);
+        if (got != want) {
+            return fail(("LookupFuzzy (" + std::to_string(maxEdits) + " edits, k " + std::to_string(k) + ")").c_str(),
+                        pattern, want, got);
+        }
+    }
+
+    // Every 50th character in rank order and the first few with codes longer than the
+    // filter packs, narrowed by the same patterns
+    std::vector<std::wstring> suggestions;
+    std::unordered_map<std::wstring, std::vector<std::wstring>> codesByCharacter;
+    size_t longCodes = 0;
+    for (const auto& entry : entries) {
+        auto [it, added] = codesByCharacter.try_emplace(entry.character);
+        it->second.push_back(entry.code);
+        bool isLong = entry.code.size() > CSuggestionFilter::MAX_STROKES && longCodes < 20;
+        if (added && (codesByCharacter.size() % 50 == 1 || isLong)) {
+            suggestions.push_back(entry.character);
+            longCodes += isLong;
+        }
+    }
+    CSuggestionFilter filter;
+    filter.Build(suggestions, dictionary);
+    for (const auto& pattern : patterns) {
+        bool whole = Stroke::HasAnyStrokes(pattern);
+        std::vector<std::wstring> want, got;
+        for (const auto& suggestion : suggestions) {
+            const auto& codes = codesByCharacter[suggestion];
+            if (std::any_of(codes.begin(), codes.end(),
+                            [&](const std::wstring& code) { return MatchesByScan(pattern, code, whole); })) {
+                want.push_back(suggestion);
+            }
+        }
+        filter.Match(pattern, got);
+        if (got != want) return fail("CSuggestionFilter", pattern, want, got);
+    }
+
+    // The batch needs the whole dictionary, so it comes last
+    auto data = dictionary.Acquire();
+    std::vector<std::vector<CharId>> batch = data->LookupRegexBatchIds(patterns);
+    for (int p = 0; p < count; ++p) {
+        std::vector<std::wstring> got = data->ToStrings(batch[p]);
+        if (got != expected[p]) return fail("LookupRegexBatchIds", patterns[p], expected[p], got);
+    }
+    std::printf("%d patterns (%zu matching, %zu from the prefix table) and %d near misses (%zu found) %s%s, %zu suggestions: every "
+                "lookup agrees with a scan\n",
+                count, matched, pages, fuzzyCount, fuzzyMatched, sharded ? "sharded" : "loaded",
+                budget ? (" under " + std::to_string(budget / 1024) + " KB").c_str() : "", suggestions.size());
+    return 0;
+}
+
+struct ReloadQuery {
+    enum Kind { REGEX, TOP_K, CODES } kind;
+    std::wstring text;
+    std::vector<std::vector<std::wstring>> valid;
+};
+
+static std::vector<std::wstring> RunReloadQuery(const CDictionary& dictionary, const ReloadQuery& query) {
+    switch (query.kind) {
+        case ReloadQuery::REGEX:
+            return dictionary.LookupRegex(query.text);
+        case ReloadQuery::TOP_K:
+            return dictionary.LookupTopK(query.text, 10, false);
+        default:
+            return dictionary.GetCodesForCharacter(query.text);
+    }
+}
+
+static int ReloadStress(int argc, char** argv) {
+    if (argc < 1) return Usage();
+    int threads = 4;
+    int reloads = 12;
+    bool sharded = false;
+    std::wstring suggestionsPath;
+    unsigned seed = 28;
+    for (int i = 1; i < argc; ++i) {
+        if (std::strcmp(argv[i], "--threads") == 0 && i + 1 < argc) {
+            threads = std::atoi(argv[++i]);
+        } else if (std::strcmp(argv[i], "--reloads") == 0 && i + 1 < argc) {
+            reloads = std::atoi(argv[++i]);
+        } else if (std::strcmp(argv[i], "--sharded") == 0) {
+            sharded = true;
+        } else if (std::strcmp(argv[i], "--suggestions") == 0 && i + 1 < argc) {
+            suggestionsPath = Unicode::Utf8ToWide(argv[++i]);
+        } else if (std::strcmp(argv[i], "--seed") == 0 && i + 1 < argc) {
+            seed = static_cast<unsigned>(std::atoi(argv[++i]));
+        } else {
+            return Usage();
+        }
+    }
+    if (threads < 1 || reloads < 1) return Usage();
+
+    // Two versions of the data to flip between: the file as given, and without every
+    // seventh line
+    std::ifstream source(argv[0], std::ios::binary);
+    if (!source) {
+        std::fprintf(stderr, "failed to load %s\n", argv[0]);
+        return 1;
+    }
+    std::filesystem::path directory = std::filesystem::temp_directory_path() / "k6-reload-stress";
+    std::filesystem::create_directories(directory);
+    std::wstring paths[2] = {(directory / "strokeDataA.txt").wstring(), (directory / "strokeDataB.txt").wstring()};
+    {
+        std::ofstream a(std::filesystem::path(paths[0]), std::ios::binary);
+        std::ofstream b(std::filesystem::path(paths[1]), std::ios::binary);
+        std::string line;
+        for (size_t n = 0; std::getline(source, line); ++n) {
+            a << line << '\n';
+            if (n % 7 != 6) b << line << '\n';
+        }
+    }
+
+    // Single-threaded references for both files, without and with the user's entry folded in
+    static const wchar_t* const CUSTOM_CODE = L"丶フ丶フ丶フ丶";
+    static const wchar_t* const CUSTOM_CHARACTER = L"\xE000";  // private use
+    CUserDictionary reference;
+    reference.Add(CUSTOM_CODE, CUSTOM_CHARACTER, 0);
+    CDictionaryData plain[2], folded[2];
+    for (int v = 0; v < 2; ++v) {
+        if (!plain[v].LoadFromFile(paths[v]) || !folded[v].LoadMerged(plain[v], &*reference.Acquire())) {
+            std::fprintf(stderr, "failed to load %s\n", Unicode::WideToUtf8(paths[v]).c_str());
+            return 1;
+        }
+        if (sharded && !plain[v].CompileShards(CDictionaryShards::GetPathForDictionary(paths[v]))) {
+            std::fprintf(stderr, "failed to write the shards for %s\n", Unicode::WideToUtf8(paths[v]).c_str());
+            return 1;
+        }
+    }
+
+    std::vector<ReloadQuery> queries;
+    for (const wchar_t* pattern : {L"丶フ", L"一丨", L"丿丶", L"一＊丶", L"～丶フ", L"丶フ丶フ", L"丨～丶フ", L"＊＊＊＊＊＊"}) {
+        queries.push_back({ReloadQuery::REGEX, pattern, {}});
+        queries.push_back({ReloadQuery::TOP_K, pattern, {}});
+    }
+    for (const wchar_t* character : {CUSTOM_CHARACTER, L"中", L"我"}) {
+        queries.push_back({ReloadQuery::CODES, character, {}});
+    }
+    for (auto& query : queries) {
+        for (const CDictionaryData* data : {&plain[0], &plain[1], &folded[0], &folded[1]}) {
+            std::vector<std::wstring> result = query.kind == ReloadQuery::REGEX ? data->LookupRegex(query.text)
+                                               : query.kind == ReloadQuery::TOP_K
+                                                   ? data->ToStrings(data->LookupTopKIds(query.text, 10, false))
+                                                   : data->GetCodesForCharacter(query.text);
+            if (std::find(query.valid.begin(), query.valid.end(), result) == query.valid.end()) {
+                query.valid.push_back(std::move(result));
+            }
+        }
+    }
+
+    CSuggestions suggestions;
+    std::vector<std::wstring> suggestionsReference;
+    if (!suggestionsPath.empty()) {
+        if (!suggestions.LoadFromFile(suggestionsPath)) {
+            std::fprintf(stderr, "failed to load %s\n", Unicode::WideToUtf8(suggestionsPath).c_str());
+            return 1;
+        }
+        suggestionsReference = suggestions.Lookup(L"中");
+    }
+
+    CUserDictionary user;
+    CDictionary dictionary;
+    dictionary.SetUserDictionary(&user);
+    dictionary.SetSharded(sharded);
+    if (!dictionary.LoadFromFile(paths[0])) {
+        std::fprintf(stderr, "failed to load %s\n", Unicode::WideToUtf8(paths[0]).c_str());
+        return 1;
+    }
+
+    std::atomic<bool> stop{false};
+    std::atomic<uint64_t> lookups{0}, wrong{0};
+    std::vector<std::thread> workers;
+    for (int t = 0; t < threads; ++t) {
+        workers.emplace_back([&, t] {
+            std::mt19937 random(seed + t + 1);
+            while (!stop.load(std::memory_order_relaxed)) {
+                const ReloadQuery& query = queries[random() % queries.size()];
+                std::vector<std::wstring> result = RunReloadQuery(dictionary, query);
+                bool ok = std::find(query.valid.begin(), query.valid.end(), result) != query.valid.end();
+                if (!suggestionsPath.empty() && suggestions.Lookup(L"中") != suggestionsReference) ok = false;
+                if (!ok && wrong.fetch_add(1) < 5) {
+                    std::fprintf(stderr, "wrong result for %s\n", Unicode::WideToUtf8(query.text).c_str());
+                }
+                lookups.fetch_add(1, std::memory_order_relaxed);
+            }
+        });
+    }
+
+    // Reload and edit while the lookups run, pausing past the fold delay every few rounds
+    // so user entries are looked up both merged and folded
+    std::mt19937 random(seed);
+    int version = 0;
+    bool custom = false;
+    size_t edits = 0;
+    auto start = std::chrono::steady_clock::now();
+    for (int round = 0; round < reloads; ++round) {
+        if (random() % 2 == 0) {
+            version ^= 1;
+            if (!dictionary.LoadFromFile(paths[version])) {
+                std::fprintf(stderr, "failed to reload %s\n", Unicode::WideToUtf8(paths[version]).c_str());
+                wrong++;
+            }
+            if (!suggestionsPath.empty()) suggestions.LoadFromFile(suggestionsPath);
+        } else {
+            custom = !custom;
+            custom ? user.Add(CUSTOM_CODE, CUSTOM_CHARACTER, 0) : user.Reset(CUSTOM_CODE, CUSTOM_CHARACTER);
+            edits++;
+        }
+        auto pause = round % 4 == 3 ? CDictionary::FOLD_DELAY + std::chrono::milliseconds(500)
+                                    : std::chrono::milliseconds(20 + random() % 200);
+        std::this_thread::sleep_for(pause);
+    }
+    stop = true;
+    for (auto& worker : workers) worker.join();
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+    // Once the last fold is in, every lookup must give the state last written
+    auto deadline = std::chrono::steady_clock::now() + CDictionary::FOLD_DELAY + std::chrono::seconds(30);
+    while (dictionary.Acquire()->GetUserVersion() != user.GetVersion() && std::chrono::steady_clock::now() < deadline) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(50));
+    }
+    const CDictionaryData& last = custom ? folded[version] : plain[version];
+    size_t settled = 0;
+    for (const auto& query : queries) {
+        std::vector<std::wstring> expected = query.kind == ReloadQuery::REGEX ? last.LookupRegex(query.text)
+                                             : query.kind == ReloadQuery::TOP_K
+                                                 ? last.ToStrings(last.LookupTopKIds(query.text, 10, false))
+                                                 : last.GetCodesForCharacter(query.text);
+        if (RunReloadQuery(dictionary, query) != expected) settled++;
+    }
+
+    std::printf("%s | threads %d | rounds %d (%zu user edits) | %.1f s | lookups %llu | wrong %llu | wrong after "
+                "settling %zu\n",
+                sharded ? "sharded" : "full", threads, reloads, edits, seconds,
+                static_cast<unsigned long long>(lookups.load()), static_cast<unsigned long long>(wrong.load()), settled);
+    std::filesystem::remove_all(directory);
+    return wrong == 0 && settled == 0 ? 0 : 1;
+}
+
+static CLookupServer* g_server = nullptr;
+
+static void StopServer(int) {
+    if (g_server) g_server->Stop();
+}
+
+static int Serve(int argc, char** argv) {
+    if (argc < 1) return Usage();
+    std::wstring suggestionsPath;
+    std::wstring address = CLookupServer::GetDefaultAddress();
+    int scanThreads = static_cast<int>(std::thread::hardware_concurrency());
+    for (int i = 1; i < argc; ++i) {
+        if (std::strcmp(argv[i], "--suggestions") == 0 && i + 1 < argc) {
+            suggestionsPath = Unicode::Utf8ToWide(argv[++i]);
+        } else if (std::strcmp(argv[i], "--socket") == 0 && i + 1 < argc) {
+            address = Unicode::Utf8ToWide(argv[++i]);
+        } else if (std::strcmp(argv[i], "--scan-threads") == 0 && i + 1 < argc) {
+            scanThreads = std::atoi(argv[++i]);
+        } else {
+            return Usage();
+        }
+    }
+
+    std::unique_ptr<CScanPool> pool;
+    CDictionary dictionary;
+    if (scanThreads > 1) {
+        pool = std::make_unique<CScanPool>(static_cast<unsigned>(scanThreads));
+        dictionary.SetScanPool(pool.get());
+    }
+    if (!dictionary.LoadFromFile(Unicode::Utf8ToWide(argv[0]))) {
+        std::fprintf(stderr, "failed to load %s\n", argv[0]);
+        return 1;
+    }
+    CSuggestions suggestions;
+    if (!suggestionsPath.empty() && !suggestions.LoadFromFile(suggestionsPath)) {
+        std::fprintf(stderr, "failed to load %s\n", Unicode::WideToUtf8(suggestionsPath).c_str());
+        return 1;
+    }
+
+    CLookupServer server(dictionary, suggestions);
+    if (!server.Listen(address)) {
+        std::fprintf(stderr, "cannot listen on %s\n", Unicode::WideToUtf8(address).c_str());
+        return 1;
+    }
+    g_server = &server;
+    std::signal(SIGINT, StopServer);
+    std::signal(SIGTERM, StopServer);
+    std::printf("serving %zu entries on %s\n", dictionary.GetEntryCount(), Unicode::WideToUtf8(address).c_str());
+    std::fflush(stdout);
+    server.Run();
+    g_server = nullptr;
+
+    CLookupServer::Stats stats = server.GetStats();
+    std::printf("connections %llu | requests %llu | batches %llu | evaluations %llu | largest batch %llu | errors %llu\n",
+                static_cast<unsigned long long>(stats.connections), static_cast<unsigned long long>(stats.requests),
+                static_cast<unsigned long long>(stats.batches), static_cast<unsigned long long>(stats.evaluations),
+                static_cast<unsigned long long>(stats.largestBatch), static_cast<unsigned long long>(stats.errors));
+    return 0;
+}
+
+// Short prefixes as typed, plus some of the slow wildcard cases
+static const wchar_t* const LOADGEN_PATTERNS[] = {
+    L"一", L"丨", L"丿丶", L"一丨", L"丶フ", L"一丨丿", L"丿丶フ一", L"フ一丨丶",
+    L"一＊丶", L"丨＊＊フ", L"一～丶", L"～丶フ", L"丨～丶フ", L"～＊＊＊丶",
+};
+
+static int LoadGen(int argc, char** argv) {
+    std::wstring address = CLookupServer::GetDefaultAddress();
+    int clients = 8, requests = 2000, depth = 1, k = 10;
+    bool json = false;
+    std::vector<std::wstring> patterns;
+    for (int i = 0; i < argc; ++i) {
+        if (std::strcmp(argv[i], "--socket") == 0 && i + 1 < argc) {
+            address = Unicode::Utf8ToWide(argv[++i]);
+        } else if (std::strcmp(argv[i], "--clients") == 0 && i + 1 < argc) {
+            clients = std::atoi(argv[++i]);
+        } else if (std::strcmp(argv[i], "--requests") == 0 && i + 1 < argc) {
+            requests = std::atoi(argv[++i]);
+        } else if (std::strcmp(argv[i], "--depth") == 0 && i + 1 < argc) {
+            depth = std::atoi(argv[++i]);
+        } else if (std::strcmp(argv[i], "--k") == 0 && i + 1 < argc) {
+            k = std::atoi(argv[++i]);
+        } else if (std::strcmp(argv[i], "--json") == 0) {
+            json = true;
+        } else {
+            patterns.push_back(Unicode::Utf8ToWide(argv[i]));
+        }
+    }
+    if (clients < 1 || requests < 1 || depth < 1 || k < 0 || k > UINT16_MAX) return Usage();
+    if (patterns.empty()) patterns.assign(std::begin(LOADGEN_PATTERNS), std::end(LOADGEN_PATTERNS));
+
+    // Each connection sends `requests` lookups, topping its window back up to depth
+    // after every response; latency runs from sending a request to reading its answer
+    std::vector<std::vector<double>> latencies(clients);
+    std::atomic<size_t> failures{0};
+    std::vector<std::thread> threads;
+    auto start = std::chrono::steady_clock::now();
+    for (int c = 0; c < clients; ++c) {
+        threads.emplace_back([&, c] {
+            CLookupClient client;
+            if (!client.Connect(address)) {
+                failures.fetch_add(static_cast<size_t>(requests));
+                return;
+            }
+            std::vector<std::chrono::steady_clock::time_point> sent(requests);
+            int next = 0, received = 0;
+            auto send = [&] {
+                LookupProtocol::Request request;
+                request.id = static_cast<uint32_t>(next);
+                request.k = static_cast<uint16_t>(k);
+                request.text = patterns[(static_cast<size_t>(c) * 7 + next) % patterns.size()];
+                request.json = json;
+                sent[next] = std::chrono::steady_clock::now();
+                next++;
+                return client.Send(request);
+            };
+            while (received < requests) {
+                bool ok = true;
+                while (ok && next < requests && next - received < depth) ok = send();
+                LookupProtocol::Response response;
+                if (!ok || !client.Receive(response) || response.id != static_cast<uint32_t>(received)) {
+                    failures.fetch_add(static_cast<size_t>(requests - received));
+                    return;
+                }
+                if (!response.error.empty()) failures.fetch_add(1);
+                latencies[c].push_back(
+                    std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - sent[received]).count());
+                received++;
+            }
+        });
+    }
+    for (auto& thread : threads) thread.join();
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+    std::vector<double> all;
+    for (const auto& samples : latencies) all.insert(all.end(), samples.begin(), samples.end());
+    if (all.empty()) {
+        std::fprintf(stderr, "no responses from %s\n", Unicode::WideToUtf8(address).c_str());
+        return 1;
+    }
+    std::sort(all.begin(), all.end());
+    auto percentile = [&all](double p) { return all[(std::min)(all.size() - 1, static_cast<size_t>(p * all.size()))]; };
+    std::printf("clients %d | depth %d | %s | responses %zu | failures %zu\n", clients, depth, json ? "json" : "binary",
+                all.size(), failures.load());
+    std::printf("throughput %.0f req/s | latency us: p50 %.1f | p90 %.1f | p99 %.1f | p99.9 %.1f | max %.1f\n",
+                all.size() / seconds, percentile(0.50), percentile(0.90), percentile(0.99), percentile(0.999), all.back());
+    return failures.load() == 0 ? 0 : 1;
+}
+
+static int User(int argc, char** argv) {
+    std::wstring path = CUserDictionary::GetDefaultPath();
+    if (argc >= 2 && std::strcmp(argv[0], "--file") == 0) {
+        path = Unicode::Utf8ToWide(argv[1]);
+        argc -= 2;
+        argv += 2;
+    }
+    if (argc < 1) return Usage();
+    CUserDictionary user;
+    user.Open(path);
+
+    std::string command = argv[0];
+    if ((command == "add" && (argc == 3 || argc == 4)) || ((command == "remove" || command == "reset") && argc == 3)) {
+        std::wstring code = Unicode::Utf8ToWide(argv[1]);
+        std::wstring character = Unicode::Utf8ToWide(argv[2]);
+        bool ok = command == "add"      ? user.Add(code, character, argc == 4 ? static_cast<uint32_t>(std::atol(argv[3])) : 0)
+                  : command == "remove" ? user.Remove(code, character)
+                                        : user.Reset(code, character);
+        if (!ok) {
+            std::fprintf(stderr, "cannot %s %s %s (codes are strokes 一丨丿丶フ)\n", argv[0], argv[1], argv[2]);
+            return 1;
+        }
+        std::printf("%s: %zu entries\n", Unicode::WideToUtf8(path).c_str(), user.Acquire()->GetEntries().size());
+        return 0;
+    }
+    if (command == "list" && argc == 1) {
+        for (const auto& entry : user.Acquire()->GetEntries()) {
+            std::printf("%s\t%s\t%s\n", Unicode::WideToUtf8(entry.code).c_str(), Unicode::WideToUtf8(entry.character).c_str(),
+                        entry.rank == CUserDictionary::REMOVED ? "-" : std::to_string(entry.rank).c_str());
+        }
+        return 0;
+    }
+    if (command == "lookup" && argc == 3) {
+        CDictionary dictionary;
+        dictionary.SetUserDictionary(&user);
+        if (!dictionary.LoadFromFile(Unicode::Utf8ToWide(argv[1]))) {
+            std::fprintf(stderr, "failed to load %s\n", argv[1]);
+            return 1;
+        }
+        std::wstring pattern = Unicode::Utf8ToWide(argv[2]);
+        auto show = [&](const char* label) {
+            auto start = std::chrono::steady_clock::now();
+            std::vector<std::wstring> page = dictionary.LookupTopK(pattern, 10, false);
+            double ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+            std::string text;
+            for (const auto& character : page) text += Unicode::WideToUtf8(character) + " ";
+            std::printf("%-7s %7.3f ms | %s\n", label, ms, text.c_str());
+        };
+        show("merged");
+        // Wait for the background fold to publish its snapshot
+        auto deadline = std::chrono::steady_clock::now() + CDictionary::FOLD_DELAY + std::chrono::seconds(30);
+        while (dictionary.Acquire()->GetUserVersion() != user.GetVersion() && std::chrono::steady_clock::now() < deadline) {
+            std::this_thread::sleep_for(std::chrono::milliseconds(50));
+        }
+        show("folded");
+        return 0;
+    }
+    return Usage();
+}
+
+// Picks stamped at set minutes under a one-day half-life, read back from the log
+static bool HistoryDecays(const std::wstring& path) {
+    static constexpr uint32_t HALF_LIFE = 24 * 60;
+    const std::wstring context = L"丿フ";
+    uint32_t now = CUserHistory::Now();
+    {
+        CUserHistory history(1, CUserHistory::DEFAULT_MAX_CONTEXTS);
+        history.Open(path);
+        for (int n = 0; n < 3; ++n) history.Record(CUserHistory::Kind::STROKES, context, L"乙", now - 3 * HALF_LIFE);
+        for (int n = 0; n < 3; ++n) history.Record(CUserHistory::Kind::STROKES, context, L"九", now - 2 * HALF_LIFE);
+        history.Record(CUserHistory::Kind::STROKES, context, L"又", now);
+        history.Close();
+    }
+
+    CUserHistory history(1, CUserHistory::DEFAULT_MAX_CONTEXTS);
+    history.Open(path);
+    struct Check {
+        const wchar_t* item;
+        uint32_t minute;
+        float score;
+    };
+    const Check checks[] = {
+        {L"又", now, 1.0f},
+        {L"又", now + HALF_LIFE, 0.5f},
+        {L"九", now, 0.75f},
+        {L"九", now + 2 * HALF_LIFE, 0.1875f},
+        {L"乙", now, 0.375f},
+        {L"乃", now, 0.0f},
+    };
+    bool ok = true;
+    for (const Check& check : checks) {
+        float score = history.GetScore(CUserHistory::Kind::STROKES, context, check.item, check.minute);
+        if (std::fabs(score - check.score) > 1e-4f) {
+            std::printf("%s %+d min: score %.4f, expected %.4f\n", Unicode::WideToUtf8(check.item).c_str(),
+                        static_cast<int>(check.minute - now), score, check.score);
+            ok = false;
+        }
+    }
+
+    // 乙 has faded below half a fresh pick, so it keeps its place behind 乃
+    std::vector<std::wstring> list{L"乃", L"乙", L"九", L"又"};
+    history.Rerank(CUserHistory::Kind::STROKES, context, list);
+    const std::vector<std::wstring> order{L"又", L"九", L"乃", L"乙"};
+    if (list != order) {
+        std::string got;
+        for (const auto& item : list) got += Unicode::WideToUtf8(item);
+        std::printf("reranked %s, expected 又九乃乙\n", got.c_str());
+        ok = false;
+    }
+    history.Close();
+    return ok;
+}
+
+static int HistoryStress(int argc, char** argv) {
+    int writers = 4;
+    int picks = 3000;
+    for (int i = 0; i < argc; ++i) {
+        if (std::strcmp(argv[i], "--writers") == 0 && i + 1 < argc) {
+            writers = std::atoi(argv[++i]);
+        } else if (std::strcmp(argv[i], "--picks") == 0 && i + 1 < argc) {
+            picks = std::atoi(argv[++i]);
+        } else {
+            return Usage();
+        }
+    }
+    if (writers < 1 || picks < 1) return Usage();
+
+    std::filesystem::path directory = std::filesystem::temp_directory_path() / "k6-history-stress";
+    std::filesystem::remove_all(directory);
+    std::filesystem::create_directories(directory);
+    std::wstring path = (directory / "userHistory.log").wstring();
+
+    // One history per thread stands in for one per process: each has its own handle on the
+    // lock file. Every fifth pick starts a new context, so each writer leaves picks/5
+    // contexts behind and compacts the log several times on the way.
+    static constexpr int PICKS_PER_CONTEXT = 5;
+    size_t maxContexts = static_cast<size_t>(writers) * picks / PICKS_PER_CONTEXT + 1;
+    auto start = std::chrono::steady_clock::now();
+    std::vector<std::thread> threads;
+    for (int w = 0; w < writers; ++w) {
+        threads.emplace_back([&, w] {
+            CUserHistory history(CUserHistory::DEFAULT_HALF_LIFE_DAYS, maxContexts);
+            history.Open(path);
+            for (int n = 0; n < picks; ++n) {
+                history.Record(CUserHistory::Kind::STROKES,
+                               std::to_wstring(w) + L"-" + std::to_wstring(n / PICKS_PER_CONTEXT), L"中");
+            }
+            history.Close();
+        });
+    }
+    for (auto& thread : threads) thread.join();
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+    CUserHistory history(CUserHistory::DEFAULT_HALF_LIFE_DAYS, maxContexts);
+    history.Open(path);
+    size_t expected = static_cast<size_t>(writers) * ((picks + PICKS_PER_CONTEXT - 1) / PICKS_PER_CONTEXT);
+    size_t found = history.GetContextCount();
+    history.Close();
+    std::printf("writers %d | picks %d each | %.2f s | contexts %zu of %zu\n", writers, picks, seconds, found, expected);
+
+    std::wstring decayPath = (directory / "decay.log").wstring();
+    bool decays = HistoryDecays(decayPath);
+    std::printf("decay %s\n", decays ? "ok" : "wrong");
+    std::filesystem::remove_all(directory);
+    return found == expected && decays ? 0 : 1;
+}
+
+static int Annotate(int argc, char** argv) {
+    if (argc < 1) return Usage();
+    CStrokeAnnotator::Codes codes = CStrokeAnnotator::Codes::Canonical;
+    CStrokeAnnotator::Format format = CStrokeAnnotator::Format::Inline;
+    int threads = 1;
+    std::vector<const char*> paths;
+    for (int i = 1; i < argc; ++i) {
+        if (std::strcmp(argv[i], "--all") == 0) {
+            codes = CStrokeAnnotator::Codes::All;
+        } else if (std::strcmp(argv[i], "--lines") == 0) {
+            format = CStrokeAnnotator::Format::Lines;
+        } else if (std::strcmp(argv[i], "--threads") == 0 && i + 1 < argc) {
+            threads = std::atoi(argv[++i]);
+        } else if (argv[i][0] != '-' || argv[i][1] == '\0') {
+            paths.push_back(argv[i]);
+        } else {
+            return Usage();
+        }
+    }
+    if (threads < 1 || paths.size() > 2) return Usage();
+
+    CDictionaryData data;
+    if (!data.LoadFromFile(Unicode::Utf8ToWide(argv[0]))) {
+        std::fprintf(stderr, "failed to load %s\n", argv[0]);
+        return 1;
+    }
+    auto start = std::chrono::steady_clock::now();
+    CStrokeAnnotator annotator(data, codes, format);
+    double buildMs = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+
+    // "-" (or nothing) is standard input and output
+    FILE* in = stdin;
+    FILE* out = stdout;
+    if (paths.size() > 0 && std::strcmp(paths[0], "-") != 0 && !(in = std::fopen(paths[0], "rb"))) {
+        std::fprintf(stderr, "cannot read %s\n", paths[0]);
+        return 1;
+    }
+    if (paths.size() > 1 && std::strcmp(paths[1], "-") != 0 && !(out = std::fopen(paths[1], "wb"))) {
+        std::fprintf(stderr, "cannot write %s\n", paths[1]);
+        return 1;
+    }
+#ifdef _WIN32
+    _setmode(_fileno(stdin), _O_BINARY);
+    _setmode(_fileno(stdout), _O_BINARY);
+#endif
+
+    CStrokeAnnotator::Stats stats;
+    bool ok = annotator.Run(in, out, static_cast<unsigned>(threads), stats);
+    if (in != stdin) std::fclose(in);
+    if (out != stdout && std::fclose(out) != 0) ok = false;
+
+    double mb = 1024.0 * 1024.0;
+    std::fprintf(stderr, "table %.1f ms, %.1f KB | annotators %d | in %.1f MB | out %.1f MB | characters %llu | "
+                 "%.3f s | %.0f MB/s in\n",
+                 buildMs, annotator.GetMemoryUsage() / 1024.0, threads, stats.bytesIn / mb, stats.bytesOut / mb,
+                 static_cast<unsigned long long>(stats.annotated), stats.seconds,
+                 stats.seconds > 0 ? stats.bytesIn / mb / stats.seconds : 0.0);
+    if (!ok) {
+        std::fprintf(stderr, "annotation failed: read or write error\n");
+        return 1;
+    }
+    return 0;
+}
+
+static int WarmStart(int argc, char** argv) {
+    if (argc < 1) return Usage();
+    std::wstring cachePath = CQueryCacheFile::GetDefaultPath();
+    bool cold = false;
+    bool save = false;
+    std::vector<std::wstring> patterns;
+    for (int i = 1; i < argc; ++i) {
+        if (std::strcmp(argv[i], "--cache") == 0 && i + 1 < argc) {
+            cachePath = Unicode::Utf8ToWide(argv[++i]);
+        } else if (std::strcmp(argv[i], "--cold") == 0) {
+            cold = true;
+        } else if (std::strcmp(argv[i], "--save") == 0) {
+            save = true;
+        } else {
+            patterns.push_back(Unicode::Utf8ToWide(argv[i]));
+        }
+    }
+    if (patterns.empty()) patterns.assign(std::begin(BENCH_PATTERNS), std::end(BENCH_PATTERNS));
+
+    auto start = std::chrono::steady_clock::now();
+    CDictionary dictionary;
+    if (!cold) dictionary.SetQueryCachePath(cachePath);
+    if (!dictionary.LoadFromFile(Unicode::Utf8ToWide(argv[0]))) {
+        std::fprintf(stderr, "failed to load %s\n", argv[0]);
+        return 1;
+    }
+    // Only loads from now on read the cache; a cold run can still save into it
+    dictionary.SetQueryCachePath(cachePath);
+    double loadMs = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+
+    // The first page as the text service asks for it (the prefix table, else the top
+    // 10), then the full list it shows on paging down
+    std::printf("%-24s %8s %12s %8s %12s\n", "pattern", "shown", "first us", "results", "all us");
+    double firstUs = 0, allUs = 0;
+    for (const auto& pattern : patterns) {
+        auto begin = std::chrono::steady_clock::now();
+        std::vector<std::wstring> page;
+        size_t total = 0;
+        if (!dictionary.LookupFirstPage(pattern, page, total)) page = dictionary.LookupTopK(pattern, 10, false);
+        auto shown = std::chrono::steady_clock::now();
+        size_t results = dictionary.LookupRegex(pattern).size();
+        auto end = std::chrono::steady_clock::now();
+        double first = std::chrono::duration<double, std::micro>(shown - begin).count();
+        double all = std::chrono::duration<double, std::micro>(end - shown).count();
+        firstUs += first;
+        allUs += all;
+        std::printf("%-24s %8zu %12.1f %8zu %12.1f\n", Unicode::WideToUtf8(pattern).c_str(), page.size(), first,
+                    results, all);
+    }
+    std::printf("%s | load %.1f ms | first pages %.2f ms | full lists %.2f ms\n", cold ? "cold" : "warm", loadMs,
+                firstUs / 1000, allUs / 1000);
+
+    if (save) {
+        if (!dictionary.SaveQueryCache()) {
+            std::fprintf(stderr, "failed to save %s\n", Unicode::WideToUtf8(cachePath).c_str());
+            return 1;
+        }
+        std::printf("saved %s\n", Unicode::WideToUtf8(cachePath).c_str());
+    }
+    return 0;
+}
+
+// Resident set of this process in KB, 0 where unknown
+static long ResidentKB() {
+    std::ifstream status("/proc/self/status");
+    std::string line;
+    while (std::getline(status, line)) {
+        if (line.compare(0, 6, "VmRSS:") == 0) return std::atol(line.c_str() + 6);
+    }
+    return 0;
+}
+
+// The compiled phrase index if it is up to date, as the text service does, else a build
+static void LoadPhraseIndex(CPhraseIndex& phrases, const std::wstring& suggestionsPath, const std::wstring& dataPath,
+                            const CSuggestions& suggestions, const CDictionary& dictionary) {
+    uint64_t hash;
+    if (!CPhraseIndex::GetDataHash(suggestionsPath, dataPath, hash) ||
+        !phrases.Load(CPhraseIndex::GetPathForSuggestions(suggestionsPath), hash)) {
+        phrases.Build(suggestions, dictionary);
+    }
+}
+
+static int Memory(int argc, char** argv) {
+    if (argc < 1) return Usage();
+    const char* suggestionsPath = nullptr;
+    size_t budget = 0;
+    std::vector<std::wstring> patterns;
+    for (int i = 1; i < argc; ++i) {
+        if (std::strcmp(argv[i], "--suggestions") == 0 && i + 1 < argc) {
+            suggestionsPath = argv[++i];
+        } else if (std::strcmp(argv[i], "--budget") == 0 && i + 1 < argc) {
+            budget = static_cast<size_t>(std::atol(argv[++i])) * 1024;
+        } else {
+            patterns.push_back(Unicode::Utf8ToWide(argv[i]));
+        }
+    }
+    if (patterns.empty()) patterns.assign(std::begin(BENCH_PATTERNS), std::end(BENCH_PATTERNS));
+
+    long residentBefore = ResidentKB();
+    auto start = std::chrono::steady_clock::now();
+    CDictionary dictionary;
+    dictionary.SetMemoryBudget(budget);
+    if (!dictionary.LoadFromFile(Unicode::Utf8ToWide(argv[0]))) {
+        std::fprintf(stderr, "failed to load %s\n", argv[0]);
+        return 1;
+    }
+    CSuggestions suggestions;
+    CPhraseIndex phrases;
+    suggestions.SetCompact(budget != 0);
+    if (suggestionsPath) {
+        std::wstring path = Unicode::Utf8ToWide(suggestionsPath);
+        if (!suggestions.LoadFromFile(path)) {
+            std::fprintf(stderr, "failed to load %s\n", suggestionsPath);
+            return 1;
+        }
+        LoadPhraseIndex(phrases, path, Unicode::Utf8ToWide(argv[0]), suggestions, dictionary);
+    }
+    double loadMs = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+
+    start = std::chrono::steady_clock::now();
+    for (const auto& pattern : patterns) dictionary.LookupRegex(pattern);
+    double lookupMs = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+
+    CMemoryReport report;
+    dictionary.GetMemoryReport(report);
+    size_t dictionaryKB = report.GetHeapBytes() / 1024;
+    if (suggestionsPath) {
+        suggestions.GetMemoryReport(report);
+        phrases.GetMemoryReport(report);
+    }
+    std::printf("%s", Unicode::WideToUtf8(report.ToString()).c_str());
+    // The budget covers the dictionary alone; what it cannot shed is reported, not capped
+    std::string met = "none";
+    if (budget) {
+        met = std::to_string(budget / 1024) + " KB (dictionary " + std::to_string(dictionaryKB) + " KB, " +
+              (dictionaryKB * 1024 <= budget ? std::string("met")
+                                             : "over by " + std::to_string(dictionaryKB - budget / 1024) + " KB") +
+              ")";
+    }
+    std::printf("budget %s | load %.1f ms | %zu full lists %.1f ms | resident +%ld KB\n", met.c_str(), loadMs,
+                patterns.size(), lookupMs, ResidentKB() - residentBefore);
+    return 0;
+}
+
+static int Shards(int argc, char** argv) {
+    if (argc < 1) return Usage();
+    bool full = false;
+    int characters = 1;
+    unsigned seed = 1;
+    for (int i = 1; i < argc; ++i) {
+        if (std::strcmp(argv[i], "--full") == 0) {
+            full = true;
+        } else if (std::strcmp(argv[i], "--characters") == 0 && i + 1 < argc) {
+            characters = std::atoi(argv[++i]);
+        } else if (std::strcmp(argv[i], "--seed") == 0 && i + 1 < argc) {
+            seed = static_cast<unsigned>(std::atoi(argv[++i]));
+        } else {
+            return Usage();
+        }
+    }
+
+    long residentBefore = ResidentKB();
+    auto start = std::chrono::steady_clock::now();
+    CDictionary dictionary;
+    dictionary.SetSharded(!full);
+    if (!dictionary.LoadFromFile(Unicode::Utf8ToWide(argv[0]))) {
+        std::fprintf(stderr, "failed to load %s\n", argv[0]);
+        return 1;
+    }
+    double loadMs = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+    long residentLoaded = ResidentKB();
+
+    // Typed through the text service's session, looking up on this thread as with
+    // asyncLookup off: first pages, near misses for short ones, the pick and its ghost
+    CSuggestions suggestions;
+    CPhraseIndex phrases;
+    CInputSession session(dictionary, suggestions, phrases);
+    std::mt19937 random(seed);
+    std::uniform_int_distribution<int> strokes(0, Stroke::COUNT - 1);
+    std::uniform_int_distribution<size_t> lengths(2, 5);
+    double firstMs = 0, slowestMs = 0;
+    start = std::chrono::steady_clock::now();
+    for (int c = 0; c < characters; ++c) {
+        size_t length = lengths(random);
+        for (size_t i = 0; i <= length; ++i) {
+            InputAction action(InputActionType::SELECT_CHARACTER);
+            if (i < length) {
+                action.type = InputActionType::ADD_STROKE;
+                action.stroke = Stroke::FromIndex(strokes(random));
+            }
+            auto begin = std::chrono::steady_clock::now();
+            session.OnKeyDown(action);
+            session.OnKeyUp();
+            double ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - begin).count();
+            if (c == 0) firstMs += ms;
+            slowestMs = (std::max)(slowestMs, ms);
+        }
+        session.ClearInput();
+    }
+    double typeMs = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+
+    CMemoryReport report;
+    dictionary.GetMemoryReport(report);
+    std::printf("%s", Unicode::WideToUtf8(report.ToString()).c_str());
+    std::printf("%s | start %.1f ms, resident +%ld KB | first character %.1f ms | %d characters %.1f ms, "
+                "slowest key %.1f ms, resident +%ld KB\n",
+                full ? "full" : "sharded", loadMs, residentLoaded - residentBefore, firstMs, characters, typeMs,
+                slowestMs, ResidentKB() - residentBefore);
+    return 0;
+}
+
+// The action InputStateMachine::ProcessKey gives a numpad key (by name, ! for a lost key)
+// in state
+static InputAction ReplayAction(InputState state, std::string key) {
+    if (!key.empty() && key[0] == '!') key.erase(0, 1);
+    static const std::map<std::string, wchar_t> STROKE_KEYS = {
+        {"7", L'一'}, {"8", L'丨'}, {"9", L'丿'}, {"4", L'丶'}, {"5", L'フ'}, {"6", L'＊'}, {"*", L'～'},
+    };
+    bool digit = key.size() == 1 && key[0] >= '0' && key[0] <= '9';
+    InputAction action(InputActionType::NOOP_CONSUME_KEYPRESS);
+    if (state == InputState::TYPING) {
+        auto stroke = STROKE_KEYS.find(key);
+        if (stroke != STROKE_KEYS.end()) {
+            action.type = InputActionType::ADD_STROKE;
+            action.stroke = stroke->second;
+        } else if (key == "Back") {
+            action.type = InputActionType::DELETE_STROKE;
+        } else if (key == "Esc" || key == ".") {
+            action.type = InputActionType::CLEAR_STROKE;
+        } else if (key == "Enter") {
+            action.type = InputActionType::SELECT_CHARACTER;
+        } else if (key == "0") {
+            action.changeNextState = true;
+            action.nextState = InputState::SELECTING;
+        }
+        return action;
+    }
+
+    if (state != InputState::SELECTING) return InputAction(InputActionType::NOOP_PASS_THROUGH_KEYPRESS);
+    action.changeNextState = true;
+    action.nextState = InputState::TYPING;
+    if (digit && key != "0") {
+        action.type = InputActionType::SELECT_CHARACTER;
+        action.index = key[0] - '1';
+    } else if (key == "Enter") {
+        action.type = InputActionType::SELECT_CHARACTER;
+    } else if (key == "Esc" || key == ".") {
+        action.type = InputActionType::CLEAR_STROKE;
+    } else if (key == "Back") {
+        action.type = InputActionType::DELETE_STROKE;
+    } else if (key == "+" || key == "-") {
+        action.type = key == "+" ? InputActionType::NEXT_SELECTION_PAGE : InputActionType::PREVIOUS_SELECTION_PAGE;
+        action.changeNextState = false;
+    } else if (key != "0") {
+        action.changeNextState = false;
+    }
+    return action;
+}
+
+// Mostly strokes with a few mistakes taken back and the odd key lost, then a pick, a
+// page, a clear or more strokes in the next burst
+static std::vector<std::vector<std::string>> RandomBursts(size_t count, std::mt19937& random) {
+    static const char* const STROKES[] = {"7", "8", "9", "4", "5", "7", "8", "9", "4", "5", "6", "*"};
+    std::vector<std::vector<std::string>> bursts(count);
+    for (auto& burst : bursts) {
+        for (size_t n = 1 + random() % 6; n > 0; --n) {
+            burst.push_back(STROKES[random() % (sizeof(STROKES) / sizeof(STROKES[0]))]);
+            if (random() % 8 == 0) burst.push_back("Back");
+            if (random() % 16 == 0) burst.push_back(std::string("!") + STROKES[random() % 5]);
+        }
+        switch (random() % 6) {
+            case 0:
+            case 1:
+                burst.push_back("Enter");
+                break;
+            case 2:
+                burst.push_back("0");
+                burst.push_back(std::to_string(1 + random() % 3));
+                break;
+            case 3:
+                burst.insert(burst.end(), {"0", "+", std::to_string(1 + random() % 9)});
+                break;
+            case 4:
+                burst.push_back(random() % 2 ? "." : "Back");
+                break;
+            default:
+                break;
+        }
+    }
+    return bursts;
+}
+
+// One input session with its own worker and learned picks (in memory only), typed at as
+// the text service's message loop would
+struct ReplaySession {
+    CUserHistory history{CUserHistory::DEFAULT_HALF_LIFE_DAYS, CUserHistory::DEFAULT_MAX_CONTEXTS};
+    std::atomic<bool> posted{false};
+    CLookupWorker worker;
+    CInputSession session;
+    const std::vector<std::string>* burst = nullptr;
+    size_t queued = 0;  // keys of burst before this one have been handled
+    std::wstring committed;
+    double ms = 0;
+
+    ReplaySession(const CDictionary& dictionary, const CSuggestions& suggestions, const CPhraseIndex& phrases,
+                  int deadlineMs, bool coalesce)
+        : worker(dictionary, [this] { posted.store(true, std::memory_order_release); }),
+          session(dictionary, suggestions, phrases) {
+        session.SetHistory(&history);
+        session.SetLookupWorker(&worker, std::chrono::milliseconds(deadlineMs));
+        if (coalesce) {
+            // The rest of the burst is queued behind the key being handled
+            session.SetPeekAction([this](InputState state, InputAction& next) {
+                if (!burst || queued >= burst->size()) return false;
+                next = ReplayAction(state, (*burst)[queued]);
+                return true;
+            });
+        }
+        worker.Start();
+    }
+    ~ReplaySession() { worker.Stop(); }
+
+    void Type(const std::vector<std::string>& keys) {
+        auto start = std::chrono::steady_clock::now();
+        burst = &keys;
+        for (queued = 1; queued <= keys.size(); ++queued) {
+            if (keys[queued - 1][0] == '!') continue;  // the peek saw it, but it never arrives
+            committed += session.OnKeyDown(ReplayAction(session.GetState(), keys[queued - 1])).commit;
+            // The message loop gets to a posted result between key-downs
+            if (posted.exchange(false, std::memory_order_acquire)) session.OnLookupResult();
+        }
+        burst = nullptr;
+        session.OnKeyUp();
+        ms += std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+    }
+};
+
+static int Replay(int argc, char** argv) {
+    if (argc < 1) return Usage();
+    const char* suggestionsPath = nullptr;
+    const char* keysPath = nullptr;
+    size_t randomBursts = 200;
+    unsigned seed = 41;
+    int deadlineMs = CLookupWorker::DEFAULT_DEADLINE_MS;
+    for (int i = 1; i < argc; ++i) {
+        if (std::strcmp(argv[i], "--suggestions") == 0 && i + 1 < argc) {
+            suggestionsPath = argv[++i];
+        } else if (std::strcmp(argv[i], "--keys") == 0 && i + 1 < argc) {
+            keysPath = argv[++i];
+        } else if (std::strcmp(argv[i], "--random") == 0 && i + 1 < argc) {
+            randomBursts = static_cast<size_t>(std::atol(argv[++i]));
+        } else if (std::strcmp(argv[i], "--seed") == 0 && i + 1 < argc) {
+            seed = static_cast<unsigned>(std::atoi(argv[++i]));
+        } else if (std::strcmp(argv[i], "--deadline-ms") == 0 && i + 1 < argc) {
+            deadlineMs = std::atoi(argv[++i]);
+        } else {
+            return Usage();
+        }
+    }
+    if (deadlineMs < 0) return Usage();
+
+    std::vector<std::vector<std::string>> bursts;
+    if (keysPath) {
+        std::ifstream keys(keysPath);
+        if (!keys) {
+            std::fprintf(stderr, "failed to open %s\n", keysPath);
+            return 1;
+        }
+        std::string line;
+        while (std::getline(keys, line)) {
+            std::istringstream words(line.substr(0, line.find('#')));
+            std::vector<std::string> burst;
+            for (std::string key; words >> key;) burst.push_back(key);
+            if (!burst.empty()) bursts.push_back(std::move(burst));
+        }
+    } else {
+        std::mt19937 random(seed);
+        bursts = RandomBursts(randomBursts, random);
+    }
+
+    std::wstring dataPath = Unicode::Utf8ToWide(argv[0]);
+    CDictionary dictionary;
+    if (!dictionary.LoadFromFile(dataPath)) {
+        std::fprintf(stderr, "failed to load %s\n", argv[0]);
+        return 1;
+    }
+    CSuggestions suggestions;
+    CPhraseIndex phrases;
+    if (suggestionsPath) {
+        std::wstring path = Unicode::Utf8ToWide(suggestionsPath);
+        if (!suggestions.LoadFromFile(path)) {
+            std::fprintf(stderr, "failed to load %s\n", suggestionsPath);
+            return 1;
+        }
+        LoadPhraseIndex(phrases, path, dataPath, suggestions, dictionary);
+    }
+
+    // Burst by burst in step, so both learn their picks at the same minute
+    ReplaySession each(dictionary, suggestions, phrases, deadlineMs, false);
+    ReplaySession coalesced(dictionary, suggestions, phrases, deadlineMs, true);
+    size_t keys = 0, agreed = 0;
+    for (size_t b = 0; b < bursts.size(); ++b) {
+        agreed = each.committed.size();
+        each.Type(bursts[b]);
+        coalesced.Type(bursts[b]);
+        keys += bursts[b].size();
+        // Once the burst's key-up is handled both show the same list, unless a result is
+        // still on its way to one of them
+        bool shown = each.session.IsLookupPending() || coalesced.session.IsLookupPending() ||
+                     each.session.GetList() == coalesced.session.GetList();
+        if (each.committed != coalesced.committed || !shown) {
+            std::string burst;
+            for (const auto& key : bursts[b]) burst += " " + key;
+            auto join = [](const std::vector<std::wstring>& list) {
+                std::wstring text;
+                for (const auto& item : list) text += item + L" ";
+                return Unicode::WideToUtf8(text);
+            };
+            // The text committed since the last burst that agreed, or the lists shown
+            std::printf("burst %zu (%s) %s differ:\n  %s\n  %s\n", b + 1, burst.c_str() + 1, shown ? "commits" : "lists",
+                        shown ? Unicode::WideToUtf8(each.committed.substr(agreed)).c_str()
+                              : join(each.session.GetList()).c_str(),
+                        shown ? Unicode::WideToUtf8(coalesced.committed.substr(agreed)).c_str()
+                              : join(coalesced.session.GetList()).c_str());
+            return 1;
+        }
+    }
+    std::printf("%zu bursts, %zu keys, %zu characters committed\n", bursts.size(), keys, each.committed.size());
+    std::printf("every stroke looked up  | %.1f ms\n", each.ms);
+    std::printf("queued strokes put off  | %.1f ms | lookups put off %llu\n", coalesced.ms,
+                static_cast<unsigned long long>(coalesced.session.GetCoalescedLookups()));
+    std::printf("same committed text and lists\n");
+    return 0;
+}
+
+int main(int argc, char** argv) {
+    if (argc < 2) return Usage();
+    if (std::strcmp(argv[1], "compile") == 0) return Compile(argc - 2, argv + 2);
+    if (std::strcmp(argv[1], "bench") == 0) return Bench(argc - 2, argv + 2);
+    if (std::strcmp(argv[1], "stress") == 0) return Stress(argc - 2, argv + 2);
+    if (std::strcmp(argv[1], "verify") == 0) return Verify(argc - 2, argv + 2);
+    if (std::strcmp(argv[1], "reload-stress") == 0) return ReloadStress(argc - 2, argv + 2);
+    if (std::strcmp(argv[1], "serve") == 0) return Serve(argc - 2, argv + 2);
+    if (std::strcmp(argv[1], "loadgen") == 0) return LoadGen(argc - 2, argv + 2);
+    if (std::strcmp(argv[1], "user") == 0) return User(argc - 2, argv + 2);
+    if (std::strcmp(argv[1], "history-stress") == 0) return HistoryStress(argc - 2, argv + 2);
+    if (std::strcmp(argv[1], "annotate") == 0) return Annotate(argc - 2, argv + 2);
+    if (std::strcmp(argv[1], "warmstart") == 0) return WarmStart(argc - 2, argv + 2);
+    if (std::strcmp(argv[1], "memory") == 0) return Memory(argc - 2, argv + 2);
+    if (std::strcmp(argv[1], "shards") == 0) return Shards(argc - 2, argv + 2);
+    if (std::strcmp(argv[1], "replay") == 0) return Replay(argc - 2, argv + 2);
+    return Usage();
+}